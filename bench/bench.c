@@ -0,0 +1,254 @@
+// Throughput benchmark of each pipeline phase over corpus files, with results written as JSON
+#include "arena.h"
+#include "emitter.h"
+#include "lexer.h"
+#include "output.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Usage: bench [--commit id] [--rounds N] [-o results.json] corpus.c ...
+
+Every corpus is measured in a child process of its own, so that its peak RSS
+is its own. Each phase runs --rounds times and the fastest round is kept:
+  lex    lex_file, reading the file included
+  parse  parse_tokens over the tokens of one lex
+  emit   emit_latex into a memory Output, over the AST of one parse
+  total  all three, as a plain run of the program does them
+  highlight  lex_highlight into a memory Output, reading the file included:
+         the one-pass --highlight mode
+Allocations are the malloc, calloc and realloc calls of one round, counted
+by wrapping them at link time (-Wl,--wrap); peak RSS is the process's high
+water mark once the phase is done. A table goes to stderr, the JSON to -o
+or stdout.
+*/
+
+#define DEFAULT_ROUNDS 5
+
+// --wrap=malloc sends the calls here, and __real_malloc to libc
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_EMIT,
+    PHASE_TOTAL,
+    PHASE_HIGHLIGHT,
+    PHASE_COUNT
+} Phase;
+
+static const char *const phase_names[PHASE_COUNT] = {"lex", "parse", "emit", "total", "highlight"};
+
+typedef struct {
+    double seconds; // fastest round
+    unsigned long allocations;
+    long peak_rss_kb;
+} PhaseResult;
+
+// What a round leaves for the next phase, built outside the timed part
+typedef struct {
+    const char *path;
+    Arena arena;
+    TokenList *tokens;
+    Ast *ast;
+    Output out;
+} Subject;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void run_phase(Subject *subject, Phase phase)
+{
+    switch (phase)
+    {
+    case PHASE_LEX:
+        subject->tokens = lex_file(&subject->arena, subject->path);
+        break;
+    case PHASE_PARSE:
+        subject->ast = parse_tokens(&subject->arena, subject->tokens);
+        break;
+    case PHASE_EMIT:
+        subject->out.length = 0;
+        emit_latex(&subject->out, subject->ast);
+        break;
+    case PHASE_TOTAL:
+        subject->out.length = 0;
+        emit_latex(&subject->out, parse_tokens(&subject->arena, lex_file(&subject->arena, subject->path)));
+        break;
+    default:
+    {
+        subject->out.length = 0;
+        const SourceBuffer *source = source_open_in(&subject->arena, subject->path);
+        lex_highlight(&subject->out, source->data, source->length);
+        break;
+    }
+    }
+}
+
+// The arena is started over for the phases that fill it, and kept with the
+// tokens or the AST the measured phase reads
+static void prepare(Subject *subject, Phase phase)
+{
+    arena_free(&subject->arena);
+    arena_init(&subject->arena, 64 * 1024);
+    if (phase == PHASE_PARSE || phase == PHASE_EMIT)
+        subject->tokens = lex_file(&subject->arena, subject->path);
+    if (phase == PHASE_EMIT)
+        subject->ast = parse_tokens(&subject->arena, subject->tokens);
+}
+
+static PhaseResult measure(Subject *subject, Phase phase, int rounds)
+{
+    PhaseResult result = {0, 0, 0};
+    for (int round = 0; round < rounds; round++)
+    {
+        prepare(subject, phase);
+        unsigned long before = allocations;
+        double start = now();
+        run_phase(subject, phase);
+        double seconds = now() - start;
+        if (round == 0 || seconds < result.seconds)
+            result.seconds = seconds;
+        result.allocations = allocations - before;
+    }
+    result.peak_rss_kb = peak_rss_kb();
+    return result;
+}
+
+// One JSON object, and its lines of the table
+static void bench_corpus(FILE *json, const char *path, int rounds)
+{
+    Subject subject;
+    subject.path = path;
+    arena_init(&subject.arena, 64 * 1024);
+    output_init_memory(&subject.out);
+    prepare(&subject, PHASE_PARSE);
+    size_t bytes = subject.tokens->source_length;
+    size_t tokens = subject.tokens->count;
+
+    PhaseResult results[PHASE_COUNT];
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        results[phase] = measure(&subject, (Phase)phase, rounds);
+
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    fprintf(json, "    {\"corpus\": \"%s\", \"bytes\": %zu, \"tokens\": %zu, \"output_bytes\": %zu, \"phases\": {",
+            name, bytes, tokens, subject.out.length);
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const PhaseResult *r = &results[phase];
+        double mb_per_s = (double)bytes / 1e6 / r->seconds;
+        double tokens_per_s = (double)tokens / r->seconds;
+        double ns_per_token = tokens ? r->seconds * 1e9 / (double)tokens : 0;
+        fprintf(json,
+                "%s\n      \"%s\": {\"seconds\": %.6f, \"mb_per_s\": %.1f, \"tokens_per_s\": %.0f, \"ns_per_token\": %.2f, "
+                "\"allocations\": %lu, \"peak_rss_kb\": %ld}",
+                phase ? "," : "", phase_names[phase], r->seconds, mb_per_s, tokens_per_s, ns_per_token,
+                r->allocations, r->peak_rss_kb);
+        fprintf(stderr, "%-28s %-6s %9.1f MB/s %12.0f tok/s %8.2f ns/tok %8lu allocs %8ld KB\n", name,
+                phase_names[phase], mb_per_s, tokens_per_s, ns_per_token, r->allocations, r->peak_rss_kb);
+    }
+    fprintf(json, "\n    }}");
+    output_close(&subject.out);
+    arena_free(&subject.arena);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *commit = "";
+    const char *json_path = NULL;
+    int rounds = DEFAULT_ROUNDS;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        if (strcmp(argv[first], "--commit") == 0 && first + 1 < argc)
+            commit = argv[++first];
+        else if (strcmp(argv[first], "--rounds") == 0 && first + 1 < argc && atoi(argv[first + 1]) > 0)
+            rounds = atoi(argv[++first]);
+        else if (strcmp(argv[first], "-o") == 0 && first + 1 < argc)
+            json_path = argv[++first];
+        else
+            break;
+    }
+    if (first >= argc)
+    {
+        fprintf(stderr, "usage: bench [--commit id] [--rounds N] [-o results.json] corpus.c ...\n");
+        return 1;
+    }
+    FILE *json = json_path ? fopen(json_path, "w") : stdout;
+    if (!json)
+    {
+        perror(json_path);
+        return 1;
+    }
+
+    fprintf(json, "{\n  \"commit\": \"%s\",\n  \"time\": %ld,\n  \"rounds\": %d,\n  \"corpora\": [", commit,
+            (long)time(NULL), rounds);
+    int failed = 0;
+    for (int i = first; i < argc; i++)
+    {
+        fprintf(json, "%s\n", i > first ? "," : "");
+        // the child writes through the same FILE, so nothing may be left in its buffer twice
+        fflush(json);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            bench_corpus(json, argv[i], rounds);
+            fflush(json);
+            _exit(0);
+        }
+        int status;
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "bench: %s failed\n", argv[i]);
+            failed = 1;
+            break;
+        }
+    }
+    fprintf(json, "\n  ]\n}\n");
+    if (json != stdout)
+        fclose(json);
+    return failed;
+}
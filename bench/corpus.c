@@ -0,0 +1,256 @@
+// Deterministic generator of synthetic C sources of a given size and mix, the input of `make bench`
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Usage: gen-corpus KIND MB [SEED]. Writes about MB megabytes of C to stdout,
+the same bytes for the same arguments on every machine. Every kind is made
+of complete functions, so that all of it lexes and parses.
+*/
+
+// Deepest block nesting of the "nested" kind
+#define MAX_DEPTH 24
+
+static uint64_t rng_state;
+
+// xorshift64*: libc's rand differs between platforms
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint32_t pick(uint32_t count)
+{
+    return next_random() % count;
+}
+
+static const char *const words[] = {
+    "buffer", "length", "count", "index", "node", "next", "value", "offset", "chunk", "token",
+    "cursor", "state", "entry", "table", "hash", "limit", "stride", "width", "left", "right",
+};
+
+static const char *const types[] = {"int", "size_t", "uint32_t", "char *", "double", "const Node *"};
+
+static void identifier(FILE *out)
+{
+    int parts = 1 + (int)pick(3);
+    for (int i = 0; i < parts; i++)
+        fprintf(out, "%s%s", i ? "_" : "", words[pick(20)]);
+}
+
+static void indent(FILE *out, int depth)
+{
+    fprintf(out, "%*s", depth * 4, "");
+}
+
+// Declarations and assignments between long names
+static void identifier_function(FILE *out, unsigned id)
+{
+    fprintf(out, "static void update_%u(State *state)\n{\n", id);
+    int lines = 8 + (int)pick(24);
+    for (int i = 0; i < lines; i++)
+    {
+        indent(out, 1);
+        if (pick(3) == 0)
+            fprintf(out, "%s ", types[pick(6)]);
+        identifier(out);
+        fputs(" = ", out);
+        identifier(out);
+        fputs(pick(2) ? "->" : ".", out);
+        identifier(out);
+        if (pick(2))
+        {
+            fputs(" + ", out);
+            identifier(out);
+        }
+        fputs(";\n", out);
+    }
+    fputs("}\n\n", out);
+}
+
+static const char *const prose[] = {
+    "the", "buffer", "is", "reused", "between", "calls", "so", "that", "nothing", "is",
+    "allocated", "on", "the", "hot", "path", "and", "every", "entry", "stays", "aligned",
+};
+
+static void sentence(FILE *out, int words_count)
+{
+    for (int i = 0; i < words_count; i++)
+        fprintf(out, "%s%s", i ? " " : "", prose[pick(20)]);
+}
+
+// Block comments in front of every function, line comments between statements
+static void comment_function(FILE *out, unsigned id)
+{
+    fputs("/*\n", out);
+    int lines = 4 + (int)pick(12);
+    for (int i = 0; i < lines; i++)
+    {
+        fputs(" * ", out);
+        sentence(out, 6 + (int)pick(8));
+        fputs(".\n", out);
+    }
+    fprintf(out, " */\nstatic int check_%u(int value)\n{\n", id);
+    int statements = 2 + (int)pick(6);
+    for (int i = 0; i < statements; i++)
+    {
+        fputs("    // ", out);
+        sentence(out, 4 + (int)pick(10));
+        fprintf(out, "\n    value = value * %u + %u;\n", 1 + pick(9), pick(100));
+    }
+    fputs("    return value;\n}\n\n", out);
+}
+
+// Lookup tables of integers, hex constants and floats
+static void number_function(FILE *out, unsigned id)
+{
+    int rows = 4 + (int)pick(16);
+    fprintf(out, "static const double table_%u[%d][8] = {\n", id, rows);
+    for (int r = 0; r < rows; r++)
+    {
+        fputs("    {", out);
+        for (int c = 0; c < 8; c++)
+        {
+            switch (pick(4))
+            {
+            case 0:
+                fprintf(out, "%u", next_random() % 100000);
+                break;
+            case 1:
+                fprintf(out, "0x%08X", next_random());
+                break;
+            case 2:
+                fprintf(out, "%u.%04u", pick(1000), pick(10000));
+                break;
+            default:
+                fprintf(out, "%u.%ue-%u", pick(10), pick(1000), 1 + pick(30));
+                break;
+            }
+            fputs(c < 7 ? ", " : "", out);
+        }
+        fputs("},\n", out);
+    }
+    fputs("};\n\n", out);
+}
+
+static const char *const formats[] = {
+    "%s: %d\\n", "%-8s|%5.2f%%\\n", "{%u, %u}", "\\t%#x & %#o\\n", "~%ld^2 = $%lld\\n", "%zu_%zu", "[%3d] %s\\r\\n",
+};
+
+// printf calls whose string literals carry escapes and LaTeX specials
+static void string_function(FILE *out, unsigned id)
+{
+    fprintf(out, "static void report_%u(FILE *out, const Stats *stats)\n{\n", id);
+    int lines = 4 + (int)pick(16);
+    for (int i = 0; i < lines; i++)
+    {
+        fputs("    fprintf(out, \"", out);
+        sentence(out, 1 + (int)pick(5));
+        fprintf(out, " %s\", stats->", formats[pick(7)]);
+        identifier(out);
+        fputs(", \"", out);
+        sentence(out, 1 + (int)pick(3));
+        fputs("\");\n", out);
+    }
+    fputs("}\n\n", out);
+}
+
+static void nested_block(FILE *out, int depth, int target)
+{
+    indent(out, depth);
+    if (depth >= target)
+    {
+        fprintf(out, "total += ((a%d + b) * (c - (d / (e + %u))));\n", depth, 1 + pick(9));
+        return;
+    }
+    switch (pick(3))
+    {
+    case 0:
+        fprintf(out, "if (x%d > %u && (y < z || w))\n", depth, pick(100));
+        break;
+    case 1:
+        fprintf(out, "while (i%d < n)\n", depth);
+        break;
+    default:
+        fprintf(out, "for (int i%d = 0; i%d < n; i%d++)\n", depth, depth, depth);
+        break;
+    }
+    indent(out, depth);
+    fputs("{\n", out);
+    // a second child now and then: any more and the leaves grow exponentially with depth
+    int children = pick(4) == 0 ? 2 : 1;
+    for (int i = 0; i < children; i++)
+        nested_block(out, depth + 1, target);
+    indent(out, depth);
+    fputs("}\n", out);
+}
+
+// Control flow nested many levels deep, with parenthesized expressions at the leaves
+static void nested_function(FILE *out, unsigned id)
+{
+    fprintf(out, "static int walk_%u(int n)\n{\n    int total = 0;\n", id);
+    nested_block(out, 1, 8 + (int)pick(MAX_DEPTH - 8));
+    fputs("    return total;\n}\n\n", out);
+}
+
+typedef void (*Generator)(FILE *out, unsigned id);
+
+typedef struct {
+    const char *name;
+    Generator generate;
+} Kind;
+
+static const Kind kinds[] = {
+    {"identifiers", identifier_function},
+    {"comments", comment_function},
+    {"numbers", number_function},
+    {"strings", string_function},
+    {"nested", nested_function},
+};
+#define KIND_COUNT (sizeof(kinds) / sizeof(kinds[0]))
+
+static void mixed_function(FILE *out, unsigned id)
+{
+    kinds[pick(KIND_COUNT)].generate(out, id);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || atol(argv[2]) < 1)
+    {
+        fprintf(stderr, "usage: gen-corpus identifiers|comments|numbers|strings|nested|mixed MB [seed]\n");
+        return 1;
+    }
+    Generator generate = strcmp(argv[1], "mixed") == 0 ? mixed_function : NULL;
+    for (size_t i = 0; i < KIND_COUNT && !generate; i++)
+        if (strcmp(argv[1], kinds[i].name) == 0)
+            generate = kinds[i].generate;
+    if (!generate)
+    {
+        fprintf(stderr, "gen-corpus: unknown kind %s\n", argv[1]);
+        return 1;
+    }
+    long target = atol(argv[2]) * 1024 * 1024;
+    rng_state = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+    if (rng_state == 0)
+        rng_state = 1;
+
+    // built in memory, where ftell works whatever stdout is
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (!out)
+        return 1;
+    fprintf(out, "#include <stdio.h>\n#include \"bench.h\"\n\n");
+    for (unsigned id = 0; ftell(out) < target; id++)
+        generate(out, id);
+    fclose(out);
+    int ok = fwrite(text, 1, length, stdout) == length;
+    free(text);
+    return ok ? 0 : 1;
+}
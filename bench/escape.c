@@ -0,0 +1,104 @@
+// Micro-benchmark of the LaTeX escaping: every scan backend on identifier-heavy and format-string-heavy text
+#include "emitter.h"
+#include "scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEXT_SIZE (8 * 1024 * 1024)
+#define ROUNDS 5
+
+static const char *const identifiers[] = {
+    "buffer_length", "read_count", "i", "node", "item_index", "stride", "x", "next_token",
+    "capacity", "MAX_SIZE", "left", "right", "chunk_offsets", "p", "total", "hash_seed",
+};
+static const char *const operators[] = {" = ", " + ", " * ", ", ", "->", ".", "(", ")", "[", "]", "; "};
+
+static const char *const formats[] = {
+    "\"%s: %d\\n\"", "\"%-8s|%5.2f%%\\n\"", "\"{%u, %u}\"", "\"\\t%#x & %#o\\n\"",
+    "\"~%ld^2 = $%lld\\n\"", "\"%zu_%zu\"", "\"\\\\%c\\\\\"", "\"[%3d] %s\\r\\n\"",
+};
+
+static void append(char **p, const char *piece)
+{
+    while (*piece)
+        *(*p)++ = *piece++;
+}
+
+// Code-like text: mostly identifiers and operators, a line break now and then
+static char *identifier_text(void)
+{
+    char *text = malloc(TEXT_SIZE + 64);
+    char *p = text;
+    srand(1);
+    while (p < text + TEXT_SIZE)
+    {
+        append(&p, identifiers[rand() % 16]);
+        append(&p, operators[rand() % 11]);
+        if (rand() % 8 == 0)
+            append(&p, "\n    ");
+    }
+    *p = '\0';
+    return text;
+}
+
+// printf calls whose format strings are dense with specials
+static char *format_text(void)
+{
+    char *text = malloc(TEXT_SIZE + 64);
+    char *p = text;
+    srand(2);
+    while (p < text + TEXT_SIZE)
+    {
+        append(&p, "printf(");
+        append(&p, formats[rand() % 8]);
+        append(&p, ", value);\n");
+    }
+    *p = '\0';
+    return text;
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+// Best of ROUNDS, in MB of input per second
+static double measure(Output *out, const char *text, size_t length)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        out->length = 0;
+        double start = now();
+        emit_escaped(out, text, length);
+        double seconds = now() - start;
+        if (best == 0 || seconds < best)
+            best = seconds;
+    }
+    return (double)length / 1e6 / best;
+}
+
+int main(void)
+{
+    static const char *const backends[] = {"scalar", "sse2", "avx2"};
+    const char *texts[] = {identifier_text(), format_text()};
+    const char *names[] = {"identifiers", "format strings"};
+    Output out;
+    output_init_memory(&out);
+
+    printf("%-8s %16s %16s\n", "", names[0], names[1]);
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        if (scan_select_backend(backends[b]) != 0)
+            continue;
+        printf("%-8s", backends[b]);
+        for (int t = 0; t < 2; t++)
+            printf(" %11.0f MB/s", measure(&out, texts[t], strlen(texts[t])));
+        printf("\n");
+    }
+    output_close(&out);
+    return 0;
+}
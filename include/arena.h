@@ -1,17 +1,41 @@
+// Chunked bump allocator: everything allocated from an Arena is released at once by arena_free
 #ifndef ARENA_H
 #define ARENA_H
 
 #include <stdlib.h>
 #include <stdint.h>
 
-typedef struct {
-    unsigned char* buffer;
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
     size_t buffer_len;
     size_t off_set;
+    unsigned char buffer[];
+} ArenaChunk;
+
+typedef struct ArenaCleanup {
+    struct ArenaCleanup *next;
+    void (*fn)(void *ctx);
+    void *ctx;
+} ArenaCleanup;
+
+typedef struct {
+    ArenaChunk *head;   // chunk currently being bumped
+    size_t chunk_size;  // size of the next regular chunk, grows geometrically
+    size_t chunk_count;
+    size_t bytes_used;
+    ArenaCleanup *cleanups; // run by arena_free, most recent first
 } Arena;
 
 void arena_init(Arena *arena, size_t size);
-void* arena_realloc(Arena *arena, size_t size);
+void* arena_alloc(Arena *arena, size_t size);
+// Grows the allocation at ptr; extends in place when ptr was the last allocation
+void* arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+char* arena_strndup(Arena *arena, const char *text, size_t length);
+// Ties a non-arena resource (e.g. a mapped source file) to the arena's lifetime
+void arena_on_free(Arena *arena, void (*fn)(void *ctx), void *ctx);
+// Runs the cleanups and empties the arena, but keeps its newest chunk, already
+// paged in, for whatever is allocated next
+void arena_reset(Arena *arena);
 void arena_free(Arena *arena);
 
-#endif
\ No newline at end of file
+#endif
@@ -3,55 +3,156 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stdint.h>
+#include <stdio.h>
+#include "arena.h"
+#include "tokens.h"
+
 typedef enum {
     AST_PROGRAM,        // root node (holds list of functions/globals)
-    AST_FUNCTION_DECL,  // int main()
-    AST_BLOCK, // represents {}
-    AST_VAR_DECL,       // int x = 5;
-    AST_BINARY_OP,      // 5 + 3
-    AST_INT_LITERAL     // 5
+    AST_FUNCTION_DECL,  // int main() { ... }: type, declarator, body
+    AST_BLOCK,          // represents {}
+    AST_VAR_DECL,       // int x = 5, *y;: type, declarators
+    AST_BINARY_OP,      // 5 + 3, x = 5: left, right
+    AST_INT_LITERAL,    // 5
+
+    // Declarations
+    AST_PREPROCESSOR,   // #include <stdio.h>, one per line
+    AST_TYPE,           // declaration specifiers or a type name, kept as a token range
+    AST_DECLARATOR,     // *x = 5, f(int a): name, initializer, params...
+    AST_PARAM,          // one function parameter: type, declarator
+
+    // Statements
+    AST_EXPR_STMT,      // x++;
+    AST_EMPTY_STMT,     // ;
+    AST_IF,             // cond, then, [else]
+    AST_WHILE,          // cond, body
+    AST_DO_WHILE,       // body, cond
+    AST_FOR,            // init, cond, step, body; missing parts are AST_NONE
+    AST_SWITCH,         // cond, body
+    AST_CASE,           // value
+    AST_DEFAULT,
+    AST_LABEL,          // name
+    AST_GOTO,           // name
+    AST_RETURN,         // [value]
+    AST_BREAK,
+    AST_CONTINUE,
+    AST_UNKNOWN,        // tokens the parser couldn't make sense of, kept verbatim
+
+    // Expressions
+    AST_IDENTIFIER,     // x
+    AST_FLOAT_LITERAL,  // 1.5
+    AST_CHAR_LITERAL,   // 'a'
+    AST_STRING_LITERAL, // "a" "b": adjacent literals are one node
+    AST_UNARY_OP,       // -x, x++: operand
+    AST_TERNARY,        // c ? a : b
+    AST_CALL,           // callee, args...
+    AST_INDEX,          // base, index
+    AST_MEMBER,         // base, name; op is AST_OP_DOT or AST_OP_ARROW
+    AST_CAST,           // type, operand
+    AST_SIZEOF_TYPE,    // sizeof(int): type
+    AST_INIT_LIST,      // { 1, .x = 2 }: elements
+    AST_DESIGNATOR,     // .x or [2] in an initializer, as a token range
+    AST_NODE_TYPE_COUNT
 } NodeType;
 
-struct ASTNode;
+// Operator codes, so nothing downstream compares operator strings
+typedef enum {
+    AST_OP_NONE,
+    // binary, loosest binding last
+    AST_OP_MUL, AST_OP_DIV, AST_OP_MOD,
+    AST_OP_ADD, AST_OP_SUB,
+    AST_OP_SHL, AST_OP_SHR,
+    AST_OP_LT, AST_OP_GT, AST_OP_LE, AST_OP_GE,
+    AST_OP_EQ, AST_OP_NE,
+    AST_OP_BIT_AND, AST_OP_BIT_XOR, AST_OP_BIT_OR,
+    AST_OP_LOG_AND, AST_OP_LOG_OR,
+    AST_OP_COND,   // ?, only seen while parsing; the node is AST_TERNARY
+    AST_OP_ELVIS,  // GNU a ?: b
+    AST_OP_ASSIGN, AST_OP_MUL_ASSIGN, AST_OP_DIV_ASSIGN, AST_OP_MOD_ASSIGN, AST_OP_ADD_ASSIGN, AST_OP_SUB_ASSIGN,
+    AST_OP_SHL_ASSIGN, AST_OP_SHR_ASSIGN, AST_OP_AND_ASSIGN, AST_OP_XOR_ASSIGN, AST_OP_OR_ASSIGN,
+    AST_OP_COMMA,
+    // unary
+    AST_OP_NEG, AST_OP_PLUS, AST_OP_NOT, AST_OP_BIT_NOT, AST_OP_DEREF, AST_OP_ADDR,
+    AST_OP_PRE_INC, AST_OP_PRE_DEC, AST_OP_POST_INC, AST_OP_POST_DEC, AST_OP_SIZEOF,
+    // member access
+    AST_OP_DOT, AST_OP_ARROW,
+    AST_OP_COUNT
+} OpCode;
 
 /*
-This implementation has a major memory consumption trade-off by using
-a union inside the ASTNode, we could save memory by using a "base node" approach where each node type is its own struct
-inheriting from a base ASTNode struct, but that would make things more complex to manage.
+Nodes are variable-size records laid out back to back in one growable
+buffer of 32-bit words, and refer to each other by word index instead of
+pointer. A node is a fixed header followed by `count` child ids, so a
+binary op takes 6 words where the old union took 32 bytes plus a malloc
+per node and per string. Names and literal values aren't copied: a node
+keeps the token range it was parsed from and the text is read from the
+source. Children come before their parent in the buffer.
 */
 
-typedef struct ASTNode {
-    NodeType type;
-    union {
-        // Data for AST_PROGRAM
-        struct {
-            struct ASTNode **statements; // Array of pointers (functions/globals)
-            int statement_count;
-        } program;
-
-        // Data for AST_FUNCTION_DECL
-        struct {
-            char *name;
-            char *return_type;
-            struct ASTNode *body; // points to a block of code
-        } function;
-
-        // Data for AST_BLOCK
-        struct {
-            struct ASTNode **statements; // compound statements
-            int statement_count;
-        } block;
-
-        // Data for AST_BINARY_OP
-        struct {
-            char *operator;       // "+", "-", "=="
-            struct ASTNode *left;
-            struct ASTNode *right;
-        } bin_op;
-
-        // Data for AST_INT_LITERAL
-        int int_val; 
-    } data;
+typedef uint32_t NodeId;
+#define AST_NONE ((NodeId)0) // no node; word 0 is never a node
+
+// ASTNode.flags
+#define AST_FLAG_FUNCTION 1 // on a declarator with a parameter list
+
+typedef struct {
+    uint8_t type;         // NodeType
+    uint8_t op;           // OpCode for operators and members, else AST_OP_NONE
+    uint16_t flags;
+    uint32_t count;       // child ids that follow the header
+    uint32_t first_token; // token range the node was parsed from, inclusive
+    uint32_t last_token;
+    NodeId children[];
 } ASTNode;
 
+typedef struct {
+    Arena *arena;
+    const TokenList *tokens;
+    uint32_t *words;
+    uint32_t used;      // words
+    uint32_t capacity;
+    uint32_t node_count;
+    NodeId root;
+} Ast;
+
+// Sizes the node buffer from the token count, it grows if that was short
+Ast* ast_create(Arena *arena, const TokenList *tokens);
+// Appends a node; `children` are copied. Ids stay valid as the buffer grows,
+// pointers from ast_node don't.
+NodeId ast_add(Ast *ast, NodeType type, OpCode op, uint32_t first_token, uint32_t last_token, const NodeId *children,
+               uint32_t count);
+void ast_set_flags(Ast *ast, NodeId id, uint16_t flags);
+// Drops every node added after `mark` (an earlier ast->used); lets the parser back out
+void ast_truncate(Ast *ast, uint32_t mark);
+
+static inline const ASTNode *ast_node(const Ast *ast, NodeId id)
+{
+    return (const ASTNode *)(ast->words + id);
+}
+
+// Nodes in buffer order, children before parents:
+// for (NodeId id = 1; id < ast->used; id = ast_next(ast, id))
+static inline NodeId ast_next(const Ast *ast, NodeId id)
+{
+    return id + (uint32_t)(sizeof(ASTNode) / sizeof(uint32_t)) + ast_node(ast, id)->count;
+}
+
+static inline NodeId ast_child(const Ast *ast, NodeId id, uint32_t i)
+{
+    const ASTNode *node = ast_node(ast, id);
+    return i < node->count ? node->children[i] : AST_NONE;
+}
+
+// Source text of the node's first token: the name of an identifier, the
+// lexeme of a literal
+const char* ast_text(const Ast *ast, NodeId id, size_t *length);
+// ID of the name of an identifier node, INTERN_NONE if its tokens weren't
+// interned; two names are the same exactly when their IDs are
+uint32_t ast_name(const Ast *ast, NodeId id);
+const char* ast_type_name(NodeType type);
+const char* ast_op_text(OpCode op);
+// Indented dump of the tree, for debugging
+void ast_print(FILE *out, const Ast *ast);
+
 #endif
@@ -0,0 +1,62 @@
+// Batch mode: expands paths, directories and manifests into an ordered input list and compiles it across cores
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "output.h"
+#include "cache.h"
+#include "diagnostics.h"
+#include "intern.h"
+
+typedef struct {
+    char **paths;
+    uint64_t *sizes; // bytes on disk, used to start the big files first
+    size_t count;
+    size_t capacity;
+} InputList;
+
+void input_list_init(InputList *inputs);
+// A file is added as is; a directory adds its .c and .h files, recursively
+// and sorted by name, without following links to directories
+void input_list_add_path(InputList *inputs, const char *path);
+// One input per line, taken from the first CSV column; blank lines and lines starting with '#' are skipped.
+// Returns -1 if the manifest can't be read.
+int input_list_add_manifest(InputList *inputs, const char *manifest);
+void input_list_free(InputList *inputs);
+
+typedef enum {
+    OUTPUT_LATEX,  // highlighted LaTeX, the default
+    OUTPUT_TOKENS, // one line per token
+    OUTPUT_AST,    // indented parse tree
+    OUTPUT_HIGHLIGHT, // the LaTeX in one pass from the lexer, without a parse
+    OUTPUT_MODE_COUNT
+} OutputMode;
+
+typedef struct {
+    int threads;
+    OutputMode mode;
+    Cache *cache; // NULL to always compile
+    // Follow #include lines, for the typedef names the headers declare; see includes.h
+    int resolve_includes;
+    const char *const *include_dirs; // -I, in order
+    size_t include_dir_count;
+} BatchOptions;
+
+// Compiles every input on `options->threads` workers and writes the results
+// to `out` in input order, whatever order they finish in. With a cache, an
+// input seen before is copied from it without being compiled. A file with
+// errors is compiled as far as it goes; the errors of every file are
+// printed to stderr at the end, and their number returned.
+size_t batch_run(const InputList *inputs, const BatchOptions *options, Output *out);
+// What batch_run writes in front of input `i` when there are several
+void batch_write_header(const InputList *inputs, size_t i, OutputMode mode, Output *out);
+
+// Compiles a source already in memory, appending the result to `out`, which
+// must be a memory Output. Allocations go to `arena`, names to `names`,
+// errors to `diagnostics`.
+void batch_compile_buffer(Arena *arena, const char *source, size_t length, OutputMode mode, const Cache *cache,
+                          InternTable *names, DiagnosticList *diagnostics, Output *out);
+
+#endif // BATCH_H
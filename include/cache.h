@@ -0,0 +1,38 @@
+// Content-addressed on-disk cache of compiled output, keyed by a hash of the input bytes and shared safely between workers and processes
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "output.h"
+
+typedef struct {
+    char *dir;
+    uint64_t fingerprint; // of the format version and the options; part of every key
+    uint64_t limit;       // bytes of entries cache_trim leaves on disk
+} Cache;
+
+typedef struct {
+    uint64_t hash;   // of the input, seeded with the fingerprint; names the entry
+    uint64_t length; // of the input, checked again on a hit
+} CacheKey;
+
+// XXH64 of `length` bytes
+uint64_t cache_hash(const void *data, size_t length, uint64_t seed);
+
+// Creates `dir` if needed. `variant` tells apart options that change the
+// output for the same input. Returns -1 if the directory can't be used.
+int cache_open(Cache *cache, const char *dir, uint64_t limit, uint64_t variant);
+void cache_close(Cache *cache);
+
+CacheKey cache_key(const Cache *cache, const char *input, size_t length);
+// On a hit, appends the stored output to `out`, marks the entry as just used
+// and returns 1; 0 on a miss
+int cache_lookup(const Cache *cache, const CacheKey *key, Output *out);
+// Best effort: the entry is written to a temporary file and renamed into
+// place, so a reader never sees half of it. Failures are ignored.
+void cache_store(const Cache *cache, const CacheKey *key, const char *output, size_t length);
+// Removes the least recently used entries until what's left fits the limit
+void cache_trim(const Cache *cache);
+
+#endif // CACHE_H
@@ -0,0 +1,54 @@
+// Daemon mode: a resident transpiler serving compile requests over a Unix domain socket, and the client that forwards to it
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+#include "batch.h"
+#include "diagnostics.h"
+#include "output.h"
+
+/*
+On connecting, a client gets a DaemonResponse whose `detail` is the
+protocol version, then sends any number of requests, each answered before
+the next is read. A request is a DaemonRequest followed by `length` bytes:
+a path the daemon opens itself, or the source text. The answer is a
+DaemonResponse followed by `length` bytes of output and `detail` Diagnostic
+records, or nothing at all if `status` is an ErrorCode. Integers are in the
+host's byte order; both ends run on the same machine.
+*/
+
+#define DAEMON_MAGIC 0x64326c63u // "cl2d"
+#define DAEMON_OK 0xffffffffu    // DaemonResponse.status of a request that compiled
+
+typedef enum {
+    DAEMON_PATH,   // the payload is an absolute path
+    DAEMON_SOURCE, // the payload is the source itself
+} DaemonInput;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t input; // DaemonInput
+    uint32_t mode;  // OutputMode
+    uint32_t version;
+    uint64_t length;
+} DaemonRequest;
+
+typedef struct {
+    uint32_t status; // DAEMON_OK or an ErrorCode
+    uint32_t detail; // the number of diagnostics, or the version in the greeting
+    uint64_t length;
+} DaemonResponse;
+
+// Listens on `socket_path` with `threads` workers until SIGINT or SIGTERM,
+// then removes the socket. Each worker keeps its arena and output buffer
+// from one request to the next. `cache_dir` may be NULL. Returns -1 if the
+// socket can't be bound, e.g. because another daemon already serves it.
+int daemon_serve(const char *socket_path, int threads, const char *cache_dir, uint64_t cache_limit);
+
+// Has the daemon at `socket_path` compile every input, writing the results
+// to `out` and the errors to stderr as batch_run would, and setting `errors`
+// to their number. Returns -1, having written nothing, if no daemon answers
+// there; the caller compiles locally instead.
+int daemon_forward(const char *socket_path, const InputList *inputs, OutputMode mode, Output *out, size_t *errors);
+
+#endif // DAEMON_H
@@ -0,0 +1,46 @@
+// Non-fatal diagnostics: errors collected per file on the thread compiling it, and reported once the run is over
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "errors.h"
+#include "lines.h"
+
+// For what isn't about a place in the file, like the file missing
+#define DIAGNOSTIC_NO_OFFSET UINT32_MAX
+
+typedef struct {
+    ErrorCode code;
+    uint32_t offset; // where in the file, in bytes; all the lexer knows when it reports
+    uint32_t line;   // 1-based, 0 until diagnostics_resolve
+    uint32_t column; // 1-based, in bytes
+} Diagnostic;
+
+typedef struct {
+    const char *file; // not copied
+    Diagnostic *items;
+    size_t count;
+    size_t capacity;
+} DiagnosticList;
+
+void diagnostics_init(DiagnosticList *list, const char *file);
+void diagnostics_free(DiagnosticList *list);
+
+// Sends what this thread reports to `list` from now on, or with NULL back to
+// panic, and returns where it went before, to be restored afterwards
+DiagnosticList* diagnostics_capture(DiagnosticList *list);
+// Whoever reports has to recover and carry on: only a thread that captures
+// nothing still panics, as everything did before
+void diagnostic_report(ErrorCode code, uint32_t offset);
+// Adds one that is already complete, e.g. received from the daemon
+void diagnostics_append(DiagnosticList *list, const Diagnostic *diagnostic);
+// Lines and columns of diagnostics [from, count), found through `lines`, an
+// index of the file they are about; it's only built if there are any
+void diagnostics_resolve(DiagnosticList *list, size_t from, LineIndex *lines);
+
+// One "file:line:column: error: message" line each
+void diagnostics_print(FILE *out, const DiagnosticList *list);
+
+#endif // DIAGNOSTICS_H
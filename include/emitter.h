@@ -1 +1,70 @@
-// Recursively traverses the Abstract Syntax Tree to generate the final formatted LaTeX string.
\ No newline at end of file
+// Walks the token stream in source order and writes it out as highlighted LaTeX, using the AST for what tokens alone can't tell
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include "ast.h"
+#include "output.h"
+
+/*
+Each file becomes a self-contained fragment: \providecommand definitions of
+the highlighting macros (\CKeyword, \CComment, \CString, \CNumber,
+\CPreproc, \CFunction), so a document can restyle them by defining them
+first, then the code in a flushleft block, \ttfamily, one source line per
+output line with its spacing kept.
+*/
+
+// The whole file behind `ast`, comments and directives included
+void emit_latex(Output *out, const Ast *ast);
+
+/*
+The same in parts, for output kept and patched piece by piece: what a run
+of tokens turns into depends only on its text, its highlighting and the
+EmitPosition it starts from, so a piece can be reused when those match.
+*/
+
+// Where the output stands between two tokens
+typedef struct {
+    uint32_t column;     // of the source line, for tab stops
+    uint32_t line_empty; // nothing written on the current line yet
+} EmitPosition;
+
+#define EMIT_START ((EmitPosition){0, 1})
+
+void emit_preamble(Output *out);
+void emit_postamble(Output *out, const EmitPosition *position);
+// Sets functions[i] for the tokens the AST knows to be function names, because
+// they are declared with a parameter list or called by name
+void mark_function_names(const Ast *ast, uint8_t *functions);
+// Tokens [first, end) with the whitespace before each, and with end ==
+// tokens->count the rest of the file too. `position` is updated.
+void emit_tokens(Output *out, const TokenList *tokens, const uint8_t *functions, uint32_t first, uint32_t end,
+                 EmitPosition *position);
+// `text` escaped as it would be in the middle of a line of code, without a
+// macro around it; for measuring the escaping on its own
+void emit_escaped(Output *out, const char *text, size_t length);
+
+/*
+Highlighting without a parse, for lex_highlight: tokens are handed over one
+at a time, in source order, as the lexer recognizes them. With no AST, an
+identifier is taken for a function name when the token right after it is a
+'(' (a call, or a declarator with its parameter list); that needs the
+identifier held back for one token.
+*/
+typedef struct {
+    Output *out;
+    const char *source;
+    size_t length;
+    uint32_t gap; // end of the last token written
+    EmitPosition position;
+    int pending;  // an identifier waits in [pending_offset, + pending_length)
+    uint32_t pending_offset;
+    uint32_t pending_length;
+} Highlighter;
+
+// Writes the preamble
+void highlight_begin(Highlighter *h, Output *out, const char *source, size_t length);
+void highlight_token(Highlighter *h, TokenType type, uint32_t offset, uint32_t length);
+// The rest of the source and the postamble
+void highlight_end(Highlighter *h);
+
+#endif // EMITTER_H
@@ -14,7 +14,9 @@ typedef enum {
     ERR_MISSING_PAREN,
     ERR_UNKNOWN_FUNCTION,
     ERR_MEMORY_ALLOCATION,
-    ERR_FILE_NOT_FOUND
+    ERR_FILE_NOT_FOUND,
+    ERR_WRITE_FAILED,
+    ERR_MALFORMED_CHAR
 } ErrorCode;
 
 const char* get_error_message(ErrorCode error);
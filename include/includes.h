@@ -0,0 +1,36 @@
+// Include resolution: follows a file's #include lines, quoted or through -I, to the typedef names its headers declare, lexing each header once per run
+#ifndef INCLUDES_H
+#define INCLUDES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "intern.h"
+#include "tokens.h"
+
+/*
+A header is found like a compiler would: "name" in the directory of the file
+that includes it, then in each -I directory in order; <name> in the -I
+directories only, as the system ones aren't searched. It is read and lexed
+the first time it's included, and what the includes need from it is kept,
+keyed by its canonical path and modification time: the typedef names it
+declares, the headers it includes in turn and its guard, #pragma once or
+#ifndef/#define/#endif around the whole file. A guarded header is walked
+once per file however often it's included; the others again each time,
+though never through a cycle. Headers are never compiled themselves, and
+errors in them aren't reported.
+*/
+
+typedef struct HeaderCache HeaderCache;
+
+// Safe to share between workers. `dirs` isn't copied, and the typedef names
+// get their IDs from `names`, the table of the files they are used with.
+HeaderCache* header_cache_open(const char *const *dirs, size_t dir_count, InternTable *names);
+void header_cache_close(HeaderCache *cache);
+
+// Sets tokens->types to the typedef names of every header `tokens`, lexed
+// from `path` ("-" for stdin) and interned, reaches, in tokens' arena.
+// Returns a hash of the headers' paths and times, 0 when it reaches none,
+// to key output that depends on them.
+uint64_t include_resolve(HeaderCache *cache, const char *path, TokenList *tokens);
+
+#endif // INCLUDES_H
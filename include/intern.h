@@ -0,0 +1,40 @@
+// Identifier interning: every distinct name gets a 32-bit ID, so names are stored once and compare as integers
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Never an ID; the name of a token that isn't an identifier
+#define INTERN_NONE 0
+// A shared table is split by hash into 1 << INTERN_SHARD_BITS tables, each
+// behind a lock of its own, so that workers seldom wait for each other
+#define INTERN_SHARD_BITS 4
+
+typedef struct InternShard InternShard;
+
+typedef struct {
+    InternShard *shards;
+    uint32_t shard_bits; // 0 for a table only one thread uses
+} InternTable;
+
+// With `shared` every call below is safe from any thread; without, the
+// table belongs to one thread at a time and takes no locks
+void intern_init(InternTable *table, int shared);
+void intern_free(InternTable *table);
+// ID of the name, added if it's new. The same text always gets the same ID.
+uint32_t intern(InternTable *table, const char *text, size_t length);
+// The name behind an ID, NUL-terminated; valid until intern_free
+const char* intern_text(InternTable *table, uint32_t id, size_t *length);
+
+// A set of IDs, kept sorted, e.g. the type names a file's headers declare
+typedef struct {
+    uint32_t *ids;
+    uint32_t count;
+} InternSet;
+
+// Sorts the IDs and drops the repeated ones
+void intern_set_sort(InternSet *set);
+int intern_set_has(const InternSet *set, uint32_t id);
+
+#endif // INTERN_H
@@ -2,64 +2,58 @@
 #ifndef LEXER_H
 #define LEXER_H
 
-// Doesn't include TOKENS for commments or preprocessor 
-// hooks, as they are not allowed into the file
-
-typedef enum {
-    TOKEN_EOF = 1,            // End of token stream
-    TOKEN_UNKNOWN = 2,        // Unknown value 
-
-    // Literals
-    TOKEN_INT_LITERAL = 3,    // 123
-    TOKEN_FLOAT_LITERAL = 4,  // 123.45, .5, 10.
-    TOKEN_CHAR_LITERAL = 5,   // 'a'
-    TOKEN_STRING_LITERAL=6, // "Hello World"
-
-    // Identifiers & Keywords
-    TOKEN_PREPROCESSOR=7,
-    TOKEN_IDENTIFIER=8,     // main, x, myVar
-    TOKEN_KEYWORD=9,        // return, int, if, while
-
-    // Operators & Punctuation
-    TOKEN_ASSIGNMENT_OPERATOR=10, // += -= *=
-    TOKEN_OPERATOR=11,       // +, -, =, ==, *
-    TOKEN_DOT=12,            // .
-    TOKEN_COMMA=13,          // ,
-    TOKEN_SEMICOLON=14,      // ;
-    TOKEN_BITWISE_OPERATOR=15, // & , | , <<, >>, ^, ~, `
-    TOKEN_LOGIC_OPERATOR=16, // &&, ||, !
-    
-    // Grouping
-    TOKEN_COMMENT=17, // // or /**/
-    TOKEN_PAREN_OPEN=18,     // (
-    TOKEN_PAREN_CLOSE=19,    // )
-    TOKEN_BRACE_OPEN=20,     // {
-    TOKEN_BRACE_CLOSE=21,    // }
-    TOKEN_BRACKET_OPEN=22,   // [
-    TOKEN_BRACKET_CLOSE=23,   // ]
-    TOKEN_ARROW=24,           // ->
-
-} TokenType;
-
+#include <stddef.h>
+#include "arena.h"
+#include "tokens.h"
+#include "source.h"
+#include "output.h"
+
+TokenList* lex_file(Arena *arena, const char *filepath);
+// Input longer than SOURCE_MAX_LENGTH is reported and lexed as if empty, here
+// and in lex_buffer_parallel and lex_highlight
+TokenList* lex_buffer(Arena *arena, const char *source, size_t length);
+// Same tokens as lex_buffer, lexed in newline-aligned pieces on `threads` cores
+TokenList* lex_buffer_parallel(Arena *arena, const char *source, size_t length, int threads);
+// Falls back to one thread for files under a couple of MB
+TokenList* lex_source_parallel(Arena *arena, const SourceBuffer *source, int threads);
+TokenType check_keyword(const char* text, size_t length);
+// Highlighted LaTeX of `source` into `out` in a single pass: each token goes
+// to the emitter as it is recognized, and no TokenList or AST is built.
+// Function names are guessed from the tokens, see Highlighter.
+void lex_highlight(Output *out, const char *source, size_t length);
+
+// Where an edit changed a token stream: tokens before `first` are the old
+// ones, old tokens [first, old_end) became new tokens [first, new_end), and
+// the ones after are the old ones, moved
 typedef struct {
-    TokenType type;
-    char *value;
-} Token;
-
-typedef struct TokenList {
-    Token **tokens;
-    int count;
-    int capacity;
-} TokenList;
-
-void printList(TokenList *list);
-const char* printEnum(unsigned int enumber);
-void add_token(TokenList *list, Token *token);
-TokenList* lex_file(const char *filepath);
-void free_token_list(TokenList *list);
-int free_token(Token *token);
-TokenList* create_token_list();
-Token* create_token(TokenType type, const char* value);
-TokenType check_keyword(const char* text);
+    uint32_t first;
+    uint32_t old_end;
+    uint32_t new_end;
+} TokenEdit;
+
+// Tokens of `source`, an edit of old's source that kept its first `prefix`
+// and last `suffix` bytes. Lexing restarts on the first token that could
+// have read into the edit and stops as soon as it meets an old token again;
+// everything else is copied. Returns NULL, without panicking, if the edited part doesn't lex.
+TokenList* lex_buffer_edit(Arena *arena, const char *source, size_t length, const TokenList *old, size_t prefix,
+                           size_t suffix, TokenEdit *edit);
+
+// Pull-based lexer over a file descriptor. It holds a fixed-size window of
+// the input instead of the whole file, so memory stays bounded on huge or
+// piped inputs (a single token longer than the window grows it). Token
+// offsets count from the start of the stream.
+typedef struct Lexer Lexer;
+
+// "-" reads stdin. Returns NULL if the file can't be opened.
+Lexer* lexer_open(const char *filepath);
+Lexer* lexer_open_fd(int fd, size_t window_size);
+// Returns 1 and fills `token`, or 0 at end of input
+int lexer_next(Lexer *lexer, Token *token);
+// Lexeme of the token lexer_next just returned; valid until the next call
+const char* lexer_token_text(const Lexer *lexer, const Token *token);
+// 1-based line and column of `offset`, which must still be in the window:
+// the start of the token lexer_next just returned, or anything after it
+void lexer_position(const Lexer *lexer, uint32_t offset, uint32_t *line, uint32_t *column);
+void lexer_close(Lexer *lexer);
 
 #endif // LEXER_H
\ No newline at end of file
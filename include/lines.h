@@ -0,0 +1,21 @@
+// Line and column of a byte offset, from an index of line starts built the first time one is asked for
+#ifndef LINES_H
+#define LINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Nothing is read at init, so an index that never answers costs nothing
+typedef struct {
+    const char *source; // not copied
+    size_t length;
+    uint32_t *starts;   // offset of each line's first byte, NULL until needed
+    uint32_t count;
+} LineIndex;
+
+void line_index_init(LineIndex *index, const char *source, size_t length);
+void line_index_free(LineIndex *index);
+// 1-based line and column, in bytes, of `offset`
+void line_index_position(LineIndex *index, uint32_t offset, uint32_t *line, uint32_t *column);
+
+#endif // LINES_H
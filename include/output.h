@@ -0,0 +1,66 @@
+// Growable output buffer, flushed to a file descriptor in large blocks, kept in memory, or backed by an mmap'd file
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <string.h>
+
+#define OUTPUT_MEMORY (-1) // Output.fd of a buffer that is never flushed
+
+typedef struct {
+    char *data;
+    size_t length;   // bytes written to data
+    size_t capacity;
+    size_t flushed;  // bytes already written to fd and gone from data
+    int fd;          // where full buffers go, or OUTPUT_MEMORY
+    int is_mapped;   // 1 if data is a shared mapping of fd, which grows with the file
+    int owns_fd;     // output_close closes fd
+} Output;
+
+// Collects everything in one heap buffer, e.g. for a job whose result is written later
+void output_init_memory(Output *out);
+void output_init_fd(Output *out, int fd);
+// Creates or truncates `path`. A regular file is mapped and written in place,
+// anything else (a pipe, a tty) gets a buffered fd. Returns -1 if it can't be opened.
+int output_open_file(Output *out, const char *path);
+// Flushes or grows the buffer so that `size` more bytes fit; output_reserve's slow path
+void output_make_room(Output *out, size_t size);
+// output_write's slow path: a block too big for the buffer goes out in the same
+// writev as what's pending, without being copied
+void output_write_block(Output *out, const char *data, size_t size);
+void output_flush(Output *out);
+// Flushes, then trims and unmaps a mapped file, closes a file it opened and frees the buffer
+void output_close(Output *out);
+
+// At least `size` writable bytes at out->data + out->length; advance out->length by what was used
+static inline char *output_reserve(Output *out, size_t size)
+{
+    if (out->capacity - out->length < size)
+        output_make_room(out, size);
+    return out->data + out->length;
+}
+
+static inline void output_write(Output *out, const char *data, size_t size)
+{
+    if (out->capacity - out->length < size)
+    {
+        output_write_block(out, data, size);
+        return;
+    }
+    memcpy(out->data + out->length, data, size);
+    out->length += size;
+}
+
+static inline void output_char(Output *out, char c)
+{
+    if (out->length == out->capacity)
+        output_make_room(out, 1);
+    out->data[out->length++] = c;
+}
+
+static inline void output_str(Output *out, const char *text)
+{
+    output_write(out, text, strlen(text));
+}
+
+#endif // OUTPUT_H
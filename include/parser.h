@@ -1 +1,26 @@
-// Analyzes the list of tokens to construct the Abstract Syntax Tree
\ No newline at end of file
+// Analyzes the list of tokens to construct the Abstract Syntax Tree
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "arena.h"
+#include "ast.h"
+#include "tokens.h"
+
+// Never fails: anything that doesn't parse becomes an AST_UNKNOWN node over
+// its tokens, so the output can still show it verbatim. The tree lives in
+// `arena` and reads names from the token list's source.
+Ast* parse_tokens(Arena *arena, const TokenList *tokens);
+
+// For parsing part of a file again after an edit: the top-level items (a
+// directive, or an external declaration) from token `first` on, one per
+// parser_next call, AST_NONE at the end of the tokens. Top-level items
+// don't depend on what came before them, so only lookahead crosses `first`.
+typedef struct Parser Parser;
+Parser* parser_open(Arena *arena, const TokenList *tokens, uint32_t first);
+NodeId parser_next(Parser *p);
+const Ast* parser_ast(const Parser *p);
+// One past the furthest token looked at so far, by lookahead and by
+// attempts that were given up too: the items parsed depend on no other
+uint32_t parser_reach(const Parser *p);
+
+#endif // PARSER_H
@@ -0,0 +1,23 @@
+// Work-stealing thread pool for running independent jobs (one per input file) across cores
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Called once per job on some worker thread; `worker` is in [0, threads)
+typedef void (*PoolJobFn)(void *ctx, size_t job, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+// Starts `threads` workers on jobs [0, count). Heavier jobs (by `weights`,
+// may be NULL) are started first so a big file doesn't end up last.
+ThreadPool* pool_start(int threads, size_t count, const uint64_t *weights, PoolJobFn fn, void *ctx);
+// Blocks until `job` has finished; lets the caller consume results in order
+void pool_wait_job(ThreadPool *pool, size_t job);
+// Waits for every job, joins the workers and frees the pool
+void pool_finish(ThreadPool *pool);
+// Number of online cores, at least 1
+int pool_default_threads(void);
+
+#endif // POOL_H
@@ -0,0 +1,33 @@
+// Vectorised scanners for the byte runs that make up most of a C file: whitespace,
+// identifiers, comment bodies and string literals. The widest implementation the
+// CPU supports (AVX2, SSE2, scalar) is picked once at startup.
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+// Every scanner returns the first byte at or after p that ends the run, or end.
+
+// Skips ' ', \t, \n, \v, \f, \r
+const char* scan_whitespace(const char *p, const char *end);
+// First byte that isn't [A-Za-z0-9_]
+const char* scan_identifier(const char *p, const char *end);
+// First '\n'
+const char* scan_line_end(const char *p, const char *end);
+// The '*' of the first "*/"
+const char* scan_comment_end(const char *p, const char *end);
+// First '"' or '\\'
+const char* scan_string_special(const char *p, const char *end);
+// Number of '\n' in [p, end); *last_newline is left alone if there are none
+uint32_t scan_count_newlines(const char *p, const char *end, const char **last_newline);
+// Bit i is set if p[i] is one of the bytes LaTeX output can't copy as is:
+// \ { } $ & # ^ _ % ~, space, \t, \n and \r. Reads exactly 32 bytes.
+uint32_t scan_latex_mask(const char *p);
+
+// "avx2", "sse2" or "scalar". CTOLATEX_SIMD=scalar|sse2 in the environment caps it.
+const char* scan_backend(void);
+// Switches to the named backend; -1 if it's unknown or the CPU lacks it. For
+// benchmarks, and only while no other thread is scanning.
+int scan_select_backend(const char *name);
+
+#endif // SCAN_H
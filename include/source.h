@@ -0,0 +1,31 @@
+// Loads a whole input file into memory (mmap when possible, a single heap buffer otherwise)
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+// Token offsets are 32-bit, so a longer input is refused with ERR_MAX_SIZE
+#define SOURCE_MAX_LENGTH ((size_t)UINT32_MAX)
+
+typedef struct {
+    const char *data;
+    size_t length;
+    int is_mapped; // 1 if data comes from mmap, 0 if it is a heap buffer
+} SourceBuffer;
+
+// "-" reads from stdin. Returns 0 on success, -1 if the file can't be read
+// or is longer than SOURCE_MAX_LENGTH, which is also reported.
+int source_open(SourceBuffer *source, const char *filepath);
+void source_close(SourceBuffer *source);
+// Opened for as long as `arena` lives, e.g. while tokens point into it. NULL if the file can't be read.
+const SourceBuffer* source_open_in(Arena *arena, const char *filepath);
+
+// The same, always read() into a heap buffer. A mapped file that another
+// process truncates raises SIGBUS on the next access to the lost pages,
+// which a process that has to outlive its inputs can't allow.
+int source_read(SourceBuffer *source, const char *filepath);
+const SourceBuffer* source_read_in(Arena *arena, const char *filepath);
+
+#endif // SOURCE_H
@@ -0,0 +1,64 @@
+// Run statistics for --stats: time spent in each pipeline phase and what it processed, summed over every file
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "arena.h"
+#include "tokens.h"
+
+typedef enum {
+    STAT_READ,  // opening and mapping the source
+    STAT_LEX,
+    STAT_PARSE,
+    STAT_EMIT,  // LaTeX, or the --tokens / --ast dump
+    STAT_WRITE, // handing the output to the kernel
+    STAT_PHASE_COUNT
+} StatPhase;
+
+typedef struct {
+    uint64_t nanoseconds[STAT_PHASE_COUNT]; // summed over workers, so above wall time with -j
+    uint64_t files;
+    uint64_t cache_hits;
+    uint64_t bytes_read;
+    uint64_t tokens[256]; // by TokenType
+    uint64_t arena_bytes;
+    uint64_t arena_chunks;
+    uint64_t output_bytes;
+} Stats;
+
+// Set by --stats. While it's 0 every call below is one well-predicted
+// branch and touches nothing, so a Stats may be left uninitialized.
+extern int stats_enabled;
+
+static inline uint64_t stats_clock(void)
+{
+    if (!stats_enabled)
+        return 0;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// Adds the time since `start`, a stats_clock() reading, to `phase`
+static inline void stats_span(Stats *stats, StatPhase phase, uint64_t start)
+{
+    if (stats_enabled)
+        stats->nanoseconds[phase] += stats_clock() - start;
+}
+
+// stats_span straight into the totals, for time that belongs to no one file
+void stats_add_span(StatPhase phase, uint64_t start);
+
+void stats_reset(Stats *stats);
+// Counts the tokens by type
+void stats_count_tokens(Stats *stats, const TokenList *list);
+// What the arena of one file grew to
+void stats_count_arena(Stats *stats, const Arena *arena);
+// Adds `stats` to the totals of the run; safe from any thread
+void stats_merge(const Stats *stats);
+// The totals as one JSON object
+void stats_print(FILE *out, double wall_seconds);
+
+#endif // STATS_H
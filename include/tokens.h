@@ -0,0 +1,207 @@
+// Token definitions and the struct-of-arrays token stream the lexer fills and the parser walks
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "arena.h"
+#include "intern.h"
+
+// Doesn't include TOKENS for commments or preprocessor 
+// hooks, as they are not allowed into the file
+
+typedef enum {
+    TOKEN_EOF = 1,            // End of token stream
+    TOKEN_UNKNOWN = 2,        // Unknown value 
+
+    // Literals
+    TOKEN_INT_LITERAL = 3,    // 123
+    TOKEN_FLOAT_LITERAL = 4,  // 123.45, .5, 10.
+    TOKEN_CHAR_LITERAL = 5,   // 'a'
+    TOKEN_STRING_LITERAL=6, // "Hello World"
+
+    // Identifiers & Keywords
+    TOKEN_PREPROCESSOR=7,
+    TOKEN_IDENTIFIER=8,     // main, x, myVar
+
+    // Operators & Punctuation
+    TOKEN_ASSIGNMENT_OPERATOR=10, // += -= *=
+    TOKEN_OPERATOR=11,       // +, -, =, ==, *
+    TOKEN_DOT=12,            // .
+    TOKEN_COMMA=13,          // ,
+    TOKEN_SEMICOLON=14,      // ;
+    TOKEN_BITWISE_OPERATOR=15, // & , | , <<, >>, ^, ~, `
+    TOKEN_LOGIC_OPERATOR=16, // &&, ||, !
+    
+    // Grouping
+    TOKEN_COMMENT=17, // // or /**/
+    TOKEN_PAREN_OPEN=18,     // (
+    TOKEN_PAREN_CLOSE=19,    // )
+    TOKEN_BRACE_OPEN=20,     // {
+    TOKEN_BRACE_CLOSE=21,    // }
+    TOKEN_BRACKET_OPEN=22,   // [
+    TOKEN_BRACKET_CLOSE=23,   // ]
+    TOKEN_ARROW=24,           // ->
+
+    // Keywords, one ID each so nothing downstream compares strings again.
+    // C89 first, then C99 and C11.
+    TOKEN_KW_AUTO = 32,             // auto
+    TOKEN_KW_BREAK = 33,            // break
+    TOKEN_KW_CASE = 34,             // case
+    TOKEN_KW_CHAR = 35,             // char
+    TOKEN_KW_CONST = 36,            // const
+    TOKEN_KW_CONTINUE = 37,         // continue
+    TOKEN_KW_DEFAULT = 38,          // default
+    TOKEN_KW_DO = 39,               // do
+    TOKEN_KW_DOUBLE = 40,           // double
+    TOKEN_KW_ELSE = 41,             // else
+    TOKEN_KW_ENUM = 42,             // enum
+    TOKEN_KW_EXTERN = 43,           // extern
+    TOKEN_KW_FLOAT = 44,            // float
+    TOKEN_KW_FOR = 45,              // for
+    TOKEN_KW_GOTO = 46,             // goto
+    TOKEN_KW_IF = 47,               // if
+    TOKEN_KW_INT = 48,              // int
+    TOKEN_KW_LONG = 49,             // long
+    TOKEN_KW_REGISTER = 50,         // register
+    TOKEN_KW_RETURN = 51,           // return
+    TOKEN_KW_SHORT = 52,            // short
+    TOKEN_KW_SIGNED = 53,           // signed
+    TOKEN_KW_SIZEOF = 54,           // sizeof
+    TOKEN_KW_STATIC = 55,           // static
+    TOKEN_KW_STRUCT = 56,           // struct
+    TOKEN_KW_SWITCH = 57,           // switch
+    TOKEN_KW_TYPEDEF = 58,          // typedef
+    TOKEN_KW_UNION = 59,            // union
+    TOKEN_KW_UNSIGNED = 60,         // unsigned
+    TOKEN_KW_VOID = 61,             // void
+    TOKEN_KW_VOLATILE = 62,         // volatile
+    TOKEN_KW_WHILE = 63,            // while
+    TOKEN_KW_INLINE = 64,           // inline
+    TOKEN_KW_RESTRICT = 65,         // restrict
+    TOKEN_KW_BOOL = 66,             // _Bool
+    TOKEN_KW_COMPLEX = 67,          // _Complex
+    TOKEN_KW_IMAGINARY = 68,        // _Imaginary
+    TOKEN_KW_ALIGNAS = 69,          // _Alignas
+    TOKEN_KW_ALIGNOF = 70,          // _Alignof
+    TOKEN_KW_ATOMIC = 71,           // _Atomic
+    TOKEN_KW_GENERIC = 72,          // _Generic
+    TOKEN_KW_NORETURN = 73,         // _Noreturn
+    TOKEN_KW_STATIC_ASSERT = 74,    // _Static_assert
+    TOKEN_KW_THREAD_LOCAL = 75,     // _Thread_local
+} TokenType;
+
+#define TOKEN_KW_FIRST TOKEN_KW_AUTO
+#define TOKEN_KW_LAST TOKEN_KW_THREAD_LOCAL
+
+static inline int token_is_keyword(TokenType type)
+{
+    return type >= TOKEN_KW_FIRST && type <= TOKEN_KW_LAST;
+}
+
+// A token is a view into the source it was lexed from: [offset, offset + length)
+// covers the whole lexeme, delimiters included (quotes, // and /* */).
+// Tokens are not stored like this, it's what the accessors hand out. Lines and
+// columns aren't kept: a LineIndex over the source finds them when needed.
+typedef struct {
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t name; // identifiers of an interned list: the name's ID; else INTERN_NONE
+} Token;
+
+// Tokens are stored column-wise, so walking types or offsets touches dense memory.
+// A full chunk is never copied, a new one is linked after it.
+typedef struct TokenChunk {
+    struct TokenChunk *next;
+    uint32_t first; // list index of types[0]
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t *types;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    uint32_t *names; // NULL until token_list_intern
+} TokenChunk;
+
+// The list, its chunks and all token data live in `arena`
+typedef struct TokenList {
+    Arena *arena;
+    const char *source; // must outlive the list; lex_file ties it to the arena
+    size_t source_length;
+    TokenChunk *head;
+    TokenChunk *tail;
+    uint32_t count;
+    InternTable *names; // set by token_list_intern
+    const InternSet *types; // typedef names of the headers it includes, NULL when they aren't looked at
+} TokenList;
+
+// Linear, forward-only walk over a TokenList, for the parser
+typedef struct {
+    const TokenList *list;
+    const TokenChunk *chunk;
+    uint32_t index; // within chunk
+} TokenCursor;
+
+// Links a new chunk after a full tail; add_token's slow path
+TokenChunk* token_list_grow(TokenList *list);
+
+// Inline because the lexer calls it once per token
+static inline void add_token(TokenList *list, TokenType type, uint32_t offset, uint32_t length)
+{
+    TokenChunk *chunk = list->tail;
+    if (chunk->count == chunk->capacity)
+        chunk = token_list_grow(list);
+    uint32_t i = chunk->count++;
+    chunk->types[i] = (uint8_t)type;
+    chunk->offsets[i] = offset;
+    chunk->lengths[i] = length;
+    list->count++;
+}
+
+void printList(TokenList *list);
+void fprintList(FILE *out, TokenList *list);
+// `text` is the token's lexeme, wherever it currently lives
+void printToken(const Token *token, const char *text);
+void fprintToken(FILE *out, const Token *token, const char *text);
+const char* printEnum(unsigned int enumber);
+// Pre-sizes the first chunk from the length of the source
+TokenList* create_token_list(Arena *arena, const char *source, size_t source_length);
+// Moves tokens [from_index, from->count) of `from` to the end of `list`.
+// Chunks are relinked rather than copied, so `from`'s arena has to live as
+// long as `list`'s; `from` is left empty.
+void token_list_splice(TokenList *list, TokenList *from, uint32_t from_index);
+// Copies tokens [begin, end) of `from` to the end of `list`, a column at a
+// time, moving their offsets by offset_delta
+void token_list_copy(TokenList *list, const TokenList *from, uint32_t begin, uint32_t end, int32_t offset_delta);
+// Gives every identifier the ID of its name in `table`, once the list is
+// complete: lexing stays a tight loop, and this pass only reads the types
+// and the identifiers' text
+void token_list_intern(TokenList *list, InternTable *table);
+// Number of tokens that start before byte `offset`
+uint32_t token_list_before(const TokenList *list, uint32_t offset);
+// Random access, walks the chunk list; prefer a TokenCursor
+void token_at(const TokenList *list, uint32_t index, Token *out);
+// Raw lexeme, not NUL-terminated: use token->length
+const char* token_text(const TokenList *list, const Token *token);
+// NUL-terminated copy of the lexeme
+char* token_cstr(Arena *arena, const TokenList *list, const Token *token);
+// Lexeme without its delimiters (comment markers, quotes)
+const char* token_value(const TokenList *list, const Token *token, size_t *length);
+// Same, for a lexeme that isn't in a TokenList (e.g. a streaming Lexer's window)
+const char* lexeme_value(TokenType type, const char *text, size_t length, size_t *value_length);
+
+void cursor_init(TokenCursor *cursor, const TokenList *list);
+// Starts on the token with list index `index`; list->count is the end
+void cursor_init_at(TokenCursor *cursor, const TokenList *list, uint32_t index);
+// Type of the token `ahead` positions after the current one, TOKEN_EOF past the end
+TokenType cursor_peek_ahead(const TokenCursor *cursor, uint32_t ahead);
+TokenType cursor_peek(const TokenCursor *cursor);
+// Fills `out` and advances; returns 0 (and a TOKEN_EOF token) at the end
+int cursor_next(TokenCursor *cursor, Token *out);
+// Consumes the current token only if it has the given type; returns 1 if it did
+int cursor_expect(TokenCursor *cursor, TokenType type, Token *out);
+// List index of the current token
+uint32_t cursor_position(const TokenCursor *cursor);
+
+#endif // TOKENS_H
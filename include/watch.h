@@ -0,0 +1,19 @@
+// Watch mode: recompiles a file on every save, lexing, parsing and emitting again only the part the edit touched
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+The previous source, its tokens and the LaTeX of each top-level item are
+kept between saves. A save is compared with the previous bytes; lexing
+restarts on the token before the first changed byte and stops once it
+meets an old token again, the items around the new tokens are parsed again,
+and only their LaTeX, plus any that follow until the output position lines
+up again, is emitted again. The rest is reused as it was.
+*/
+
+// Writes the LaTeX of `path` to `output_path` (stdout if NULL), then again
+// after every change to the file, until the process is stopped. Returns -1
+// if the file can't be read or watched.
+int watch_file(const char *path, const char *output_path);
+
+#endif // WATCH_H
@@ -0,0 +1,145 @@
+#include "arena.h"
+#include "errors.h"
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_MAX_CHUNK_SIZE ((size_t)16 * 1024 * 1024)
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static ArenaChunk *create_chunk(size_t size)
+{
+    ArenaChunk *chunk = (ArenaChunk *)malloc(sizeof(ArenaChunk) + size);
+    if (!chunk)
+    {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->buffer_len = size;
+    chunk->off_set = 0;
+    return chunk;
+}
+
+void arena_init(Arena *arena, size_t size)
+{
+    arena->chunk_size = align_up(size > 0 ? size : ARENA_ALIGNMENT);
+    arena->head = create_chunk(arena->chunk_size);
+    arena->chunk_count = 1;
+    arena->bytes_used = 0;
+    arena->cleanups = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = align_up(size);
+    ArenaChunk *head = arena->head;
+    if (head->buffer_len - head->off_set < size)
+    {
+        if (size > arena->chunk_size / 2)
+        {
+            // Oversized requests get a private chunk behind the head, so the
+            // space left in the current chunk is not thrown away
+            ArenaChunk *chunk = create_chunk(size);
+            chunk->off_set = size;
+            chunk->next = head->next;
+            head->next = chunk;
+            arena->chunk_count++;
+            arena->bytes_used += size;
+            return chunk->buffer;
+        }
+        if (arena->chunk_size < ARENA_MAX_CHUNK_SIZE)
+            arena->chunk_size *= 2;
+        head = create_chunk(arena->chunk_size);
+        head->next = arena->head;
+        arena->head = head;
+        arena->chunk_count++;
+    }
+    void *ptr = head->buffer + head->off_set;
+    head->off_set += size;
+    arena->bytes_used += size;
+    return ptr;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    if (!ptr)
+        return arena_alloc(arena, new_size);
+    if (new_size <= old_size)
+        return ptr;
+
+    ArenaChunk *head = arena->head;
+    size_t old_aligned = align_up(old_size);
+    size_t new_aligned = align_up(new_size);
+    if (head->off_set >= old_aligned && (unsigned char *)ptr == head->buffer + head->off_set - old_aligned &&
+        head->buffer_len - head->off_set >= new_aligned - old_aligned)
+    {
+        head->off_set += new_aligned - old_aligned;
+        arena->bytes_used += new_aligned - old_aligned;
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    memcpy(moved, ptr, old_size);
+    return moved;
+}
+
+char *arena_strndup(Arena *arena, const char *text, size_t length)
+{
+    char *copy = (char *)arena_alloc(arena, length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void arena_on_free(Arena *arena, void (*fn)(void *ctx), void *ctx)
+{
+    ArenaCleanup *cleanup = (ArenaCleanup *)arena_alloc(arena, sizeof(ArenaCleanup));
+    cleanup->fn = fn;
+    cleanup->ctx = ctx;
+    cleanup->next = arena->cleanups;
+    arena->cleanups = cleanup;
+}
+
+static void run_cleanups(Arena *arena)
+{
+    for (ArenaCleanup *cleanup = arena->cleanups; cleanup; cleanup = cleanup->next)
+        cleanup->fn(cleanup->ctx);
+    arena->cleanups = NULL;
+}
+
+void arena_reset(Arena *arena)
+{
+    run_cleanups(arena);
+    // the head is the newest, so the biggest, regular chunk
+    ArenaChunk *chunk = arena->head->next;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head->next = NULL;
+    arena->head->off_set = 0;
+    arena->chunk_count = 1;
+    arena->bytes_used = 0;
+}
+
+void arena_free(Arena *arena)
+{
+    run_cleanups(arena);
+
+    ArenaChunk *chunk = arena->head;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->chunk_count = 0;
+    arena->bytes_used = 0;
+}
@@ -0,0 +1,250 @@
+#include "ast.h"
+#include "errors.h"
+#include <string.h>
+
+#define HEADER_WORDS (sizeof(ASTNode) / sizeof(uint32_t))
+
+// A node per token or two is typical for C, at 4 to 6 words each
+static const uint32_t WORDS_PER_TOKEN_ESTIMATE = 3;
+static const uint32_t MIN_AST_WORDS = 256;
+
+Ast *ast_create(Arena *arena, const TokenList *tokens)
+{
+    Ast *ast = (Ast *)arena_alloc(arena, sizeof(Ast));
+    ast->arena = arena;
+    ast->tokens = tokens;
+    uint64_t estimate = (uint64_t)tokens->count * WORDS_PER_TOKEN_ESTIMATE;
+    if (estimate < MIN_AST_WORDS)
+        estimate = MIN_AST_WORDS;
+    if (estimate > UINT32_MAX / 2)
+        estimate = UINT32_MAX / 2;
+    ast->capacity = (uint32_t)estimate;
+    ast->words = (uint32_t *)arena_alloc(arena, ast->capacity * sizeof(uint32_t));
+    // word 0 stays unused so that AST_NONE never names a node
+    ast->used = 1;
+    ast->node_count = 0;
+    ast->root = AST_NONE;
+    return ast;
+}
+
+NodeId ast_add(Ast *ast, NodeType type, OpCode op, uint32_t first_token, uint32_t last_token, const NodeId *children,
+               uint32_t count)
+{
+    uint32_t size = (uint32_t)HEADER_WORDS + count;
+    if (ast->capacity - ast->used < size)
+    {
+        uint32_t capacity = ast->capacity;
+        while (capacity - ast->used < size)
+        {
+            if (capacity > UINT32_MAX / 2)
+                panic(ERR_MAX_SIZE, 0);
+            capacity *= 2;
+        }
+        ast->words = (uint32_t *)arena_realloc(ast->arena, ast->words, ast->capacity * sizeof(uint32_t),
+                                               capacity * sizeof(uint32_t));
+        ast->capacity = capacity;
+    }
+
+    NodeId id = ast->used;
+    ASTNode *node = (ASTNode *)(ast->words + id);
+    node->type = (uint8_t)type;
+    node->op = (uint8_t)op;
+    node->flags = 0;
+    node->count = count;
+    node->first_token = first_token;
+    node->last_token = last_token;
+    if (count)
+        memcpy(node->children, children, count * sizeof(NodeId));
+    ast->used += size;
+    ast->node_count++;
+    return id;
+}
+
+void ast_set_flags(Ast *ast, NodeId id, uint16_t flags)
+{
+    ((ASTNode *)(ast->words + id))->flags = flags;
+}
+
+void ast_truncate(Ast *ast, uint32_t mark)
+{
+    // nodes can only be walked forwards, so count the dropped ones from mark
+    for (NodeId id = mark; id < ast->used; id = ast_next(ast, id))
+        ast->node_count--;
+    if (mark < ast->used)
+        ast->used = mark;
+}
+
+const char *ast_text(const Ast *ast, NodeId id, size_t *length)
+{
+    Token tok;
+    token_at(ast->tokens, ast_node(ast, id)->first_token, &tok);
+    *length = tok.length;
+    return token_text(ast->tokens, &tok);
+}
+
+uint32_t ast_name(const Ast *ast, NodeId id)
+{
+    Token tok;
+    token_at(ast->tokens, ast_node(ast, id)->first_token, &tok);
+    return tok.name;
+}
+
+const char *ast_type_name(NodeType type)
+{
+    static const char *const names[AST_NODE_TYPE_COUNT] = {
+        [AST_PROGRAM] = "PROGRAM",
+        [AST_FUNCTION_DECL] = "FUNCTION_DECL",
+        [AST_BLOCK] = "BLOCK",
+        [AST_VAR_DECL] = "VAR_DECL",
+        [AST_BINARY_OP] = "BINARY_OP",
+        [AST_INT_LITERAL] = "INT_LITERAL",
+        [AST_PREPROCESSOR] = "PREPROCESSOR",
+        [AST_TYPE] = "TYPE",
+        [AST_DECLARATOR] = "DECLARATOR",
+        [AST_PARAM] = "PARAM",
+        [AST_EXPR_STMT] = "EXPR_STMT",
+        [AST_EMPTY_STMT] = "EMPTY_STMT",
+        [AST_IF] = "IF",
+        [AST_WHILE] = "WHILE",
+        [AST_DO_WHILE] = "DO_WHILE",
+        [AST_FOR] = "FOR",
+        [AST_SWITCH] = "SWITCH",
+        [AST_CASE] = "CASE",
+        [AST_DEFAULT] = "DEFAULT",
+        [AST_LABEL] = "LABEL",
+        [AST_GOTO] = "GOTO",
+        [AST_RETURN] = "RETURN",
+        [AST_BREAK] = "BREAK",
+        [AST_CONTINUE] = "CONTINUE",
+        [AST_UNKNOWN] = "UNKNOWN",
+        [AST_IDENTIFIER] = "IDENTIFIER",
+        [AST_FLOAT_LITERAL] = "FLOAT_LITERAL",
+        [AST_CHAR_LITERAL] = "CHAR_LITERAL",
+        [AST_STRING_LITERAL] = "STRING_LITERAL",
+        [AST_UNARY_OP] = "UNARY_OP",
+        [AST_TERNARY] = "TERNARY",
+        [AST_CALL] = "CALL",
+        [AST_INDEX] = "INDEX",
+        [AST_MEMBER] = "MEMBER",
+        [AST_CAST] = "CAST",
+        [AST_SIZEOF_TYPE] = "SIZEOF_TYPE",
+        [AST_INIT_LIST] = "INIT_LIST",
+        [AST_DESIGNATOR] = "DESIGNATOR",
+    };
+    return type < AST_NODE_TYPE_COUNT && names[type] ? names[type] : "INVALID";
+}
+
+const char *ast_op_text(OpCode op)
+{
+    static const char *const texts[AST_OP_COUNT] = {
+        [AST_OP_NONE] = "",
+        [AST_OP_MUL] = "*",
+        [AST_OP_DIV] = "/",
+        [AST_OP_MOD] = "%",
+        [AST_OP_ADD] = "+",
+        [AST_OP_SUB] = "-",
+        [AST_OP_SHL] = "<<",
+        [AST_OP_SHR] = ">>",
+        [AST_OP_LT] = "<",
+        [AST_OP_GT] = ">",
+        [AST_OP_LE] = "<=",
+        [AST_OP_GE] = ">=",
+        [AST_OP_EQ] = "==",
+        [AST_OP_NE] = "!=",
+        [AST_OP_BIT_AND] = "&",
+        [AST_OP_BIT_XOR] = "^",
+        [AST_OP_BIT_OR] = "|",
+        [AST_OP_LOG_AND] = "&&",
+        [AST_OP_LOG_OR] = "||",
+        [AST_OP_COND] = "?",
+        [AST_OP_ELVIS] = "?:",
+        [AST_OP_ASSIGN] = "=",
+        [AST_OP_MUL_ASSIGN] = "*=",
+        [AST_OP_DIV_ASSIGN] = "/=",
+        [AST_OP_MOD_ASSIGN] = "%=",
+        [AST_OP_ADD_ASSIGN] = "+=",
+        [AST_OP_SUB_ASSIGN] = "-=",
+        [AST_OP_SHL_ASSIGN] = "<<=",
+        [AST_OP_SHR_ASSIGN] = ">>=",
+        [AST_OP_AND_ASSIGN] = "&=",
+        [AST_OP_XOR_ASSIGN] = "^=",
+        [AST_OP_OR_ASSIGN] = "|=",
+        [AST_OP_COMMA] = ",",
+        [AST_OP_NEG] = "-",
+        [AST_OP_PLUS] = "+",
+        [AST_OP_NOT] = "!",
+        [AST_OP_BIT_NOT] = "~",
+        [AST_OP_DEREF] = "*",
+        [AST_OP_ADDR] = "&",
+        [AST_OP_PRE_INC] = "++",
+        [AST_OP_PRE_DEC] = "--",
+        [AST_OP_POST_INC] = "++",
+        [AST_OP_POST_DEC] = "--",
+        [AST_OP_SIZEOF] = "sizeof",
+        [AST_OP_DOT] = ".",
+        [AST_OP_ARROW] = "->",
+    };
+    return op < AST_OP_COUNT ? texts[op] : "";
+}
+
+typedef struct {
+    NodeId id;
+    uint32_t depth;
+} PrintFrame;
+
+void ast_print(FILE *out, const Ast *ast)
+{
+    if (ast->root == AST_NONE)
+        return;
+    // explicit stack: generated code nests deeper than the C stack would like
+    size_t capacity = 64;
+    size_t top = 0;
+    PrintFrame *stack = (PrintFrame *)malloc(capacity * sizeof(PrintFrame));
+    if (!stack)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    stack[top++] = (PrintFrame){ast->root, 0};
+    while (top > 0)
+    {
+        PrintFrame frame = stack[--top];
+        if (frame.id == AST_NONE)
+        {
+            fprintf(out, "%*s-\n", (int)(frame.depth * 2), "");
+            continue;
+        }
+        const ASTNode *node = ast_node(ast, frame.id);
+        fprintf(out, "%*s%s", (int)(frame.depth * 2), "", ast_type_name((NodeType)node->type));
+        if (node->op != AST_OP_NONE)
+            fprintf(out, " %s", ast_op_text((OpCode)node->op));
+        switch (node->type)
+        {
+        case AST_IDENTIFIER:
+        case AST_INT_LITERAL:
+        case AST_FLOAT_LITERAL:
+        case AST_CHAR_LITERAL:
+        case AST_STRING_LITERAL:
+        case AST_PREPROCESSOR:
+        {
+            size_t length;
+            const char *text = ast_text(ast, frame.id, &length);
+            fprintf(out, " %.*s", (int)length, text);
+            break;
+        }
+        default:
+            break;
+        }
+        fprintf(out, " [%u-%u]\n", node->first_token, node->last_token);
+
+        if (top + node->count > capacity)
+        {
+            while (top + node->count > capacity)
+                capacity *= 2;
+            PrintFrame *grown = (PrintFrame *)realloc(stack, capacity * sizeof(PrintFrame));
+            if (!grown)
+                panic(ERR_MEMORY_ALLOCATION, 0);
+            stack = grown;
+        }
+        for (uint32_t i = node->count; i > 0; i--)
+            stack[top++] = (PrintFrame){node->children[i - 1], frame.depth + 1};
+    }
+    free(stack);
+}
@@ -0,0 +1,469 @@
+#include "batch.h"
+#include "pool.h"
+#include "lexer.h"
+#include "parser.h"
+#include "emitter.h"
+#include "errors.h"
+#include "diagnostics.h"
+#include "includes.h"
+#include "stats.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void input_list_init(InputList *inputs)
+{
+    inputs->paths = NULL;
+    inputs->sizes = NULL;
+    inputs->count = 0;
+    inputs->capacity = 0;
+}
+
+static void input_list_push(InputList *inputs, const char *path, size_t length, uint64_t size)
+{
+    if (inputs->count == inputs->capacity)
+    {
+        size_t capacity = inputs->capacity ? inputs->capacity * 2 : 16;
+        char **paths = (char **)realloc(inputs->paths, capacity * sizeof(char *));
+        if (paths)
+            inputs->paths = paths;
+        uint64_t *sizes = (uint64_t *)realloc(inputs->sizes, capacity * sizeof(uint64_t));
+        if (sizes)
+            inputs->sizes = sizes;
+        if (!paths || !sizes)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        inputs->capacity = capacity;
+    }
+    char *copy = (char *)malloc(length + 1);
+    if (!copy)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    memcpy(copy, path, length);
+    copy[length] = '\0';
+    inputs->paths[inputs->count] = copy;
+    inputs->sizes[inputs->count] = size;
+    inputs->count++;
+}
+
+static int is_c_source(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 2 && name[length - 2] == '.' && (name[length - 1] == 'c' || name[length - 1] == 'h');
+}
+
+static void add_directory(InputList *inputs, const char *dir)
+{
+    struct dirent **entries;
+    // alphasort keeps the batch order independent of the filesystem
+    int n = scandir(dir, &entries, NULL, alphasort);
+    if (n < 0)
+        return;
+    size_t dir_length = strlen(dir);
+    for (int i = 0; i < n; i++)
+    {
+        const char *name = entries[i]->d_name;
+        if (name[0] != '.')
+        {
+            size_t name_length = strlen(name);
+            char *path = (char *)malloc(dir_length + name_length + 2);
+            if (!path)
+                panic(ERR_MEMORY_ALLOCATION, 0);
+            memcpy(path, dir, dir_length);
+            size_t at = dir_length;
+            if (at > 0 && path[at - 1] != '/')
+                path[at++] = '/';
+            memcpy(path + at, name, name_length + 1);
+
+            // a link to a directory isn't followed, as it may lead back up
+            // the tree; a link to a file is added like the file
+            struct stat st;
+            if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+                add_directory(inputs, path);
+            else if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && is_c_source(name))
+                input_list_push(inputs, path, strlen(path), (uint64_t)st.st_size);
+            free(path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+}
+
+void input_list_add_path(InputList *inputs, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        add_directory(inputs, path);
+        return;
+    }
+    // anything else, missing files included, is reported when it gets compiled
+    uint64_t size = stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    input_list_push(inputs, path, strlen(path), size);
+}
+
+int input_list_add_manifest(InputList *inputs, const char *manifest)
+{
+    FILE *file = fopen(manifest, "r");
+    if (!file)
+        return -1;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, file)) >= 0)
+    {
+        const char *start = line;
+        const char *end = line + length;
+        const char *comma = memchr(start, ',', (size_t)length);
+        if (comma)
+            end = comma;
+        while (start < end && (*start == ' ' || *start == '\t'))
+            start++;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+            end--;
+        if (end - start >= 2 && *start == '"' && end[-1] == '"')
+        {
+            start++;
+            end--;
+        }
+        if (start == end || *start == '#')
+            continue;
+
+        // the path has to be NUL-terminated for stat
+        char saved = *end;
+        *(char *)end = '\0';
+        input_list_add_path(inputs, start);
+        *(char *)end = saved;
+    }
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+void input_list_free(InputList *inputs)
+{
+    for (size_t i = 0; i < inputs->count; i++)
+        free(inputs->paths[i]);
+    free(inputs->paths);
+    free(inputs->sizes);
+    input_list_init(inputs);
+}
+
+// What every file of a run is compiled with
+typedef struct {
+    OutputMode mode;
+    const Cache *cache;   // NULL to always compile
+    InternTable *names;
+    HeaderCache *headers; // NULL to leave includes alone
+} CompileContext;
+
+// Parse -> Emit of the tokens into `out`
+static void compile_tokens(Arena *arena, TokenList *list, OutputMode mode, Stats *stats, Output *out)
+{
+    uint64_t start;
+    if (mode == OUTPUT_LATEX)
+    {
+        start = stats_clock();
+        Ast *ast = parse_tokens(arena, list);
+        stats_span(stats, STAT_PARSE, start);
+        start = stats_clock();
+        emit_latex(out, ast);
+        stats_span(stats, STAT_EMIT, start);
+    }
+    else
+    {
+        Ast *ast = NULL;
+        if (mode == OUTPUT_AST)
+        {
+            start = stats_clock();
+            ast = parse_tokens(arena, list);
+            stats_span(stats, STAT_PARSE, start);
+        }
+        // the debugging dumps are printed through stdio
+        start = stats_clock();
+        char *text = NULL;
+        size_t length = 0;
+        FILE *dump = open_memstream(&text, &length);
+        if (!dump)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        if (mode == OUTPUT_TOKENS)
+            fprintList(dump, list);
+        else
+            ast_print(dump, ast);
+        fclose(dump);
+        output_write(out, text, length);
+        free(text);
+        stats_span(stats, STAT_EMIT, start);
+    }
+}
+
+static int mode_parses(OutputMode mode)
+{
+    return mode == OUTPUT_LATEX || mode == OUTPUT_AST;
+}
+
+// The tokens of `source`, read from `path`. For the modes that parse they
+// are interned, and given the typedef names of the file's headers when
+// includes are followed; `stamp` is then the hash of those headers, else 0.
+// Following includes is timed as lexing.
+static TokenList *lex_source(Arena *arena, const SourceBuffer *source, const char *path, int threads,
+                             const CompileContext *context, Stats *stats, uint64_t *stamp)
+{
+    uint64_t start = stats_clock();
+    TokenList *list = lex_source_parallel(arena, source, threads);
+    *stamp = 0;
+    if (mode_parses(context->mode))
+    {
+        token_list_intern(list, context->names);
+        if (context->headers)
+            *stamp = include_resolve(context->headers, path, list);
+    }
+    stats_span(stats, STAT_LEX, start);
+    if (stats_enabled)
+        stats_count_tokens(stats, list);
+    return list;
+}
+
+// Lex -> Parse -> Emit of the source into `out`
+static void compile_source(Arena *arena, const SourceBuffer *source, const char *path, int threads,
+                           const CompileContext *context, Stats *stats, Output *out)
+{
+    if (context->mode == OUTPUT_HIGHLIGHT)
+    {
+        // lexing and emitting are one pass, timed as emitting
+        uint64_t start = stats_clock();
+        lex_highlight(out, source->data, source->length);
+        stats_span(stats, STAT_EMIT, start);
+        return;
+    }
+    uint64_t stamp;
+    TokenList *list = lex_source(arena, source, path, threads, context, stats, &stamp);
+    compile_tokens(arena, list, context->mode, stats, out);
+}
+
+// The lexer reports byte offsets; the file's lines are only looked for once
+// there is an error to place
+static void resolve_positions(DiagnosticList *diagnostics, size_t from, const char *source, size_t length)
+{
+    if (diagnostics->count == from)
+        return;
+    LineIndex lines;
+    line_index_init(&lines, source, length);
+    diagnostics_resolve(diagnostics, from, &lines);
+    line_index_free(&lines);
+}
+
+// One file, written to `out`, its errors to `diagnostics`. `threads` > 1
+// splits the lexing of a big file across cores.
+static void compile_file(const char *path, int threads, const CompileContext *context, DiagnosticList *diagnostics,
+                         Output *out)
+{
+    const Cache *cache = context->cache;
+    DiagnosticList *previous = diagnostics_capture(diagnostics);
+    size_t reported = diagnostics->count;
+    Stats stats;
+    if (stats_enabled)
+        stats_reset(&stats);
+    // Every allocation made while compiling this file lives here
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    uint64_t start = stats_clock();
+    const SourceBuffer *source = source_open_in(&arena, path);
+    if (!source)
+    {
+        // unless source_open said why
+        if (diagnostics->count == reported)
+            diagnostic_report(ERR_FILE_NOT_FOUND, DIAGNOSTIC_NO_OFFSET);
+        diagnostics_capture(previous);
+        arena_free(&arena);
+        return;
+    }
+    stats_span(&stats, STAT_READ, start);
+
+    if (!cache)
+    {
+        compile_source(&arena, source, path, threads, context, &stats, out);
+    }
+    else
+    {
+        CacheKey key = cache_key(cache, source->data, source->length);
+        TokenList *list = NULL;
+        if (context->headers && mode_parses(context->mode))
+        {
+            // the output depends on the headers too, which are only known
+            // once the file is lexed
+            uint64_t stamp;
+            list = lex_source(&arena, source, path, threads, context, &stats, &stamp);
+            if (stamp != 0)
+                key.hash = cache_hash(&stamp, sizeof(stamp), key.hash);
+        }
+        if (cache_lookup(cache, &key, out))
+        {
+            if (stats_enabled)
+                stats.cache_hits++;
+        }
+        else
+        {
+            // compiled on the side, since `out` may flush part of it before the end
+            Output fresh;
+            output_init_memory(&fresh);
+            if (list)
+                compile_tokens(&arena, list, context->mode, &stats, &fresh);
+            else
+                compile_source(&arena, source, path, threads, context, &stats, &fresh);
+            // a hit would bring back the output without the errors
+            if (diagnostics->count == reported)
+                cache_store(cache, &key, fresh.data, fresh.length);
+            output_write(out, fresh.data, fresh.length);
+            output_close(&fresh);
+        }
+    }
+    if (stats_enabled)
+    {
+        stats.files = 1;
+        stats.bytes_read = source->length;
+        stats_count_arena(&stats, &arena);
+        stats_merge(&stats);
+    }
+    resolve_positions(diagnostics, reported, source->data, source->length);
+    arena_free(&arena);
+    diagnostics_capture(previous);
+}
+
+void batch_compile_buffer(Arena *arena, const char *source, size_t length, OutputMode mode, const Cache *cache,
+                          InternTable *names, DiagnosticList *diagnostics, Output *out)
+{
+    CacheKey key;
+    if (cache)
+    {
+        key = cache_key(cache, source, length);
+        if (cache_lookup(cache, &key, out))
+            return;
+    }
+    DiagnosticList *previous = diagnostics_capture(diagnostics);
+    size_t reported = diagnostics->count;
+    Stats stats;
+    if (stats_enabled)
+        stats_reset(&stats);
+    uint64_t start = stats_clock();
+    size_t first = out->length;
+    if (mode == OUTPUT_HIGHLIGHT)
+    {
+        lex_highlight(out, source, length);
+        stats_span(&stats, STAT_EMIT, start);
+    }
+    else
+    {
+        TokenList *list = lex_buffer(arena, source, length);
+        if (mode != OUTPUT_TOKENS)
+            token_list_intern(list, names);
+        stats_span(&stats, STAT_LEX, start);
+        compile_tokens(arena, list, mode, &stats, out);
+    }
+    if (stats_enabled)
+        stats_merge(&stats);
+    if (cache && diagnostics->count == reported)
+        cache_store(cache, &key, out->data + first, out->length - first);
+    resolve_positions(diagnostics, reported, source, length);
+    diagnostics_capture(previous);
+}
+
+typedef struct {
+    const InputList *inputs;
+    const CompileContext *context; // its names and headers shared by the workers
+    Output *outputs; // in memory, one per input
+    DiagnosticList *diagnostics; // one per input
+} BatchJobs;
+
+static void compile_job(void *ctx, size_t job, int worker)
+{
+    (void)worker;
+    BatchJobs *jobs = (BatchJobs *)ctx;
+    output_init_memory(&jobs->outputs[job]);
+    compile_file(jobs->inputs->paths[job], 1, jobs->context, &jobs->diagnostics[job], &jobs->outputs[job]);
+}
+
+void batch_write_header(const InputList *inputs, size_t i, OutputMode mode, Output *out)
+{
+    if (inputs->count <= 1)
+        return;
+    // a LaTeX comment, so that the fragments still compile back to back
+    output_str(out, mode == OUTPUT_LATEX || mode == OUTPUT_HIGHLIGHT ? "% ==> " : "==> ");
+    output_str(out, inputs->paths[i]);
+    output_str(out, " <==\n");
+}
+
+// Every input on a pool of workers, each compiled to memory first
+static void run_jobs(const InputList *inputs, const BatchOptions *options, const CompileContext *context,
+                     DiagnosticList *diagnostics, Output *out)
+{
+    BatchJobs jobs;
+    jobs.inputs = inputs;
+    jobs.context = context;
+    jobs.diagnostics = diagnostics;
+    jobs.outputs = (Output *)calloc(inputs->count, sizeof(Output));
+    if (!jobs.outputs)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+
+    ThreadPool *pool = pool_start(options->threads, inputs->count, inputs->sizes, compile_job, &jobs);
+    // write each result as soon as everything before it is out
+    for (size_t i = 0; i < inputs->count; i++)
+    {
+        pool_wait_job(pool, i);
+        batch_write_header(inputs, i, options->mode, out);
+        output_write(out, jobs.outputs[i].data, jobs.outputs[i].length);
+        output_close(&jobs.outputs[i]);
+    }
+    pool_finish(pool);
+    free(jobs.outputs);
+}
+
+size_t batch_run(const InputList *inputs, const BatchOptions *options, Output *out)
+{
+    DiagnosticList *diagnostics = (DiagnosticList *)malloc((inputs->count + 1) * sizeof(DiagnosticList));
+    if (!diagnostics)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    for (size_t i = 0; i < inputs->count; i++)
+        diagnostics_init(&diagnostics[i], inputs->paths[i]);
+
+    int threads = options->threads;
+    // a single file gets all the threads for itself
+    int serial = threads <= 1 || inputs->count <= 1;
+    // one table for the whole run, so that a name has the same ID in every
+    // file and in the headers; it only takes locks when workers share it
+    InternTable names;
+    intern_init(&names, !serial);
+    CompileContext context;
+    context.mode = options->mode;
+    context.cache = options->cache;
+    context.names = &names;
+    context.headers = options->resolve_includes
+                          ? header_cache_open(options->include_dirs, options->include_dir_count, &names)
+                          : NULL;
+    if (serial)
+    {
+        for (size_t i = 0; i < inputs->count; i++)
+        {
+            batch_write_header(inputs, i, options->mode, out);
+            compile_file(inputs->paths[i], threads, &context, &diagnostics[i], out);
+        }
+    }
+    else
+        run_jobs(inputs, options, &context, diagnostics, out);
+    if (context.headers)
+        header_cache_close(context.headers);
+    intern_free(&names);
+    if (options->cache)
+        cache_trim(options->cache);
+
+    // in input order, after everything else
+    size_t count = 0;
+    for (size_t i = 0; i < inputs->count; i++)
+    {
+        diagnostics_print(stderr, &diagnostics[i]);
+        count += diagnostics[i].count;
+        diagnostics_free(&diagnostics[i]);
+    }
+    free(diagnostics);
+    return count;
+}
@@ -0,0 +1,332 @@
+#include "cache.h"
+#include "errors.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bump whenever the output for the same input changes, so that older
+// entries stop matching
+#define CACHE_VERSION 1
+// What cache_trim keeps once it has to evict, as a share of the limit, so
+// that the next few stores don't trigger it again
+#define CACHE_TRIM_KEEP 0.9
+// Temporary files of a writer that died are removed after this long
+#define CACHE_STALE_SECONDS 3600
+
+static const char CACHE_MAGIC[8] = {'c', '2', 'l', 'c', 'a', 'c', 'h', 'e'};
+
+typedef struct {
+    char magic[8];
+    uint64_t fingerprint;
+    uint64_t hash;
+    uint64_t input_length;
+    uint64_t output_length; // bytes following the header
+} EntryHeader;
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    return rotl64(acc, 31) * PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t lane)
+{
+    acc ^= hash_round(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t cache_hash(const void *data, size_t length, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    uint64_t h;
+    if (length >= 32)
+    {
+        // four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        do
+        {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME5;
+    }
+    h += (uint64_t)length;
+
+    for (; end - p >= 8; p += 8)
+        h = rotl64(h ^ hash_round(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (end - p >= 4)
+    {
+        h = rotl64(h ^ (uint64_t)read32(p) * PRIME1, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ *p * PRIME5, 11) * PRIME1;
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+int cache_open(Cache *cache, const char *dir, uint64_t limit, uint64_t variant)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return -1;
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || access(dir, R_OK | W_OK | X_OK) != 0)
+        return -1;
+    cache->dir = strdup(dir);
+    if (!cache->dir)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    uint64_t version[2] = {CACHE_VERSION, variant};
+    cache->fingerprint = cache_hash(version, sizeof(version), 0);
+    cache->limit = limit;
+    return 0;
+}
+
+void cache_close(Cache *cache)
+{
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+CacheKey cache_key(const Cache *cache, const char *input, size_t length)
+{
+    CacheKey key;
+    key.hash = cache_hash(input, length, cache->fingerprint);
+    key.length = (uint64_t)length;
+    return key;
+}
+
+// Entries are named by their hash alone: 16 hex digits
+static void entry_path(const Cache *cache, uint64_t hash, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%016llx", cache->dir, (unsigned long long)hash);
+}
+
+static int read_exactly(int fd, char *buffer, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t got = pread(fd, buffer, size, offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        buffer += got;
+        size -= (size_t)got;
+        offset += got;
+    }
+    return 0;
+}
+
+static int write_exactly(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+int cache_lookup(const Cache *cache, const CacheKey *key, Output *out)
+{
+    char path[4096];
+    entry_path(cache, key->hash, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    int hit = 0;
+    EntryHeader header;
+    struct stat st;
+    if (read_exactly(fd, (char *)&header, sizeof(header), 0) == 0 && fstat(fd, &st) == 0 &&
+        memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header.fingerprint == cache->fingerprint &&
+        header.hash == key->hash && header.input_length == key->length &&
+        (uint64_t)st.st_size == sizeof(header) + header.output_length)
+    {
+        size_t length = (size_t)header.output_length;
+        char *dst = output_reserve(out, length);
+        if (read_exactly(fd, dst, length, sizeof(header)) == 0)
+        {
+            out->length += length;
+            hit = 1;
+            // the modification time is the last use, for cache_trim
+            futimens(fd, NULL);
+        }
+    }
+    close(fd);
+    return hit;
+}
+
+void cache_store(const Cache *cache, const CacheKey *key, const char *output, size_t length)
+{
+    static unsigned int counter;
+    char path[4096];
+    char temporary[4096 + 64];
+    entry_path(cache, key->hash, path, sizeof(path));
+    // unique across processes and across the workers of this one
+    snprintf(temporary, sizeof(temporary), "%s.%ld.%u.tmp", path, (long)getpid(),
+             __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return;
+
+    EntryHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.fingerprint = cache->fingerprint;
+    header.hash = key->hash;
+    header.input_length = key->length;
+    header.output_length = (uint64_t)length;
+    int ok = write_exactly(fd, (const char *)&header, sizeof(header)) == 0 && write_exactly(fd, output, length) == 0;
+    if (close(fd) != 0)
+        ok = 0;
+    if (!ok || rename(temporary, path) != 0)
+        unlink(temporary);
+}
+
+typedef struct {
+    char *name;
+    time_t used;
+    uint64_t size;
+} TrimEntry;
+
+static int by_last_use(const void *a, const void *b)
+{
+    time_t x = ((const TrimEntry *)a)->used;
+    time_t y = ((const TrimEntry *)b)->used;
+    return (x > y) - (x < y);
+}
+
+static int is_entry_name(const char *name)
+{
+    size_t digits = strspn(name, "0123456789abcdef");
+    return digits == 16 && name[16] == '\0';
+}
+
+static int is_temporary_name(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4 && strspn(name, "0123456789abcdef") == 16 && strcmp(name + length - 4, ".tmp") == 0;
+}
+
+void cache_trim(const Cache *cache)
+{
+    DIR *dir = opendir(cache->dir);
+    if (!dir)
+        return;
+    TrimEntry *entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    size_t dir_length = strlen(cache->dir);
+    char path[4096];
+
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        const char *name = item->d_name;
+        int entry = is_entry_name(name);
+        if (!entry && !is_temporary_name(name))
+            continue;
+        if (dir_length + strlen(name) + 2 > sizeof(path))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, name);
+        struct stat st;
+        if (stat(path, &st) != 0)
+            continue;
+        if (!entry)
+        {
+            if (now - st.st_mtime > CACHE_STALE_SECONDS)
+                unlink(path);
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            TrimEntry *grown = (TrimEntry *)realloc(entries, capacity * sizeof(TrimEntry));
+            if (!grown)
+                panic(ERR_MEMORY_ALLOCATION, 0);
+            entries = grown;
+        }
+        entries[count].name = strdup(name);
+        if (!entries[count].name)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        entries[count].used = st.st_mtime;
+        entries[count].size = (uint64_t)st.st_size;
+        total += (uint64_t)st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > cache->limit)
+    {
+        uint64_t keep = (uint64_t)((double)cache->limit * CACHE_TRIM_KEEP);
+        qsort(entries, count, sizeof(TrimEntry), by_last_use);
+        // another process may have removed it already; it's gone either way
+        for (size_t i = 0; i < count && total > keep; i++)
+        {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+            unlink(path);
+            total -= entries[i].size;
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+}
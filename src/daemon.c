@@ -0,0 +1,386 @@
+#include "daemon.h"
+#include "arena.h"
+#include "cache.h"
+#include "errors.h"
+#include "source.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Bump whenever DaemonRequest, DaemonResponse or Diagnostic change; a client
+// that gets another version in the greeting compiles locally
+#define DAEMON_VERSION 4
+#define DAEMON_MAX_SOURCE ((uint64_t)SOURCE_MAX_LENGTH)
+#define DAEMON_BACKLOG 64
+// Requests between two cache_trim runs
+#define DAEMON_TRIM_EVERY 256
+// A client reads the answer in pieces this big, straight into its output
+#define FORWARD_READ_SIZE (256 * 1024)
+
+typedef struct {
+    int listener;
+    Cache *caches; // one per OutputMode, NULL without a cache
+    Arena arena;   // reset, not freed, between requests
+    Output out;    // in memory, kept at the biggest size an answer needed
+    InternTable names; // this worker's alone, started over every DAEMON_TRIM_EVERY requests
+    unsigned int names_served;
+    DiagnosticList diagnostics;
+    pthread_t thread;
+} DaemonWorker;
+
+static unsigned int requests_served;
+
+static int read_exactly(int fd, void *buffer, size_t size)
+{
+    char *p = (char *)buffer;
+    while (size > 0)
+    {
+        ssize_t got = read(fd, p, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        p += got;
+        size -= (size_t)got;
+    }
+    return 0;
+}
+
+// sendmsg rather than write: a peer that hung up must not raise SIGPIPE
+static int send_exactly(int fd, const void *header, size_t header_size, const char *data, size_t size)
+{
+    struct iovec parts[2] = {{(void *)header, header_size}, {(void *)data, size}};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    while (message.msg_iovlen > 0)
+    {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            return -1;
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len)
+        {
+            sent -= (ssize_t)message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+static int socket_address(struct sockaddr_un *address, const char *socket_path)
+{
+    if (strlen(socket_path) >= sizeof(address->sun_path))
+        return -1;
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+static int connect_to(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if (socket_address(&address, socket_path) != 0)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Status of one request; on DAEMON_OK its output is in worker->out and its
+// errors in worker->diagnostics
+static uint32_t compile_request(DaemonWorker *worker, const DaemonRequest *request, const char *payload)
+{
+    const char *source = payload;
+    size_t length = (size_t)request->length;
+    if (request->input == DAEMON_PATH)
+    {
+        // relative paths would be the daemon's, not the client's
+        if (payload[0] != '/' || strlen(payload) != length)
+            return ERR_FILE_NOT_FOUND;
+        // a file too long to lex is reported, which must not panic here
+        DiagnosticList *previous = diagnostics_capture(&worker->diagnostics);
+        // read, not mapped: a file truncated mid-compile would kill the daemon
+        const SourceBuffer *buffer = source_read_in(&worker->arena, payload);
+        diagnostics_capture(previous);
+        if (!buffer)
+            return worker->diagnostics.count > 0 ? worker->diagnostics.items[0].code : ERR_FILE_NOT_FOUND;
+        source = buffer->data;
+        length = buffer->length;
+    }
+    if ((uint64_t)length > DAEMON_MAX_SOURCE)
+        return ERR_MAX_SIZE;
+    const Cache *cache = worker->caches ? &worker->caches[request->mode] : NULL;
+    batch_compile_buffer(&worker->arena, source, length, (OutputMode)request->mode, cache, &worker->names,
+                         &worker->diagnostics, &worker->out);
+    return DAEMON_OK;
+}
+
+// Answers requests until the client hangs up or sends something malformed
+static void serve_connection(DaemonWorker *worker, int fd)
+{
+    DaemonResponse greeting = {DAEMON_OK, DAEMON_VERSION, 0};
+    if (send_exactly(fd, &greeting, sizeof(greeting), NULL, 0) != 0)
+    {
+        close(fd);
+        return;
+    }
+    DaemonRequest request;
+    while (read_exactly(fd, &request, sizeof(request)) == 0)
+    {
+        if (request.magic != DAEMON_MAGIC || request.version != DAEMON_VERSION || request.input > DAEMON_SOURCE ||
+            request.mode >= OUTPUT_MODE_COUNT || request.length > DAEMON_MAX_SOURCE)
+            break;
+        char *payload = (char *)arena_alloc(&worker->arena, (size_t)request.length + 1);
+        if (read_exactly(fd, payload, (size_t)request.length) != 0)
+            break;
+        payload[request.length] = '\0';
+
+        worker->out.length = 0;
+        worker->diagnostics.count = 0;
+        DaemonResponse response;
+        response.status = compile_request(worker, &request, payload);
+        response.detail = 0;
+        response.length = 0;
+        if (response.status == DAEMON_OK)
+        {
+            // the diagnostics travel after the output, in the same buffer
+            response.detail = (uint32_t)worker->diagnostics.count;
+            response.length = (uint64_t)worker->out.length;
+            output_write(&worker->out, (const char *)worker->diagnostics.items,
+                         worker->diagnostics.count * sizeof(Diagnostic));
+        }
+        int sent = send_exactly(fd, &response, sizeof(response), worker->out.data,
+                                response.status == DAEMON_OK ? worker->out.length : 0);
+        arena_reset(&worker->arena);
+        if (sent != 0)
+            break;
+
+        unsigned int served = __atomic_add_fetch(&requests_served, 1, __ATOMIC_RELAXED);
+        if (worker->caches && served % DAEMON_TRIM_EVERY == 0)
+            cache_trim(&worker->caches[0]);
+        // names from every client ever served would only pile up
+        if (++worker->names_served % DAEMON_TRIM_EVERY == 0)
+        {
+            intern_free(&worker->names);
+            intern_init(&worker->names, 0);
+        }
+    }
+    close(fd);
+}
+
+// Every worker blocks in accept on the same socket; the kernel hands each
+// connection to one of them
+static void *worker_main(void *ctx)
+{
+    DaemonWorker *worker = (DaemonWorker *)ctx;
+    for (;;)
+    {
+        int fd = accept(worker->listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+                continue;
+            break;
+        }
+        serve_connection(worker, fd);
+    }
+    return NULL;
+}
+
+static int listen_on(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if (socket_address(&address, socket_path) != 0)
+        return -1;
+    // a socket file nobody answers on was left by a daemon that died
+    int running = connect_to(socket_path);
+    if (running >= 0)
+    {
+        close(running);
+        return -1;
+    }
+    if (errno == ECONNREFUSED)
+        unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, DAEMON_BACKLOG) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_serve(const char *socket_path, int threads, const char *cache_dir, uint64_t cache_limit)
+{
+    Cache *caches = NULL;
+    if (cache_dir)
+    {
+        // keyed on the mode, as in batch mode; the entries share one directory
+        caches = (Cache *)calloc(OUTPUT_MODE_COUNT, sizeof(Cache));
+        if (!caches)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        for (int mode = OUTPUT_LATEX; mode < OUTPUT_MODE_COUNT; mode++)
+            if (cache_open(&caches[mode], cache_dir, cache_limit, (uint64_t)mode) != 0)
+                return -1;
+    }
+    int listener = listen_on(socket_path);
+    if (listener < 0)
+        return -1;
+
+    // the workers inherit the mask, so the signals only ever reach sigwait
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    DaemonWorker *workers = (DaemonWorker *)calloc((size_t)threads, sizeof(DaemonWorker));
+    if (!workers)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].listener = listener;
+        workers[i].caches = caches;
+        arena_init(&workers[i].arena, 64 * 1024);
+        output_init_memory(&workers[i].out);
+        intern_init(&workers[i].names, 0);
+        workers[i].names_served = 0;
+        diagnostics_init(&workers[i].diagnostics, NULL);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+    }
+    fprintf(stderr, "serving on %s with %d workers\n", socket_path, threads);
+
+    int signal_number;
+    sigwait(&stop, &signal_number);
+    // workers may be in the middle of an answer; they end with the process
+    unlink(socket_path);
+    close(listener);
+    return 0;
+}
+
+// Sends one input: stdin is read here, a path is made absolute for the
+// daemon. Returns -1, having sent nothing, if the input can't be read.
+static int send_request(int fd, const char *path, OutputMode mode)
+{
+    DaemonRequest request;
+    request.magic = DAEMON_MAGIC;
+    request.mode = (uint32_t)mode;
+    request.version = DAEMON_VERSION;
+    int sent;
+    if (strcmp(path, "-") == 0)
+    {
+        SourceBuffer source;
+        if (source_open(&source, path) != 0)
+            return -1;
+        request.input = DAEMON_SOURCE;
+        request.length = (uint64_t)source.length;
+        sent = send_exactly(fd, &request, sizeof(request), source.data, source.length);
+        source_close(&source);
+    }
+    else
+    {
+        char *absolute = realpath(path, NULL);
+        if (!absolute)
+            return -1;
+        request.input = DAEMON_PATH;
+        request.length = (uint64_t)strlen(absolute);
+        sent = send_exactly(fd, &request, sizeof(request), absolute, strlen(absolute));
+        free(absolute);
+    }
+    if (sent != 0)
+        panic(ERR_WRITE_FAILED, 0);
+    return 0;
+}
+
+// Reads an answer's output into `out` and its diagnostics into `diagnostics`
+static void receive_answer(int fd, const DaemonResponse *response, DiagnosticList *diagnostics, Output *out)
+{
+    uint64_t left = response->length;
+    while (left > 0)
+    {
+        size_t piece = left < FORWARD_READ_SIZE ? (size_t)left : FORWARD_READ_SIZE;
+        char *dst = output_reserve(out, piece);
+        if (read_exactly(fd, dst, piece) != 0)
+            panic(ERR_WRITE_FAILED, 0);
+        out->length += piece;
+        left -= piece;
+    }
+    for (uint32_t i = 0; i < response->detail; i++)
+    {
+        Diagnostic diagnostic;
+        if (read_exactly(fd, &diagnostic, sizeof(diagnostic)) != 0)
+            panic(ERR_WRITE_FAILED, 0);
+        diagnostics_append(diagnostics, &diagnostic);
+    }
+}
+
+int daemon_forward(const char *socket_path, const InputList *inputs, OutputMode mode, Output *out, size_t *errors)
+{
+    int fd = connect_to(socket_path);
+    if (fd < 0)
+        return -1;
+    // nothing is sent, stdin included, before the daemon is known to understand it
+    DaemonResponse greeting;
+    if (read_exactly(fd, &greeting, sizeof(greeting)) != 0 || greeting.status != DAEMON_OK ||
+        greeting.detail != DAEMON_VERSION)
+    {
+        close(fd);
+        return -1;
+    }
+    // reported at the end, as batch_run does
+    *errors = 0;
+    DiagnosticList *diagnostics = (DiagnosticList *)malloc((inputs->count + 1) * sizeof(DiagnosticList));
+    if (!diagnostics)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    for (size_t i = 0; i < inputs->count; i++)
+    {
+        diagnostics_init(&diagnostics[i], inputs->paths[i]);
+        batch_write_header(inputs, i, mode, out);
+        DaemonResponse response = {ERR_FILE_NOT_FOUND, 0, 0};
+        if (send_request(fd, inputs->paths[i], mode) == 0 && read_exactly(fd, &response, sizeof(response)) != 0)
+            panic(ERR_WRITE_FAILED, 0);
+        if (response.status == DAEMON_OK)
+            receive_answer(fd, &response, &diagnostics[i], out);
+        else
+        {
+            Diagnostic failure = {(ErrorCode)response.status, DIAGNOSTIC_NO_OFFSET, 0, 0};
+            diagnostics_append(&diagnostics[i], &failure);
+        }
+    }
+    close(fd);
+    for (size_t i = 0; i < inputs->count; i++)
+    {
+        diagnostics_print(stderr, &diagnostics[i]);
+        *errors += diagnostics[i].count;
+        diagnostics_free(&diagnostics[i]);
+    }
+    free(diagnostics);
+    return 0;
+}
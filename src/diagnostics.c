@@ -0,0 +1,75 @@
+#include "diagnostics.h"
+#include <stdlib.h>
+
+// Workers compile different files at once, each into its own list
+static _Thread_local DiagnosticList *captured;
+
+void diagnostics_init(DiagnosticList *list, const char *file)
+{
+    list->file = file;
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void diagnostics_free(DiagnosticList *list)
+{
+    free(list->items);
+    diagnostics_init(list, list->file);
+}
+
+DiagnosticList *diagnostics_capture(DiagnosticList *list)
+{
+    DiagnosticList *previous = captured;
+    captured = list;
+    return previous;
+}
+
+void diagnostics_append(DiagnosticList *list, const Diagnostic *diagnostic)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        Diagnostic *grown = (Diagnostic *)realloc(list->items, capacity * sizeof(Diagnostic));
+        if (!grown)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *diagnostic;
+}
+
+void diagnostic_report(ErrorCode code, uint32_t offset)
+{
+    if (!captured)
+    {
+        // without a file to look the offset up in there is no line to give
+        panic(code, 0);
+        return;
+    }
+    Diagnostic diagnostic = {code, offset, 0, 0};
+    diagnostics_append(captured, &diagnostic);
+}
+
+void diagnostics_resolve(DiagnosticList *list, size_t from, LineIndex *lines)
+{
+    for (size_t i = from; i < list->count; i++)
+    {
+        Diagnostic *diagnostic = &list->items[i];
+        if (diagnostic->offset != DIAGNOSTIC_NO_OFFSET)
+            line_index_position(lines, diagnostic->offset, &diagnostic->line, &diagnostic->column);
+    }
+}
+
+void diagnostics_print(FILE *out, const DiagnosticList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const Diagnostic *diagnostic = &list->items[i];
+        if (diagnostic->line > 0)
+            fprintf(out, "%s:%u:%u: error: %s\n", list->file, diagnostic->line, diagnostic->column,
+                    get_error_message(diagnostic->code));
+        else
+            fprintf(out, "%s: error: %s\n", list->file, get_error_message(diagnostic->code));
+    }
+}
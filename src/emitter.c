@@ -0,0 +1,409 @@
+#include "emitter.h"
+#include "scan.h"
+#include <string.h>
+
+// Columns between tab stops when tabs are expanded
+#define TAB_WIDTH 4
+// Source bytes escaped per output_reserve, and the most one of them can
+// turn into: a line's \mbox{} and reopened macro plus the longest escape,
+// each copied whole from its padded Snippet
+#define EMIT_SLICE 4096
+#define MAX_EXPANSION 64
+
+// Padded so that a copy of the whole array compiles to a few moves; only
+// `length` bytes of it are kept
+typedef struct {
+    char text[24];
+    uint8_t length;
+} Snippet;
+
+#define SNIPPET(text) {text, sizeof(text) - 1}
+#define PUT(dst, literal) (memcpy(dst, literal, sizeof(literal) - 1), (dst) + sizeof(literal) - 1)
+
+static char *put_snippet(char *dst, const Snippet *snippet)
+{
+    memcpy(dst, snippet->text, sizeof(snippet->text));
+    return dst + snippet->length;
+}
+
+typedef enum {
+    CLASS_PLAIN,
+    CLASS_KEYWORD,
+    CLASS_COMMENT,
+    CLASS_STRING,
+    CLASS_NUMBER,
+    CLASS_PREPROCESSOR,
+    CLASS_FUNCTION,
+    CLASS_COUNT
+} TokenClass;
+
+// Opening of the macro each class is wrapped in; plain text has none
+static const Snippet class_macros[CLASS_COUNT] = {
+    [CLASS_PLAIN] = SNIPPET(""),
+    [CLASS_KEYWORD] = SNIPPET("\\CKeyword{"),
+    [CLASS_COMMENT] = SNIPPET("\\CComment{"),
+    [CLASS_STRING] = SNIPPET("\\CString{"),
+    [CLASS_NUMBER] = SNIPPET("\\CNumber{"),
+    [CLASS_PREPROCESSOR] = SNIPPET("\\CPreproc{"),
+    [CLASS_FUNCTION] = SNIPPET("\\CFunction{"),
+};
+
+static const char PREAMBLE[] = "\\providecommand{\\CKeyword}[1]{\\textbf{#1}}\n"
+                               "\\providecommand{\\CComment}[1]{\\textit{#1}}\n"
+                               "\\providecommand{\\CString}[1]{#1}\n"
+                               "\\providecommand{\\CNumber}[1]{#1}\n"
+                               "\\providecommand{\\CPreproc}[1]{\\textsl{#1}}\n"
+                               "\\providecommand{\\CFunction}[1]{#1}\n"
+                               "\\begin{flushleft}\\ttfamily\n";
+static const char POSTAMBLE[] = "\\end{flushleft}\n";
+
+// What LaTeX needs in place of the characters it treats specially. Spaces
+// are control spaces so runs of them survive.
+static const Snippet escapes[256] = {
+    ['\\'] = SNIPPET("\\textbackslash{}"),
+    ['{'] = SNIPPET("\\{"),
+    ['}'] = SNIPPET("\\}"),
+    ['$'] = SNIPPET("\\$"),
+    ['&'] = SNIPPET("\\&"),
+    ['#'] = SNIPPET("\\#"),
+    ['%'] = SNIPPET("\\%"),
+    ['_'] = SNIPPET("\\_"),
+    ['^'] = SNIPPET("\\textasciicircum{}"),
+    ['~'] = SNIPPET("\\textasciitilde{}"),
+    [' '] = SNIPPET("\\ "),
+};
+
+typedef struct {
+    Output *out;
+    const char *source_end; // runs are copied 16 bytes at a time while the source lasts
+    const Snippet *macro;   // of the token being written, NULL between tokens
+    int macro_open;         // the macro's '{' is out on the current line
+    int line_empty;
+    uint32_t column;        // for tab stops
+} Emitter;
+
+// Runs before anything is written on a line, and before each piece of a token
+static char *begin_content(Emitter *e, char *dst, unsigned char first)
+{
+    if (e->line_empty)
+    {
+        e->line_empty = 0;
+        // glue right after a line break is dropped, a box in front keeps
+        // the indentation; and \\ would take a leading [ or * as its argument
+        if (first == ' ' || first == '\t')
+            dst = PUT(dst, "\\mbox{}");
+        else if (!e->macro && (first == '[' || first == '*'))
+            dst = PUT(dst, "{}");
+    }
+    if (e->macro && !e->macro_open)
+    {
+        dst = put_snippet(dst, e->macro);
+        e->macro_open = 1;
+    }
+    return dst;
+}
+
+// A macro can't span lines, so one open on this line is closed here and
+// reopened on the next
+static char *end_line(Emitter *e, char *dst)
+{
+    if (e->macro_open)
+    {
+        *dst++ = '}';
+        e->macro_open = 0;
+    }
+    if (e->line_empty)
+        dst = PUT(dst, "\\mbox{}");
+    e->line_empty = 1;
+    e->column = 0;
+    return PUT(dst, "\\\\\n");
+}
+
+static char *copy_run(Emitter *e, char *dst, const unsigned char *run, const unsigned char *end)
+{
+    size_t length = (size_t)(end - run);
+    dst = begin_content(e, dst, *run);
+    if (length <= 16 && (const char *)run + 16 <= e->source_end)
+        memcpy(dst, run, 16);
+    else
+        memcpy(dst, run, length);
+    e->column += (uint32_t)length;
+    return dst + length;
+}
+
+static char *escape_byte(Emitter *e, char *dst, unsigned char c)
+{
+    switch (c)
+    {
+    case '\n':
+        return end_line(e, dst);
+    case '\r':
+        return dst;
+    case '\t':
+    {
+        dst = begin_content(e, dst, c);
+        uint32_t spaces = TAB_WIDTH - e->column % TAB_WIDTH;
+        for (uint32_t i = 0; i < spaces; i++)
+            dst = PUT(dst, "\\ ");
+        e->column += spaces;
+        return dst;
+    }
+    default:
+        dst = begin_content(e, dst, c);
+        e->column++;
+        return put_snippet(dst, &escapes[c]);
+    }
+}
+
+// Escapes up to EMIT_SLICE bytes into `dst`, which has room for MAX_EXPANSION
+// bytes out per byte in. The input is classified 32 bytes at a time and only
+// the bytes flagged in the mask are looked at; the runs between them are
+// copied whole.
+static char *escape_slice(Emitter *e, char *dst, const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *run = p;
+    while (p < end)
+    {
+        size_t block = (size_t)(end - p) < 32 ? (size_t)(end - p) : 32;
+        uint32_t mask;
+        if ((const char *)p + 32 <= e->source_end)
+            mask = scan_latex_mask((const char *)p);
+        else
+        {
+            // the last bytes of the source, padded with bytes that are never special
+            char padded[32] = {0};
+            memcpy(padded, p, block);
+            mask = scan_latex_mask(padded);
+        }
+        if (block < 32)
+            mask &= (1u << block) - 1;
+        while (mask)
+        {
+            const unsigned char *hit = p + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (hit > run)
+                dst = copy_run(e, dst, run, hit);
+            dst = escape_byte(e, dst, *hit);
+            run = hit + 1;
+        }
+        p += block;
+    }
+    if (end > run)
+        dst = copy_run(e, dst, run, end);
+    return dst;
+}
+
+// Source text of any length, escaped EMIT_SLICE bytes at a time
+static void emit_text(Emitter *e, const char *text, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    while (length > 0)
+    {
+        size_t slice = length < EMIT_SLICE ? length : EMIT_SLICE;
+        char *dst = output_reserve(e->out, slice * MAX_EXPANSION);
+        dst = escape_slice(e, dst, p, p + slice);
+        e->out->length = (size_t)(dst - e->out->data);
+        p += slice;
+        length -= slice;
+    }
+}
+
+void emit_escaped(Output *out, const char *text, size_t length)
+{
+    Emitter e = {out, text + length, NULL, 0, 0, 0};
+    emit_text(&e, text, length);
+}
+
+static void close_macro(Emitter *e)
+{
+    if (e->macro_open)
+    {
+        output_char(e->out, '}');
+        e->macro_open = 0;
+    }
+    e->macro = NULL;
+}
+
+// The whitespace before a token and the token itself. The usual short pair
+// is escaped straight into one reservation.
+static void emit_token(Emitter *e, const char *gap, const char *text, size_t length, TokenClass token_class)
+{
+    const Snippet *macro = token_class == CLASS_PLAIN ? NULL : &class_macros[token_class];
+    size_t total = (size_t)(text - gap) + length;
+    if (total > EMIT_SLICE)
+    {
+        emit_text(e, gap, (size_t)(text - gap));
+        e->macro = macro;
+        emit_text(e, text, length);
+        close_macro(e);
+        return;
+    }
+    char *dst = output_reserve(e->out, total * MAX_EXPANSION + 1);
+    const unsigned char *p = (const unsigned char *)text;
+    // mostly a single space between two tokens on a line
+    if (p - (const unsigned char *)gap == 1 && *gap == ' ' && !e->line_empty)
+    {
+        dst = PUT(dst, "\\ ");
+        e->column++;
+    }
+    else
+        dst = escape_slice(e, dst, (const unsigned char *)gap, p);
+    e->macro = macro;
+    dst = escape_slice(e, dst, p, p + length);
+    if (e->macro_open)
+    {
+        *dst++ = '}';
+        e->macro_open = 0;
+    }
+    e->macro = NULL;
+    e->out->length = (size_t)(dst - e->out->data);
+}
+
+static TokenClass lexical_class(TokenType type)
+{
+    if (token_is_keyword(type))
+        return CLASS_KEYWORD;
+    switch (type)
+    {
+    case TOKEN_COMMENT:
+        return CLASS_COMMENT;
+    case TOKEN_STRING_LITERAL:
+    case TOKEN_CHAR_LITERAL:
+        return CLASS_STRING;
+    case TOKEN_INT_LITERAL:
+    case TOKEN_FLOAT_LITERAL:
+        return CLASS_NUMBER;
+    case TOKEN_PREPROCESSOR:
+        return CLASS_PREPROCESSOR;
+    default:
+        return CLASS_PLAIN;
+    }
+}
+
+void mark_function_names(const Ast *ast, uint8_t *functions)
+{
+    for (NodeId id = 1; id < ast->used; id = ast_next(ast, id))
+    {
+        const ASTNode *node = ast_node(ast, id);
+        NodeId name;
+        if (node->type == AST_DECLARATOR && (node->flags & AST_FLAG_FUNCTION))
+            name = node->children[0];
+        else if (node->type == AST_CALL)
+            name = node->children[0];
+        else
+            continue;
+        if (name != AST_NONE && ast_node(ast, name)->type == AST_IDENTIFIER)
+            functions[ast_node(ast, name)->first_token] = 1;
+    }
+}
+
+void emit_preamble(Output *out)
+{
+    output_write(out, PREAMBLE, sizeof(PREAMBLE) - 1);
+}
+
+void emit_postamble(Output *out, const EmitPosition *position)
+{
+    if (!position->line_empty)
+        output_char(out, '\n');
+    output_write(out, POSTAMBLE, sizeof(POSTAMBLE) - 1);
+}
+
+void emit_tokens(Output *out, const TokenList *tokens, const uint8_t *functions, uint32_t first, uint32_t end,
+                 EmitPosition *position)
+{
+    Emitter e = {out, tokens->source + tokens->source_length, NULL, 0, (int)position->line_empty, position->column};
+
+    // tokens cover every lexeme, comments and directives included, so what
+    // lies between two of them is whitespace
+    const char *source = tokens->source;
+    size_t gap = 0;
+    if (first > 0)
+    {
+        Token previous;
+        token_at(tokens, first - 1, &previous);
+        gap = (size_t)previous.offset + previous.length;
+    }
+    for (const TokenChunk *chunk = tokens->head; chunk && chunk->first < end; chunk = chunk->next)
+    {
+        if (chunk->first + chunk->count <= first)
+            continue;
+        uint32_t i = first > chunk->first ? first - chunk->first : 0;
+        uint32_t stop = end - chunk->first < chunk->count ? end - chunk->first : chunk->count;
+        const uint8_t *chunk_functions = functions + chunk->first;
+        for (; i < stop; i++)
+        {
+            uint32_t offset = chunk->offsets[i];
+            TokenClass token_class =
+                chunk_functions[i] ? CLASS_FUNCTION : lexical_class((TokenType)chunk->types[i]);
+            emit_token(&e, source + gap, source + offset, chunk->lengths[i], token_class);
+            gap = (size_t)offset + chunk->lengths[i];
+        }
+    }
+    if (end == tokens->count)
+        emit_text(&e, source + gap, tokens->source_length - gap);
+    position->column = e.column;
+    position->line_empty = (uint32_t)e.line_empty;
+}
+
+void highlight_begin(Highlighter *h, Output *out, const char *source, size_t length)
+{
+    h->out = out;
+    h->source = source;
+    h->length = length;
+    h->gap = 0;
+    h->position = EMIT_START;
+    h->pending = 0;
+    emit_preamble(out);
+}
+
+static void highlight_write(Highlighter *h, uint32_t offset, uint32_t length, TokenClass token_class)
+{
+    Emitter e = {h->out, h->source + h->length, NULL, 0, (int)h->position.line_empty, h->position.column};
+    emit_token(&e, h->source + h->gap, h->source + offset, length, token_class);
+    h->gap = offset + length;
+    h->position.column = e.column;
+    h->position.line_empty = (uint32_t)e.line_empty;
+}
+
+void highlight_token(Highlighter *h, TokenType type, uint32_t offset, uint32_t length)
+{
+    if (h->pending)
+    {
+        h->pending = 0;
+        highlight_write(h, h->pending_offset, h->pending_length,
+                        type == TOKEN_PAREN_OPEN ? CLASS_FUNCTION : CLASS_PLAIN);
+    }
+    if (type == TOKEN_IDENTIFIER)
+    {
+        h->pending = 1;
+        h->pending_offset = offset;
+        h->pending_length = length;
+        return;
+    }
+    highlight_write(h, offset, length, lexical_class(type));
+}
+
+void highlight_end(Highlighter *h)
+{
+    if (h->pending)
+        highlight_write(h, h->pending_offset, h->pending_length, CLASS_PLAIN);
+    Emitter e = {h->out, h->source + h->length, NULL, 0, (int)h->position.line_empty, h->position.column};
+    emit_text(&e, h->source + h->gap, h->length - h->gap);
+    h->position.column = e.column;
+    h->position.line_empty = (uint32_t)e.line_empty;
+    emit_postamble(h->out, &h->position);
+}
+
+void emit_latex(Output *out, const Ast *ast)
+{
+    const TokenList *tokens = ast->tokens;
+    uint32_t count = tokens->count;
+    uint8_t *functions = (uint8_t *)arena_alloc(ast->arena, count ? count : 1);
+    memset(functions, 0, count);
+    mark_function_names(ast, functions);
+    EmitPosition position = EMIT_START;
+    emit_preamble(out);
+    emit_tokens(out, tokens, functions, 0, count, &position);
+    emit_postamble(out, &position);
+}
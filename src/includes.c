@@ -0,0 +1,524 @@
+#include "includes.h"
+#include "arena.h"
+#include "cache.h"
+#include "diagnostics.h"
+#include "errors.h"
+#include "lexer.h"
+#include "source.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Includes nested deeper than this are taken for a runaway and not followed
+#define MAX_INCLUDE_DEPTH 64
+// The path table is chained, so this only sets how long the chains get
+#define HEADER_BUCKETS 256
+
+typedef struct {
+    const char *name; // as written between the quotes or brackets
+    int angled;
+} IncludeLine;
+
+// What the includes need from one header
+typedef struct HeaderEntry {
+    struct HeaderEntry *next; // in its bucket, newest first
+    const char *path;         // canonical
+    uint64_t mtime[2];        // seconds, nanoseconds
+    uint64_t stamp;           // hash of the path and the time
+    pthread_mutex_t load;     // held by the one thread reading the header
+    int loaded;
+    int once;                 // #pragma once
+    uint32_t guard;           // ID of the guard macro, INTERN_NONE without one
+    uint32_t *types;          // IDs of the typedef names
+    uint32_t type_count;
+    IncludeLine *includes;
+    uint32_t include_count;
+} HeaderEntry;
+
+struct HeaderCache {
+    const char *const *dirs;
+    size_t dir_count;
+    InternTable *names;
+    pthread_mutex_t lock; // the buckets and the arena
+    HeaderEntry *buckets[HEADER_BUCKETS];
+    Arena arena;          // the entries and all they hold
+};
+
+HeaderCache *header_cache_open(const char *const *dirs, size_t dir_count, InternTable *names)
+{
+    HeaderCache *cache = (HeaderCache *)calloc(1, sizeof(HeaderCache));
+    if (!cache)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    cache->dirs = dirs;
+    cache->dir_count = dir_count;
+    cache->names = names;
+    pthread_mutex_init(&cache->lock, NULL);
+    arena_init(&cache->arena, 64 * 1024);
+    return cache;
+}
+
+void header_cache_close(HeaderCache *cache)
+{
+    for (size_t i = 0; i < HEADER_BUCKETS; i++)
+        for (HeaderEntry *entry = cache->buckets[i]; entry; entry = entry->next)
+            pthread_mutex_destroy(&entry->load);
+    pthread_mutex_destroy(&cache->lock);
+    arena_free(&cache->arena);
+    free(cache);
+}
+
+// ---- reading a header ----
+
+// A directive split after its '#': the name, e.g. "include", and the rest of the line
+typedef struct {
+    const char *name;
+    size_t name_length;
+    const char *rest;
+    const char *end;
+} Directive;
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static const char *skip_word(const char *p, const char *end)
+{
+    while (p < end && (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')))
+        p++;
+    return p;
+}
+
+static void split_directive(const char *text, size_t length, Directive *directive)
+{
+    const char *end = text + length;
+    const char *p = skip_blanks(text + 1, end);
+    directive->name = p;
+    p = skip_word(p, end);
+    directive->name_length = (size_t)(p - directive->name);
+    directive->rest = skip_blanks(p, end);
+    directive->end = end;
+}
+
+static int directive_is(const Directive *directive, const char *name)
+{
+    return directive->name_length == strlen(name) && memcmp(directive->name, name, directive->name_length) == 0;
+}
+
+// The macro an #ifndef X, #if !defined X or #if !defined(X) tests, as an
+// ID; INTERN_NONE for any other condition
+static uint32_t guard_macro(HeaderCache *cache, const Directive *directive)
+{
+    const char *p = directive->rest;
+    const char *end = directive->end;
+    int parens = 0;
+    if (directive_is(directive, "if"))
+    {
+        if (p == end || *p != '!')
+            return INTERN_NONE;
+        p = skip_blanks(p + 1, end);
+        const char *word = p;
+        p = skip_word(p, end);
+        if (p - word != 7 || memcmp(word, "defined", 7) != 0)
+            return INTERN_NONE;
+        p = skip_blanks(p, end);
+        if (p < end && *p == '(')
+        {
+            parens = 1;
+            p = skip_blanks(p + 1, end);
+        }
+    }
+    else if (!directive_is(directive, "ifndef"))
+        return INTERN_NONE;
+    const char *macro = p;
+    p = skip_word(p, end);
+    if (p == macro)
+        return INTERN_NONE;
+    uint32_t id = intern(cache->names, macro, (size_t)(p - macro));
+    p = skip_blanks(p, end);
+    if (parens)
+    {
+        if (p == end || *p != ')')
+            return INTERN_NONE;
+        p = skip_blanks(p + 1, end);
+    }
+    // a comment may close the line, anything else makes it another condition
+    return p == end || *p == '/' || *p == '\r' || *p == '\n' ? id : INTERN_NONE;
+}
+
+// The name of an #include "name" or <name>; 0 for a computed include
+static int include_line(Arena *arena, const Directive *directive, IncludeLine *line)
+{
+    const char *p = directive->rest;
+    if (p == directive->end || (*p != '"' && *p != '<'))
+        return 0;
+    char close = *p == '"' ? '"' : '>';
+    const char *name = p + 1;
+    const char *name_end = (const char *)memchr(name, close, (size_t)(directive->end - name));
+    if (!name_end || name_end == name)
+        return 0;
+    line->name = arena_strndup(arena, name, (size_t)(name_end - name));
+    line->angled = close == '>';
+    return 1;
+}
+
+static void push_id(Arena *arena, uint32_t **ids, uint32_t *count, uint32_t *capacity, uint32_t id)
+{
+    if (*count == *capacity)
+    {
+        uint32_t grown = *capacity ? *capacity * 2 : 16;
+        *ids = (uint32_t *)arena_realloc(arena, *ids, *capacity * sizeof(uint32_t), grown * sizeof(uint32_t));
+        *capacity = grown;
+    }
+    (*ids)[(*count)++] = id;
+}
+
+static void push_include(Arena *arena, HeaderEntry *entry, uint32_t *capacity, const IncludeLine *line)
+{
+    if (entry->include_count == *capacity)
+    {
+        uint32_t grown = *capacity ? *capacity * 2 : 8;
+        entry->includes = (IncludeLine *)arena_realloc(arena, entry->includes, *capacity * sizeof(IncludeLine),
+                                                       grown * sizeof(IncludeLine));
+        *capacity = grown;
+    }
+    entry->includes[entry->include_count++] = *line;
+}
+
+/*
+The name a typedef declares is the last identifier outside brackets before
+the ',' or ';' that ends its declarator, as in typedef struct {...} T, *PT;
+or the first one right after a '(' and some '*', as in typedef int (*F)(int).
+Braces are counted outside typedefs too: one in the body of an inline
+function is local, and not looked at.
+*/
+typedef struct {
+    int in_typedef;
+    uint32_t braces;  // outside a typedef: depth in the file; inside: in its struct body
+    uint32_t nesting; // () and [] inside the typedef
+    int after_paren;  // 1 after '(', 2 after '(' and one or more '*'
+    uint32_t name;    // the name so far
+    int name_final;
+} TypedefScan;
+
+static void scan_typedef(HeaderCache *cache, TypedefScan *scan, const TokenList *tokens, const Token *tok,
+                         Arena *arena, HeaderEntry *entry, uint32_t *capacity)
+{
+    const char *text = tokens->source + tok->offset;
+    int star = tok->length == 1 && *text == '*';
+    if (!scan->in_typedef)
+    {
+        if (tok->type == TOKEN_BRACE_OPEN)
+            scan->braces++;
+        else if (tok->type == TOKEN_BRACE_CLOSE && scan->braces > 0)
+            scan->braces--;
+        else if (tok->type == TOKEN_KW_TYPEDEF && scan->braces == 0)
+        {
+            memset(scan, 0, sizeof(*scan));
+            scan->in_typedef = 1;
+        }
+        return;
+    }
+    if (tok->type == TOKEN_BRACE_OPEN || tok->type == TOKEN_BRACE_CLOSE || scan->braces > 0)
+    {
+        if (tok->type == TOKEN_BRACE_OPEN)
+            scan->braces++;
+        else if (tok->type == TOKEN_BRACE_CLOSE && scan->braces > 0)
+            scan->braces--;
+        return;
+    }
+    if (tok->type == TOKEN_IDENTIFIER && !scan->name_final &&
+        (scan->nesting == 0 || scan->after_paren == 2) && !(tok->length > 11 && memcmp(text, "__attribute", 11) == 0))
+    {
+        scan->name = intern(cache->names, text, tok->length);
+        scan->name_final = scan->after_paren == 2;
+    }
+    else if (tok->type == TOKEN_PAREN_OPEN || tok->type == TOKEN_BRACKET_OPEN)
+        scan->nesting++;
+    else if ((tok->type == TOKEN_PAREN_CLOSE || tok->type == TOKEN_BRACKET_CLOSE) && scan->nesting > 0)
+        scan->nesting--;
+    else if (scan->nesting == 0 && (tok->type == TOKEN_COMMA || tok->type == TOKEN_SEMICOLON))
+    {
+        if (scan->name != INTERN_NONE)
+            push_id(arena, &entry->types, &entry->type_count, capacity, scan->name);
+        scan->name = INTERN_NONE;
+        scan->name_final = 0;
+        scan->in_typedef = tok->type == TOKEN_COMMA;
+    }
+    scan->after_paren = tok->type == TOKEN_PAREN_OPEN ? 1 : star && scan->after_paren ? 2 : 0;
+}
+
+// Fills `entry` from the header's tokens, allocating in `arena`
+static void summarize(HeaderCache *cache, const TokenList *tokens, Arena *arena, HeaderEntry *entry)
+{
+    uint32_t type_capacity = 0;
+    uint32_t include_capacity = 0;
+    TypedefScan scan;
+    memset(&scan, 0, sizeof(scan));
+    // a guard is an #ifndef X first and a #define X second, whose #endif is last
+    uint32_t significant = 0;
+    uint32_t guard = INTERN_NONE;
+    uint32_t depth = 0;
+    int guard_closed = 0;
+    int guard_broken = 0;
+
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    while (cursor_next(&cursor, &tok))
+    {
+        if (tok.type == TOKEN_COMMENT)
+            continue;
+        significant++;
+        if (guard_closed)
+            guard_broken = 1;
+        if (tok.type != TOKEN_PREPROCESSOR)
+        {
+            scan_typedef(cache, &scan, tokens, &tok, arena, entry, &type_capacity);
+            continue;
+        }
+        Directive directive;
+        split_directive(tokens->source + tok.offset, tok.length, &directive);
+        IncludeLine line;
+        if (directive_is(&directive, "include"))
+        {
+            if (include_line(arena, &directive, &line))
+                push_include(arena, entry, &include_capacity, &line);
+        }
+        else if (directive_is(&directive, "pragma"))
+        {
+            const char *word = directive.rest;
+            if (skip_word(word, directive.end) - word == 4 && memcmp(word, "once", 4) == 0)
+                entry->once = 1;
+        }
+        else if (directive_is(&directive, "if") || directive_is(&directive, "ifdef") ||
+                 directive_is(&directive, "ifndef"))
+        {
+            if (significant == 1)
+                guard = guard_macro(cache, &directive);
+            depth++;
+        }
+        else if (directive_is(&directive, "endif") && depth > 0)
+        {
+            if (--depth == 0)
+                guard_closed = 1;
+        }
+        else if ((directive_is(&directive, "else") || directive_is(&directive, "elif")) && depth == 1)
+            guard_broken = 1;
+        else if (directive_is(&directive, "define") && significant == 2)
+        {
+            const char *macro = directive.rest;
+            const char *macro_end = skip_word(macro, directive.end);
+            if (guard == INTERN_NONE || macro_end == macro ||
+                intern(cache->names, macro, (size_t)(macro_end - macro)) != guard)
+                guard_broken = 1;
+        }
+        if (significant == 2 && !directive_is(&directive, "define"))
+            guard_broken = 1;
+    }
+    if (significant < 2 || !guard_closed || guard_broken)
+        guard = INTERN_NONE;
+    entry->guard = guard;
+}
+
+// Reads and lexes the header; a header that can't be read stays empty
+static void load_entry(HeaderCache *cache, HeaderEntry *entry)
+{
+    Arena scratch;
+    arena_init(&scratch, 64 * 1024);
+    // the lexer would report the header's errors in the file including it
+    DiagnosticList ignored;
+    diagnostics_init(&ignored, entry->path);
+    DiagnosticList *previous = diagnostics_capture(&ignored);
+    const SourceBuffer *source = source_open_in(&scratch, entry->path);
+    if (source)
+    {
+        TokenList *tokens = lex_buffer(&scratch, source->data, source->length);
+        HeaderEntry summary;
+        memset(&summary, 0, sizeof(summary));
+        summarize(cache, tokens, &scratch, &summary);
+
+        // copied out of the scratch arena into the cache's
+        pthread_mutex_lock(&cache->lock);
+        entry->once = summary.once;
+        entry->guard = summary.guard;
+        entry->type_count = summary.type_count;
+        entry->types = (uint32_t *)arena_alloc(&cache->arena, (summary.type_count + 1) * sizeof(uint32_t));
+        if (summary.type_count > 0)
+            memcpy(entry->types, summary.types, summary.type_count * sizeof(uint32_t));
+        entry->include_count = summary.include_count;
+        entry->includes =
+            (IncludeLine *)arena_alloc(&cache->arena, (summary.include_count + 1) * sizeof(IncludeLine));
+        for (uint32_t i = 0; i < summary.include_count; i++)
+        {
+            entry->includes[i].name =
+                arena_strndup(&cache->arena, summary.includes[i].name, strlen(summary.includes[i].name));
+            entry->includes[i].angled = summary.includes[i].angled;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    diagnostics_capture(previous);
+    diagnostics_free(&ignored);
+    arena_free(&scratch);
+}
+
+// The entry of the header at canonical `path`, as it is on disk now. The
+// first thread to ask for it loads it, the others wait for that.
+static HeaderEntry *find_entry(HeaderCache *cache, const char *path, const struct stat *st)
+{
+    uint64_t path_hash = cache_hash(path, strlen(path), 0);
+    uint64_t mtime[2] = {(uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec};
+    pthread_mutex_lock(&cache->lock);
+    HeaderEntry **bucket = &cache->buckets[path_hash % HEADER_BUCKETS];
+    HeaderEntry *entry = *bucket;
+    while (entry && (memcmp(entry->mtime, mtime, sizeof(mtime)) != 0 || strcmp(entry->path, path) != 0))
+        entry = entry->next;
+    if (!entry)
+    {
+        // one that changed on disk gets a new entry; the old one may still be in use
+        entry = (HeaderEntry *)arena_alloc(&cache->arena, sizeof(HeaderEntry));
+        memset(entry, 0, sizeof(*entry));
+        entry->path = arena_strndup(&cache->arena, path, strlen(path));
+        memcpy(entry->mtime, mtime, sizeof(mtime));
+        entry->stamp = cache_hash(mtime, sizeof(mtime), path_hash);
+        pthread_mutex_init(&entry->load, NULL);
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    pthread_mutex_lock(&entry->load);
+    if (!entry->loaded)
+    {
+        load_entry(cache, entry);
+        entry->loaded = 1;
+    }
+    pthread_mutex_unlock(&entry->load);
+    return entry;
+}
+
+// ---- following the includes of one file ----
+
+typedef struct {
+    HeaderCache *cache;
+    Arena *arena; // the file's
+    InternSet types;
+    uint32_t type_capacity;
+    const HeaderEntry **closed; // guarded headers already walked
+    uint32_t closed_count;
+    uint32_t closed_capacity;
+    const HeaderEntry *stack[MAX_INCLUDE_DEPTH];
+    uint32_t depth;
+    uint64_t stamp;
+} IncludeWalk;
+
+// Canonical path of `name` in `dir` (of `dir_length` bytes, 0 for the working directory)
+static int try_path(const char *dir, size_t dir_length, const char *name, char *resolved, struct stat *st)
+{
+    char candidate[PATH_MAX];
+    size_t name_length = strlen(name);
+    if (name[0] == '/')
+        dir_length = 0;
+    if (dir_length + name_length + 2 > sizeof(candidate))
+        return 0;
+    size_t at = 0;
+    if (dir_length > 0)
+    {
+        memcpy(candidate, dir, dir_length);
+        at = dir_length;
+        if (candidate[at - 1] != '/')
+            candidate[at++] = '/';
+    }
+    memcpy(candidate + at, name, name_length + 1);
+    return stat(candidate, st) == 0 && S_ISREG(st->st_mode) && realpath(candidate, resolved) != NULL;
+}
+
+static void walk_header(IncludeWalk *walk, const HeaderEntry *entry);
+
+// Follows one include of a file in `dir`
+static void walk_line(IncludeWalk *walk, const char *dir, size_t dir_length, const IncludeLine *line)
+{
+    char resolved[PATH_MAX];
+    struct stat st;
+    int found = !line->angled && try_path(dir, dir_length, line->name, resolved, &st);
+    for (size_t i = 0; !found && i < walk->cache->dir_count; i++)
+        found = try_path(walk->cache->dirs[i], strlen(walk->cache->dirs[i]), line->name, resolved, &st);
+    if (found)
+        walk_header(walk, find_entry(walk->cache, resolved, &st));
+}
+
+static size_t dir_length_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) + (slash == path) : 0;
+}
+
+static void walk_header(IncludeWalk *walk, const HeaderEntry *entry)
+{
+    for (uint32_t i = 0; i < walk->closed_count; i++)
+    {
+        const HeaderEntry *closed = walk->closed[i];
+        if (closed == entry || (entry->guard != INTERN_NONE && closed->guard == entry->guard))
+            return;
+    }
+    for (uint32_t i = 0; i < walk->depth; i++)
+        if (walk->stack[i] == entry)
+            return;
+    if (walk->depth == MAX_INCLUDE_DEPTH)
+        return;
+    if (entry->once || entry->guard != INTERN_NONE)
+    {
+        if (walk->closed_count == walk->closed_capacity)
+        {
+            uint32_t grown = walk->closed_capacity ? walk->closed_capacity * 2 : 16;
+            walk->closed = (const HeaderEntry **)arena_realloc(walk->arena, walk->closed,
+                                                               walk->closed_capacity * sizeof(HeaderEntry *),
+                                                               grown * sizeof(HeaderEntry *));
+            walk->closed_capacity = grown;
+        }
+        walk->closed[walk->closed_count++] = entry;
+    }
+    walk->stamp = cache_hash(&entry->stamp, sizeof(entry->stamp), walk->stamp);
+    for (uint32_t i = 0; i < entry->type_count; i++)
+        push_id(walk->arena, &walk->types.ids, &walk->types.count, &walk->type_capacity, entry->types[i]);
+
+    walk->stack[walk->depth++] = entry;
+    size_t dir_length = dir_length_of(entry->path);
+    for (uint32_t i = 0; i < entry->include_count; i++)
+        walk_line(walk, entry->path, dir_length, &entry->includes[i]);
+    walk->depth--;
+}
+
+uint64_t include_resolve(HeaderCache *cache, const char *path, TokenList *tokens)
+{
+    IncludeWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.cache = cache;
+    walk.arena = tokens->arena;
+    // stdin includes from the working directory
+    size_t dir_length = strcmp(path, "-") == 0 ? 0 : dir_length_of(path);
+
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    while (cursor_next(&cursor, &tok))
+    {
+        if (tok.type != TOKEN_PREPROCESSOR)
+            continue;
+        Directive directive;
+        split_directive(tokens->source + tok.offset, tok.length, &directive);
+        IncludeLine line;
+        if (directive_is(&directive, "include") && include_line(tokens->arena, &directive, &line))
+            walk_line(&walk, path, dir_length, &line);
+    }
+
+    InternSet *types = (InternSet *)arena_alloc(tokens->arena, sizeof(InternSet));
+    *types = walk.types;
+    intern_set_sort(types);
+    tokens->types = types;
+    return walk.stamp;
+}
@@ -0,0 +1,202 @@
+#include "intern.h"
+#include "arena.h"
+#include "errors.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 1024
+
+typedef struct {
+    const char *text; // in the shard's arena
+    uint32_t length;
+    uint32_t hash;
+} InternEntry;
+
+// Open addressing with linear probing. A slot holds an entry index, 0 when
+// empty, and the table is kept at most half full so probes stay short.
+struct InternShard {
+    pthread_mutex_t lock;
+    Arena keys;
+    uint32_t *slots;
+    uint32_t slot_mask;
+    InternEntry *entries; // by index, 0 unused
+    uint32_t count;       // entries, the unused one included
+    uint32_t capacity;
+};
+
+// Eight bytes at a time: identifiers are short, and most fit in one or two
+static uint32_t hash_name(const char *text, size_t length)
+{
+    uint64_t h = 0x9e3779b97f4a7c15u ^ (uint64_t)length;
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, text, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdu;
+        h ^= h >> 32;
+        text += 8;
+        length -= 8;
+    }
+    if (length > 0)
+    {
+        // byte by byte, as a memcpy of a length only known here is a call
+        uint64_t word = 0;
+        for (size_t i = 0; i < length; i++)
+            word |= (uint64_t)(unsigned char)text[i] << (i * 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdu;
+    }
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+static void shard_init(InternShard *shard)
+{
+    pthread_mutex_init(&shard->lock, NULL);
+    arena_init(&shard->keys, 64 * 1024);
+    shard->slots = (uint32_t *)calloc(INITIAL_SLOTS, sizeof(uint32_t));
+    shard->entries = (InternEntry *)malloc(INITIAL_SLOTS / 2 * sizeof(InternEntry));
+    if (!shard->slots || !shard->entries)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    shard->slot_mask = INITIAL_SLOTS - 1;
+    shard->count = 1;
+    shard->capacity = INITIAL_SLOTS / 2;
+}
+
+static void shard_free(InternShard *shard)
+{
+    pthread_mutex_destroy(&shard->lock);
+    arena_free(&shard->keys);
+    free(shard->slots);
+    free(shard->entries);
+}
+
+// Doubles the slots, and with them the room for entries
+static void shard_grow(InternShard *shard)
+{
+    uint32_t slot_count = (shard->slot_mask + 1) * 2;
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    InternEntry *entries = (InternEntry *)realloc(shard->entries, slot_count / 2 * sizeof(InternEntry));
+    if (!slots || !entries)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    shard->entries = entries;
+    shard->capacity = slot_count / 2;
+    for (uint32_t index = 1; index < shard->count; index++)
+    {
+        uint32_t slot = entries[index].hash & (slot_count - 1);
+        while (slots[slot])
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = index;
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->slot_mask = slot_count - 1;
+}
+
+static uint32_t shard_intern(InternShard *shard, const char *text, size_t length, uint32_t hash)
+{
+    uint32_t slot = hash & shard->slot_mask;
+    for (uint32_t index; (index = shard->slots[slot]) != 0; slot = (slot + 1) & shard->slot_mask)
+    {
+        const InternEntry *entry = &shard->entries[index];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0)
+            return index;
+    }
+    if (shard->count == shard->capacity)
+    {
+        shard_grow(shard);
+        slot = hash & shard->slot_mask;
+        while (shard->slots[slot])
+            slot = (slot + 1) & shard->slot_mask;
+    }
+    uint32_t index = shard->count++;
+    InternEntry *entry = &shard->entries[index];
+    entry->text = arena_strndup(&shard->keys, text, length);
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
+    shard->slots[slot] = index;
+    return index;
+}
+
+void intern_init(InternTable *table, int shared)
+{
+    table->shard_bits = shared ? INTERN_SHARD_BITS : 0;
+    uint32_t shard_count = 1u << table->shard_bits;
+    table->shards = (InternShard *)malloc(shard_count * sizeof(InternShard));
+    if (!table->shards)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    for (uint32_t i = 0; i < shard_count; i++)
+        shard_init(&table->shards[i]);
+}
+
+void intern_free(InternTable *table)
+{
+    for (uint32_t i = 0; i < (1u << table->shard_bits); i++)
+        shard_free(&table->shards[i]);
+    free(table->shards);
+    table->shards = NULL;
+}
+
+// An ID is the entry's index in its shard, shifted to make room for the shard
+uint32_t intern(InternTable *table, const char *text, size_t length)
+{
+    uint32_t hash = hash_name(text, length);
+    if (table->shard_bits == 0)
+        return shard_intern(table->shards, text, length, hash);
+    // the top bits pick the shard, so the slot bits stay independent of them
+    uint32_t shard_index = hash >> (32 - table->shard_bits);
+    InternShard *shard = &table->shards[shard_index];
+    pthread_mutex_lock(&shard->lock);
+    uint32_t index = shard_intern(shard, text, length, hash);
+    pthread_mutex_unlock(&shard->lock);
+    return index << table->shard_bits | shard_index;
+}
+
+const char *intern_text(InternTable *table, uint32_t id, size_t *length)
+{
+    InternShard *shard = &table->shards[id & ((1u << table->shard_bits) - 1)];
+    uint32_t index = id >> table->shard_bits;
+    // entries move when a shard grows
+    if (table->shard_bits)
+        pthread_mutex_lock(&shard->lock);
+    const InternEntry *entry = &shard->entries[index];
+    const char *text = entry->text;
+    *length = entry->length;
+    if (table->shard_bits)
+        pthread_mutex_unlock(&shard->lock);
+    return text;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void intern_set_sort(InternSet *set)
+{
+    if (set->count == 0)
+        return;
+    qsort(set->ids, set->count, sizeof(uint32_t), compare_ids);
+    uint32_t kept = 1;
+    for (uint32_t i = 1; i < set->count; i++)
+        if (set->ids[i] != set->ids[kept - 1])
+            set->ids[kept++] = set->ids[i];
+    set->count = kept;
+}
+
+int intern_set_has(const InternSet *set, uint32_t id)
+{
+    uint32_t low = 0;
+    uint32_t high = set->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (set->ids[mid] < id)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low < set->count && set->ids[low] == id;
+}
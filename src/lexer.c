@@ -1,780 +1,860 @@
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "lexer.h"
+#include "emitter.h"
 #include "errors.h"
+#include "diagnostics.h"
+#include "source.h"
+#include "scan.h"
+#include "pool.h"
 
-const int MAX_TOKEN_VALUE_LENGTH = 255;
+// Longest multi-character constant accepted between single quotes
 const int MAX_CHAR_VALUE = 10;
 
-void printList(TokenList *list) {
-    for (int i = 0; i < list->count; i++)
-    {
-        Token *tok = list->tokens[i];
-        printf("%s : %s\n", printEnum(tok->type), tok->value);
-    }
-    
+typedef struct {
+    const char *text;
+    uint8_t length;
+    uint8_t type;
+} KeywordEntry;
+
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 14
+
+// Perfect hash over the first, second and last byte plus the length. The
+// multipliers were found by brute force so that every keyword lands in its
+// own slot; adding a keyword means searching for a new (1, 9, 12) triple.
+static inline unsigned keyword_hash(const char *text, size_t length)
+{
+    return ((unsigned char)text[0] + (unsigned char)text[1] * 9u + (unsigned char)text[length - 1] * 12u +
+            (unsigned)length) & 127u;
 }
 
-const char* printEnum(unsigned int enumber) {
-    switch (enumber) {
-        case TOKEN_EOF: return "TOKEN_EOF";
-        case TOKEN_UNKNOWN: return "TOKEN_UNKNOWN";
-        case TOKEN_INT_LITERAL: return "TOKEN_INT_LITERAL";
-        case TOKEN_FLOAT_LITERAL: return "TOKEN_FLOAT_LITERAL";
-        case TOKEN_CHAR_LITERAL: return "TOKEN_CHAR_LITERAL";
-        case TOKEN_STRING_LITERAL: return "TOKEN_STRING_LITERAL";
-        case TOKEN_PREPROCESSOR: return "TOKEN_PREPROCESSOR";
-        case TOKEN_IDENTIFIER: return "TOKEN_IDENTIFIER";
-        case TOKEN_KEYWORD: return "TOKEN_KEYWORD";
-        case TOKEN_ASSIGNMENT_OPERATOR: return "TOKEN_ASSIGNMENT_OPERATOR";
-        case TOKEN_OPERATOR: return "TOKEN_OPERATOR";
-        case TOKEN_DOT: return "TOKEN_DOT";
-        case TOKEN_COMMA: return "TOKEN_COMMA";
-        case TOKEN_SEMICOLON: return "TOKEN_SEMICOLON";
-        case TOKEN_BITWISE_OPERATOR: return "TOKEN_BITWISE_OPERATOR";
-        case TOKEN_LOGIC_OPERATOR: return "TOKEN_LOGIC_OPERATOR";
-        case TOKEN_COMMENT: return "TOKEN_COMMENT";
-        case TOKEN_PAREN_OPEN: return "TOKEN_PAREN_OPEN";
-        case TOKEN_PAREN_CLOSE: return "TOKEN_PAREN_CLOSE";
-        case TOKEN_BRACE_OPEN: return "TOKEN_BRACE_OPEN";
-        case TOKEN_BRACE_CLOSE: return "TOKEN_BRACE_CLOSE";
-        case TOKEN_BRACKET_OPEN: return "TOKEN_BRACKET_OPEN";
-        case TOKEN_BRACKET_CLOSE: return "TOKEN_BRACKET_CLOSE";
-        case TOKEN_ARROW: return "TOKEN_ARROW";
-        default: return "TOKEN_INVALID";
-    }
+TokenType check_keyword(const char *text, size_t length)
+{
+    static const KeywordEntry keywords[128] = {
+        [0] = {"union", 5, TOKEN_KW_UNION},
+        [1] = {"do", 2, TOKEN_KW_DO},
+        [4] = {"typedef", 7, TOKEN_KW_TYPEDEF},
+        [6] = {"goto", 4, TOKEN_KW_GOTO},
+        [8] = {"switch", 6, TOKEN_KW_SWITCH},
+        [9] = {"inline", 6, TOKEN_KW_INLINE},
+        [10] = {"_Generic", 8, TOKEN_KW_GENERIC},
+        [11] = {"unsigned", 8, TOKEN_KW_UNSIGNED},
+        [12] = {"case", 4, TOKEN_KW_CASE},
+        [13] = {"double", 6, TOKEN_KW_DOUBLE},
+        [14] = {"continue", 8, TOKEN_KW_CONTINUE},
+        [16] = {"short", 5, TOKEN_KW_SHORT},
+        [17] = {"void", 4, TOKEN_KW_VOID},
+        [20] = {"_Alignas", 8, TOKEN_KW_ALIGNAS},
+        [33] = {"volatile", 8, TOKEN_KW_VOLATILE},
+        [38] = {"_Imaginary", 10, TOKEN_KW_IMAGINARY},
+        [39] = {"float", 5, TOKEN_KW_FLOAT},
+        [40] = {"for", 3, TOKEN_KW_FOR},
+        [43] = {"long", 4, TOKEN_KW_LONG},
+        [45] = {"return", 6, TOKEN_KW_RETURN},
+        [49] = {"static", 6, TOKEN_KW_STATIC},
+        [54] = {"auto", 4, TOKEN_KW_AUTO},
+        [58] = {"int", 3, TOKEN_KW_INT},
+        [63] = {"const", 5, TOKEN_KW_CONST},
+        [70] = {"_Bool", 5, TOKEN_KW_BOOL},
+        [72] = {"_Static_assert", 14, TOKEN_KW_STATIC_ASSERT},
+        [73] = {"if", 2, TOKEN_KW_IF},
+        [75] = {"extern", 6, TOKEN_KW_EXTERN},
+        [78] = {"_Noreturn", 9, TOKEN_KW_NORETURN},
+        [83] = {"_Atomic", 7, TOKEN_KW_ATOMIC},
+        [90] = {"signed", 6, TOKEN_KW_SIGNED},
+        [95] = {"register", 8, TOKEN_KW_REGISTER},
+        [96] = {"while", 5, TOKEN_KW_WHILE},
+        [98] = {"_Complex", 8, TOKEN_KW_COMPLEX},
+        [99] = {"enum", 4, TOKEN_KW_ENUM},
+        [103] = {"char", 4, TOKEN_KW_CHAR},
+        [104] = {"default", 7, TOKEN_KW_DEFAULT},
+        [109] = {"break", 5, TOKEN_KW_BREAK},
+        [112] = {"_Thread_local", 13, TOKEN_KW_THREAD_LOCAL},
+        [113] = {"else", 4, TOKEN_KW_ELSE},
+        [114] = {"sizeof", 6, TOKEN_KW_SIZEOF},
+        [119] = {"restrict", 8, TOKEN_KW_RESTRICT},
+        [120] = {"_Alignof", 8, TOKEN_KW_ALIGNOF},
+        [125] = {"struct", 6, TOKEN_KW_STRUCT},
+    };
+
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+        return TOKEN_IDENTIFIER;
+    const KeywordEntry *entry = &keywords[keyword_hash(text, length)];
+    if (entry->length == length && memcmp(entry->text, text, length) == 0)
+        return (TokenType)entry->type;
+    return TOKEN_IDENTIFIER;
 }
 
-TokenList *create_token_list()
+// The lexer is a DFA: the class of a token's first byte picks the state,
+// and the states for runs (identifiers, numbers, comments, literals) loop
+// on their own table lookups. Bytes 0x80-0xff are CC_OTHER, like isalpha in
+// the C locale.
+typedef enum {
+    CC_OTHER = 0,
+    CC_SPACE,
+    CC_IDENT,
+    CC_DIGIT,
+    CC_DOT,
+    CC_SLASH,
+    CC_QUOTE,
+    CC_APOS,
+    CC_HASH,
+    CC_PUNCT,
+    CC_COUNT
+} CharClass;
+
+static const uint8_t char_class[256] = {
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, // 00 ........
+    CC_OTHER, CC_SPACE, CC_SPACE, CC_SPACE, CC_SPACE, CC_SPACE, CC_OTHER, CC_OTHER, // 08 ........
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, // 10 ........
+    CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, CC_OTHER, // 18 ........
+    CC_SPACE, CC_PUNCT, CC_QUOTE, CC_HASH, CC_OTHER, CC_PUNCT, CC_PUNCT, CC_APOS, // 20 .!"#$%&'
+    CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_DOT, CC_SLASH, // 28 ()*+,-./
+    CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, CC_DIGIT, // 30 01234567
+    CC_DIGIT, CC_DIGIT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, // 38 89:;<=>?
+    CC_OTHER, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 40 @ABCDEFG
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 48 HIJKLMNO
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 50 PQRSTUVW
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_PUNCT, CC_OTHER, CC_PUNCT, CC_PUNCT, CC_IDENT, // 58 XYZ[\]^_
+    CC_PUNCT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 60 `abcdefg
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 68 hijklmno
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, CC_IDENT, // 70 pqrstuvw
+    CC_IDENT, CC_IDENT, CC_IDENT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_PUNCT, CC_OTHER, // 78 xyz{|}~.
+};
+
+// [A-Za-z0-9_], what may follow the first byte of an identifier
+static const uint8_t ident_char[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 00
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 10
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 20
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, // 30
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1, // 50
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, // 70
+};
+
+// Token type of a punctuation byte on its own
+static const uint8_t punct_type[256] = {
+    ['='] = TOKEN_OPERATOR,           ['<'] = TOKEN_BITWISE_OPERATOR,    ['>'] = TOKEN_BITWISE_OPERATOR,
+    ['!'] = TOKEN_LOGIC_OPERATOR,     ['+'] = TOKEN_ASSIGNMENT_OPERATOR, ['-'] = TOKEN_ASSIGNMENT_OPERATOR,
+    ['*'] = TOKEN_OPERATOR,           ['&'] = TOKEN_BITWISE_OPERATOR,    ['|'] = TOKEN_BITWISE_OPERATOR,
+    ['?'] = TOKEN_OPERATOR,           ['`'] = TOKEN_BITWISE_OPERATOR,    ['~'] = TOKEN_BITWISE_OPERATOR,
+    ['^'] = TOKEN_BITWISE_OPERATOR,   [';'] = TOKEN_SEMICOLON,           ['('] = TOKEN_PAREN_OPEN,
+    [')'] = TOKEN_PAREN_CLOSE,        ['{'] = TOKEN_BRACE_OPEN,          ['}'] = TOKEN_BRACE_CLOSE,
+    ['['] = TOKEN_BRACKET_OPEN,       [']'] = TOKEN_BRACKET_CLOSE,       [','] = TOKEN_COMMA,
+    [':'] = TOKEN_OPERATOR,           ['%'] = TOKEN_OPERATOR,
+};
+
+// Punctuation that can start a two-byte operator gets a row in op_transition
+enum {
+    OP_NONE = 0,
+    OP_EQUAL,
+    OP_LESS,
+    OP_GREATER,
+    OP_BANG,
+    OP_PLUS,
+    OP_MINUS,
+    OP_STAR,
+    OP_AMPERSAND,
+    OP_PIPE,
+    OP_QUESTION,
+    OP_ROWS
+};
+
+static const uint8_t op_row[256] = {
+    ['='] = OP_EQUAL, ['<'] = OP_LESS,  ['>'] = OP_GREATER,   ['!'] = OP_BANG, ['+'] = OP_PLUS,
+    ['-'] = OP_MINUS, ['*'] = OP_STAR,  ['&'] = OP_AMPERSAND, ['|'] = OP_PIPE, ['?'] = OP_QUESTION,
+};
+
+// (first byte, second byte) -> type of the two-byte operator, 0 if there is none
+static const uint8_t op_transition[OP_ROWS][256] = {
+    [OP_EQUAL] = {['='] = TOKEN_OPERATOR},
+    [OP_LESS] = {['<'] = TOKEN_BITWISE_OPERATOR, ['='] = TOKEN_OPERATOR},
+    [OP_GREATER] = {['>'] = TOKEN_BITWISE_OPERATOR, ['='] = TOKEN_OPERATOR},
+    [OP_BANG] = {['='] = TOKEN_OPERATOR},
+    [OP_PLUS] = {['='] = TOKEN_ASSIGNMENT_OPERATOR, ['+'] = TOKEN_ASSIGNMENT_OPERATOR},
+    [OP_MINUS] = {['='] = TOKEN_ASSIGNMENT_OPERATOR, ['-'] = TOKEN_ASSIGNMENT_OPERATOR, ['>'] = TOKEN_ARROW},
+    [OP_STAR] = {['='] = TOKEN_ASSIGNMENT_OPERATOR},
+    [OP_AMPERSAND] = {['&'] = TOKEN_LOGIC_OPERATOR, ['='] = TOKEN_ASSIGNMENT_OPERATOR},
+    [OP_PIPE] = {['|'] = TOKEN_LOGIC_OPERATOR},
+    [OP_QUESTION] = {[':'] = TOKEN_LOGIC_OPERATOR},
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LEXER_COMPUTED_GOTO 1
+#endif
+
+// scan_token results
+enum {
+    LEX_ERROR = -2,     // malformed token while speculative, cursor left on it
+    LEX_NEED_MORE = -1, // the token may continue past `end`, refill and call again
+    LEX_END = 0,
+    LEX_TOKEN = 1,
+};
+
+// [base, end) is the part of the input in memory, it starts base_offset
+// bytes into the whole input. Unless at_eof is set, reaching `end` means
+// "more bytes may follow", never "end of input". Nothing else carries over
+// from one token to the next: lines are only counted when one is asked for.
+typedef struct {
+    const char *base;
+    const char *cursor;
+    const char *end;
+    uint32_t base_offset;
+    int at_eof;
+    int speculative; // report malformed tokens with LEX_ERROR instead of panicking
+} LexState;
+
+static void lex_state_init(LexState *lx, const char *source, size_t length)
 {
-    TokenList *list = (TokenList *)calloc(1, sizeof(TokenList));
-    if (!list)
-    {
-        panic(ERR_MEMORY_ALLOCATION, 0);
-        return NULL;
-    }
-    list->tokens = NULL;
-    list->count = 0;
-    list->capacity = 10;
-    list->tokens = (Token **)calloc(list->capacity, sizeof(Token *));
-    if (!list->tokens)
-    {
-        panic(ERR_MEMORY_ALLOCATION, 0);
-        free(list);
-        return NULL;
-    }
-    return list;
+    lx->base = source;
+    lx->cursor = source;
+    lx->end = source + length;
+    lx->base_offset = 0;
+    lx->at_eof = 1;
+    lx->speculative = 0;
 }
 
-void add_token(TokenList *list, Token *token)
+static inline uint32_t input_offset(const LexState *lx, const char *p)
 {
-    if (list->count >= list->capacity)
-    {
-        list->capacity *= 2;
-        Token **new_tokens = (Token **)realloc(list->tokens, sizeof(Token *) * list->capacity);
-        if (!new_tokens)
-        {
-            panic(ERR_MEMORY_ALLOCATION, 0);
-        }
-        list->tokens = new_tokens;
-    }
-    list->tokens[list->count++] = token;
+    return lx->base_offset + (uint32_t)(p - lx->base);
 }
 
-void free_token_list(TokenList *list)
+static inline int is_digit(const char *p, const char *end)
 {
-    if (list == NULL)
-        return;
-    for (int i = 0; i < list->count; i++)
-    {
-        if (list->tokens[i] == NULL)
-            continue;
-        if (free_token(list->tokens[i]))
-        {
-            panic(ERR_FREE_MEMORY, 0);
-        }
-    }
-    free(list->tokens);
-    free(list);
+    return p < end && char_class[(unsigned char)*p] == CC_DIGIT;
 }
 
-int free_token(Token *token)
+static inline int is_space(unsigned char c)
 {
-    if (!token)
-        return 1;
-    free(token->value);
-    free(token);
-    return 0;
+    return char_class[c] == CC_SPACE;
+}
+
+// A malformed token starting at `start`, for a lexer that isn't speculative;
+// the caller then recovers by emitting what it can and carrying on
+static void report_malformed(const LexState *lx, const char *start, ErrorCode code)
+{
+    diagnostic_report(code, input_offset(lx, start));
 }
 
-Token *create_token(TokenType type, const char *value)
+// Skips whitespace and recognises the next token. Returns LEX_TOKEN,
+// LEX_END, or LEX_NEED_MORE with the cursor left on the token's first byte.
+static inline int scan_token(LexState *lx, Token *tok)
 {
-    Token *new_token = (Token *)malloc(sizeof(Token));
-    if (!new_token)
+#ifdef LEXER_COMPUTED_GOTO
+    static const void *const dispatch[CC_COUNT] = {
+        [CC_OTHER] = &&state_other, [CC_SPACE] = &&state_space,   [CC_IDENT] = &&state_ident,
+        [CC_DIGIT] = &&state_number, [CC_DOT] = &&state_dot,      [CC_SLASH] = &&state_slash,
+        [CC_QUOTE] = &&state_string, [CC_APOS] = &&state_char,    [CC_HASH] = &&state_hash,
+        [CC_PUNCT] = &&state_punct,
+    };
+#endif
+    const char *p = lx->cursor;
+    const char *end = lx->end;
+    const char *start;
+    TokenType type;
+
+next:
+    if (p >= end)
     {
-        panic(ERR_MEMORY_ALLOCATION, 0);
-        return NULL;
+        lx->cursor = p;
+        return lx->at_eof ? LEX_END : LEX_NEED_MORE;
     }
-
-    new_token->type = type;
-    new_token->value = strdup(value);
-
-    if (!new_token->value)
+    start = p;
+#ifdef LEXER_COMPUTED_GOTO
+    goto *dispatch[char_class[(unsigned char)*p++]];
+#else
+    switch (char_class[(unsigned char)*p++])
     {
-        free(new_token);
-        panic(ERR_MEMORY_ALLOCATION, 0);
-        return NULL;
+    case CC_SPACE: goto state_space;
+    case CC_IDENT: goto state_ident;
+    case CC_DIGIT: goto state_number;
+    case CC_DOT: goto state_dot;
+    case CC_SLASH: goto state_slash;
+    case CC_QUOTE: goto state_string;
+    case CC_APOS: goto state_char;
+    case CC_HASH: goto state_hash;
+    case CC_PUNCT: goto state_punct;
+    default: goto state_other;
     }
-    return new_token;
-}
-
-TokenType check_keyword(const char *text)
-{
-    static const char *keywords[] = {
-        "auto", "break", "case", "char", "const", "continue", "default", "do",
-        "double", "else", "enum", "extern", "float", "for", "goto", "if",
-        "int", "long", "register", "return", "short", "signed", "sizeof", "static",
-        "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while"};
-
-    for (int i = 0; i < 32; i++)
+#endif
+
+state_space:
+    // a lone separator is the common case, only longer runs go to the scanner
+    if (p < end && is_space((unsigned char)*p))
+        p = scan_whitespace(p, end);
+    goto next;
+
+state_ident:
+    if (p < end && ident_char[(unsigned char)*p])
+        p = scan_identifier(p + 1, end);
+    type = check_keyword(start, p - start);
+    goto emit;
+
+state_dot:
+    if (!is_digit(p, end))
+    {
+        type = TOKEN_DOT;
+        goto emit;
+    }
+    type = TOKEN_FLOAT_LITERAL;
+    goto fraction;
+
+state_number:
+    type = TOKEN_INT_LITERAL;
+    while (is_digit(p, end))
+        p++;
+    if (p < end && *p == '.')
+    {
+        type = TOKEN_FLOAT_LITERAL;
+        p++;
+    fraction:
+        while (is_digit(p, end))
+            p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
     {
-        if (strcmp(text, keywords[i]) == 0)
+        type = TOKEN_FLOAT_LITERAL;
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (!is_digit(p, end))
         {
-            return TOKEN_KEYWORD;
+            if (p >= end && !lx->at_eof)
+                goto need_more;
+            if (lx->speculative)
+                goto error;
+            // kept as a float without its exponent digits
+            report_malformed(lx, start, ERR_MALFORMED_FLOAT);
         }
+        while (is_digit(p, end))
+            p++;
     }
-    return TOKEN_IDENTIFIER;
-}
-
-TokenList *lex_file(const char *filepath)
-{
-    int current_line = 1;
+    goto emit;
 
-    FILE *file = fopen(filepath, "r");
-    if (!file)
+state_slash:
+    if (p < end && *p == '/')
     {
-        panic(ERR_FILE_NOT_FOUND, 0);
-        return NULL;
+        p = scan_line_end(p + 1, end);
+        type = TOKEN_COMMENT;
+        goto emit;
+    }
+    if (p < end && *p == '*')
+    {
+        p = scan_comment_end(p + 1, end);
+        if (p < end)
+            p += 2; // skip the closing */
+        type = TOKEN_COMMENT;
+        goto emit;
     }
+    if (p < end && *p == '=')
+    {
+        p++;
+        type = TOKEN_OPERATOR;
+        goto emit;
+    }
+    type = TOKEN_OPERATOR;
+    goto emit;
 
-    TokenList *tokenList = create_token_list();
+state_string:
+    for (;;)
+    {
+        p = scan_string_special(p, end);
+        if (p >= end || *p == '"')
+            break;
+        p += p + 1 < end ? 2 : 1; // skip the escaped byte
+    }
+    if (p < end)
+        p++; // End of string
+    type = TOKEN_STRING_LITERAL;
+    goto emit;
 
-    int ch;
-    while ((ch = fgetc(file)) != EOF)
+state_char:
     {
-        if (ch == '\n')
-        {
-            current_line++;
-            continue;
-        }
-        if (isspace(ch))
-            continue;
-        // handle == comparison
-        if (ch == '=')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "=="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "="));
-            }
-            continue;
-        }
-        // handle bitwise operators
-        if (ch == '<')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == '<')
-            {
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "<<"));
-            }
-            else if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "<="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "<"));
-            }
-            continue;
-        }
-        if (ch == '>')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == '>')
-            {
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, ">>"));
-            }
-            else if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_OPERATOR, ">="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, ">"));
-            }
-            continue;
-        }
-        // handle != comparison
-        if (ch == '!')
+        const char *body = p;
+        while (p < end && *p != '\'')
         {
-            int next_ch = fgetc(file);
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "!="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_LOGIC_OPERATOR, "!"));
-            }
-            continue;
-        }
-        // handle += -= *= ++ --
-        if (ch == '+')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "+="));
-            }
-            else if (next_ch == '+')
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "++"));
-            }
-            else
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "+"));
-            }
-            continue;
-        }
-        if (ch == '-')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "-="));
-            }
-            else if (next_ch == '-')
+            if (p - body >= MAX_CHAR_VALUE - 1)
             {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "--"));
+                if (lx->speculative)
+                    goto error;
+                // a stray quote: it alone is unknown, what follows is lexed as code
+                report_malformed(lx, start, ERR_MALFORMED_CHAR);
+                p = body;
+                goto state_other;
             }
-            else if (next_ch == '>')
-            {
-                add_token(tokenList, create_token(TOKEN_ARROW, "->"));
-            }
-            else
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "-"));
-            }
-            continue;
+            p++;
         }
-        // handle pointers and *=
-        if (ch == '*')
+        // whatever it turns out to be ends past the quote, and emit would send
+        // a token ending on the window's last byte back here after reporting
+        if (p + 1 >= end && !lx->at_eof)
+            goto need_more;
+        // avoid empty '' and malformed char literal like 'a
+        if (p == body || p == end)
         {
-            int next_ch = fgetc(file);
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "*="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "*"));
-            }
-            continue;
+            if (lx->speculative)
+                goto error;
+            report_malformed(lx, start, ERR_MALFORMED_CHAR);
+            // '' is unknown as a whole, a quote at the very end alone
+            p = p == body && p < end ? body + 1 : body;
+            goto state_other;
         }
-        // handle logical operators
-        if (ch == '&')
-        {
-            int next_ch = fgetc(file);
+        p++;
+        type = TOKEN_CHAR_LITERAL;
+        goto emit;
+    }
 
-            if (next_ch == '&')
-            {
-                add_token(tokenList, create_token(TOKEN_LOGIC_OPERATOR, "&&"));
-            }
-            else if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_ASSIGNMENT_OPERATOR, "&="));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "&"));
-            }
-            continue;
-        }
+state_hash:
+    p = scan_line_end(p, end);
+    type = TOKEN_PREPROCESSOR;
+    goto emit;
 
-        if (ch == '|')
+state_punct:
+    {
+        unsigned char ch = (unsigned char)start[0];
+        type = (TokenType)punct_type[ch];
+        uint8_t row = op_row[ch];
+        if (row && p < end)
         {
-            int next_ch = fgetc(file);
-            if (next_ch == '|')
-            {
-                add_token(tokenList, create_token(TOKEN_LOGIC_OPERATOR, "||"));
-            }
-            else
+            uint8_t pair = op_transition[row][(unsigned char)*p];
+            if (pair)
             {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "|"));
+                type = (TokenType)pair;
+                p++;
             }
-            continue;
         }
+        goto emit;
+    }
 
-        // handle division
-        if (ch == '/')
-        {
-            int next_ch = fgetc(file);
-            char buffer[MAX_TOKEN_VALUE_LENGTH + 1];
-            if (next_ch == '=')
-            {
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "/="));
-            }
-            else if (next_ch == '/')
-            {
-                int i = 0;
-                while ((next_ch = fgetc(file)) != EOF && next_ch != '\n')
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH - 1)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    }
-                }
-
-                buffer[i] = '\0'; // Null-terminate
-                add_token(tokenList, create_token(TOKEN_COMMENT, buffer));
-            }
-            else if (next_ch == '*')
-            {
-                int prev_ch = 0;
-                int i = 0;
-                while ((next_ch = fgetc(file)) != EOF)
-                {
-                    if (prev_ch == '*' && next_ch == '/')
-                    {
-                        break;
-                    }
-                    if (next_ch == '\n')
-                    {
-                        current_line++;
-                    }
-                    prev_ch = next_ch;
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        int temp = fgetc(file);
-                        if (next_ch == '*' && temp == '/')
-                        {
-                            ungetc(temp, file);
-                            continue;
-                        }
-                        ungetc(temp, file);
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    }
-                }
-                buffer[i] = '\0';
-                add_token(tokenList, create_token(TOKEN_COMMENT, buffer));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "/"));
-            }
-            continue;
-        }
+state_other:
+    type = TOKEN_UNKNOWN;
+
+emit:
+    // a token that ran into the end of the window may not be complete
+    if (p >= end && !lx->at_eof)
+        goto need_more;
+    tok->type = type;
+    tok->offset = input_offset(lx, start);
+    tok->length = (uint32_t)(p - start);
+    tok->name = INTERN_NONE;
+    lx->cursor = p;
+    return LEX_TOKEN;
+
+need_more:
+    lx->cursor = start;
+    return LEX_NEED_MORE;
+
+error:
+    lx->cursor = start;
+    return LEX_ERROR;
+}
 
-        // handle keyword
-        if (isalpha(ch) || ch == '_')
-        {
-            char buffer[MAX_TOKEN_VALUE_LENGTH + 1];
-            int i = 0;
+TokenList *lex_file(Arena *arena, const char *filepath)
+{
+    // tokens point into the source, so it stays mapped until the arena is freed
+    const SourceBuffer *source = source_open_in(arena, filepath);
+    if (!source)
+    {
+        panic(ERR_FILE_NOT_FOUND, 0);
+        return NULL;
+    }
+    return lex_buffer(arena, source->data, source->length);
+}
 
-            buffer[i++] = ch;
+// Longer input can't be given 32-bit offsets
+static size_t checked_length(size_t length)
+{
+    if (length <= SOURCE_MAX_LENGTH)
+        return length;
+    diagnostic_report(ERR_MAX_SIZE, DIAGNOSTIC_NO_OFFSET);
+    return 0;
+}
 
-            while (isalnum(ch = fgetc(file)) || ch == '_')
-            {
-                if (i < MAX_TOKEN_VALUE_LENGTH)
-                {
-                    buffer[i++] = ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                }
-            }
+TokenList *lex_buffer(Arena *arena, const char *source, size_t length)
+{
+    length = checked_length(length);
+    LexState lx;
+    lex_state_init(&lx, source, length);
+    TokenList *tokenList = create_token_list(arena, source, length);
+
+    Token tok;
+    while (scan_token(&lx, &tok) == LEX_TOKEN)
+        add_token(tokenList, tok.type, tok.offset, tok.length);
+    return tokenList;
+}
 
-            buffer[i] = '\0';
-            if (ch != EOF)
-                ungetc(ch, file);
+void lex_highlight(Output *out, const char *source, size_t length)
+{
+    length = checked_length(length);
+    LexState lx;
+    lex_state_init(&lx, source, length);
+    Highlighter h;
+    highlight_begin(&h, out, source, length);
+
+    Token tok;
+    while (scan_token(&lx, &tok) == LEX_TOKEN)
+        highlight_token(&h, tok.type, tok.offset, tok.length);
+    highlight_end(&h);
+}
 
-            TokenType type = check_keyword(buffer);
-            add_token(tokenList, create_token(type, buffer));
-            continue;
-        }
-        // handle floats
-        if (ch == '.')
+// Puts the state back on the first byte of a token it already scanned
+static void rewind_to(LexState *lx, const Token *tok)
+{
+    lx->cursor = lx->base + (tok->offset - lx->base_offset);
+}
+
+TokenList *lex_buffer_edit(Arena *arena, const char *source, size_t length, const TokenList *old, size_t prefix,
+                           size_t suffix, TokenEdit *edit)
+{
+    // too long to lex; the full lex reports it
+    if (length > SOURCE_MAX_LENGTH)
+        return NULL;
+    // the edit may extend the token it follows, so that one is lexed again,
+    // and so is any token whose scan may have read as far as the edit: a
+    // quote looks up to MAX_CHAR_VALUE bytes ahead for the one closing it
+    uint32_t first = token_list_before(old, (uint32_t)prefix);
+    if (first > 0)
+        first--;
+    size_t lookahead = (size_t)MAX_CHAR_VALUE;
+    uint32_t quoted = token_list_before(old, prefix > lookahead ? (uint32_t)(prefix - lookahead) : 0);
+    if (quoted < first)
+        first = quoted;
+
+    TokenList *tokenList = create_token_list(arena, source, length);
+    token_list_copy(tokenList, old, 0, first, 0);
+    LexState lx;
+    lex_state_init(&lx, source, length);
+    lx.speculative = 1;
+    TokenCursor cursor;
+    Token tok, guess;
+    cursor_init_at(&cursor, old, first);
+    int have_guess = cursor_next(&cursor, &guess);
+    if (have_guess && guess.offset < prefix)
+        rewind_to(&lx, &guess);
+
+    // past the edit, an old token at the same place means the same tokens
+    // from there on, as in the parallel stitch below
+    int64_t delta = (int64_t)length - (int64_t)old->source_length;
+    size_t edit_end = length - suffix;
+    int result;
+    while ((result = scan_token(&lx, &tok)) == LEX_TOKEN)
+    {
+        if (tok.offset >= edit_end)
         {
-            char buffer[256];
-            int next_ch = fgetc(file);
-            if (!isdigit(next_ch))
+            while (have_guess && guess.offset + delta < tok.offset)
+                have_guess = cursor_next(&cursor, &guess);
+            if (have_guess && guess.offset + delta == tok.offset)
             {
-                add_token(tokenList, create_token(TOKEN_DOT, "."));
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
+                uint32_t resync = cursor_position(&cursor) - 1;
+                edit->first = first;
+                edit->old_end = resync;
+                edit->new_end = tokenList->count;
+                token_list_copy(tokenList, old, resync, old->count, (int32_t)delta);
+                return tokenList;
             }
-            else
-            {
-                int i = 0;
-                buffer[i++] = ch;
-                buffer[i++] = next_ch;
-                next_ch = fgetc(file);
-                while (isdigit(next_ch))
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    }
-                    next_ch = fgetc(file);
-                }
-                if (next_ch == 'e' || next_ch == 'E')
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    }
-                    next_ch = fgetc(file);
-                    if (next_ch == '+' || next_ch == '-')
-                    {
-                        if (i < MAX_TOKEN_VALUE_LENGTH)
-                        {
-                            buffer[i++] = next_ch;
-                        }
-                        else
-                        {
-                            panic(ERR_MAX_SIZE, current_line);
-                        }
-                        next_ch = fgetc(file);
-                    }
-                    if (!isdigit(next_ch))
-                        panic(ERR_MALFORMED_FLOAT, current_line);
-                    while (isdigit(next_ch))
-                    {
-                        if (i < MAX_TOKEN_VALUE_LENGTH)
-                        {
-                            buffer[i++] = next_ch;
-                        }
-                        else
-                        {
-                            panic(ERR_MAX_SIZE, current_line);
-                        }
-                        next_ch = fgetc(file);
-                    }
-                }
-                buffer[i] = '\0';
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_FLOAT_LITERAL, buffer));
-            }
-            continue;
         }
+        add_token(tokenList, tok.type, tok.offset, tok.length);
+    }
+    if (result == LEX_ERROR)
+        return NULL;
+    edit->first = first;
+    edit->old_end = old->count;
+    edit->new_end = tokenList->count;
+    return tokenList;
+}
 
-        if (isdigit(ch))
+// Parallel lexing splits the input into pieces that each start after a
+// newline. A worker lexes its piece guessing that nothing (comment, string,
+// char literal) is open at its first byte, keeping the tokens that start
+// inside the piece. The stitch then lexes serially from where the previous
+// piece really ended until it meets a token the guess produced too: from
+// there on both streams are the same, so the rest of the guess is spliced
+// in. A right guess costs the stitch one token.
+static const size_t PARALLEL_MIN_PIECE = 1024 * 1024;
+
+typedef struct {
+    const char *source;
+    size_t length;
+    uint32_t start; // tokens starting in [start, end) belong to this piece
+    uint32_t end;
+    Arena arena;
+    TokenList *tokens;
+    LexState state; // where the guess stopped: past its last token, or on an error
+} LexPiece;
+
+static void lex_piece_job(void *ctx, size_t job, int worker)
+{
+    (void)worker;
+    LexPiece *piece = &((LexPiece *)ctx)[job];
+    LexState *lx = &piece->state;
+    lex_state_init(lx, piece->source, piece->length);
+    lx->cursor = piece->source + piece->start;
+    lx->speculative = 1;
+
+    TokenList *tokenList = create_token_list(&piece->arena, piece->source, piece->end - piece->start);
+    Token tok;
+    while (scan_token(lx, &tok) == LEX_TOKEN)
+    {
+        if (tok.offset >= piece->end)
         {
-            char buffer[256];
-            int i = 0;
-            int is_float = 0;
-
-            buffer[i++] = ch;
-            int next_ch = fgetc(file);
-
-            while (isdigit(next_ch))
-            {
-                if (i < MAX_TOKEN_VALUE_LENGTH)
-                {
-                    buffer[i++] = next_ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                };
-                next_ch = fgetc(file);
-            }
-
-            if (next_ch == '.')
-            {
-                is_float = 1;
-                if (i < MAX_TOKEN_VALUE_LENGTH)
-                {
-                    buffer[i++] = next_ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                };
-                next_ch = fgetc(file);
-                while (isdigit(next_ch))
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    };
-                    next_ch = fgetc(file);
-                }
-            }
-
-            if (next_ch == 'e' || next_ch == 'E')
-            {
-                is_float = 1;
-                if (i < MAX_TOKEN_VALUE_LENGTH)
-                {
-                    buffer[i++] = next_ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                };
-                next_ch = fgetc(file);
-                if (next_ch == '+' || next_ch == '-')
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    };
-                    next_ch = fgetc(file);
-                }
-                if (!isdigit(next_ch))
-                    panic(ERR_MALFORMED_FLOAT, current_line);
-                while (isdigit(next_ch))
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH)
-                    {
-                        buffer[i++] = next_ch;
-                    }
-                    else
-                    {
-                        panic(ERR_MAX_SIZE, current_line);
-                    };
-                    next_ch = fgetc(file);
-                }
-            }
+            rewind_to(lx, &tok);
+            break;
+        }
+        add_token(tokenList, tok.type, tok.offset, tok.length);
+    }
+    piece->tokens = tokenList;
+}
 
-            buffer[i] = '\0';
-            if (next_ch != EOF)
-                ungetc(next_ch, file);
+static void free_piece_arena(void *arena)
+{
+    arena_free((Arena *)arena);
+}
 
-            if (is_float)
-            {
-                add_token(tokenList, create_token(TOKEN_FLOAT_LITERAL, buffer));
-            }
-            else
-            {
-                add_token(tokenList, create_token(TOKEN_INT_LITERAL, buffer));
-            }
-            continue;
+TokenList *lex_buffer_parallel(Arena *arena, const char *source, size_t length, int threads)
+{
+    length = checked_length(length);
+    if (threads <= 1 || length < 2)
+        return lex_buffer(arena, source, length);
+
+    // cut after the first newline at or past each even split point
+    LexPiece *pieces = (LexPiece *)arena_alloc(arena, threads * sizeof(LexPiece));
+    size_t count = 0;
+    size_t start = 0;
+    for (int i = 1; i <= threads && start < length; i++)
+    {
+        size_t end = length;
+        if (i < threads)
+        {
+            size_t split = length / threads * i;
+            const char *newline = split > start ? memchr(source + split, '\n', length - split) : NULL;
+            if (!newline)
+                continue;
+            end = (size_t)(newline - source) + 1;
         }
-        if (ch == '\'')
+        pieces[count].source = source;
+        pieces[count].length = length;
+        pieces[count].start = (uint32_t)start;
+        pieces[count].end = (uint32_t)end;
+        arena_init(&pieces[count].arena, 64 * 1024);
+        arena_on_free(arena, free_piece_arena, &pieces[count].arena);
+        count++;
+        start = end;
+    }
+    if (count > 0)
+        pieces[count - 1].end = (uint32_t)length;
+
+    ThreadPool *pool = pool_start(threads, count, NULL, lex_piece_job, pieces);
+    pool_finish(pool);
+
+    // stitch; this is also where a real error is reported, as in lex_buffer
+    LexState lx;
+    lex_state_init(&lx, source, length);
+    TokenList *tokenList = create_token_list(arena, source, 0);
+    tokenList->source_length = length;
+    Token tok;
+    for (size_t i = 0; i < count; i++)
+    {
+        LexPiece *piece = &pieces[i];
+        TokenCursor cursor;
+        Token guess;
+        cursor_init(&cursor, piece->tokens);
+        int have_guess = cursor_next(&cursor, &guess);
+        // speculative until a token is known to be this piece's: the first
+        // one past its end is lexed again by the next piece, and would be
+        // reported twice
+        lx.speculative = 1;
+        for (;;)
         {
-            char buffer[MAX_CHAR_VALUE + 1];
-            buffer[0] = '\0';
-            int next_ch = fgetc(file);
-            int i = 0;
-            while (next_ch != EOF)
+            int result = scan_token(&lx, &tok);
+            if (result == LEX_ERROR && input_offset(&lx, lx.cursor) < piece->end)
             {
-                if (!(next_ch == '\''))
-                {
-                    if (i < MAX_CHAR_VALUE - 1)
-                    {
-                        buffer[i++] = next_ch;
-                        next_ch = fgetc(file);
-                    }
-                    else
-                    {
-                        panic(ERR_SYNTAX_ERROR, current_line);
-                    }
-                }
-                else
-                {
-                    buffer[i] = '\0';
-                    add_token(tokenList, create_token(TOKEN_CHAR_LITERAL, buffer));
-                    break;
-                }
+                lx.speculative = 0;
+                result = scan_token(&lx, &tok);
+                lx.speculative = 1;
             }
-            if (i == 0)
+            if (result == LEX_ERROR)
+                break;
+            if (result != LEX_TOKEN)
+                return tokenList;
+            if (tok.offset >= piece->end)
             {
-                panic(ERR_SYNTAX_ERROR, current_line);
+                rewind_to(&lx, &tok);
+                break;
             }
-            if (next_ch == EOF)
-            { // avoid malformed char literal like 'a
-                panic(ERR_SYNTAX_ERROR, current_line);
+            while (have_guess && guess.offset < tok.offset)
+                have_guess = cursor_next(&cursor, &guess);
+            // same start: same tokens from here on
+            if (have_guess && guess.offset == tok.offset)
+            {
+                token_list_splice(tokenList, piece->tokens, cursor_position(&cursor) - 1);
+                lx = piece->state;
+                break;
             }
-            continue;
+            add_token(tokenList, tok.type, tok.offset, tok.length);
         }
+    }
+    lx.speculative = 0;
+    while (scan_token(&lx, &tok) == LEX_TOKEN)
+        add_token(tokenList, tok.type, tok.offset, tok.length);
+    return tokenList;
+}
 
-        if (ch == '"')
-        {
-            char buffer[MAX_TOKEN_VALUE_LENGTH + 1];
-            int i = 0;
-            int current_ch;
+TokenList *lex_source_parallel(Arena *arena, const SourceBuffer *source, int threads)
+{
+    // below a few pieces' worth the threads cost more than they save
+    size_t most = source->length / PARALLEL_MIN_PIECE;
+    if ((size_t)threads > most)
+        threads = (int)most;
+    return lex_buffer_parallel(arena, source->data, source->length, threads);
+}
 
-            while ((current_ch = fgetc(file)) != EOF)
-            {
-                if (current_ch == '"')
-                    break; // End of string
-
-                if (current_ch == '\\')
-                {
-                    if (i < MAX_TOKEN_VALUE_LENGTH - 1)
-                    {
-                        buffer[i++] = current_ch;
-                        current_ch = fgetc(file);
-                        buffer[i++] = current_ch;
-                    }
-                    else
-                    {
-                        fgetc(file);
-                        panic(ERR_MAX_SIZE, current_line);
-                    }
-                    continue;
-                }
-
-                if (i < MAX_TOKEN_VALUE_LENGTH - 1)
-                {
-                    buffer[i++] = current_ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                }
-            }
-            buffer[i] = '\0';
-            add_token(tokenList, create_token(TOKEN_STRING_LITERAL, buffer));
-            continue;
-        }
+static const size_t LEXER_WINDOW_SIZE = 64 * 1024;
+
+struct Lexer {
+    int fd;
+    int owns_fd;
+    char *window;
+    size_t capacity;
+    size_t filled;
+    LexState state;
+    // what was dropped from the window, for lexer_position
+    uint32_t dropped_lines;
+    uint32_t line_start;
+};
+
+Lexer *lexer_open_fd(int fd, size_t window_size)
+{
+    Lexer *lexer = (Lexer *)malloc(sizeof(Lexer));
+    if (!lexer)
+    {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return NULL;
+    }
+    lexer->fd = fd;
+    lexer->owns_fd = 0;
+    lexer->capacity = window_size > 0 ? window_size : LEXER_WINDOW_SIZE;
+    lexer->window = (char *)malloc(lexer->capacity);
+    if (!lexer->window)
+    {
+        free(lexer);
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return NULL;
+    }
+    lexer->filled = 0;
+    lexer->dropped_lines = 0;
+    lexer->line_start = 0;
+    lex_state_init(&lexer->state, lexer->window, 0);
+    lexer->state.at_eof = 0;
+    return lexer;
+}
 
-        if (ch == '?')
-        {
-            int next_ch = fgetc(file);
-            if (next_ch == ':')
-            {
-                add_token(tokenList, create_token(TOKEN_LOGIC_OPERATOR, "?:"));
-            }
-            else
-            {
-                if (next_ch != EOF)
-                    ungetc(next_ch, file);
-                add_token(tokenList, create_token(TOKEN_OPERATOR, "?"));
-            }
-            continue;
-        }
+Lexer *lexer_open(const char *filepath)
+{
+    int fd = strcmp(filepath, "-") == 0 ? STDIN_FILENO : open(filepath, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    Lexer *lexer = lexer_open_fd(fd, 0);
+    lexer->owns_fd = fd != STDIN_FILENO;
+    return lexer;
+}
 
-        if (ch == '#')
+// Drops everything before the cursor, then reads more. Only a token that
+// fills the whole window makes it grow. Each refill rescans the pending
+// token from its first byte, so once that token is at least half the
+// window the refill waits for a full window: rescans then only happen
+// after the window doubled and a long comment still costs linear time.
+static void lexer_refill(Lexer *lexer)
+{
+    LexState *lx = &lexer->state;
+    size_t consumed = (size_t)(lx->cursor - lexer->window);
+    if (consumed > 0)
+    {
+        // counted once per refill, while still in cache, rather than per token
+        const char *last_newline = NULL;
+        lexer->dropped_lines += scan_count_newlines(lexer->window, lx->cursor, &last_newline);
+        if (last_newline)
+            lexer->line_start = input_offset(lx, last_newline + 1);
+        memmove(lexer->window, lx->cursor, lexer->filled - consumed);
+        lexer->filled -= consumed;
+        lx->base_offset += (uint32_t)consumed;
+    }
+    else if (lexer->filled == lexer->capacity)
+    {
+        char *grown = (char *)realloc(lexer->window, lexer->capacity * 2);
+        if (!grown)
         {
-            char buffer[MAX_TOKEN_VALUE_LENGTH + 1];
-            int i = 0;
-            buffer[i++] = '#';
-
-            int next_ch;
-            while ((next_ch = fgetc(file)) != EOF && next_ch != '\n')
-            {
-                if (i < MAX_TOKEN_VALUE_LENGTH - 1)
-                {
-                    buffer[i++] = next_ch;
-                }
-                else
-                {
-                    panic(ERR_MAX_SIZE, current_line);
-                }
-            }
-            buffer[i] = '\0';
-            add_token(tokenList, create_token(TOKEN_PREPROCESSOR, buffer));
-            continue;
+            panic(ERR_MEMORY_ALLOCATION, 0);
+            return;
         }
+        lexer->window = grown;
+        lexer->capacity *= 2;
+    }
 
-        // if it wasn't anything else, then it's simple punctuation or operator
-        switch (ch)
+    int fill_window = lexer->filled >= lexer->capacity / 2;
+    while (lexer->filled < lexer->capacity)
+    {
+        ssize_t got = read(lexer->fd, lexer->window + lexer->filled, lexer->capacity - lexer->filled);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
         {
-        case '`':
-            add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "`"));
-            break;
-        case '~':
-            add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "~"));
-            break;
-        case '^':
-            add_token(tokenList, create_token(TOKEN_BITWISE_OPERATOR, "^"));
-            break;
-        case ';':
-            add_token(tokenList, create_token(TOKEN_SEMICOLON, ";"));
-            break;
-        case '(':
-            add_token(tokenList, create_token(TOKEN_PAREN_OPEN, "("));
-            break;
-        case ')':
-            add_token(tokenList, create_token(TOKEN_PAREN_CLOSE, ")"));
-            break;
-        case '{':
-            add_token(tokenList, create_token(TOKEN_BRACE_OPEN, "{"));
-            break;
-        case '}':
-            add_token(tokenList, create_token(TOKEN_BRACE_CLOSE, "}"));
-            break;
-        case '[':
-            add_token(tokenList, create_token(TOKEN_BRACKET_OPEN, "["));
-            break;
-        case ']':
-            add_token(tokenList, create_token(TOKEN_BRACKET_CLOSE, "]"));
-            break;
-        case ',':
-            add_token(tokenList, create_token(TOKEN_COMMA, ","));
-            break;
-        case ':':
-            add_token(tokenList, create_token(TOKEN_OPERATOR, ":"));
-            break;
-        case '%':
-            add_token(tokenList, create_token(TOKEN_OPERATOR, "%"));
-            break;
-        default:
-            add_token(tokenList, create_token(TOKEN_UNKNOWN, "unk"));
+            lx->at_eof = 1;
             break;
         }
+        lexer->filled += (size_t)got;
+        if (!fill_window)
+            break; // pipes hand out what they have; lex it rather than wait for a full window
     }
-    fclose(file);
-    return tokenList;
-}
\ No newline at end of file
+    // offsets are 32-bit, so the input ends where they would wrap
+    if (lexer->filled > SOURCE_MAX_LENGTH - lx->base_offset)
+    {
+        diagnostic_report(ERR_MAX_SIZE, DIAGNOSTIC_NO_OFFSET);
+        lexer->filled = SOURCE_MAX_LENGTH - lx->base_offset;
+        lx->at_eof = 1;
+    }
+
+    lx->base = lexer->window;
+    lx->cursor = lexer->window;
+    lx->end = lexer->window + lexer->filled;
+}
+
+int lexer_next(Lexer *lexer, Token *token)
+{
+    for (;;)
+    {
+        int result = scan_token(&lexer->state, token);
+        if (result != LEX_NEED_MORE)
+            return result;
+        lexer_refill(lexer);
+    }
+}
+
+const char *lexer_token_text(const Lexer *lexer, const Token *token)
+{
+    return lexer->window + (token->offset - lexer->state.base_offset);
+}
+
+void lexer_position(const Lexer *lexer, uint32_t offset, uint32_t *line, uint32_t *column)
+{
+    const LexState *lx = &lexer->state;
+    const char *last_newline = NULL;
+    uint32_t newlines = scan_count_newlines(lx->base, lx->base + (offset - lx->base_offset), &last_newline);
+    *line = lexer->dropped_lines + newlines + 1;
+    *column = offset - (last_newline ? input_offset(lx, last_newline + 1) : lexer->line_start) + 1;
+}
+
+void lexer_close(Lexer *lexer)
+{
+    if (!lexer)
+        return;
+    if (lexer->owns_fd)
+        close(lexer->fd);
+    free(lexer->window);
+    free(lexer);
+}
@@ -0,0 +1,58 @@
+#include "lines.h"
+#include "errors.h"
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+void line_index_init(LineIndex *index, const char *source, size_t length)
+{
+    index->source = source;
+    index->length = length;
+    index->starts = NULL;
+    index->count = 0;
+}
+
+void line_index_free(LineIndex *index)
+{
+    free(index->starts);
+    line_index_init(index, index->source, index->length);
+}
+
+// One vectorized pass sizes the index, a memchr walk fills it
+static void build(LineIndex *index)
+{
+    const char *source = index->source;
+    const char *end = source + index->length;
+    const char *last_newline = NULL;
+    uint32_t count = scan_count_newlines(source, end, &last_newline) + 1;
+    index->starts = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!index->starts)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    index->starts[0] = 0;
+    const char *p = source;
+    for (uint32_t line = 1; line < count; line++)
+    {
+        p = (const char *)memchr(p, '\n', (size_t)(end - p)) + 1;
+        index->starts[line] = (uint32_t)(p - source);
+    }
+    index->count = count;
+}
+
+void line_index_position(LineIndex *index, uint32_t offset, uint32_t *line, uint32_t *column)
+{
+    if (!index->starts)
+        build(index);
+    // the last line starting at or before offset
+    uint32_t low = 0;
+    uint32_t high = index->count;
+    while (high - low > 1)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (index->starts[mid] <= offset)
+            low = mid;
+        else
+            high = mid;
+    }
+    *line = low + 1;
+    *column = offset - index->starts[low] + 1;
+}
@@ -1,31 +1,206 @@
-// Manages the input CSV and the compilation pipeline (Lex -> Parse -> Emit)
-#include "errors.h"
-#include "lexer.h"
-#include "parser.h"
-#include "emitter.h"
-#include "ast.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Program Usage: ./program path/to/my/file.c");
-        panic(ERR_WRONG_ARG_NUM,0);
-    } else {
-        const char *filepath = argv[1];
-        // Lexing
-        TokenList *list = lex_file(filepath);
-        if (!list) {
-            panic(ERR_FILE_NOT_FOUND, 0);
-        }
-        printList(list);
-        // Parsing
-        // ASTNode *ast = parse_tokens(list);
-        // if (!ast) {
-        //     panic(ERR_UNEXPECTED_TOKEN);
-        // }
-        // Emitting
-        //emit(ast);
-    }
-}
\ No newline at end of file
+// Manages the input CSV and the compilation pipeline (Lex -> Parse -> Emit)
+#include "errors.h"
+#include "lexer.h"
+#include "parser.h"
+#include "emitter.h"
+#include "ast.h"
+#include "arena.h"
+#include "batch.h"
+#include "pool.h"
+#include "output.h"
+#include "watch.h"
+#include "daemon.h"
+#include "stats.h"
+#include "diagnostics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// --cache-limit when it isn't given, in MB
+#define DEFAULT_CACHE_LIMIT 256
+
+// Dumps tokens as they are lexed, holding only a window of the input.
+// Returns the number of errors, printed once the file is done.
+static size_t stream_tokens(const char *filepath)
+{
+    DiagnosticList diagnostics;
+    diagnostics_init(&diagnostics, filepath);
+    DiagnosticList *previous = diagnostics_capture(&diagnostics);
+    Lexer *lexer = lexer_open(filepath);
+    if (!lexer) {
+        diagnostic_report(ERR_FILE_NOT_FOUND, DIAGNOSTIC_NO_OFFSET);
+    } else {
+        Token token;
+        size_t resolved = 0;
+        while (lexer_next(lexer, &token)) {
+            // placed now, while the window still holds what they point at
+            for (; resolved < diagnostics.count; resolved++) {
+                Diagnostic *diagnostic = &diagnostics.items[resolved];
+                lexer_position(lexer, diagnostic->offset, &diagnostic->line, &diagnostic->column);
+            }
+            printToken(&token, lexer_token_text(lexer, &token));
+        }
+        lexer_close(lexer);
+    }
+    diagnostics_capture(previous);
+    fflush(stdout);
+    diagnostics_print(stderr, &diagnostics);
+    size_t count = diagnostics.count;
+    diagnostics_free(&diagnostics);
+    return count;
+}
+
+static void usage(void) {
+    printf("Program Usage: ./program [--stream | --tokens | --ast | --highlight | --watch] [-j N] [-o out.tex] [--cache dir [--cache-limit MB]] [--connect socket] [--stats] [--includes] [-I dir ...] [--manifest list.csv] path/to/my/file.c|dir ...\n"
+           "       ./program --serve socket [-j N] [--cache dir [--cache-limit MB]]");
+    panic(ERR_WRONG_ARG_NUM,0);
+}
+
+int main(int argc, char *argv[]) {
+    InputList inputs;
+    input_list_init(&inputs);
+    size_t errors = 0;
+    int stream = 0;
+    int watch = 0;
+    const char *output_path = NULL;
+    const char *cache_dir = NULL;
+    const char *serve_path = NULL;
+    // a daemon there, if one runs, compiles in our place
+    const char *socket_path = getenv("CTOLATEX_SOCKET");
+    long cache_limit = DEFAULT_CACHE_LIMIT;
+    BatchOptions options;
+    options.threads = pool_default_threads();
+    options.mode = OUTPUT_LATEX;
+    options.cache = NULL;
+    options.resolve_includes = 0;
+    // -I directories, pointing into argv
+    const char **include_dirs = (const char **)malloc((size_t)argc * sizeof(char *));
+    if (!include_dirs) {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    }
+    options.include_dirs = include_dirs;
+    options.include_dir_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "--tokens") == 0) {
+            options.mode = OUTPUT_TOKENS;
+        } else if (strcmp(argv[i], "--ast") == 0) {
+            options.mode = OUTPUT_AST;
+        } else if (strcmp(argv[i], "--highlight") == 0) {
+            options.mode = OUTPUT_HIGHLIGHT;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_enabled = 1;
+        } else if (strcmp(argv[i], "--includes") == 0) {
+            options.resolve_includes = 1;
+        } else if (strncmp(argv[i], "-I", 2) == 0) {
+            const char *dir = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!dir) {
+                usage();
+            }
+            include_dirs[options.include_dir_count++] = dir;
+            options.resolve_includes = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        } else if (strncmp(argv[i], "-j", 2) == 0 && strcmp(argv[i], "-") != 0) {
+            const char *count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!count || atoi(count) < 1) {
+                usage();
+            }
+            options.threads = atoi(count);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc) {
+                usage();
+            }
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                usage();
+            }
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-limit") == 0) {
+            if (i + 1 >= argc || atol(argv[i + 1]) < 1) {
+                usage();
+            }
+            cache_limit = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0 || strcmp(argv[i], "--connect") == 0) {
+            if (i + 1 >= argc) {
+                usage();
+            }
+            if (argv[i][2] == 's') {
+                serve_path = argv[++i];
+            } else {
+                socket_path = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 >= argc || input_list_add_manifest(&inputs, argv[++i]) != 0) {
+                panic(ERR_FILE_NOT_FOUND, 0);
+            }
+        } else {
+            input_list_add_path(&inputs, argv[i]);
+        }
+    }
+
+    if (serve_path) {
+        if (inputs.count != 0 || daemon_serve(serve_path, options.threads, cache_dir, (uint64_t)cache_limit * 1024 * 1024) != 0) {
+            panic(ERR_FILE_NOT_FOUND, 0);
+        }
+    } else if (inputs.count == 0 || (watch && inputs.count != 1)) {
+        usage();
+    } else if (watch) {
+        if (watch_file(inputs.paths[0], output_path) != 0) {
+            panic(ERR_FILE_NOT_FOUND, 0);
+        }
+    } else if (stream) {
+        for (size_t i = 0; i < inputs.count; i++) {
+            errors += stream_tokens(inputs.paths[i]);
+        }
+    } else {
+        // Lex -> Parse -> Emit, one file per job
+        uint64_t run_start = stats_clock();
+        Output out;
+        if (!output_path) {
+            output_init_fd(&out, STDOUT_FILENO);
+        } else if (output_open_file(&out, output_path) != 0) {
+            panic(ERR_FILE_NOT_FOUND, 0);
+        }
+        // with --stats the work has to happen here, where it's measured; the
+        // daemon doesn't follow includes
+        if (socket_path && !stats_enabled && !options.resolve_includes && daemon_forward(socket_path, &inputs, options.mode, &out, &errors) == 0) {
+            output_close(&out);
+            input_list_free(&inputs);
+            free(include_dirs);
+            return errors ? EXIT_FAILURE : 0;
+        }
+        Cache cache;
+        if (cache_dir) {
+            // keyed on the mode too: the same file gives other output with --tokens
+            if (cache_open(&cache, cache_dir, (uint64_t)cache_limit * 1024 * 1024, (uint64_t)options.mode) != 0) {
+                panic(ERR_FILE_NOT_FOUND, 0);
+            }
+            options.cache = &cache;
+        }
+        errors = batch_run(&inputs, &options, &out);
+        if (stats_enabled) {
+            Stats written;
+            stats_reset(&written);
+            written.output_bytes = out.flushed + out.length;
+            stats_merge(&written);
+        }
+        // a mapped -o file is only trimmed and unmapped here, which counts as writing
+        uint64_t write_start = stats_clock();
+        output_close(&out);
+        stats_add_span(STAT_WRITE, write_start);
+        if (options.cache) {
+            cache_close(&cache);
+        }
+        if (stats_enabled) {
+            stats_print(stderr, (double)(stats_clock() - run_start) / 1e9);
+        }
+    }
+    input_list_free(&inputs);
+    free(include_dirs);
+    // the output is complete, but some files in it had errors
+    return errors ? EXIT_FAILURE : 0;
+}
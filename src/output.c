@@ -0,0 +1,176 @@
+#include "output.h"
+#include "errors.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// A flush to a file descriptor is one write of about this much
+static const size_t OUTPUT_BLOCK_SIZE = 1024 * 1024;
+static const size_t OUTPUT_MEMORY_INITIAL = 64 * 1024;
+// A mapped file starts this big and doubles; output_close trims it
+static const size_t OUTPUT_MAP_INITIAL = 4 * 1024 * 1024;
+
+// writev until every part is out, picking up after short writes
+static void write_all(int fd, struct iovec *parts, int count)
+{
+    uint64_t start = stats_clock();
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, parts, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            panic(ERR_WRITE_FAILED, 0);
+        }
+        size_t left = (size_t)written;
+        while (count > 0 && left >= parts->iov_len)
+        {
+            left -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = (char *)parts->iov_base + left;
+            parts->iov_len -= left;
+        }
+    }
+    stats_add_span(STAT_WRITE, start);
+}
+
+static size_t grown_capacity(const Output *out, size_t initial, size_t size)
+{
+    size_t capacity = out->capacity ? out->capacity : initial;
+    while (capacity - out->length < size)
+        capacity *= 2;
+    return capacity;
+}
+
+static void grow_heap(Output *out, size_t size)
+{
+    size_t capacity = grown_capacity(out, OUTPUT_MEMORY_INITIAL, size);
+    char *grown = (char *)realloc(out->data, capacity);
+    if (!grown)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    out->data = grown;
+    out->capacity = capacity;
+}
+
+// The file is extended first and mapped again whole; pages already written
+// stay in the page cache, so nothing is copied
+static void grow_mapping(Output *out, size_t size)
+{
+    size_t capacity = grown_capacity(out, OUTPUT_MAP_INITIAL, size);
+    if (out->data)
+        munmap(out->data, out->capacity);
+    if (ftruncate(out->fd, (off_t)capacity) != 0)
+        panic(ERR_WRITE_FAILED, 0);
+    void *mapped = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+    if (mapped == MAP_FAILED)
+        panic(ERR_WRITE_FAILED, 0);
+    out->data = (char *)mapped;
+    out->capacity = capacity;
+}
+
+void output_init_memory(Output *out)
+{
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+    out->flushed = 0;
+    out->fd = OUTPUT_MEMORY;
+    out->is_mapped = 0;
+    out->owns_fd = 0;
+}
+
+void output_init_fd(Output *out, int fd)
+{
+    output_init_memory(out);
+    out->fd = fd;
+    grow_heap(out, OUTPUT_BLOCK_SIZE);
+}
+
+int output_open_file(Output *out, const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        output_init_memory(out);
+        out->fd = fd;
+        out->is_mapped = 1;
+    }
+    else
+        output_init_fd(out, fd);
+    out->owns_fd = 1;
+    return 0;
+}
+
+void output_make_room(Output *out, size_t size)
+{
+    if (out->is_mapped)
+    {
+        grow_mapping(out, size);
+        return;
+    }
+    if (out->fd != OUTPUT_MEMORY)
+    {
+        output_flush(out);
+        if (out->capacity >= size)
+            return;
+    }
+    grow_heap(out, size);
+}
+
+void output_write_block(Output *out, const char *data, size_t size)
+{
+    if (out->fd != OUTPUT_MEMORY && !out->is_mapped)
+    {
+        // the buffer would have to be flushed anyway: one syscall for both
+        struct iovec parts[2] = {{out->data, out->length}, {(void *)data, size}};
+        write_all(out->fd, parts, 2);
+        out->flushed += out->length + size;
+        out->length = 0;
+        return;
+    }
+    output_make_room(out, size);
+    memcpy(out->data + out->length, data, size);
+    out->length += size;
+}
+
+void output_flush(Output *out)
+{
+    if (out->fd == OUTPUT_MEMORY || out->is_mapped || out->length == 0)
+        return;
+    struct iovec part = {out->data, out->length};
+    write_all(out->fd, &part, 1);
+    out->flushed += out->length;
+    out->length = 0;
+}
+
+void output_close(Output *out)
+{
+    if (out->is_mapped)
+    {
+        if (out->data)
+            munmap(out->data, out->capacity);
+        if (ftruncate(out->fd, (off_t)out->length) != 0)
+            panic(ERR_WRITE_FAILED, 0);
+    }
+    else
+    {
+        output_flush(out);
+        free(out->data);
+    }
+    if (out->owns_fd)
+        close(out->fd);
+    output_init_memory(out);
+}
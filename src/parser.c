@@ -0,0 +1,1492 @@
+#include "parser.h"
+#include "errors.h"
+#include <string.h>
+
+// Pending work of the expression parser: an open bracket, or an operator
+// still waiting for its right operand. Brackets sort first.
+typedef enum {
+    FRAME_ROOT,
+    FRAME_GROUP,      // ( e )
+    FRAME_CALL,       // f( args )
+    FRAME_INDEX,      // a[ e ]
+    FRAME_INIT_LIST,  // { elements }
+    FRAME_DESIGNATED, // .x = value, inside an initializer list
+    FRAME_COND_THEN,  // c ? then :
+    FRAME_BINARY,
+    FRAME_COND_ELSE,  // c ? a : else
+    FRAME_PREFIX,     // -x, sizeof x
+    FRAME_CAST,       // (T) x and (T){ ... }
+} FrameKind;
+
+// Identifiers that are really compiler extensions: __attribute__((...)) and
+// friends, skipped wherever they show up
+static const char *const attribute_words[] = {"__attribute__", "__attribute", "__declspec", "__asm__", "__asm", "asm"};
+#define ATTRIBUTE_WORDS (sizeof(attribute_words) / sizeof(attribute_words[0]))
+
+typedef struct {
+    uint8_t kind;       // FrameKind
+    uint8_t op;         // OpCode of the node the frame becomes
+    uint8_t precedence; // an operator's binding strength; the loosest operator a bracket takes
+    uint32_t first;     // token the node starts at
+    uint32_t base;      // operand stack height where the node's children start
+    uint32_t outer;     // brackets: the enclosing bracket frame
+} ExprFrame;
+
+typedef struct {
+    TokenCursor cursor;
+    Token current;
+    uint32_t current_index;
+    uint32_t consumed_end;
+    uint32_t ast_used;
+    uint32_t stack_top;
+} ParserMark;
+
+// A statement that holds statements, open while they are parsed
+typedef enum {
+    STMT_WHOLE, // none open: the statement was parsed in one go
+    STMT_BLOCK,
+    STMT_IF,
+    STMT_WHILE,
+    STMT_DO,
+    STMT_FOR,
+    STMT_SWITCH,
+} StmtKind;
+
+typedef struct {
+    uint8_t kind;    // StmtKind
+    uint8_t in_else; // an if past its else
+    ParserMark mark; // where the statement starts
+} StmtFrame;
+
+// A declarator still open, as in int f(int (*g)(char)) while char is read:
+// each parameter list holds the declarator above it
+typedef struct {
+    uint32_t first;       // token the declarator starts at
+    uint32_t base;        // stack height of its name and initializer slots
+    NodeId name;
+    uint32_t depth;       // brackets open in it, its parameter list aside
+    uint8_t in_params;
+    uint8_t is_function;
+    uint32_t param_first; // in its parameter list: token the open parameter starts at
+    NodeId param_type;    // and that parameter's specifiers
+} DeclFrame;
+
+// The parser reads significant tokens only: comments and preprocessor lines
+// are skipped, and the ones between statements are turned back into
+// AST_PREPROCESSOR nodes where they sit. Nothing panics; a statement or
+// top-level item that doesn't parse is rolled back and kept as AST_UNKNOWN.
+struct Parser {
+    const TokenList *tokens;
+    Ast *ast;
+    TokenCursor cursor;      // raw position just after `current`
+    Token current;           // next significant token, TOKEN_EOF at the end
+    uint32_t current_index;
+    uint32_t consumed_end;   // one past the last significant token consumed
+    uint32_t reach;          // one past the furthest token looked at, kept by rewind_to
+    int failed;
+    NodeId *stack;           // children of the nodes being built
+    uint32_t stack_top;
+    uint32_t stack_capacity;
+    ExprFrame *frames;       // operators and brackets of the expression being parsed
+    uint32_t frames_top;
+    uint32_t frames_capacity;
+    StmtFrame *statements;   // statements still open, innermost last
+    uint32_t statements_top;
+    uint32_t statements_capacity;
+    DeclFrame *declarators;  // declarators still open, innermost last
+    uint32_t declarators_top;
+    uint32_t declarators_capacity;
+    uint32_t directives_from; // parser_next has returned the directives before this token
+    uint32_t attributes[ATTRIBUTE_WORDS]; // their IDs when the tokens are interned
+};
+
+
+// Binding strength of binary operators, loosest first
+enum {
+    PREC_NONE = 0,
+    PREC_COMMA,
+    PREC_ASSIGN,
+    PREC_COND,
+    PREC_LOG_OR,
+    PREC_LOG_AND,
+    PREC_BIT_OR,
+    PREC_BIT_XOR,
+    PREC_BIT_AND,
+    PREC_EQUALITY,
+    PREC_RELATIONAL,
+    PREC_SHIFT,
+    PREC_ADDITIVE,
+    PREC_MULTIPLICATIVE,
+    PREC_UNARY, // prefix operators and casts
+};
+
+typedef struct {
+    uint8_t precedence;
+    uint8_t right_assoc;
+} OpInfo;
+
+static const OpInfo op_info[AST_OP_COUNT] = {
+    [AST_OP_MUL] = {PREC_MULTIPLICATIVE, 0}, [AST_OP_DIV] = {PREC_MULTIPLICATIVE, 0},
+    [AST_OP_MOD] = {PREC_MULTIPLICATIVE, 0}, [AST_OP_ADD] = {PREC_ADDITIVE, 0},
+    [AST_OP_SUB] = {PREC_ADDITIVE, 0},       [AST_OP_SHL] = {PREC_SHIFT, 0},
+    [AST_OP_SHR] = {PREC_SHIFT, 0},          [AST_OP_LT] = {PREC_RELATIONAL, 0},
+    [AST_OP_GT] = {PREC_RELATIONAL, 0},      [AST_OP_LE] = {PREC_RELATIONAL, 0},
+    [AST_OP_GE] = {PREC_RELATIONAL, 0},      [AST_OP_EQ] = {PREC_EQUALITY, 0},
+    [AST_OP_NE] = {PREC_EQUALITY, 0},        [AST_OP_BIT_AND] = {PREC_BIT_AND, 0},
+    [AST_OP_BIT_XOR] = {PREC_BIT_XOR, 0},    [AST_OP_BIT_OR] = {PREC_BIT_OR, 0},
+    [AST_OP_LOG_AND] = {PREC_LOG_AND, 0},    [AST_OP_LOG_OR] = {PREC_LOG_OR, 0},
+    [AST_OP_COND] = {PREC_COND, 1},          [AST_OP_ELVIS] = {PREC_COND, 1},
+    [AST_OP_ASSIGN] = {PREC_ASSIGN, 1},      [AST_OP_MUL_ASSIGN] = {PREC_ASSIGN, 1},
+    [AST_OP_DIV_ASSIGN] = {PREC_ASSIGN, 1},  [AST_OP_MOD_ASSIGN] = {PREC_ASSIGN, 1},
+    [AST_OP_ADD_ASSIGN] = {PREC_ASSIGN, 1},  [AST_OP_SUB_ASSIGN] = {PREC_ASSIGN, 1},
+    [AST_OP_SHL_ASSIGN] = {PREC_ASSIGN, 1},  [AST_OP_SHR_ASSIGN] = {PREC_ASSIGN, 1},
+    [AST_OP_AND_ASSIGN] = {PREC_ASSIGN, 1},  [AST_OP_XOR_ASSIGN] = {PREC_ASSIGN, 1},
+    [AST_OP_OR_ASSIGN] = {PREC_ASSIGN, 1},   [AST_OP_COMMA] = {PREC_COMMA, 0},
+};
+
+// ---- token access ----
+
+static void reached(Parser *p, const TokenCursor *cursor)
+{
+    uint32_t end = cursor_position(cursor);
+    if (end > p->reach)
+        p->reach = end;
+}
+
+static void advance(Parser *p)
+{
+    if (p->current.type != TOKEN_EOF)
+        p->consumed_end = p->current_index + 1;
+    for (;;)
+    {
+        uint32_t index = cursor_position(&p->cursor);
+        if (!cursor_next(&p->cursor, &p->current))
+        {
+            p->current_index = p->tokens->count;
+            break;
+        }
+        if (p->current.type != TOKEN_COMMENT && p->current.type != TOKEN_PREPROCESSOR)
+        {
+            p->current_index = index;
+            break;
+        }
+    }
+    reached(p, &p->cursor);
+}
+
+// Moves a lookahead cursor to the next significant token; at the end
+// `out` is left as it was
+static void scan_next(Parser *p, TokenCursor *cursor, Token *out)
+{
+    while (cursor_next(cursor, out))
+    {
+        if (out->type != TOKEN_COMMENT && out->type != TOKEN_PREPROCESSOR)
+            break;
+    }
+    reached(p, cursor);
+}
+
+// The significant token after the current one
+static void peek(Parser *p, Token *out)
+{
+    TokenCursor cursor = p->cursor;
+    *out = p->current;
+    scan_next(p, &cursor, out);
+}
+
+static int token_is(const Parser *p, const Token *tok, const char *text)
+{
+    size_t length = strlen(text);
+    return tok->length == length && memcmp(token_text(p->tokens, tok), text, length) == 0;
+}
+
+static int at(const Parser *p, TokenType type)
+{
+    return p->current.type == type;
+}
+
+static int at_text(const Parser *p, const char *text)
+{
+    return token_is(p, &p->current, text);
+}
+
+static int accept(Parser *p, TokenType type)
+{
+    if (!at(p, type))
+        return 0;
+    advance(p);
+    return 1;
+}
+
+static void expect(Parser *p, TokenType type)
+{
+    if (!accept(p, type))
+        p->failed = 1;
+}
+
+static void expect_text(Parser *p, const char *text)
+{
+    if (at_text(p, text))
+        advance(p);
+    else
+        p->failed = 1;
+}
+
+static void mark(const Parser *p, ParserMark *m)
+{
+    m->cursor = p->cursor;
+    m->current = p->current;
+    m->current_index = p->current_index;
+    m->consumed_end = p->consumed_end;
+    m->ast_used = p->ast->used;
+    m->stack_top = p->stack_top;
+}
+
+static void rewind_to(Parser *p, const ParserMark *m)
+{
+    p->cursor = m->cursor;
+    p->current = m->current;
+    p->current_index = m->current_index;
+    p->consumed_end = m->consumed_end;
+    ast_truncate(p->ast, m->ast_used);
+    p->stack_top = m->stack_top;
+    p->failed = 0;
+}
+
+// ---- node building ----
+
+static void push(Parser *p, NodeId id)
+{
+    if (p->stack_top == p->stack_capacity)
+    {
+        uint32_t capacity = p->stack_capacity ? p->stack_capacity * 2 : 64;
+        p->stack = (NodeId *)arena_realloc(p->ast->arena, p->stack, p->stack_capacity * sizeof(NodeId),
+                                           capacity * sizeof(NodeId));
+        p->stack_capacity = capacity;
+    }
+    p->stack[p->stack_top++] = id;
+}
+
+// A node over [first, last consumed token] whose children are the ones pushed since `base`
+static NodeId finish(Parser *p, NodeType type, OpCode op, uint32_t first, uint32_t base)
+{
+    NodeId id = ast_add(p->ast, type, op, first, p->consumed_end - 1, p->stack + base, p->stack_top - base);
+    p->stack_top = base;
+    return id;
+}
+
+static NodeId leaf(Parser *p, NodeType type, uint32_t first)
+{
+    return ast_add(p->ast, type, AST_OP_NONE, first, p->consumed_end - 1, NULL, 0);
+}
+
+static NodeId node2(Parser *p, NodeType type, OpCode op, uint32_t first, NodeId a, NodeId b)
+{
+    NodeId children[2] = {a, b};
+    return ast_add(p->ast, type, op, first, p->consumed_end - 1, children, 2);
+}
+
+// ---- classification ----
+
+// Keywords that can open a declaration
+static int is_declaration_keyword(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_KW_AUTO: case TOKEN_KW_CHAR: case TOKEN_KW_CONST: case TOKEN_KW_DOUBLE:
+    case TOKEN_KW_ENUM: case TOKEN_KW_EXTERN: case TOKEN_KW_FLOAT: case TOKEN_KW_INT:
+    case TOKEN_KW_LONG: case TOKEN_KW_REGISTER: case TOKEN_KW_SHORT: case TOKEN_KW_SIGNED:
+    case TOKEN_KW_STATIC: case TOKEN_KW_STRUCT: case TOKEN_KW_TYPEDEF: case TOKEN_KW_UNION:
+    case TOKEN_KW_UNSIGNED: case TOKEN_KW_VOID: case TOKEN_KW_VOLATILE: case TOKEN_KW_INLINE:
+    case TOKEN_KW_RESTRICT: case TOKEN_KW_BOOL: case TOKEN_KW_COMPLEX: case TOKEN_KW_IMAGINARY:
+    case TOKEN_KW_ALIGNAS: case TOKEN_KW_ATOMIC: case TOKEN_KW_NORETURN: case TOKEN_KW_STATIC_ASSERT:
+    case TOKEN_KW_THREAD_LOCAL:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Keywords that name or qualify a type, i.e. can start a type name in a cast
+static int is_type_keyword(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_KW_CHAR: case TOKEN_KW_CONST: case TOKEN_KW_DOUBLE: case TOKEN_KW_ENUM:
+    case TOKEN_KW_FLOAT: case TOKEN_KW_INT: case TOKEN_KW_LONG: case TOKEN_KW_SHORT:
+    case TOKEN_KW_SIGNED: case TOKEN_KW_STRUCT: case TOKEN_KW_UNION: case TOKEN_KW_UNSIGNED:
+    case TOKEN_KW_VOID: case TOKEN_KW_VOLATILE: case TOKEN_KW_RESTRICT: case TOKEN_KW_BOOL:
+    case TOKEN_KW_COMPLEX: case TOKEN_KW_IMAGINARY: case TOKEN_KW_ATOMIC:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Keywords that settle the base type (as opposed to qualifiers and storage classes)
+static int is_type_specifier(TokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_KW_CHAR: case TOKEN_KW_DOUBLE: case TOKEN_KW_FLOAT: case TOKEN_KW_INT:
+    case TOKEN_KW_LONG: case TOKEN_KW_SHORT: case TOKEN_KW_SIGNED: case TOKEN_KW_UNSIGNED:
+    case TOKEN_KW_VOID: case TOKEN_KW_BOOL: case TOKEN_KW_COMPLEX: case TOKEN_KW_IMAGINARY:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int is_attribute(const Parser *p, const Token *tok)
+{
+    if (tok->type != TOKEN_IDENTIFIER)
+        return 0;
+    for (size_t i = 0; i < ATTRIBUTE_WORDS; i++)
+    {
+        if (tok->name != INTERN_NONE ? tok->name == p->attributes[i] : token_is(p, tok, attribute_words[i]))
+            return 1;
+    }
+    return 0;
+}
+
+// A typedef name from the file's headers, when they were looked at
+static int is_type_name(const Parser *p, const Token *tok)
+{
+    return tok->type == TOKEN_IDENTIFIER && p->tokens->types && intern_set_has(p->tokens->types, tok->name);
+}
+
+static int is_closer(TokenType type)
+{
+    return type == TOKEN_PAREN_CLOSE || type == TOKEN_BRACKET_CLOSE || type == TOKEN_BRACE_CLOSE;
+}
+
+static int is_opener(TokenType type)
+{
+    return type == TOKEN_PAREN_OPEN || type == TOKEN_BRACKET_OPEN || type == TOKEN_BRACE_OPEN;
+}
+
+// Skips a balanced (), [] or {} group starting at the current token
+static void skip_group(Parser *p)
+{
+    uint32_t depth = 0;
+    do
+    {
+        if (at(p, TOKEN_EOF))
+        {
+            p->failed = 1;
+            return;
+        }
+        if (is_opener(p->current.type))
+            depth++;
+        else if (is_closer(p->current.type))
+            depth--;
+        advance(p);
+    } while (depth > 0);
+}
+
+// Does the statement starting here declare something? Decided on a few
+// tokens of lookahead, as only the typedef names of headers are known.
+static int is_declaration_start(Parser *p)
+{
+    if (is_declaration_keyword(p->current.type))
+        return 1;
+    if (!at(p, TOKEN_IDENTIFIER))
+        return 0;
+    TokenCursor cursor = p->cursor;
+    Token next = p->current;
+    scan_next(p, &cursor, &next);
+    if (next.type == TOKEN_IDENTIFIER || is_declaration_keyword(next.type))
+        return 1;
+    // T (*f)(int); unless T is a label
+    if (is_type_name(p, &p->current))
+        return !token_is(p, &next, ":");
+    if (!token_is(p, &next, "*"))
+        return 0;
+    // T *x; T **x = ...; as a statement, a * b; is more likely a declaration
+    do
+        scan_next(p, &cursor, &next);
+    while (token_is(p, &next, "*") || next.type == TOKEN_KW_CONST);
+    if (next.type != TOKEN_IDENTIFIER)
+        return 0;
+    scan_next(p, &cursor, &next);
+    return next.type == TOKEN_SEMICOLON || next.type == TOKEN_COMMA || next.type == TOKEN_BRACKET_OPEN ||
+           next.type == TOKEN_PAREN_CLOSE || token_is(p, &next, "=");
+}
+
+// Is the '(' here the start of a cast or compound literal?
+static int is_cast_start(Parser *p)
+{
+    TokenCursor cursor = p->cursor;
+    Token next = p->current;
+    scan_next(p, &cursor, &next);
+    if (is_type_keyword(next.type))
+        return 1;
+    if (next.type != TOKEN_IDENTIFIER)
+        return 0;
+    // (T)(x) and (T)-1 too, which are only told from expressions by knowing T
+    if (is_type_name(p, &next))
+        return 1;
+    scan_next(p, &cursor, &next);
+    if (token_is(p, &next, "*"))
+    {
+        // (T *) and (T **const)
+        while (token_is(p, &next, "*") || next.type == TOKEN_KW_CONST)
+            scan_next(p, &cursor, &next);
+        return next.type == TOKEN_PAREN_CLOSE;
+    }
+    if (next.type != TOKEN_PAREN_CLOSE)
+        return 0;
+    // (T) x, as opposed to (x) + y
+    scan_next(p, &cursor, &next);
+    switch (next.type)
+    {
+    case TOKEN_IDENTIFIER:
+    case TOKEN_INT_LITERAL:
+    case TOKEN_FLOAT_LITERAL:
+    case TOKEN_CHAR_LITERAL:
+    case TOKEN_STRING_LITERAL:
+    case TOKEN_BRACE_OPEN:
+        return 1;
+    default:
+        return token_is(p, &next, "!") || token_is(p, &next, "~");
+    }
+}
+
+// ---- expressions ----
+
+static NodeId parse_block(Parser *p);
+
+// The binary operator at the current token, and how many tokens it spans
+static OpCode binary_op(Parser *p, uint32_t *width)
+{
+    const Token *tok = &p->current;
+    *width = 1;
+    switch (tok->type)
+    {
+    case TOKEN_COMMA:
+        return AST_OP_COMMA;
+    case TOKEN_OPERATOR:
+    case TOKEN_ASSIGNMENT_OPERATOR:
+    case TOKEN_BITWISE_OPERATOR:
+    case TOKEN_LOGIC_OPERATOR:
+        break;
+    default:
+        return AST_OP_NONE;
+    }
+
+    const char *text = token_text(p->tokens, tok);
+    OpCode op = AST_OP_NONE;
+    if (tok->length == 1)
+    {
+        switch (text[0])
+        {
+        case '*': op = AST_OP_MUL; break;
+        case '/': op = AST_OP_DIV; break;
+        case '%': op = AST_OP_MOD; break;
+        case '+': op = AST_OP_ADD; break;
+        case '-': op = AST_OP_SUB; break;
+        case '<': op = AST_OP_LT; break;
+        case '>': op = AST_OP_GT; break;
+        case '&': op = AST_OP_BIT_AND; break;
+        case '^': op = AST_OP_BIT_XOR; break;
+        case '|': op = AST_OP_BIT_OR; break;
+        case '?': op = AST_OP_COND; break;
+        case '=': op = AST_OP_ASSIGN; break;
+        default: return AST_OP_NONE;
+        }
+    }
+    else if (tok->length == 2)
+    {
+        static const struct {
+            char text[3];
+            OpCode op;
+        } pairs[] = {
+            {"<<", AST_OP_SHL},        {">>", AST_OP_SHR},        {"<=", AST_OP_LE},         {">=", AST_OP_GE},
+            {"==", AST_OP_EQ},         {"!=", AST_OP_NE},         {"&&", AST_OP_LOG_AND},    {"||", AST_OP_LOG_OR},
+            {"?:", AST_OP_ELVIS},      {"*=", AST_OP_MUL_ASSIGN}, {"/=", AST_OP_DIV_ASSIGN}, {"+=", AST_OP_ADD_ASSIGN},
+            {"-=", AST_OP_SUB_ASSIGN}, {"&=", AST_OP_AND_ASSIGN},
+        };
+        for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+        {
+            if (text[0] == pairs[i].text[0] && text[1] == pairs[i].text[1])
+            {
+                op = pairs[i].op;
+                break;
+            }
+        }
+        if (op == AST_OP_NONE)
+            return AST_OP_NONE;
+    }
+    else
+        return AST_OP_NONE;
+
+    // the lexer has no %= ^= |= <<= >>=, they arrive as the operator then an adjacent =
+    if (op == AST_OP_MOD || op == AST_OP_BIT_XOR || op == AST_OP_BIT_OR || op == AST_OP_SHL || op == AST_OP_SHR)
+    {
+        Token next;
+        peek(p, &next);
+        if (next.offset == tok->offset + tok->length && token_is(p, &next, "="))
+        {
+            *width = 2;
+            switch (op)
+            {
+            case AST_OP_MOD: return AST_OP_MOD_ASSIGN;
+            case AST_OP_BIT_XOR: return AST_OP_XOR_ASSIGN;
+            case AST_OP_BIT_OR: return AST_OP_OR_ASSIGN;
+            case AST_OP_SHL: return AST_OP_SHL_ASSIGN;
+            default: return AST_OP_SHR_ASSIGN;
+            }
+        }
+    }
+    return op;
+}
+
+static OpCode prefix_op(const Parser *p)
+{
+    const Token *tok = &p->current;
+    if (tok->type == TOKEN_KW_SIZEOF || tok->type == TOKEN_KW_ALIGNOF)
+        return AST_OP_SIZEOF;
+    if (tok->length > 2)
+        return AST_OP_NONE;
+    const char *text = token_text(p->tokens, tok);
+    if (tok->length == 2)
+    {
+        if (text[0] == '+' && text[1] == '+')
+            return AST_OP_PRE_INC;
+        if (text[0] == '-' && text[1] == '-')
+            return AST_OP_PRE_DEC;
+        return AST_OP_NONE;
+    }
+    switch (text[0])
+    {
+    case '-': return AST_OP_NEG;
+    case '+': return AST_OP_PLUS;
+    case '!': return AST_OP_NOT;
+    case '~': return AST_OP_BIT_NOT;
+    case '*': return AST_OP_DEREF;
+    case '&': return AST_OP_ADDR;
+    default: return AST_OP_NONE;
+    }
+}
+
+// A parenthesised type name, as a token range; leaves the ')' current
+static NodeId parse_type_name(Parser *p)
+{
+    uint32_t first = p->current_index;
+    uint32_t depth = 0;
+    while (!at(p, TOKEN_EOF) && !(depth == 0 && at(p, TOKEN_PAREN_CLOSE)))
+    {
+        if (is_opener(p->current.type))
+            depth++;
+        else if (is_closer(p->current.type))
+            depth--;
+        advance(p);
+    }
+    if (p->current_index == first)
+    {
+        p->failed = 1;
+        return AST_NONE;
+    }
+    return leaf(p, AST_TYPE, first);
+}
+
+// Reduces the operator frame on top: its children are the operands pushed
+// since it opened
+static void reduce(Parser *p)
+{
+    static const uint8_t node_types[] = {
+        [FRAME_BINARY] = AST_BINARY_OP,
+        [FRAME_COND_ELSE] = AST_TERNARY,
+        [FRAME_PREFIX] = AST_UNARY_OP,
+        [FRAME_CAST] = AST_CAST,
+    };
+    const ExprFrame *frame = &p->frames[--p->frames_top];
+    push(p, finish(p, (NodeType)node_types[frame->kind], (OpCode)frame->op, frame->first, frame->base));
+}
+
+static uint32_t push_frame(Parser *p, FrameKind kind, OpCode op, int precedence, uint32_t first, uint32_t base,
+                           uint32_t outer)
+{
+    if (p->frames_top == p->frames_capacity)
+    {
+        uint32_t capacity = p->frames_capacity ? p->frames_capacity * 2 : 32;
+        p->frames = (ExprFrame *)arena_realloc(p->ast->arena, p->frames, p->frames_capacity * sizeof(ExprFrame),
+                                               capacity * sizeof(ExprFrame));
+        p->frames_capacity = capacity;
+    }
+    p->frames[p->frames_top] = (ExprFrame){(uint8_t)kind, (uint8_t)op, (uint8_t)precedence, first, base, outer};
+    return p->frames_top++;
+}
+
+/*
+Operator precedence parsing without recursion. Operands and finished
+subtrees sit on p->stack, pending operators and open brackets on
+p->frames, so nesting depth costs heap rather than C stack and every
+token is shifted once and reduced once. The loop is a small state machine:
+
+  operand   a prefix operator, cast, literal, name, '(' or '{' is expected
+  postfix   calls, subscripts, members and ++/-- on the operand just read
+  binary    an infix operator is shifted after reducing the tighter ones
+            below it, or anything else ends the innermost bracket
+  element   the start of an initializer list element, maybe designated
+
+`context` is the innermost bracket frame: its precedence is the loosest
+operator it accepts, so a ',' ends a call argument but not a subscript.
+*/
+static NodeId parse_expression(Parser *p, int min_precedence)
+{
+    uint32_t root = push_frame(p, FRAME_ROOT, AST_OP_NONE, min_precedence, p->current_index, p->stack_top, 0);
+    uint32_t context = root;
+    uint32_t operand_first = p->current_index; // where the operand on top of the stack starts
+    uint32_t first;
+    uint32_t width;
+    OpCode op;
+
+operand:
+    first = p->current_index;
+    op = prefix_op(p);
+    if (op != AST_OP_NONE)
+    {
+        advance(p);
+        if (op == AST_OP_SIZEOF && at(p, TOKEN_PAREN_OPEN) && is_cast_start(p))
+        {
+            advance(p);
+            push(p, parse_type_name(p));
+            expect(p, TOKEN_PAREN_CLOSE);
+            if (p->failed)
+                goto fail;
+            push(p, finish(p, AST_SIZEOF_TYPE, AST_OP_NONE, first, p->stack_top - 1));
+            operand_first = first;
+            goto binary;
+        }
+        push_frame(p, FRAME_PREFIX, op, PREC_UNARY, first, p->stack_top, context);
+        goto operand;
+    }
+    if (at(p, TOKEN_PAREN_OPEN) && is_cast_start(p))
+    {
+        // (T) x, or the compound literal (T){ ... } when a '{' follows
+        advance(p);
+        uint32_t base = p->stack_top;
+        push(p, parse_type_name(p));
+        expect(p, TOKEN_PAREN_CLOSE);
+        if (p->failed)
+            goto fail;
+        push_frame(p, FRAME_CAST, AST_OP_NONE, PREC_UNARY, first, base, context);
+        goto operand;
+    }
+    switch (p->current.type)
+    {
+    case TOKEN_IDENTIFIER:
+        advance(p);
+        push(p, leaf(p, AST_IDENTIFIER, first));
+        break;
+    case TOKEN_INT_LITERAL:
+        advance(p);
+        push(p, leaf(p, AST_INT_LITERAL, first));
+        break;
+    case TOKEN_FLOAT_LITERAL:
+        advance(p);
+        push(p, leaf(p, AST_FLOAT_LITERAL, first));
+        break;
+    case TOKEN_CHAR_LITERAL:
+        advance(p);
+        push(p, leaf(p, AST_CHAR_LITERAL, first));
+        break;
+    case TOKEN_STRING_LITERAL:
+        while (at(p, TOKEN_STRING_LITERAL))
+            advance(p);
+        push(p, leaf(p, AST_STRING_LITERAL, first));
+        break;
+    case TOKEN_PAREN_OPEN:
+        context = push_frame(p, FRAME_GROUP, AST_OP_NONE, PREC_COMMA, first, p->stack_top, context);
+        advance(p);
+        goto operand;
+    case TOKEN_BRACE_OPEN:
+        context = push_frame(p, FRAME_INIT_LIST, AST_OP_NONE, PREC_ASSIGN, first, p->stack_top, context);
+        advance(p);
+        goto element;
+    default:
+        goto fail;
+    }
+    operand_first = first;
+
+postfix:
+    first = operand_first;
+    if (at(p, TOKEN_PAREN_OPEN))
+    {
+        context = push_frame(p, FRAME_CALL, AST_OP_NONE, PREC_ASSIGN, first, p->stack_top - 1, context);
+        advance(p);
+        if (at(p, TOKEN_PAREN_CLOSE))
+            goto terminator;
+        goto operand;
+    }
+    if (at(p, TOKEN_BRACKET_OPEN))
+    {
+        context = push_frame(p, FRAME_INDEX, AST_OP_NONE, PREC_COMMA, first, p->stack_top - 1, context);
+        advance(p);
+        goto operand;
+    }
+    if (at(p, TOKEN_DOT) || at(p, TOKEN_ARROW))
+    {
+        op = at(p, TOKEN_DOT) ? AST_OP_DOT : AST_OP_ARROW;
+        advance(p);
+        uint32_t name_first = p->current_index;
+        expect(p, TOKEN_IDENTIFIER);
+        if (p->failed)
+            goto fail;
+        push(p, leaf(p, AST_IDENTIFIER, name_first));
+        push(p, finish(p, AST_MEMBER, op, first, p->stack_top - 2));
+        goto postfix;
+    }
+    if (at_text(p, "++") || at_text(p, "--"))
+    {
+        op = at_text(p, "++") ? AST_OP_POST_INC : AST_OP_POST_DEC;
+        advance(p);
+        push(p, finish(p, AST_UNARY_OP, op, first, p->stack_top - 1));
+        goto postfix;
+    }
+
+binary:
+    op = binary_op(p, &width);
+    if (op == AST_OP_NONE || op_info[op].precedence < p->frames[context].precedence)
+        goto terminator;
+    while (p->frames[p->frames_top - 1].kind >= FRAME_BINARY)
+    {
+        const ExprFrame *top = &p->frames[p->frames_top - 1];
+        if (top->precedence < op_info[op].precedence ||
+            (top->precedence == op_info[op].precedence && op_info[op].right_assoc))
+            break;
+        operand_first = top->first;
+        reduce(p);
+    }
+    while (width--)
+        advance(p);
+    if (op == AST_OP_COND)
+        context = push_frame(p, FRAME_COND_THEN, AST_OP_NONE, PREC_COMMA, operand_first, p->stack_top - 1, context);
+    else
+        push_frame(p, FRAME_BINARY, op, op_info[op].precedence, operand_first, p->stack_top - 1, context);
+    goto operand;
+
+element:
+    if (at(p, TOKEN_BRACE_CLOSE))
+        goto terminator;
+    if (at(p, TOKEN_DOT) || at(p, TOKEN_BRACKET_OPEN))
+    {
+        // .x = v, [2] = v: the designator is kept as a token range
+        first = p->current_index;
+        uint32_t base = p->stack_top;
+        while (!at(p, TOKEN_EOF) && !at_text(p, "="))
+        {
+            if (at(p, TOKEN_BRACKET_OPEN))
+                skip_group(p);
+            else
+                advance(p);
+        }
+        push(p, leaf(p, AST_DESIGNATOR, first));
+        expect_text(p, "=");
+        if (p->failed)
+            goto fail;
+        context = push_frame(p, FRAME_DESIGNATED, AST_OP_ASSIGN, PREC_ASSIGN, first, base, context);
+    }
+    goto operand;
+
+terminator:
+    // nothing more binds here: close the operators, then the innermost bracket
+    while (p->frames[p->frames_top - 1].kind >= FRAME_BINARY)
+        reduce(p);
+    ExprFrame *frame = &p->frames[context];
+    operand_first = frame->first;
+    switch ((FrameKind)frame->kind)
+    {
+    case FRAME_ROOT:
+        break;
+    case FRAME_GROUP:
+        expect(p, TOKEN_PAREN_CLOSE);
+        if (p->failed)
+            goto fail;
+        context = frame->outer;
+        p->frames_top--;
+        goto postfix;
+    case FRAME_CALL:
+        if (accept(p, TOKEN_COMMA) && !at(p, TOKEN_PAREN_CLOSE))
+            goto operand;
+        expect(p, TOKEN_PAREN_CLOSE);
+        if (p->failed)
+            goto fail;
+        push(p, finish(p, AST_CALL, AST_OP_NONE, frame->first, frame->base));
+        context = frame->outer;
+        p->frames_top--;
+        goto postfix;
+    case FRAME_INDEX:
+        expect(p, TOKEN_BRACKET_CLOSE);
+        if (p->failed)
+            goto fail;
+        push(p, finish(p, AST_INDEX, AST_OP_NONE, frame->first, frame->base));
+        context = frame->outer;
+        p->frames_top--;
+        goto postfix;
+    case FRAME_COND_THEN:
+        expect_text(p, ":");
+        if (p->failed)
+            goto fail;
+        // the else branch is an operand of a right-associative operator
+        frame->kind = FRAME_COND_ELSE;
+        frame->precedence = PREC_COND;
+        context = frame->outer;
+        goto operand;
+    case FRAME_DESIGNATED:
+        push(p, finish(p, AST_BINARY_OP, AST_OP_ASSIGN, frame->first, frame->base));
+        context = frame->outer;
+        p->frames_top--;
+        goto terminator;
+    case FRAME_INIT_LIST:
+        if (accept(p, TOKEN_COMMA))
+            goto element;
+        expect(p, TOKEN_BRACE_CLOSE);
+        if (p->failed)
+            goto fail;
+        push(p, finish(p, AST_INIT_LIST, AST_OP_NONE, frame->first, frame->base));
+        context = frame->outer;
+        p->frames_top--;
+        // a cast right below is a compound literal, which takes postfix operators
+        if (p->frames[p->frames_top - 1].kind == FRAME_CAST)
+        {
+            operand_first = p->frames[p->frames_top - 1].first;
+            reduce(p);
+        }
+        goto postfix;
+    default:
+        goto fail;
+    }
+    p->frames_top = root;
+    return p->stack[--p->stack_top];
+
+fail:
+    p->failed = 1;
+    p->stack_top = p->frames[root].base;
+    p->frames_top = root;
+    return AST_NONE;
+}
+
+// ---- declarations ----
+
+// Storage classes, qualifiers and the type, as one token range. Returns
+// AST_NONE when there are none (implicit int, or K&R parameter names).
+static NodeId parse_specifiers(Parser *p)
+{
+    uint32_t first = p->current_index;
+    int have_type = 0;
+    for (;;)
+    {
+        TokenType type = p->current.type;
+        if (type == TOKEN_KW_STRUCT || type == TOKEN_KW_UNION || type == TOKEN_KW_ENUM)
+        {
+            advance(p);
+            while (is_attribute(p, &p->current))
+            {
+                advance(p);
+                if (at(p, TOKEN_PAREN_OPEN))
+                    skip_group(p);
+            }
+            accept(p, TOKEN_IDENTIFIER);
+            // member lists stay a token range, the output shows them as written
+            if (at(p, TOKEN_BRACE_OPEN))
+                skip_group(p);
+            have_type = 1;
+        }
+        else if (type == TOKEN_KW_ALIGNAS || (type == TOKEN_KW_ATOMIC && !have_type))
+        {
+            advance(p);
+            if (at(p, TOKEN_PAREN_OPEN))
+            {
+                skip_group(p);
+                have_type = 1;
+            }
+        }
+        else if (is_declaration_keyword(type) && type != TOKEN_KW_STATIC_ASSERT)
+        {
+            have_type |= is_type_specifier(type);
+            advance(p);
+        }
+        else if (is_attribute(p, &p->current))
+        {
+            advance(p);
+            if (at(p, TOKEN_PAREN_OPEN))
+                skip_group(p);
+        }
+        else if (type == TOKEN_IDENTIFIER && !have_type)
+        {
+            // a typedef name, unless it's the declarator itself: T x, T *x, T const;
+            // a known one is a type whatever follows, as in T (*f)(int)
+            Token next;
+            peek(p, &next);
+            if (!is_type_name(p, &p->current) && next.type != TOKEN_IDENTIFIER &&
+                !is_declaration_keyword(next.type) && !token_is(p, &next, "*"))
+                break;
+            have_type = 1;
+            advance(p);
+        }
+        else
+            break;
+        if (p->failed)
+            return AST_NONE;
+    }
+    if (p->current_index == first)
+        return AST_NONE;
+    return leaf(p, AST_TYPE, first);
+}
+
+// Opens a declarator at the current token, with slots for its name and
+// initializer that are filled in when it closes
+static void open_declarator(Parser *p, int in_params)
+{
+    if (p->declarators_top == p->declarators_capacity)
+    {
+        uint32_t capacity = p->declarators_capacity ? p->declarators_capacity * 2 : 16;
+        p->declarators = (DeclFrame *)arena_realloc(p->ast->arena, p->declarators,
+                                                    p->declarators_capacity * sizeof(DeclFrame),
+                                                    capacity * sizeof(DeclFrame));
+        p->declarators_capacity = capacity;
+    }
+    DeclFrame *frame = &p->declarators[p->declarators_top++];
+    memset(frame, 0, sizeof(*frame));
+    frame->first = p->current_index;
+    frame->base = p->stack_top;
+    frame->name = AST_NONE;
+    frame->in_params = (uint8_t)in_params;
+    push(p, AST_NONE);
+    push(p, AST_NONE);
+}
+
+// Starts the next parameter in the list of the declarator on top: its
+// specifiers here, its declarator as a new frame
+static void open_param(Parser *p)
+{
+    uint32_t first = p->current_index;
+    NodeId type = parse_specifiers(p);
+    DeclFrame *frame = &p->declarators[p->declarators_top - 1];
+    frame->param_first = first;
+    frame->param_type = type;
+    if (!p->failed)
+        open_declarator(p, 1);
+}
+
+// Closes the declarator on top at the ',' ';' '{' '=' ':' or ')' that ends
+// it, taking its initializer or bit-field width
+static NodeId close_declarator(Parser *p)
+{
+    // a copy, as the expressions may open declarators of their own
+    DeclFrame frame = p->declarators[--p->declarators_top];
+    p->stack[frame.base] = frame.name;
+    // the slot is written after the call, as the expression's operands may
+    // move the stack
+    if (!frame.in_params && at_text(p, "="))
+    {
+        advance(p);
+        NodeId init = parse_expression(p, PREC_ASSIGN);
+        if (p->failed)
+            return AST_NONE;
+        p->stack[frame.base + 1] = init;
+    }
+    else if (at_text(p, ":"))
+    {
+        // bit-field width
+        advance(p);
+        NodeId width = parse_expression(p, PREC_ASSIGN);
+        p->stack[frame.base + 1] = width;
+    }
+    if (p->current_index == frame.first)
+    {
+        p->stack_top = frame.base;
+        return AST_NONE;
+    }
+    NodeId id = finish(p, AST_DECLARATOR, AST_OP_NONE, frame.first, frame.base);
+    if (frame.is_function)
+        ast_set_flags(p->ast, id, AST_FLAG_FUNCTION);
+    return id;
+}
+
+// The parameter on top has its declarator: one AST_PARAM, then the next
+// parameter or the list's ')'
+static void close_param(Parser *p, NodeId declarator)
+{
+    const DeclFrame *frame = &p->declarators[p->declarators_top - 1];
+    if (p->current_index == frame->param_first)
+    {
+        p->failed = 1;
+        return;
+    }
+    push(p, node2(p, AST_PARAM, AST_OP_NONE, frame->param_first, frame->param_type, declarator));
+    if (accept(p, TOKEN_COMMA) && !at(p, TOKEN_PAREN_CLOSE))
+        open_param(p);
+    else
+        expect(p, TOKEN_PAREN_CLOSE);
+}
+
+/*
+Everything between the specifiers and the next ',' or ';' (or ')' in a
+parameter list): pointers, the name, array sizes, parameters, initializer.
+Only the name, the parameters and the initializer become nodes. The
+declarators of parameters are frames on p->declarators rather than calls,
+so function pointers nested however deep cost heap and not C stack.
+*/
+static NodeId parse_declarator(Parser *p, int in_params)
+{
+    uint32_t bottom = p->declarators_top;
+    open_declarator(p, in_params);
+    while (!p->failed)
+    {
+        DeclFrame *frame = &p->declarators[p->declarators_top - 1];
+        TokenType type = p->current.type;
+        if (type == TOKEN_EOF)
+            p->failed = 1;
+        else if (frame->depth == 0 && (type == TOKEN_COMMA || type == TOKEN_SEMICOLON || type == TOKEN_BRACE_OPEN ||
+                                       type == TOKEN_PAREN_CLOSE || at_text(p, "=") || at_text(p, ":")))
+        {
+            if (type == TOKEN_PAREN_CLOSE && !frame->in_params)
+            {
+                p->failed = 1;
+                break;
+            }
+            NodeId declarator = close_declarator(p);
+            if (p->declarators_top == bottom)
+                return p->failed ? AST_NONE : declarator;
+            if (!p->failed)
+                close_param(p, declarator);
+        }
+        else if (is_attribute(p, &p->current))
+        {
+            advance(p);
+            if (at(p, TOKEN_PAREN_OPEN))
+                skip_group(p);
+        }
+        else if (type == TOKEN_PAREN_OPEN && frame->name != AST_NONE && !frame->is_function)
+        {
+            // the first parameter list after the name; in (*f)(int) it follows the closing paren
+            frame->is_function = 1;
+            advance(p);
+            if (!accept(p, TOKEN_PAREN_CLOSE))
+                open_param(p);
+        }
+        else if (type == TOKEN_IDENTIFIER && frame->name == AST_NONE)
+        {
+            uint32_t name_first = p->current_index;
+            advance(p);
+            frame->name = leaf(p, AST_IDENTIFIER, name_first);
+        }
+        else
+        {
+            if (is_opener(type))
+                frame->depth++;
+            else if (is_closer(type))
+                frame->depth--;
+            advance(p);
+        }
+    }
+    p->declarators_top = bottom;
+    return AST_NONE;
+}
+
+// A declaration up to its ';', or a whole function definition when
+// `allow_function` is set and a body follows the first declarator
+static NodeId parse_declaration(Parser *p, int allow_function)
+{
+    uint32_t first = p->current_index;
+    uint32_t base = p->stack_top;
+    NodeId type = parse_specifiers(p);
+    push(p, type);
+    while (!p->failed && !at(p, TOKEN_SEMICOLON))
+    {
+        NodeId declarator = parse_declarator(p, 0);
+        if (p->failed)
+            return AST_NONE;
+        if (declarator == AST_NONE)
+        {
+            p->failed = 1;
+            return AST_NONE;
+        }
+        if (allow_function && p->stack_top == base + 1 && at(p, TOKEN_BRACE_OPEN) &&
+            (ast_node(p->ast, declarator)->flags & AST_FLAG_FUNCTION))
+        {
+            push(p, declarator);
+            push(p, parse_block(p));
+            if (p->failed)
+                return AST_NONE;
+            return finish(p, AST_FUNCTION_DECL, AST_OP_NONE, first, base);
+        }
+        push(p, declarator);
+        if (!accept(p, TOKEN_COMMA))
+            break;
+    }
+    expect(p, TOKEN_SEMICOLON);
+    if (p->failed)
+        return AST_NONE;
+    return finish(p, AST_VAR_DECL, AST_OP_NONE, first, base);
+}
+
+// ---- statements ----
+
+// The significant tokens skipped between the last one consumed and the
+// current one were comments and directives; the directives become nodes
+static void push_directives(Parser *p)
+{
+    for (uint32_t i = p->consumed_end; i < p->current_index; i++)
+    {
+        Token tok;
+        token_at(p->tokens, i, &tok);
+        if (tok.type == TOKEN_PREPROCESSOR)
+            push(p, ast_add(p->ast, AST_PREPROCESSOR, AST_OP_NONE, i, i, NULL, 0));
+    }
+}
+
+// Recovery: swallow tokens up to a ';' or the end of a {} group at this
+// level, without crossing the '}' that closes the enclosing block
+static NodeId parse_unknown(Parser *p)
+{
+    uint32_t first = p->current_index;
+    uint32_t depth = 0;
+    while (!at(p, TOKEN_EOF))
+    {
+        TokenType type = p->current.type;
+        if (depth == 0 && type == TOKEN_BRACE_CLOSE && p->current_index != first)
+            break;
+        if (is_opener(type))
+            depth++;
+        else if (is_closer(type) && depth > 0)
+            depth--;
+        advance(p);
+        if (depth == 0 && (type == TOKEN_SEMICOLON || type == TOKEN_BRACE_CLOSE))
+        {
+            if (type == TOKEN_BRACE_CLOSE)
+                accept(p, TOKEN_SEMICOLON);
+            break;
+        }
+    }
+    return leaf(p, AST_UNKNOWN, first);
+}
+
+// Optional expression, ended by `end`
+static NodeId parse_clause(Parser *p, TokenType end)
+{
+    NodeId value = at(p, end) ? AST_NONE : parse_expression(p, PREC_COMMA);
+    expect(p, end);
+    return value;
+}
+
+static NodeId parse_condition(Parser *p)
+{
+    expect(p, TOKEN_PAREN_OPEN);
+    NodeId cond = parse_expression(p, PREC_COMMA);
+    expect(p, TOKEN_PAREN_CLOSE);
+    return cond;
+}
+
+static StmtFrame *push_statement(Parser *p)
+{
+    if (p->statements_top == p->statements_capacity)
+    {
+        uint32_t capacity = p->statements_capacity ? p->statements_capacity * 2 : 16;
+        p->statements = (StmtFrame *)arena_realloc(p->ast->arena, p->statements,
+                                                   p->statements_capacity * sizeof(StmtFrame),
+                                                   capacity * sizeof(StmtFrame));
+        p->statements_capacity = capacity;
+    }
+    StmtFrame *frame = &p->statements[p->statements_top++];
+    mark(p, &frame->mark);
+    return frame;
+}
+
+// Starts the statement at the current token. One that holds statements is
+// parsed up to its first one and left open, its kind in `frame`; any other
+// is parsed whole and returned, with STMT_WHOLE as the kind.
+static NodeId begin_statement(Parser *p, StmtFrame *frame)
+{
+    uint32_t first = p->current_index;
+    uint32_t base = p->stack_top;
+    frame->kind = STMT_WHOLE;
+    frame->in_else = 0;
+    switch (p->current.type)
+    {
+    case TOKEN_BRACE_OPEN:
+        advance(p);
+        frame->kind = STMT_BLOCK;
+        return AST_NONE;
+    case TOKEN_SEMICOLON:
+        advance(p);
+        return leaf(p, AST_EMPTY_STMT, first);
+    case TOKEN_KW_IF:
+    {
+        advance(p);
+        push(p, parse_condition(p));
+        frame->kind = STMT_IF;
+        return AST_NONE;
+    }
+    case TOKEN_KW_WHILE:
+    {
+        advance(p);
+        push(p, parse_condition(p));
+        frame->kind = STMT_WHILE;
+        return AST_NONE;
+    }
+    case TOKEN_KW_DO:
+    {
+        advance(p);
+        frame->kind = STMT_DO;
+        return AST_NONE;
+    }
+    case TOKEN_KW_FOR:
+    {
+        advance(p);
+        expect(p, TOKEN_PAREN_OPEN);
+        if (is_declaration_start(p))
+            push(p, parse_declaration(p, 0));
+        else
+            push(p, parse_clause(p, TOKEN_SEMICOLON));
+        push(p, parse_clause(p, TOKEN_SEMICOLON));
+        push(p, parse_clause(p, TOKEN_PAREN_CLOSE));
+        frame->kind = STMT_FOR;
+        return AST_NONE;
+    }
+    case TOKEN_KW_SWITCH:
+    {
+        advance(p);
+        push(p, parse_condition(p));
+        frame->kind = STMT_SWITCH;
+        return AST_NONE;
+    }
+    case TOKEN_KW_CASE:
+    {
+        advance(p);
+        push(p, parse_expression(p, PREC_COND));
+        expect_text(p, ":");
+        return finish(p, AST_CASE, AST_OP_NONE, first, base);
+    }
+    case TOKEN_KW_DEFAULT:
+        advance(p);
+        expect_text(p, ":");
+        return leaf(p, AST_DEFAULT, first);
+    case TOKEN_KW_RETURN:
+        advance(p);
+        push(p, parse_clause(p, TOKEN_SEMICOLON));
+        return finish(p, AST_RETURN, AST_OP_NONE, first, base);
+    case TOKEN_KW_BREAK:
+        advance(p);
+        expect(p, TOKEN_SEMICOLON);
+        return leaf(p, AST_BREAK, first);
+    case TOKEN_KW_CONTINUE:
+        advance(p);
+        expect(p, TOKEN_SEMICOLON);
+        return leaf(p, AST_CONTINUE, first);
+    case TOKEN_KW_GOTO:
+    {
+        advance(p);
+        uint32_t name_first = p->current_index;
+        expect(p, TOKEN_IDENTIFIER);
+        push(p, leaf(p, AST_IDENTIFIER, name_first));
+        expect(p, TOKEN_SEMICOLON);
+        return finish(p, AST_GOTO, AST_OP_NONE, first, base);
+    }
+    case TOKEN_IDENTIFIER:
+    {
+        Token next;
+        peek(p, &next);
+        if (token_is(p, &next, ":"))
+        {
+            advance(p);
+            push(p, leaf(p, AST_IDENTIFIER, first));
+            advance(p);
+            return finish(p, AST_LABEL, AST_OP_NONE, first, base);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    if (is_declaration_start(p))
+        return parse_declaration(p, 0);
+    push(p, parse_expression(p, PREC_COMMA));
+    expect(p, TOKEN_SEMICOLON);
+    return finish(p, AST_EXPR_STMT, AST_OP_NONE, first, base);
+}
+
+/*
+Statements nest without using the C stack: the ones still open wait on
+p->statements, each with the mark it started at, while their children are
+parsed. A statement that fails is rolled back to its mark and kept as
+AST_UNKNOWN, and the one around it goes on. The bottom one is the block
+whose '{' is current, as a function body.
+*/
+static NodeId parse_block(Parser *p)
+{
+    uint32_t bottom = p->statements_top;
+    StmtFrame *frame = push_statement(p);
+    NodeId result;
+    frame->kind = STMT_BLOCK;
+    expect(p, TOKEN_BRACE_OPEN);
+    goto block_item;
+
+next:
+    frame = push_statement(p);
+    result = begin_statement(p, frame);
+    if (p->failed)
+        goto fail;
+    if (frame->kind == STMT_WHOLE)
+        goto done;
+    if (frame->kind == STMT_BLOCK)
+        goto block_item;
+    goto next;
+
+done:
+    // `result` is the top statement, complete: it goes to the one around it
+    p->statements_top--;
+    if (p->statements_top == bottom)
+        return result;
+    push(p, result);
+    frame = &p->statements[p->statements_top - 1];
+    uint32_t first = frame->mark.current_index;
+    uint32_t base = frame->mark.stack_top;
+    switch ((StmtKind)frame->kind)
+    {
+    case STMT_BLOCK:
+        goto block_item;
+    case STMT_IF:
+        if (!frame->in_else && accept(p, TOKEN_KW_ELSE))
+        {
+            frame->in_else = 1;
+            goto next;
+        }
+        result = finish(p, AST_IF, AST_OP_NONE, first, base);
+        goto done;
+    case STMT_WHILE:
+        result = finish(p, AST_WHILE, AST_OP_NONE, first, base);
+        goto done;
+    case STMT_DO:
+        expect(p, TOKEN_KW_WHILE);
+        push(p, parse_condition(p));
+        expect(p, TOKEN_SEMICOLON);
+        if (p->failed)
+            goto fail;
+        result = finish(p, AST_DO_WHILE, AST_OP_NONE, first, base);
+        goto done;
+    case STMT_FOR:
+        result = finish(p, AST_FOR, AST_OP_NONE, first, base);
+        goto done;
+    case STMT_SWITCH:
+        result = finish(p, AST_SWITCH, AST_OP_NONE, first, base);
+        goto done;
+    default:
+        goto fail;
+    }
+
+block_item:
+    push_directives(p);
+    if (!p->failed && !at(p, TOKEN_BRACE_CLOSE) && !at(p, TOKEN_EOF))
+        goto next;
+    // an unclosed block at the end of the file is closed there
+    accept(p, TOKEN_BRACE_CLOSE);
+    if (p->failed && p->statements_top - 1 > bottom)
+        goto fail;
+    frame = &p->statements[p->statements_top - 1];
+    result = finish(p, AST_BLOCK, AST_OP_NONE, frame->mark.current_index, frame->mark.stack_top);
+    goto done;
+
+fail:
+    frame = &p->statements[p->statements_top - 1];
+    rewind_to(p, &frame->mark);
+    result = parse_unknown(p);
+    goto done;
+}
+
+// A function definition, a declaration, or whatever else sits at file scope
+static NodeId parse_external(Parser *p)
+{
+    uint32_t first = p->current_index;
+    if (accept(p, TOKEN_SEMICOLON))
+        return leaf(p, AST_EMPTY_STMT, first);
+    ParserMark m;
+    mark(p, &m);
+    NodeId id = parse_declaration(p, 1);
+    if (!p->failed)
+        return id;
+    rewind_to(p, &m);
+    return parse_unknown(p);
+}
+
+static void parser_init(Parser *p, Arena *arena, const TokenList *tokens, uint32_t first)
+{
+    p->tokens = tokens;
+    p->ast = ast_create(arena, tokens);
+    cursor_init_at(&p->cursor, tokens, first);
+    p->current.type = TOKEN_UNKNOWN;
+    p->current_index = 0;
+    p->consumed_end = 0;
+    p->reach = first;
+    p->failed = 0;
+    p->stack = NULL;
+    p->stack_top = 0;
+    p->stack_capacity = 0;
+    p->frames = NULL;
+    p->frames_top = 0;
+    p->frames_capacity = 0;
+    p->statements = NULL;
+    p->statements_top = 0;
+    p->statements_capacity = 0;
+    p->declarators = NULL;
+    p->declarators_top = 0;
+    p->declarators_capacity = 0;
+    for (size_t i = 0; i < ATTRIBUTE_WORDS; i++)
+        p->attributes[i] = tokens->names ? intern(tokens->names, attribute_words[i], strlen(attribute_words[i]))
+                                         : INTERN_NONE;
+    advance(p);
+    p->consumed_end = first;
+    p->directives_from = first;
+}
+
+Parser *parser_open(Arena *arena, const TokenList *tokens, uint32_t first)
+{
+    Parser *p = (Parser *)arena_alloc(arena, sizeof(Parser));
+    parser_init(p, arena, tokens, first);
+    return p;
+}
+
+NodeId parser_next(Parser *p)
+{
+    // the directives in front of an item come before it, one per call
+    while (p->directives_from < p->current_index)
+    {
+        uint32_t i = p->directives_from++;
+        Token tok;
+        token_at(p->tokens, i, &tok);
+        if (tok.type == TOKEN_PREPROCESSOR)
+            return ast_add(p->ast, AST_PREPROCESSOR, AST_OP_NONE, i, i, NULL, 0);
+    }
+    if (at(p, TOKEN_EOF))
+        return AST_NONE;
+    NodeId id = parse_external(p);
+    p->directives_from = p->consumed_end;
+    return id;
+}
+
+const Ast *parser_ast(const Parser *p)
+{
+    return p->ast;
+}
+
+uint32_t parser_reach(const Parser *p)
+{
+    return p->reach;
+}
+
+Ast *parse_tokens(Arena *arena, const TokenList *tokens)
+{
+    Parser parser;
+    Parser *p = &parser;
+    parser_init(p, arena, tokens, 0);
+    NodeId id;
+    while ((id = parser_next(p)) != AST_NONE)
+        push(p, id);
+    // the root spans the whole file, trailing comments included
+    uint32_t last = tokens->count ? tokens->count - 1 : 0;
+    p->ast->root = ast_add(p->ast, AST_PROGRAM, AST_OP_NONE, 0, last, p->stack, p->stack_top);
+    return p->ast;
+}
@@ -0,0 +1,189 @@
+#include "pool.h"
+#include "errors.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Each worker owns a deque of job ids. It pops from the front (its heaviest
+// job left) and, once empty, steals from the back of someone else's.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} WorkQueue;
+
+typedef struct {
+    ThreadPool *pool;
+    int id;
+} WorkerArgs;
+
+struct ThreadPool {
+    int threads;
+    size_t count;
+    PoolJobFn fn;
+    void *ctx;
+    WorkQueue *queues;
+    pthread_t *workers;
+    WorkerArgs *args;
+    unsigned char *done;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+};
+
+static const uint64_t *sort_weights;
+
+static int heavier_first(const void *a, const void *b)
+{
+    uint64_t wa = sort_weights[*(const size_t *)a];
+    uint64_t wb = sort_weights[*(const size_t *)b];
+    if (wa != wb)
+        return wa < wb ? 1 : -1;
+    return *(const size_t *)a < *(const size_t *)b ? -1 : 1;
+}
+
+static int pop_own(WorkQueue *queue, size_t *job)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail)
+    {
+        *job = queue->jobs[queue->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static int steal(WorkQueue *queue, size_t *job)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail)
+    {
+        *job = queue->jobs[--queue->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerArgs *args = (WorkerArgs *)arg;
+    ThreadPool *pool = args->pool;
+    size_t job;
+
+    for (;;)
+    {
+        int found = pop_own(&pool->queues[args->id], &job);
+        // no job is ever added after start, so one empty sweep means we're done
+        for (int i = 1; !found && i < pool->threads; i++)
+            found = steal(&pool->queues[(args->id + i) % pool->threads], &job);
+        if (!found)
+            break;
+
+        pool->fn(pool->ctx, job, args->id);
+
+        pthread_mutex_lock(&pool->done_lock);
+        pool->done[job] = 1;
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->done_lock);
+    }
+    return NULL;
+}
+
+ThreadPool *pool_start(int threads, size_t count, const uint64_t *weights, PoolJobFn fn, void *ctx)
+{
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > count && count > 0)
+        threads = (int)count;
+
+    ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+    size_t *order = (size_t *)malloc((count + 1) * sizeof(size_t));
+    if (!pool || !order)
+    {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->count = count;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->queues = (WorkQueue *)calloc(threads, sizeof(WorkQueue));
+    pool->workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    pool->args = (WorkerArgs *)calloc(threads, sizeof(WorkerArgs));
+    pool->done = (unsigned char *)calloc(count + 1, 1);
+    if (!pool->queues || !pool->workers || !pool->args || !pool->done)
+    {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->done_lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < count; i++)
+        order[i] = i;
+    if (weights)
+    {
+        sort_weights = weights;
+        qsort(order, count, sizeof(size_t), heavier_first);
+    }
+
+    // deal the sorted jobs round-robin, so every queue starts heavy-first
+    for (int w = 0; w < threads; w++)
+    {
+        pthread_mutex_init(&pool->queues[w].lock, NULL);
+        pool->queues[w].jobs = (size_t *)malloc((count / threads + 1) * sizeof(size_t));
+        if (!pool->queues[w].jobs)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        WorkQueue *queue = &pool->queues[i % threads];
+        queue->jobs[queue->tail++] = order[i];
+    }
+    free(order);
+
+    for (int w = 0; w < threads; w++)
+    {
+        pool->args[w].pool = pool;
+        pool->args[w].id = w;
+        if (pthread_create(&pool->workers[w], NULL, worker_main, &pool->args[w]) != 0)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+    }
+    return pool;
+}
+
+void pool_wait_job(ThreadPool *pool, size_t job)
+{
+    pthread_mutex_lock(&pool->done_lock);
+    while (!pool->done[job])
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    pthread_mutex_unlock(&pool->done_lock);
+}
+
+void pool_finish(ThreadPool *pool)
+{
+    for (int w = 0; w < pool->threads; w++)
+        pthread_join(pool->workers[w], NULL);
+    for (int w = 0; w < pool->threads; w++)
+    {
+        pthread_mutex_destroy(&pool->queues[w].lock);
+        free(pool->queues[w].jobs);
+    }
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->queues);
+    free(pool->workers);
+    free(pool->args);
+    free(pool->done);
+    free(pool);
+}
+
+int pool_default_threads(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
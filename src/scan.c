@@ -0,0 +1,422 @@
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline int is_space_byte(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_ident_byte(unsigned char c)
+{
+    return (unsigned char)((c | 0x20) - 'a') < 26 || (unsigned char)(c - '0') < 10 || c == '_';
+}
+
+static const unsigned char latex_bytes[256] = {
+    ['\\'] = 1, ['{'] = 1, ['}'] = 1, ['$'] = 1, ['&'] = 1, ['#'] = 1, ['^'] = 1, ['_'] = 1,
+    ['%'] = 1,  ['~'] = 1, [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1,
+};
+
+// Scalar implementations, also used for the tail of the vector ones
+
+static const char *whitespace_scalar(const char *p, const char *end)
+{
+    while (p < end && is_space_byte((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static const char *identifier_scalar(const char *p, const char *end)
+{
+    while (p < end && is_ident_byte((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static const char *line_end_scalar(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static const char *comment_end_scalar(const char *p, const char *end)
+{
+    while (p + 1 < end)
+    {
+        const char *star = memchr(p, '*', end - p - 1);
+        if (!star)
+            break;
+        if (star[1] == '/')
+            return star;
+        p = star + 1;
+    }
+    return end;
+}
+
+static const char *string_special_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '"' && *p != '\\')
+        p++;
+    return p;
+}
+
+static uint32_t count_newlines_scalar(const char *p, const char *end, const char **last_newline)
+{
+    uint32_t count = 0;
+    const char *nl;
+    while ((nl = memchr(p, '\n', end - p)) != NULL)
+    {
+        count++;
+        *last_newline = nl;
+        p = nl + 1;
+    }
+    return count;
+}
+
+static uint32_t latex_mask_scalar(const char *p)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++)
+        mask |= (uint32_t)latex_bytes[(unsigned char)p[i]] << i;
+    return mask;
+}
+
+#ifdef SCAN_X86
+
+// SSE2 is part of x86-64, so these need no runtime check
+
+static inline unsigned space_mask_sse2(__m128i v)
+{
+    __m128i blank = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i control = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                    _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(blank, control));
+}
+
+static inline unsigned ident_mask_sse2(__m128i v)
+{
+    // bytes >= 0x80 are negative and fall outside every range
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(alpha, _mm_or_si128(digit, under)));
+}
+
+static const char *whitespace_sse2(const char *p, const char *end)
+{
+    while (p + 16 <= end)
+    {
+        unsigned stop = ~space_mask_sse2(_mm_loadu_si128((const __m128i *)p)) & 0xffffu;
+        if (stop)
+            return p + __builtin_ctz(stop);
+        p += 16;
+    }
+    return whitespace_scalar(p, end);
+}
+
+static const char *identifier_sse2(const char *p, const char *end)
+{
+    while (p + 16 <= end)
+    {
+        unsigned stop = ~ident_mask_sse2(_mm_loadu_si128((const __m128i *)p)) & 0xffffu;
+        if (stop)
+            return p + __builtin_ctz(stop);
+        p += 16;
+    }
+    return identifier_scalar(p, end);
+}
+
+static const char *line_end_sse2(const char *p, const char *end)
+{
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned hit = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        p += 16;
+    }
+    return line_end_scalar(p, end);
+}
+
+static const char *comment_end_sse2(const char *p, const char *end)
+{
+    // compare the block and the block shifted by one: '*' here and '/' next
+    while (p + 17 <= end)
+    {
+        __m128i star = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8('*'));
+        __m128i slash = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), _mm_set1_epi8('/'));
+        unsigned hit = (unsigned)_mm_movemask_epi8(_mm_and_si128(star, slash));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        p += 16;
+    }
+    return comment_end_scalar(p, end);
+}
+
+static const char *string_special_sse2(const char *p, const char *end)
+{
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return string_special_scalar(p, end);
+}
+
+static uint32_t count_newlines_sse2(const char *p, const char *end, const char **last_newline)
+{
+    uint32_t count = 0;
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned nl = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if (nl)
+        {
+            count += (uint32_t)__builtin_popcount(nl);
+            *last_newline = p + 31 - __builtin_clz(nl);
+        }
+        p += 16;
+    }
+    return count + count_newlines_scalar(p, end, last_newline);
+}
+
+static inline __m128i byte_range_sse2(__m128i v, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(low - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8((char)(high + 1))));
+}
+
+// Without a byte shuffle, the set as its ranges: \t-\n, \r, ' ', #-&, \\, ^-_, {, }-~
+static inline unsigned latex_mask16_sse2(__m128i v)
+{
+    __m128i hit = _mm_or_si128(byte_range_sse2(v, '\t', '\n'), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    hit = _mm_or_si128(hit, byte_range_sse2(v, '#', '&'));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    hit = _mm_or_si128(hit, byte_range_sse2(v, '^', '_'));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+    hit = _mm_or_si128(hit, byte_range_sse2(v, '}', '~'));
+    return (unsigned)_mm_movemask_epi8(hit);
+}
+
+static uint32_t latex_mask_sse2(const char *p)
+{
+    uint32_t low = latex_mask16_sse2(_mm_loadu_si128((const __m128i *)p));
+    uint32_t high = latex_mask16_sse2(_mm_loadu_si128((const __m128i *)(p + 16)));
+    return low | high << 16;
+}
+
+// AVX2 versions, only called after a runtime check
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline uint32_t space_mask_avx2(__m256i v)
+{
+    __m256i blank = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i control = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(blank, control));
+}
+
+AVX2 static const char *whitespace_avx2(const char *p, const char *end)
+{
+    while (p + 32 <= end)
+    {
+        uint32_t stop = ~space_mask_avx2(_mm256_loadu_si256((const __m256i *)p));
+        if (stop)
+            return p + __builtin_ctz(stop);
+        p += 32;
+    }
+    return whitespace_sse2(p, end);
+}
+
+AVX2 static const char *line_end_avx2(const char *p, const char *end)
+{
+    while (p + 32 <= end)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        uint32_t hit = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        p += 32;
+    }
+    return line_end_sse2(p, end);
+}
+
+AVX2 static const char *comment_end_avx2(const char *p, const char *end)
+{
+    while (p + 33 <= end)
+    {
+        __m256i star = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), _mm256_set1_epi8('*'));
+        __m256i slash = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), _mm256_set1_epi8('/'));
+        uint32_t hit = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(star, slash));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        p += 32;
+    }
+    return comment_end_sse2(p, end);
+}
+
+AVX2 static const char *string_special_avx2(const char *p, const char *end)
+{
+    while (p + 32 <= end)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return string_special_sse2(p, end);
+}
+
+AVX2 static uint32_t count_newlines_avx2(const char *p, const char *end, const char **last_newline)
+{
+    uint32_t count = 0;
+    while (p + 32 <= end)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        uint32_t nl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if (nl)
+        {
+            count += (uint32_t)__builtin_popcount(nl);
+            *last_newline = p + 31 - __builtin_clz(nl);
+        }
+        p += 32;
+    }
+    return count + count_newlines_sse2(p, end, last_newline);
+}
+
+// Two 16-entry lookups, on the low and the high nibble of each byte, whose
+// AND is nonzero only for the set. Each bit of the tables is one high nibble:
+// bit 0 for 0x0_ (\t \n \r), 1 for 0x2_ (' ' # $ % &), 2 for 0x5_ (\\ ^ _),
+// 3 for 0x7_ ({ } ~). Bytes >= 0x80 have no bits in either table.
+AVX2 static uint32_t latex_mask_avx2(const char *p)
+{
+    const __m256i low_table = _mm256_setr_epi8(2, 0, 0, 2, 2, 2, 2, 0, 0, 1, 1, 8, 4, 9, 12, 4,
+                                               2, 0, 0, 2, 2, 2, 2, 0, 0, 1, 1, 8, 4, 9, 12, 4);
+    const __m256i high_table = _mm256_setr_epi8(1, 0, 2, 0, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                1, 0, 2, 0, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    __m256i clean = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+    return ~(uint32_t)_mm256_movemask_epi8(clean);
+}
+
+#endif // SCAN_X86
+
+typedef struct {
+    const char *name;
+    const char *(*whitespace)(const char *, const char *);
+    const char *(*identifier)(const char *, const char *);
+    const char *(*line_end)(const char *, const char *);
+    const char *(*comment_end)(const char *, const char *);
+    const char *(*string_special)(const char *, const char *);
+    uint32_t (*count_newlines)(const char *, const char *, const char **);
+    uint32_t (*latex_mask)(const char *);
+} ScanImpl;
+
+static const ScanImpl scalar_impl = {
+    "scalar", whitespace_scalar, identifier_scalar, line_end_scalar,
+    comment_end_scalar, string_special_scalar, count_newlines_scalar, latex_mask_scalar,
+};
+
+#ifdef SCAN_X86
+static const ScanImpl sse2_impl = {
+    "sse2", whitespace_sse2, identifier_sse2, line_end_sse2,
+    comment_end_sse2, string_special_sse2, count_newlines_sse2, latex_mask_sse2,
+};
+
+// Identifiers are short, one 16-byte block almost always finds the end,
+// so they stay on SSE2
+static const ScanImpl avx2_impl = {
+    "avx2", whitespace_avx2, identifier_sse2, line_end_avx2,
+    comment_end_avx2, string_special_avx2, count_newlines_avx2, latex_mask_avx2,
+};
+
+static const ScanImpl *impl = &sse2_impl;
+#else
+static const ScanImpl *impl = &scalar_impl;
+#endif
+
+int scan_select_backend(const char *name)
+{
+    if (strcmp(name, "scalar") == 0)
+        impl = &scalar_impl;
+#ifdef SCAN_X86
+    else if (strcmp(name, "sse2") == 0)
+        impl = &sse2_impl;
+    else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        impl = &avx2_impl;
+#endif
+    else
+        return -1;
+    return 0;
+}
+
+// Runs before main, so the pointer never changes once threads exist
+__attribute__((constructor)) static void select_impl(void)
+{
+    const char *cap = getenv("CTOLATEX_SIMD");
+    if (cap && (strcmp(cap, "scalar") == 0 || strcmp(cap, "sse2") == 0))
+        scan_select_backend(cap);
+    else
+        scan_select_backend("avx2");
+}
+
+const char *scan_whitespace(const char *p, const char *end)
+{
+    return impl->whitespace(p, end);
+}
+
+const char *scan_identifier(const char *p, const char *end)
+{
+    return impl->identifier(p, end);
+}
+
+const char *scan_line_end(const char *p, const char *end)
+{
+    return impl->line_end(p, end);
+}
+
+const char *scan_comment_end(const char *p, const char *end)
+{
+    return impl->comment_end(p, end);
+}
+
+const char *scan_string_special(const char *p, const char *end)
+{
+    return impl->string_special(p, end);
+}
+
+uint32_t scan_count_newlines(const char *p, const char *end, const char **last_newline)
+{
+    return impl->count_newlines(p, end, last_newline);
+}
+
+uint32_t scan_latex_mask(const char *p)
+{
+    return impl->latex_mask(p);
+}
+
+const char *scan_backend(void)
+{
+    return impl->name;
+}
@@ -0,0 +1,165 @@
+#include "source.h"
+#include "errors.h"
+#include "diagnostics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+// Fallback for pipes, stdin and anything else mmap refuses: read it all
+// into one heap buffer, doubling as needed.
+static int read_whole_fd(SourceBuffer *source, int fd, size_t size_hint)
+{
+    size_t capacity = size_hint > 0 ? size_hint + 1 : READ_CHUNK_SIZE;
+    size_t length = 0;
+    char *buffer = (char *)malloc(capacity);
+    if (!buffer)
+    {
+        panic(ERR_MEMORY_ALLOCATION, 0);
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (length == capacity)
+        {
+            capacity *= 2;
+            char *grown = (char *)realloc(buffer, capacity);
+            if (!grown)
+            {
+                free(buffer);
+                panic(ERR_MEMORY_ALLOCATION, 0);
+                return -1;
+            }
+            buffer = grown;
+        }
+        ssize_t got = read(fd, buffer + length, capacity - length);
+        // a signal that arrived before anything was read
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got == 0)
+            break;
+        if (got < 0)
+        {
+            free(buffer);
+            return -1;
+        }
+        length += (size_t)got;
+        if (length > SOURCE_MAX_LENGTH)
+        {
+            free(buffer);
+            diagnostic_report(ERR_MAX_SIZE, DIAGNOSTIC_NO_OFFSET);
+            return -1;
+        }
+    }
+
+    source->data = buffer;
+    source->length = length;
+    source->is_mapped = 0;
+    return 0;
+}
+
+static int open_source(SourceBuffer *source, const char *filepath, int may_map)
+{
+    source->data = NULL;
+    source->length = 0;
+    source->is_mapped = 0;
+
+    if (strcmp(filepath, "-") == 0)
+        return read_whole_fd(source, STDIN_FILENO, 0);
+
+    int fd;
+    do
+        fd = open(filepath, O_RDONLY);
+    while (fd < 0 && errno == EINTR);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode) && (uint64_t)st.st_size > SOURCE_MAX_LENGTH)
+    {
+        close(fd);
+        diagnostic_report(ERR_MAX_SIZE, DIAGNOSTIC_NO_OFFSET);
+        return -1;
+    }
+
+    int result = 0;
+    if (S_ISREG(st.st_mode) && st.st_size > 0 && may_map)
+    {
+        void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            madvise(mapped, (size_t)st.st_size, MADV_SEQUENTIAL);
+            source->data = (const char *)mapped;
+            source->length = (size_t)st.st_size;
+            source->is_mapped = 1;
+        }
+        else
+        {
+            result = read_whole_fd(source, fd, (size_t)st.st_size);
+        }
+    }
+    else
+    {
+        result = read_whole_fd(source, fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0);
+    }
+    close(fd);
+    return result;
+}
+
+int source_open(SourceBuffer *source, const char *filepath)
+{
+    return open_source(source, filepath, 1);
+}
+
+int source_read(SourceBuffer *source, const char *filepath)
+{
+    return open_source(source, filepath, 0);
+}
+
+void source_close(SourceBuffer *source)
+{
+    if (!source->data)
+        return;
+    if (source->is_mapped)
+        munmap((void *)source->data, source->length);
+    else
+        free((void *)source->data);
+    source->data = NULL;
+    source->length = 0;
+}
+
+static void close_source(void *source)
+{
+    source_close((SourceBuffer *)source);
+}
+
+static const SourceBuffer *open_source_in(Arena *arena, const char *filepath, int may_map)
+{
+    SourceBuffer *source = (SourceBuffer *)arena_alloc(arena, sizeof(SourceBuffer));
+    if (open_source(source, filepath, may_map) != 0)
+        return NULL;
+    arena_on_free(arena, close_source, source);
+    return source;
+}
+
+const SourceBuffer *source_open_in(Arena *arena, const char *filepath)
+{
+    return open_source_in(arena, filepath, 1);
+}
+
+const SourceBuffer *source_read_in(Arena *arena, const char *filepath)
+{
+    return open_source_in(arena, filepath, 0);
+}
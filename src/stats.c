@@ -0,0 +1,74 @@
+#include "stats.h"
+#include <string.h>
+
+int stats_enabled;
+
+static Stats totals;
+
+static const char *const phase_names[STAT_PHASE_COUNT] = {"read", "lex", "parse", "emit", "write"};
+
+void stats_reset(Stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void stats_count_tokens(Stats *stats, const TokenList *list)
+{
+    for (const TokenChunk *chunk = list->head; chunk; chunk = chunk->next)
+        for (uint32_t i = 0; i < chunk->count; i++)
+            stats->tokens[chunk->types[i]]++;
+}
+
+void stats_count_arena(Stats *stats, const Arena *arena)
+{
+    stats->arena_bytes += arena->bytes_used;
+    stats->arena_chunks += arena->chunk_count;
+}
+
+// Field by field, since workers merge while others still run
+static void add(uint64_t *total, uint64_t value)
+{
+    if (value)
+        __atomic_fetch_add(total, value, __ATOMIC_RELAXED);
+}
+
+void stats_add_span(StatPhase phase, uint64_t start)
+{
+    if (stats_enabled)
+        add(&totals.nanoseconds[phase], stats_clock() - start);
+}
+
+void stats_merge(const Stats *stats)
+{
+    for (int phase = 0; phase < STAT_PHASE_COUNT; phase++)
+        add(&totals.nanoseconds[phase], stats->nanoseconds[phase]);
+    add(&totals.files, stats->files);
+    add(&totals.cache_hits, stats->cache_hits);
+    add(&totals.bytes_read, stats->bytes_read);
+    for (int type = 0; type < 256; type++)
+        add(&totals.tokens[type], stats->tokens[type]);
+    add(&totals.arena_bytes, stats->arena_bytes);
+    add(&totals.arena_chunks, stats->arena_chunks);
+    add(&totals.output_bytes, stats->output_bytes);
+}
+
+void stats_print(FILE *out, double wall_seconds)
+{
+    fprintf(out, "{\"wall_ms\": %.3f, \"phases_ms\": {", wall_seconds * 1e3);
+    for (int phase = 0; phase < STAT_PHASE_COUNT; phase++)
+        fprintf(out, "%s\"%s\": %.3f", phase ? ", " : "", phase_names[phase],
+                (double)totals.nanoseconds[phase] / 1e6);
+    fprintf(out, "}, \"files\": %llu, \"cache_hits\": %llu, \"bytes_read\": %llu, \"output_bytes\": %llu",
+            (unsigned long long)totals.files, (unsigned long long)totals.cache_hits,
+            (unsigned long long)totals.bytes_read, (unsigned long long)totals.output_bytes);
+
+    uint64_t count = 0;
+    for (int type = 0; type < 256; type++)
+        count += totals.tokens[type];
+    fprintf(out, ", \"tokens\": {\"total\": %llu", (unsigned long long)count);
+    for (int type = 0; type < 256; type++)
+        if (totals.tokens[type])
+            fprintf(out, ", \"%s\": %llu", printEnum((unsigned int)type), (unsigned long long)totals.tokens[type]);
+    fprintf(out, "}, \"arena\": {\"bytes\": %llu, \"chunks\": %llu}}\n", (unsigned long long)totals.arena_bytes,
+            (unsigned long long)totals.arena_chunks);
+}
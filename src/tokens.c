@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include "tokens.h"
+
+void printList(TokenList *list) {
+    fprintList(stdout, list);
+}
+
+void fprintList(FILE *out, TokenList *list) {
+    TokenCursor cursor;
+    Token tok;
+    cursor_init(&cursor, list);
+    while (cursor_next(&cursor, &tok))
+        fprintToken(out, &tok, token_text(list, &tok));
+}
+
+void printToken(const Token *token, const char *text) {
+    fprintToken(stdout, token, text);
+}
+
+void fprintToken(FILE *out, const Token *token, const char *text) {
+    size_t length;
+    const char *value = lexeme_value(token->type, text, token->length, &length);
+    fprintf(out, "%s : %.*s\n", printEnum(token->type), (int)length, value);
+}
+
+const char* printEnum(unsigned int enumber) {
+    switch (enumber) {
+        case TOKEN_EOF: return "TOKEN_EOF";
+        case TOKEN_UNKNOWN: return "TOKEN_UNKNOWN";
+        case TOKEN_INT_LITERAL: return "TOKEN_INT_LITERAL";
+        case TOKEN_FLOAT_LITERAL: return "TOKEN_FLOAT_LITERAL";
+        case TOKEN_CHAR_LITERAL: return "TOKEN_CHAR_LITERAL";
+        case TOKEN_STRING_LITERAL: return "TOKEN_STRING_LITERAL";
+        case TOKEN_PREPROCESSOR: return "TOKEN_PREPROCESSOR";
+        case TOKEN_IDENTIFIER: return "TOKEN_IDENTIFIER";
+        case TOKEN_ASSIGNMENT_OPERATOR: return "TOKEN_ASSIGNMENT_OPERATOR";
+        case TOKEN_OPERATOR: return "TOKEN_OPERATOR";
+        case TOKEN_DOT: return "TOKEN_DOT";
+        case TOKEN_COMMA: return "TOKEN_COMMA";
+        case TOKEN_SEMICOLON: return "TOKEN_SEMICOLON";
+        case TOKEN_BITWISE_OPERATOR: return "TOKEN_BITWISE_OPERATOR";
+        case TOKEN_LOGIC_OPERATOR: return "TOKEN_LOGIC_OPERATOR";
+        case TOKEN_COMMENT: return "TOKEN_COMMENT";
+        case TOKEN_PAREN_OPEN: return "TOKEN_PAREN_OPEN";
+        case TOKEN_PAREN_CLOSE: return "TOKEN_PAREN_CLOSE";
+        case TOKEN_BRACE_OPEN: return "TOKEN_BRACE_OPEN";
+        case TOKEN_BRACE_CLOSE: return "TOKEN_BRACE_CLOSE";
+        case TOKEN_BRACKET_OPEN: return "TOKEN_BRACKET_OPEN";
+        case TOKEN_BRACKET_CLOSE: return "TOKEN_BRACKET_CLOSE";
+        case TOKEN_ARROW: return "TOKEN_ARROW";
+        case TOKEN_KW_AUTO: return "TOKEN_KW_AUTO";
+        case TOKEN_KW_BREAK: return "TOKEN_KW_BREAK";
+        case TOKEN_KW_CASE: return "TOKEN_KW_CASE";
+        case TOKEN_KW_CHAR: return "TOKEN_KW_CHAR";
+        case TOKEN_KW_CONST: return "TOKEN_KW_CONST";
+        case TOKEN_KW_CONTINUE: return "TOKEN_KW_CONTINUE";
+        case TOKEN_KW_DEFAULT: return "TOKEN_KW_DEFAULT";
+        case TOKEN_KW_DO: return "TOKEN_KW_DO";
+        case TOKEN_KW_DOUBLE: return "TOKEN_KW_DOUBLE";
+        case TOKEN_KW_ELSE: return "TOKEN_KW_ELSE";
+        case TOKEN_KW_ENUM: return "TOKEN_KW_ENUM";
+        case TOKEN_KW_EXTERN: return "TOKEN_KW_EXTERN";
+        case TOKEN_KW_FLOAT: return "TOKEN_KW_FLOAT";
+        case TOKEN_KW_FOR: return "TOKEN_KW_FOR";
+        case TOKEN_KW_GOTO: return "TOKEN_KW_GOTO";
+        case TOKEN_KW_IF: return "TOKEN_KW_IF";
+        case TOKEN_KW_INT: return "TOKEN_KW_INT";
+        case TOKEN_KW_LONG: return "TOKEN_KW_LONG";
+        case TOKEN_KW_REGISTER: return "TOKEN_KW_REGISTER";
+        case TOKEN_KW_RETURN: return "TOKEN_KW_RETURN";
+        case TOKEN_KW_SHORT: return "TOKEN_KW_SHORT";
+        case TOKEN_KW_SIGNED: return "TOKEN_KW_SIGNED";
+        case TOKEN_KW_SIZEOF: return "TOKEN_KW_SIZEOF";
+        case TOKEN_KW_STATIC: return "TOKEN_KW_STATIC";
+        case TOKEN_KW_STRUCT: return "TOKEN_KW_STRUCT";
+        case TOKEN_KW_SWITCH: return "TOKEN_KW_SWITCH";
+        case TOKEN_KW_TYPEDEF: return "TOKEN_KW_TYPEDEF";
+        case TOKEN_KW_UNION: return "TOKEN_KW_UNION";
+        case TOKEN_KW_UNSIGNED: return "TOKEN_KW_UNSIGNED";
+        case TOKEN_KW_VOID: return "TOKEN_KW_VOID";
+        case TOKEN_KW_VOLATILE: return "TOKEN_KW_VOLATILE";
+        case TOKEN_KW_WHILE: return "TOKEN_KW_WHILE";
+        case TOKEN_KW_INLINE: return "TOKEN_KW_INLINE";
+        case TOKEN_KW_RESTRICT: return "TOKEN_KW_RESTRICT";
+        case TOKEN_KW_BOOL: return "TOKEN_KW_BOOL";
+        case TOKEN_KW_COMPLEX: return "TOKEN_KW_COMPLEX";
+        case TOKEN_KW_IMAGINARY: return "TOKEN_KW_IMAGINARY";
+        case TOKEN_KW_ALIGNAS: return "TOKEN_KW_ALIGNAS";
+        case TOKEN_KW_ALIGNOF: return "TOKEN_KW_ALIGNOF";
+        case TOKEN_KW_ATOMIC: return "TOKEN_KW_ATOMIC";
+        case TOKEN_KW_GENERIC: return "TOKEN_KW_GENERIC";
+        case TOKEN_KW_NORETURN: return "TOKEN_KW_NORETURN";
+        case TOKEN_KW_STATIC_ASSERT: return "TOKEN_KW_STATIC_ASSERT";
+        case TOKEN_KW_THREAD_LOCAL: return "TOKEN_KW_THREAD_LOCAL";
+        default: return "TOKEN_INVALID";
+    }
+}
+
+// Rough upper bound on token density for C source; overshooting only costs
+// untouched arena pages, undershooting costs an extra chunk
+static const size_t BYTES_PER_TOKEN_ESTIMATE = 4;
+static const uint32_t MIN_CHUNK_TOKENS = 256;
+
+static TokenChunk *create_token_chunk(Arena *arena, uint32_t capacity, uint32_t first)
+{
+    TokenChunk *chunk = (TokenChunk *)arena_alloc(arena, sizeof(TokenChunk));
+    chunk->next = NULL;
+    chunk->first = first;
+    chunk->count = 0;
+    chunk->capacity = capacity;
+    chunk->types = (uint8_t *)arena_alloc(arena, capacity * sizeof(uint8_t));
+    chunk->offsets = (uint32_t *)arena_alloc(arena, capacity * sizeof(uint32_t));
+    chunk->lengths = (uint32_t *)arena_alloc(arena, capacity * sizeof(uint32_t));
+    chunk->names = NULL;
+    return chunk;
+}
+
+TokenList *create_token_list(Arena *arena, const char *source, size_t source_length)
+{
+    TokenList *list = (TokenList *)arena_alloc(arena, sizeof(TokenList));
+    list->arena = arena;
+    list->source = source;
+    list->source_length = source_length;
+    list->count = 0;
+    list->names = NULL;
+    list->types = NULL;
+
+    size_t estimate = source_length / BYTES_PER_TOKEN_ESTIMATE;
+    if (estimate < MIN_CHUNK_TOKENS)
+        estimate = MIN_CHUNK_TOKENS;
+    if (estimate > UINT32_MAX / 2)
+        estimate = UINT32_MAX / 2;
+    list->head = create_token_chunk(arena, (uint32_t)estimate, 0);
+    list->tail = list->head;
+    return list;
+}
+
+TokenChunk *token_list_grow(TokenList *list)
+{
+    // the estimate was short; later chunks get half the first one's size
+    uint32_t capacity = list->head->capacity / 2;
+    TokenChunk *chunk = create_token_chunk(list->arena, capacity > MIN_CHUNK_TOKENS ? capacity : MIN_CHUNK_TOKENS,
+                                           list->count);
+    list->tail->next = chunk;
+    list->tail = chunk;
+    return chunk;
+}
+
+void token_list_copy(TokenList *list, const TokenList *from, uint32_t begin, uint32_t end, int32_t offset_delta)
+{
+    for (const TokenChunk *chunk = from->head; chunk && chunk->first < end; chunk = chunk->next)
+    {
+        uint32_t i = begin > chunk->first ? begin - chunk->first : 0;
+        uint32_t stop = end - chunk->first < chunk->count ? end - chunk->first : chunk->count;
+        while (i < stop)
+        {
+            TokenChunk *tail = list->tail;
+            if (tail->count == tail->capacity)
+                tail = token_list_grow(list);
+            uint32_t n = stop - i < tail->capacity - tail->count ? stop - i : tail->capacity - tail->count;
+            uint32_t at = tail->count;
+            memcpy(tail->types + at, chunk->types + i, n * sizeof(uint8_t));
+            memcpy(tail->lengths + at, chunk->lengths + i, n * sizeof(uint32_t));
+            for (uint32_t k = 0; k < n; k++)
+                tail->offsets[at + k] = chunk->offsets[i + k] + (uint32_t)offset_delta;
+            tail->count += n;
+            list->count += n;
+            i += n;
+        }
+    }
+}
+
+void token_list_intern(TokenList *list, InternTable *table)
+{
+    list->names = table;
+    for (TokenChunk *chunk = list->head; chunk; chunk = chunk->next)
+    {
+        chunk->names = (uint32_t *)arena_alloc(list->arena, (chunk->count ? chunk->count : 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < chunk->count; i++)
+            chunk->names[i] = chunk->types[i] == TOKEN_IDENTIFIER
+                                  ? intern(table, list->source + chunk->offsets[i], chunk->lengths[i])
+                                  : INTERN_NONE;
+    }
+}
+
+uint32_t token_list_before(const TokenList *list, uint32_t offset)
+{
+    const TokenChunk *chunk = list->head;
+    while (chunk->next && chunk->count > 0 && chunk->offsets[chunk->count - 1] < offset)
+        chunk = chunk->next;
+    uint32_t low = 0;
+    uint32_t high = chunk->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (chunk->offsets[mid] < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return chunk->first + low;
+}
+
+void token_list_splice(TokenList *list, TokenList *from, uint32_t from_index)
+{
+    TokenChunk *chunk = from->head;
+    while (chunk && from_index >= chunk->first + chunk->count)
+        chunk = chunk->next;
+    if (!chunk)
+        return;
+
+    // drop the tokens before from_index by sliding the first chunk's arrays
+    uint32_t skip = from_index - chunk->first;
+    chunk->types += skip;
+    chunk->offsets += skip;
+    chunk->lengths += skip;
+    chunk->count -= skip;
+    chunk->capacity -= skip;
+
+    list->tail->next = chunk;
+    for (; chunk; chunk = chunk->next)
+    {
+        chunk->first = list->count;
+        list->count += chunk->count;
+        list->tail = chunk;
+    }
+    from->head = NULL;
+    from->tail = NULL;
+    from->count = 0;
+}
+
+static void read_token(const TokenChunk *chunk, uint32_t i, Token *out)
+{
+    out->type = (TokenType)chunk->types[i];
+    out->offset = chunk->offsets[i];
+    out->length = chunk->lengths[i];
+    out->name = chunk->names ? chunk->names[i] : INTERN_NONE;
+}
+
+static void eof_token(const TokenList *list, Token *out)
+{
+    out->type = TOKEN_EOF;
+    out->offset = (uint32_t)list->source_length;
+    out->length = 0;
+    out->name = INTERN_NONE;
+}
+
+void token_at(const TokenList *list, uint32_t index, Token *out)
+{
+    const TokenChunk *chunk = list->head;
+    while (chunk && index >= chunk->first + chunk->count)
+        chunk = chunk->next;
+    if (!chunk)
+    {
+        eof_token(list, out);
+        return;
+    }
+    read_token(chunk, index - chunk->first, out);
+}
+
+const char *token_text(const TokenList *list, const Token *token)
+{
+    return list->source + token->offset;
+}
+
+char *token_cstr(Arena *arena, const TokenList *list, const Token *token)
+{
+    return arena_strndup(arena, token_text(list, token), token->length);
+}
+
+const char *token_value(const TokenList *list, const Token *token, size_t *length)
+{
+    return lexeme_value(token->type, token_text(list, token), token->length, length);
+}
+
+const char *lexeme_value(TokenType type, const char *text, size_t len, size_t *length)
+{
+    switch (type)
+    {
+    case TOKEN_COMMENT:
+        // both // and /* open with two bytes, only a terminated /* */ closes with two
+        if (text[1] == '*' && len >= 4 && text[len - 2] == '*' && text[len - 1] == '/')
+            len -= 2;
+        text += 2;
+        len -= 2;
+        break;
+    case TOKEN_CHAR_LITERAL:
+        text += 1;
+        len -= 2;
+        break;
+    case TOKEN_STRING_LITERAL:
+        if (len >= 2 && text[len - 1] == '"')
+        {
+            // the closing quote is only real if it isn't escaped
+            size_t backslashes = 0;
+            while (len - 2 - backslashes > 0 && text[len - 2 - backslashes] == '\\')
+                backslashes++;
+            if (backslashes % 2 == 0)
+                len -= 1;
+        }
+        text += 1;
+        len -= 1;
+        break;
+    default:
+        break;
+    }
+    *length = len;
+    return text;
+}
+
+void cursor_init(TokenCursor *cursor, const TokenList *list)
+{
+    cursor->list = list;
+    cursor->chunk = list->head;
+    cursor->index = 0;
+}
+
+void cursor_init_at(TokenCursor *cursor, const TokenList *list, uint32_t index)
+{
+    cursor_init(cursor, list);
+    while (cursor->chunk->next && index >= cursor->chunk->first + cursor->chunk->count)
+        cursor->chunk = cursor->chunk->next;
+    cursor->index = index - cursor->chunk->first;
+}
+
+TokenType cursor_peek_ahead(const TokenCursor *cursor, uint32_t ahead)
+{
+    const TokenChunk *chunk = cursor->chunk;
+    uint32_t i = cursor->index + ahead;
+    while (chunk && i >= chunk->count)
+    {
+        i -= chunk->count;
+        chunk = chunk->next;
+    }
+    return chunk ? (TokenType)chunk->types[i] : TOKEN_EOF;
+}
+
+TokenType cursor_peek(const TokenCursor *cursor)
+{
+    if (cursor->index < cursor->chunk->count)
+        return (TokenType)cursor->chunk->types[cursor->index];
+    return cursor_peek_ahead(cursor, 0);
+}
+
+int cursor_next(TokenCursor *cursor, Token *out)
+{
+    while (cursor->index == cursor->chunk->count)
+    {
+        if (!cursor->chunk->next)
+        {
+            eof_token(cursor->list, out);
+            return 0;
+        }
+        cursor->chunk = cursor->chunk->next;
+        cursor->index = 0;
+    }
+    read_token(cursor->chunk, cursor->index++, out);
+    return 1;
+}
+
+int cursor_expect(TokenCursor *cursor, TokenType type, Token *out)
+{
+    if (cursor_peek(cursor) != type)
+        return 0;
+    return cursor_next(cursor, out);
+}
+
+uint32_t cursor_position(const TokenCursor *cursor)
+{
+    return cursor->chunk->first + cursor->index;
+}
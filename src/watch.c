@@ -0,0 +1,455 @@
+#include "watch.h"
+#include "diagnostics.h"
+#include "emitter.h"
+#include "errors.h"
+#include "lexer.h"
+#include "lines.h"
+#include "parser.h"
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+// Events this close together are one save (editors write, rename, chmod...)
+#define WATCH_SETTLE_MS 20
+#define NO_RESYNC ((size_t)-1)
+
+// A top-level item with the comments and whitespace in front of it, and its LaTeX
+typedef struct {
+    uint32_t first; // tokens [first, end)
+    uint32_t end;
+    uint32_t reach; // parsing it and those before it looked at tokens up to here
+    EmitPosition entry; // where the output stood before it
+    EmitPosition exit;
+    char *latex;        // malloc'd
+    size_t length;
+} Segment;
+
+// One version of the file. The source is a copy, since a mapping would
+// follow the file as it's rewritten and the old bytes are needed for the diff.
+typedef struct {
+    Arena *arena; // source and tokens; heap-allocated, the token list points at it
+    const char *source;
+    size_t length;
+    TokenList *tokens;
+    uint8_t *functions; // one flag per token, see mark_function_names
+    Segment *segments;  // cover the tokens in order
+    size_t segment_count;
+    size_t segment_capacity;
+    DiagnosticList diagnostics; // of the lexer, lines resolved
+} Version;
+
+typedef struct {
+    uint32_t lexed;
+    size_t parsed;
+    size_t emitted;
+} WatchStats;
+
+static int read_version(Version *v, const char *path)
+{
+    // read, not mapped: the file is being edited, and one truncated while
+    // mapped raises SIGBUS
+    SourceBuffer source;
+    if (source_read(&source, path) != 0)
+        return -1;
+    v->arena = (Arena *)malloc(sizeof(Arena));
+    if (!v->arena)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    arena_init(v->arena, 64 * 1024);
+    char *copy = (char *)arena_alloc(v->arena, source.length ? source.length : 1);
+    memcpy(copy, source.data, source.length);
+    v->source = copy;
+    v->length = source.length;
+    source_close(&source);
+    v->tokens = NULL;
+    v->functions = NULL;
+    v->segments = NULL;
+    v->segment_count = 0;
+    v->segment_capacity = 0;
+    diagnostics_init(&v->diagnostics, path);
+    return 0;
+}
+
+static void free_version(Version *v)
+{
+    for (size_t i = 0; i < v->segment_count; i++)
+        free(v->segments[i].latex);
+    free(v->segments);
+    free(v->functions);
+    diagnostics_free(&v->diagnostics);
+    arena_free(v->arena);
+    free(v->arena);
+}
+
+static Segment *push_segment(Version *v, uint32_t first, uint32_t end)
+{
+    if (v->segment_count == v->segment_capacity)
+    {
+        size_t capacity = v->segment_capacity ? v->segment_capacity * 2 : 64;
+        Segment *grown = (Segment *)realloc(v->segments, capacity * sizeof(Segment));
+        if (!grown)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        v->segments = grown;
+        v->segment_capacity = capacity;
+    }
+    Segment *segment = &v->segments[v->segment_count++];
+    memset(segment, 0, sizeof(Segment));
+    segment->first = first;
+    segment->end = end;
+    return segment;
+}
+
+// The segment holding token `token`
+static size_t segment_at(const Version *v, uint32_t token)
+{
+    size_t low = 0;
+    size_t high = v->segment_count;
+    while (high - low > 1)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (v->segments[mid].first <= token)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// A segment per top-level item from token `first` on. With `old`, stops at
+// the first item boundary past the edit that was one in `old` too, and
+// returns that old segment's index; NO_RESYNC if the tokens ran out first.
+static size_t parse_items(Version *v, Parser *parser, uint32_t first, const Version *old, const TokenEdit *edit)
+{
+    uint32_t start = first;
+    NodeId item;
+    while ((item = parser_next(parser)) != AST_NONE)
+    {
+        uint32_t end = ast_node(parser_ast(parser), item)->last_token + 1;
+        push_segment(v, start, end)->reach = parser_reach(parser);
+        start = end;
+        // from past new_end on, the gap in front of the next token is old text as well
+        if (old && end > edit->new_end)
+        {
+            uint32_t old_index = end - edit->new_end + edit->old_end;
+            size_t j = segment_at(old, old_index);
+            if (old->segments[j].first == old_index)
+                return j;
+        }
+    }
+    // comments after the last item go with it
+    if (start > first)
+        v->segments[v->segment_count - 1].end = v->tokens->count;
+    else
+        push_segment(v, start, v->tokens->count);
+    v->segments[v->segment_count - 1].reach = parser_reach(parser);
+    return NO_RESYNC;
+}
+
+static void emit_segment(const Version *v, Segment *segment, EmitPosition *position)
+{
+    Output out;
+    output_init_memory(&out);
+    segment->entry = *position;
+    emit_tokens(&out, v->tokens, v->functions, segment->first, segment->end, position);
+    segment->exit = *position;
+    // the segment takes the buffer over
+    free(segment->latex);
+    segment->latex = out.data;
+    segment->length = out.length;
+}
+
+static int same_position(const EmitPosition *a, const EmitPosition *b)
+{
+    return a->column == b->column && a->line_empty == b->line_empty;
+}
+
+static void resolve_diagnostics(Version *v)
+{
+    LineIndex lines;
+    line_index_init(&lines, v->source, v->length);
+    diagnostics_resolve(&v->diagnostics, 0, &lines);
+    line_index_free(&lines);
+}
+
+// The first version, or one an edit can't be lexed into, compiled whole
+static void build_version(Version *v)
+{
+    DiagnosticList *previous = diagnostics_capture(&v->diagnostics);
+    v->tokens = lex_buffer(v->arena, v->source, v->length);
+    diagnostics_capture(previous);
+    resolve_diagnostics(v);
+    uint32_t count = v->tokens->count;
+    v->functions = (uint8_t *)calloc(count ? count : 1, 1);
+    if (!v->functions)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    Arena scratch;
+    arena_init(&scratch, 64 * 1024);
+    Parser *parser = parser_open(&scratch, v->tokens, 0);
+    parse_items(v, parser, 0, NULL, NULL);
+    mark_function_names(parser_ast(parser), v->functions);
+    arena_free(&scratch);
+    EmitPosition position = EMIT_START;
+    for (size_t i = 0; i < v->segment_count; i++)
+        emit_segment(v, &v->segments[i], &position);
+}
+
+static size_t common_prefix(const char *a, const char *b, size_t limit)
+{
+    size_t n = 0;
+    while (n + 4096 <= limit && memcmp(a + n, b + n, 4096) == 0)
+        n += 4096;
+    while (n < limit && a[n] == b[n])
+        n++;
+    return n;
+}
+
+// Of the bytes before a_end and b_end
+static size_t common_suffix(const char *a_end, const char *b_end, size_t limit)
+{
+    size_t n = 0;
+    while (n + 4096 <= limit && memcmp(a_end - n - 4096, b_end - n - 4096, 4096) == 0)
+        n += 4096;
+    while (n < limit && a_end[-1 - (ptrdiff_t)n] == b_end[-1 - (ptrdiff_t)n])
+        n++;
+    return n;
+}
+
+// The old diagnostics about tokens the edit didn't lex again still hold,
+// moved like the tokens; the lexed ones had none, or the edit would have
+// failed
+static void carry_diagnostics(const Version *old, Version *v, const TokenEdit *edit)
+{
+    Token tok;
+    uint32_t from = (uint32_t)old->length;
+    if (edit->first < old->tokens->count)
+    {
+        token_at(old->tokens, edit->first, &tok);
+        from = tok.offset;
+    }
+    uint32_t to = UINT32_MAX;
+    if (edit->old_end < old->tokens->count)
+    {
+        token_at(old->tokens, edit->old_end, &tok);
+        to = tok.offset;
+    }
+    int64_t delta = (int64_t)v->length - (int64_t)old->length;
+    for (size_t i = 0; i < old->diagnostics.count; i++)
+    {
+        Diagnostic diagnostic = old->diagnostics.items[i];
+        if (diagnostic.offset >= to)
+            diagnostic.offset = (uint32_t)(diagnostic.offset + delta);
+        else if (diagnostic.offset >= from)
+            continue;
+        diagnostics_append(&v->diagnostics, &diagnostic);
+    }
+    resolve_diagnostics(v);
+}
+
+// Builds `v`, already read, from `old`: the segments before the edit are
+// moved over as they are, the ones around it are parsed and emitted again,
+// and the ones after it are moved too, emitted again only until the output
+// position they start from is the one they were emitted for. An edit with
+// lexer errors is compiled whole, to report them. Returns 1 if nothing
+// changed.
+static int update_version(Version *old, Version *v, WatchStats *stats)
+{
+    size_t limit = old->length < v->length ? old->length : v->length;
+    size_t prefix = common_prefix(old->source, v->source, limit);
+    if (prefix == old->length && prefix == v->length)
+        return 1;
+    size_t suffix = common_suffix(old->source + old->length, v->source + v->length, limit - prefix);
+    TokenEdit edit;
+    DiagnosticList *previous = diagnostics_capture(&v->diagnostics);
+    v->tokens = lex_buffer_edit(v->arena, v->source, v->length, old->tokens, prefix, suffix, &edit);
+    diagnostics_capture(previous);
+    if (!v->tokens)
+    {
+        build_version(v);
+        stats->lexed = v->tokens->count;
+        stats->parsed = v->segment_count;
+        stats->emitted = v->segment_count;
+        return 0;
+    }
+    carry_diagnostics(old, v, &edit);
+    stats->lexed = edit.new_end - edit.first;
+
+    uint32_t count = v->tokens->count;
+    v->functions = (uint8_t *)malloc(count ? count : 1);
+    if (!v->functions)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    memcpy(v->functions, old->functions, edit.first);
+    memcpy(v->functions + edit.new_end, old->functions + edit.old_end, count - edit.new_end);
+
+    // every item whose parse looked at a token the edit may have changed,
+    // even in an attempt it gave up, is parsed again
+    size_t reparse = segment_at(old, edit.first);
+    while (reparse > 0 && old->segments[reparse - 1].reach > edit.first)
+        reparse--;
+    for (size_t i = 0; i < reparse; i++)
+    {
+        *push_segment(v, 0, 0) = old->segments[i];
+        old->segments[i].latex = NULL;
+    }
+
+    uint32_t start = old->segments[reparse].first;
+    Arena scratch;
+    arena_init(&scratch, 64 * 1024);
+    Parser *parser = parser_open(&scratch, v->tokens, start);
+    size_t resync = parse_items(v, parser, start, old, &edit);
+    size_t parsed_end = v->segment_count;
+    uint32_t token_end = v->segments[parsed_end - 1].end;
+    memset(v->functions + start, 0, token_end - start);
+    mark_function_names(parser_ast(parser), v->functions);
+    arena_free(&scratch);
+    stats->parsed = parsed_end - reparse;
+
+    if (resync != NO_RESYNC)
+    {
+        for (size_t i = resync; i < old->segment_count; i++)
+        {
+            Segment *segment = push_segment(v, 0, 0);
+            *segment = old->segments[i];
+            segment->first = segment->first - edit.old_end + edit.new_end;
+            segment->end = segment->end - edit.old_end + edit.new_end;
+            segment->reach = segment->reach - edit.old_end + edit.new_end;
+            old->segments[i].latex = NULL;
+        }
+    }
+
+    EmitPosition position = reparse > 0 ? v->segments[reparse - 1].exit : EMIT_START;
+    stats->emitted = 0;
+    for (size_t i = reparse; i < v->segment_count; i++)
+    {
+        Segment *segment = &v->segments[i];
+        if (i >= parsed_end && same_position(&segment->entry, &position))
+            break;
+        emit_segment(v, segment, &position);
+        stats->emitted++;
+    }
+    return 0;
+}
+
+static void write_document(const Version *v, const char *output_path)
+{
+    Output out;
+    char *temporary = NULL;
+    if (!output_path)
+        output_init_fd(&out, STDOUT_FILENO);
+    else
+    {
+        size_t length = strlen(output_path);
+        temporary = (char *)malloc(length + 5);
+        if (!temporary)
+            panic(ERR_MEMORY_ALLOCATION, 0);
+        memcpy(temporary, output_path, length);
+        memcpy(temporary + length, ".tmp", 5);
+        // written through, not mapped: it's rewritten whole on every save, and
+        // page faults on a fresh mapping cost more than the copy
+        int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            panic(ERR_WRITE_FAILED, 0);
+        output_init_fd(&out, fd);
+        out.owns_fd = 1;
+    }
+    emit_preamble(&out);
+    for (size_t i = 0; i < v->segment_count; i++)
+        output_write(&out, v->segments[i].latex, v->segments[i].length);
+    EmitPosition end = v->segment_count ? v->segments[v->segment_count - 1].exit : EMIT_START;
+    emit_postamble(&out, &end);
+    output_close(&out);
+    // renamed over the old one, so that a LaTeX run never reads half of it
+    if (temporary && rename(temporary, output_path) != 0)
+        panic(ERR_WRITE_FAILED, 0);
+    free(temporary);
+}
+
+// Blocks until `name` in the watched directory is written or moved into
+// place, then lets the rest of the save settle. Returns 0 if inotify fails.
+static int wait_for_change(int fd, const char *name)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    for (;;)
+    {
+        if (changed)
+        {
+            struct pollfd pending = {fd, POLLIN, 0};
+            if (poll(&pending, 1, WATCH_SETTLE_MS) <= 0)
+                return 1;
+        }
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return 0;
+        for (const char *p = buffer; p < buffer + got;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)(const void *)p;
+            if (event->len > 0 && strcmp(event->name, name) == 0)
+                changed = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static double milliseconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1e3 + (double)t.tv_nsec / 1e6;
+}
+
+int watch_file(const char *path, const char *output_path)
+{
+    Version current;
+    if (strcmp(path, "-") == 0 || read_version(&current, path) != 0)
+        return -1;
+    build_version(&current);
+    write_document(&current, output_path);
+    diagnostics_print(stderr, &current.diagnostics);
+
+    // the directory is watched rather than the file, as editors often save
+    // by writing a new file and renaming it over the old one
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    char *dir = !slash ? strdup(".") : slash == path ? strdup("/") : strndup(path, (size_t)(slash - path));
+    if (!dir)
+        panic(ERR_MEMORY_ALLOCATION, 0);
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        free(dir);
+        free_version(&current);
+        return -1;
+    }
+    free(dir);
+
+    while (wait_for_change(fd, name))
+    {
+        double start = milliseconds();
+        Version next;
+        if (read_version(&next, path) != 0)
+            continue;
+        WatchStats stats;
+        if (update_version(&current, &next, &stats) != 0)
+        {
+            free_version(&next);
+            continue;
+        }
+        free_version(&current);
+        current = next;
+        write_document(&current, output_path);
+        diagnostics_print(stderr, &current.diagnostics);
+        fprintf(stderr, "%s: %u tokens lexed, %zu of %zu items parsed, %zu emitted, %.2f ms\n", path, stats.lexed,
+                stats.parsed, current.segment_count, stats.emitted, milliseconds() - start);
+    }
+    close(fd);
+    free_version(&current);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "test.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int test_failures;
+
+const char corpus[] = "#include <stdio.h>\n"
+                      "#define MAX(a, b) ((a) > (b) ? (a) : (b))\n"
+                      "/* a block comment\n * over lines */\n"
+                      "typedef struct node { int value; struct node *next; } node;\n"
+                      "static const char *names[] = {\"zero\", \"one\\n\", \"t\\\"wo\"};\n"
+                      "enum color { RED, GREEN = 2, BLUE };\n"
+                      "int sum(const node *list, int (*f)(int))\n"
+                      "{\n"
+                      "    int total = 0; // running\n"
+                      "    for (const node *n = list; n; n = n->next)\n"
+                      "        total += f ? f(n->value) : n->value;\n"
+                      "    return total;\n"
+                      "}\n"
+                      "\n"
+                      "int main(int argc, char **argv)\n"
+                      "{\n"
+                      "\tchar c = '\\n', d = 'x';\n"
+                      "\tfloat x = 1.5e-3, y = .25, z = 10.;\n"
+                      "\tunsigned long mask = 255 & ~(1 << 3) | 7 ^ 2;\n"
+                      "\tswitch (argc) { case 1: c = d; break; default: goto out; }\n"
+                      "\tdo { argc--; } while (argc > 0 && argv[argc] != NULL || !c);\n"
+                      "\tif (x <= y) x = y; else if (y >= z) y /= 2; else z *= (float)sizeof(node);\n"
+                      "\tstruct { int a[3]; } s = { .a = { [1] = 2 } };\n"
+                      "\tprintf(\"%d %s\\n\", MAX(s.a[1], 1), names[0]);\n"
+                      "out:\n"
+                      "\treturn sum(NULL, 0) % 2;\n"
+                      "}\n";
+
+static uint32_t random_state = 12345;
+
+uint32_t random_below(uint32_t bound)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % bound;
+}
+
+char *file_text(FILE *file)
+{
+    long length = ftell(file);
+    char *text = (char *)malloc((size_t)length + 1);
+    if (!text)
+        abort();
+    rewind(file);
+    size_t got = fread(text, 1, (size_t)length, file);
+    text[got] = '\0';
+    return text;
+}
+
+void make_temp_dir(char *dir)
+{
+    strcpy(dir, "/tmp/ctolatex-test.XXXXXX");
+    if (!mkdtemp(dir))
+        abort();
+}
+
+void write_file(const char *path, const char *text)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        abort();
+    fputs(text, file);
+    fclose(file);
+}
+
+void remove_tree(const char *path)
+{
+    // a symlink goes, not what it points to
+    struct stat st;
+    DIR *dir = lstat(path, &st) == 0 && S_ISDIR(st.st_mode) ? opendir(path) : NULL;
+    if (dir)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            char child[1024];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            remove_tree(child);
+        }
+        closedir(dir);
+    }
+    remove(path);
+}
+
+int quiet_stderr(void)
+{
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    return saved;
+}
+
+void restore_stderr(int saved)
+{
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+int test_report(const char *name)
+{
+    if (test_failures)
+    {
+        fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// Shared by the programs under tests/: a CHECK that counts failures instead of stopping, and inputs to check with
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+Each tests/test_<module>.c is a program of its own, linked against the
+library: main runs its tests and returns test_report(). `make test` builds
+and runs them all.
+*/
+
+// Checks that failed so far in this program
+extern int test_failures;
+
+#define CHECK(condition)                                                                                             \
+    do                                                                                                               \
+    {                                                                                                                \
+        if (!(condition))                                                                                            \
+        {                                                                                                            \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #condition);            \
+            test_failures++;                                                                                         \
+        }                                                                                                            \
+    } while (0)
+
+// Most of C in a few lines, for the tests that compare two ways of doing the
+// same thing: both have to handle all of it
+extern const char corpus[];
+
+// Deterministic inputs: the same sequence on every run
+uint32_t random_below(uint32_t bound);
+
+// What has been written to `file`, as a NUL-terminated string to be freed
+char* file_text(FILE *file);
+
+// A new empty directory under /tmp, for the tests that need files; `dir`
+// holds at least 64 bytes
+void make_temp_dir(char *dir);
+void write_file(const char *path, const char *text);
+// `path` and everything under it
+void remove_tree(const char *path);
+
+// stderr goes nowhere until restore_stderr, for calls that print errors the
+// test expects
+int quiet_stderr(void);
+void restore_stderr(int saved);
+
+// Prints "<name>: ..." with how the checks went; the program's exit status
+int test_report(const char *name);
+
+#endif // TEST_H
@@ -0,0 +1,209 @@
+// Tests of batch mode: which inputs paths and manifests expand to, and output that doesn't depend on the workers
+#include "batch.h"
+#include "cache.h"
+#include "test.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A directory gives its .c and .h files, sorted and recursively, leaving
+// out dot files and anything else; a manifest gives its first column
+static void test_inputs(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    static const char *const files[] = {"b.c", "a.h", "notes.txt", ".hidden.c", "sub/c.c", ".git/d.c"};
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.git", dir);
+    mkdir(path, 0700);
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        write_file(path, "int x;\n");
+    }
+    InputList inputs;
+    input_list_init(&inputs);
+    input_list_add_path(&inputs, dir);
+    static const char *const expected[] = {"a.h", "b.c", "sub/c.c"};
+    CHECK(inputs.count == 3);
+    for (size_t i = 0; i < inputs.count && i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, expected[i]);
+        CHECK(strcmp(inputs.paths[i], path) == 0 && inputs.sizes[i] == 7);
+    }
+    input_list_free(&inputs);
+
+    char manifest[128], text[512];
+    snprintf(manifest, sizeof(manifest), "%s/list.csv", dir);
+    snprintf(text, sizeof(text), "# inputs\n\n  \"%s/b.c\", first\n%s/sub\r\n#%s/a.h\n", dir, dir, dir);
+    write_file(manifest, text);
+    input_list_init(&inputs);
+    CHECK(input_list_add_manifest(&inputs, manifest) == 0);
+    CHECK(inputs.count == 2);
+    snprintf(path, sizeof(path), "%s/b.c", dir);
+    CHECK(inputs.count > 0 && strcmp(inputs.paths[0], path) == 0);
+    snprintf(path, sizeof(path), "%s/sub/c.c", dir);
+    CHECK(inputs.count > 1 && strcmp(inputs.paths[1], path) == 0);
+    snprintf(path, sizeof(path), "%s/missing.csv", dir);
+    CHECK(input_list_add_manifest(&inputs, path) == -1);
+    input_list_free(&inputs);
+    remove_tree(dir);
+}
+
+// Links to files are inputs like the files; links to directories aren't
+// followed, so one that points back up the tree ends nowhere
+static void test_input_links(void)
+{
+    char dir[64], path[128], target[128];
+    make_temp_dir(dir);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    mkdir(path, 0700);
+    static const char *const files[] = {"b.c", "sub/c.c"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        write_file(path, "int x;\n");
+    }
+    static const struct {
+        const char *link;
+        const char *target; // relative to the link's directory, or to `dir` with a leading '/'
+    } links[] = {{"sub/loop", ".."}, {"sub/self", "."}, {"up", "/sub"}, {"link.c", "b.c"}, {"gone.c", "none.c"}};
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, links[i].link);
+        if (links[i].target[0] == '/')
+            snprintf(target, sizeof(target), "%s%s", dir, links[i].target);
+        else
+            snprintf(target, sizeof(target), "%s", links[i].target);
+        CHECK(symlink(target, path) == 0);
+    }
+    InputList inputs;
+    input_list_init(&inputs);
+    input_list_add_path(&inputs, dir);
+    static const char *const expected[] = {"b.c", "link.c", "sub/c.c"};
+    CHECK(inputs.count == 3);
+    for (size_t i = 0; i < inputs.count && i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, expected[i]);
+        CHECK(strcmp(inputs.paths[i], path) == 0 && inputs.sizes[i] == 7);
+    }
+    input_list_free(&inputs);
+
+    // named directly, a link to a directory is still the directory
+    snprintf(path, sizeof(path), "%s/up", dir);
+    input_list_init(&inputs);
+    input_list_add_path(&inputs, path);
+    CHECK(inputs.count == 1);
+    input_list_free(&inputs);
+    remove_tree(dir);
+}
+
+// Files of a few sizes, so the biggest-first order differs from the input
+// order, one of them with two errors
+static void make_inputs(char *dir, InputList *inputs)
+{
+    make_temp_dir(dir);
+    char path[128];
+    for (int i = 0; i < 6; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d.c", dir, i);
+        FILE *file = fopen(path, "w");
+        fprintf(file, "int file%d;\n", i);
+        for (int copy = 0; copy < (i * 5) % 3 + 1; copy++)
+            fputs(corpus, file);
+        if (i == 3)
+            fputs("int x = 1e;\nchar c = 'ab;\n", file);
+        fclose(file);
+    }
+    input_list_init(inputs);
+    input_list_add_path(inputs, dir);
+}
+
+static char *batch_output(const InputList *inputs, const BatchOptions *options, size_t *errors)
+{
+    Output out;
+    output_init_memory(&out);
+    int saved = quiet_stderr();
+    *errors = batch_run(inputs, options, &out);
+    restore_stderr(saved);
+    output_char(&out, '\0');
+    char *text = strdup(out.data);
+    output_close(&out);
+    return text;
+}
+
+static size_t count_files(const char *path)
+{
+    size_t count = 0;
+    DIR *dir = opendir(path);
+    for (struct dirent *entry; dir && (entry = readdir(dir)) != NULL;)
+        count += entry->d_name[0] != '.';
+    if (dir)
+        closedir(dir);
+    return count;
+}
+
+// However many workers compile them, cached or not, the files come out the
+// same and in input order, with the same errors, in every mode
+static void test_batch_agrees(void)
+{
+    char dir[64];
+    InputList inputs;
+    make_inputs(dir, &inputs);
+    static const OutputMode modes[] = {OUTPUT_LATEX, OUTPUT_TOKENS, OUTPUT_AST, OUTPUT_HIGHLIGHT};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        BatchOptions options = {1, modes[m], NULL, 0, NULL, 0};
+        size_t errors, other_errors;
+        char *expected = batch_output(&inputs, &options, &errors);
+        CHECK(errors == 2);
+        const char *at = expected;
+        for (size_t i = 0; i < inputs.count; i++)
+        {
+            char header[160];
+            snprintf(header, sizeof(header), "==> %s <==\n", inputs.paths[i]);
+            at = strstr(at, header);
+            CHECK(at != NULL);
+            if (!at)
+                break;
+        }
+        for (options.threads = 2; options.threads <= 8; options.threads++)
+        {
+            char *output = batch_output(&inputs, &options, &other_errors);
+            CHECK(strcmp(output, expected) == 0 && other_errors == errors);
+            free(output);
+        }
+        char cache_dir[80];
+        snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+        Cache cache;
+        CHECK(cache_open(&cache, cache_dir, 1 << 20, (uint64_t)modes[m]) == 0);
+        options.cache = &cache;
+        for (options.threads = 1; options.threads <= 4; options.threads += 3)
+        {
+            // the first run fills the cache, the second reads it
+            for (int run = 0; run < 2; run++)
+            {
+                char *output = batch_output(&inputs, &options, &other_errors);
+                CHECK(strcmp(output, expected) == 0 && other_errors == errors);
+                free(output);
+            }
+        }
+        // output with errors isn't stored, and the other modes have entries of their own
+        CHECK(count_files(cache_dir) == (inputs.count - 1) * (m + 1));
+        cache_close(&cache);
+        free(expected);
+    }
+    input_list_free(&inputs);
+    remove_tree(dir);
+}
+
+int main(void)
+{
+    test_inputs();
+    test_input_links();
+    test_batch_agrees();
+    return test_report("batch");
+}
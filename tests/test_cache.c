@@ -0,0 +1,96 @@
+// Tests of the compiled-output cache: its hash, entries found again, and trimming
+#include "cache.h"
+#include "test.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// XXH64's published answers, through the short and the 32-byte-stripe paths
+static void test_hash(void)
+{
+    CHECK(cache_hash("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(cache_hash("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+    // the same bytes at any alignment
+    size_t length = strlen(corpus);
+    char *buffer = (char *)malloc(length + 8);
+    uint64_t expected = cache_hash(corpus, length, 7);
+    for (size_t shift = 1; shift < 8; shift++)
+    {
+        memcpy(buffer + shift, corpus, length);
+        CHECK(cache_hash(buffer + shift, length, 7) == expected);
+    }
+    CHECK(cache_hash(corpus, length, 8) != expected);
+    free(buffer);
+}
+
+// A stored entry is found by the same input and options only
+static void test_round_trip(void)
+{
+    char dir[64];
+    make_temp_dir(dir);
+    Cache cache, other;
+    CHECK(cache_open(&cache, dir, 1 << 20, 0) == 0);
+    CHECK(cache_open(&other, dir, 1 << 20, 1) == 0);
+    CacheKey key = cache_key(&cache, corpus, strlen(corpus));
+    Output out;
+    output_init_memory(&out);
+    CHECK(!cache_lookup(&cache, &key, &out));
+    cache_store(&cache, &key, "compiled", 8);
+    CHECK(cache_lookup(&cache, &key, &out) && out.length == 8 && memcmp(out.data, "compiled", 8) == 0);
+    CacheKey variant = cache_key(&other, corpus, strlen(corpus));
+    CHECK(variant.hash != key.hash && !cache_lookup(&other, &variant, &out));
+    CacheKey shorter = cache_key(&cache, corpus, strlen(corpus) - 1);
+    CHECK(!cache_lookup(&cache, &shorter, &out));
+    output_close(&out);
+    cache_close(&other);
+    cache_close(&cache);
+    remove_tree(dir);
+}
+
+// Over the limit, the entries used longest ago go first
+static void test_trim(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    Cache cache;
+    CHECK(cache_open(&cache, dir, 8 * 1024, 0) == 0);
+    static char output[1024];
+    memset(output, 'x', sizeof(output));
+    CacheKey keys[16];
+    time_t now = time(NULL);
+    for (int i = 0; i < 16; i++)
+    {
+        char input[16];
+        snprintf(input, sizeof(input), "input %d", i);
+        keys[i] = cache_key(&cache, input, strlen(input));
+        cache_store(&cache, &keys[i], output, sizeof(output));
+        // entry i was last used i minutes later than entry 0
+        snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)keys[i].hash);
+        struct timespec times[2] = {{now - 3600 + i * 60, 0}, {now - 3600 + i * 60, 0}};
+        CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+    }
+    Output out;
+    output_init_memory(&out);
+    CHECK(cache_lookup(&cache, &keys[0], &out));
+    cache_trim(&cache);
+    CHECK(cache_lookup(&cache, &keys[0], &out));
+    CHECK(!cache_lookup(&cache, &keys[1], &out));
+    CHECK(cache_lookup(&cache, &keys[15], &out));
+    int kept = 0;
+    for (int i = 0; i < 16; i++)
+        kept += cache_lookup(&cache, &keys[i], &out);
+    CHECK(kept > 1 && kept * (int)sizeof(output) < 8 * 1024);
+    output_close(&out);
+    cache_close(&cache);
+    remove_tree(dir);
+}
+
+int main(void)
+{
+    test_hash();
+    test_round_trip();
+    test_trim();
+    return test_report("cache");
+}
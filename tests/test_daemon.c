@@ -0,0 +1,231 @@
+// Tests of daemon mode: answers that match local compiles, and a daemon that outlives bad inputs
+#include "daemon.h"
+#include "test.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A daemon serving `socket_path` from a child process, its errors silenced
+static pid_t start_daemon(const char *socket_path)
+{
+    fflush(NULL);
+    pid_t daemon = fork();
+    if (daemon == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        _exit(daemon_serve(socket_path, 2, NULL, 0) == 0 ? 0 : 1);
+    }
+    return daemon;
+}
+
+static void stop_daemon(pid_t daemon)
+{
+    kill(daemon, SIGTERM);
+    int status;
+    CHECK(waitpid(daemon, &status, 0) == daemon && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// Forwards `inputs`, waiting for the daemon to listen first
+static int forward(const char *socket_path, const InputList *inputs, OutputMode mode, Output *out, size_t *errors)
+{
+    int result = -1;
+    for (int attempt = 0; attempt < 200 && result != 0; attempt++)
+    {
+        int saved = quiet_stderr();
+        result = daemon_forward(socket_path, inputs, mode, out, errors);
+        restore_stderr(saved);
+        if (result != 0)
+            usleep(10 * 1000);
+    }
+    return result;
+}
+
+// What the daemon sends back is what batch_run writes locally, in every
+// mode, errors included
+static void test_daemon_matches_local(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    for (int i = 0; i < 4; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d.c", dir, i);
+        FILE *file = fopen(path, "w");
+        fprintf(file, "int file%d;\n", i);
+        for (int copy = 0; copy < i; copy++)
+            fputs(corpus, file);
+        if (i == 2)
+            fputs("int x = 1e;\nchar c = 'ab;\n", file);
+        fclose(file);
+    }
+    InputList inputs;
+    input_list_init(&inputs);
+    input_list_add_path(&inputs, dir);
+    char socket_path[96];
+    snprintf(socket_path, sizeof(socket_path), "%s/daemon.sock", dir);
+    pid_t daemon = start_daemon(socket_path);
+
+    static const OutputMode modes[] = {OUTPUT_LATEX, OUTPUT_TOKENS, OUTPUT_AST, OUTPUT_HIGHLIGHT};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        BatchOptions options = {1, modes[m], NULL, 0, NULL, 0};
+        Output expected, out;
+        output_init_memory(&expected);
+        int saved = quiet_stderr();
+        size_t errors = batch_run(&inputs, &options, &expected), forwarded_errors = 0;
+        restore_stderr(saved);
+        CHECK(errors == 2);
+        output_init_memory(&out);
+        CHECK(forward(socket_path, &inputs, modes[m], &out, &forwarded_errors) == 0);
+        CHECK(out.length == expected.length && memcmp(out.data, expected.data, out.length) == 0);
+        CHECK(forwarded_errors == errors);
+        output_close(&out);
+        output_close(&expected);
+    }
+    stop_daemon(daemon);
+    input_list_free(&inputs);
+    remove_tree(dir);
+}
+
+// One request on a connection, in the protocol `version` the greeting gave;
+// the first of the diagnostics in the answer, if any, goes to `first`
+static int send_request(int fd, uint32_t version, DaemonInput input, const char *payload, DaemonResponse *response,
+                        Diagnostic *first)
+{
+    DaemonRequest request = {DAEMON_MAGIC, (uint32_t)input, OUTPUT_LATEX, version, strlen(payload)};
+    if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != (ssize_t)sizeof(request) ||
+        send(fd, payload, request.length, MSG_NOSIGNAL) != (ssize_t)request.length)
+        return -1;
+    if (recv(fd, response, sizeof(*response), MSG_WAITALL) != (ssize_t)sizeof(*response))
+        return -1;
+    size_t length = response->length + response->detail * sizeof(Diagnostic);
+    char *answer = (char *)malloc(length + 1);
+    ssize_t got = length ? recv(fd, answer, length, MSG_WAITALL) : 0;
+    if (response->detail > 0)
+        memcpy(first, answer + response->length, sizeof(Diagnostic));
+    free(answer);
+    return got == (ssize_t)length ? 0 : -1;
+}
+
+// A source with errors is compiled as far as it goes, and a path that isn't
+// there fails only its own request: the same connection goes on being served
+static void test_daemon_survives_bad_inputs(void)
+{
+    char dir[64], socket_path[96];
+    make_temp_dir(dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/daemon.sock", dir);
+    pid_t daemon = start_daemon(socket_path);
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    int fd = -1;
+    for (int attempt = 0; attempt < 200 && fd < 0; attempt++)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+            usleep(10 * 1000);
+        }
+    }
+    CHECK(fd >= 0);
+    DaemonResponse response;
+    Diagnostic first;
+    CHECK(recv(fd, &response, sizeof(response), MSG_WAITALL) == (ssize_t)sizeof(response) &&
+          response.status == DAEMON_OK);
+    uint32_t version = response.detail;
+    CHECK(send_request(fd, version, DAEMON_SOURCE, "int a;\nfloat f = 1.5e;\n", &response, &first) == 0 &&
+          response.status == DAEMON_OK && response.length > 0 && response.detail == 1);
+    CHECK(first.code == ERR_MALFORMED_FLOAT && first.line == 2 && first.column == 11);
+    CHECK(send_request(fd, version, DAEMON_PATH, "/nonexistent/file.c", &response, &first) == 0 &&
+          response.status == ERR_FILE_NOT_FOUND);
+    CHECK(send_request(fd, version, DAEMON_SOURCE, corpus, &response, &first) == 0 && response.status == DAEMON_OK &&
+          response.length > 0 && response.detail == 0);
+    close(fd);
+    stop_daemon(daemon);
+    remove_tree(dir);
+}
+
+// A connection to the daemon at `socket_path`, past its greeting, whose
+// version goes to `version`; -1 if it never listens
+static int connect_daemon(const char *socket_path, uint32_t *version)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        DaemonResponse greeting;
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+            recv(fd, &greeting, sizeof(greeting), MSG_WAITALL) == (ssize_t)sizeof(greeting))
+        {
+            *version = greeting.detail;
+            return fd;
+        }
+        close(fd);
+        usleep(10 * 1000);
+    }
+    return -1;
+}
+
+// A file cut short and grown back while the daemon compiles it costs that
+// request at most: the daemon reads files rather than mapping them, as a
+// mapping that loses its pages raises SIGBUS
+static void test_daemon_survives_truncation(void)
+{
+    char dir[64], socket_path[96], path[128];
+    make_temp_dir(dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/daemon.sock", dir);
+    snprintf(path, sizeof(path), "%s/shrinking.c", dir);
+    FILE *file = fopen(path, "w");
+    for (int copy = 0; copy < 500; copy++)
+        fputs(corpus, file);
+    off_t size = ftello(file);
+    fclose(file);
+
+    pid_t daemon = start_daemon(socket_path);
+    uint32_t version = 0;
+    int fd = connect_daemon(socket_path, &version);
+    CHECK(fd >= 0);
+    fflush(NULL);
+    pid_t truncator = fork();
+    if (truncator == 0)
+    {
+        // short for half of the time
+        for (;;)
+        {
+            if (truncate(path, 1) != 0)
+                _exit(1);
+            usleep(500);
+            if (truncate(path, size) != 0)
+                _exit(1);
+            usleep(500);
+        }
+    }
+    DaemonResponse response;
+    Diagnostic first;
+    int answered = 0;
+    for (int i = 0; i < 200 && fd >= 0; i++)
+        answered += send_request(fd, version, DAEMON_PATH, path, &response, &first) == 0;
+    kill(truncator, SIGKILL);
+    waitpid(truncator, NULL, 0);
+    CHECK(answered == 200);
+    close(fd);
+    stop_daemon(daemon);
+    remove_tree(dir);
+}
+
+int main(void)
+{
+    test_daemon_matches_local();
+    test_daemon_survives_bad_inputs();
+    test_daemon_survives_truncation();
+    return test_report("daemon");
+}
@@ -0,0 +1,150 @@
+// Tests of the LaTeX emitter: what known inputs turn into
+#include "arena.h"
+#include "emitter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "scan.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char PREAMBLE[] = "\\providecommand{\\CKeyword}[1]{\\textbf{#1}}\n"
+                               "\\providecommand{\\CComment}[1]{\\textit{#1}}\n"
+                               "\\providecommand{\\CString}[1]{#1}\n"
+                               "\\providecommand{\\CNumber}[1]{#1}\n"
+                               "\\providecommand{\\CPreproc}[1]{\\textsl{#1}}\n"
+                               "\\providecommand{\\CFunction}[1]{#1}\n"
+                               "\\begin{flushleft}\\ttfamily\n";
+
+static char *emit_text(const char *source)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    Ast *ast = parse_tokens(&arena, lex_buffer(&arena, source, strlen(source)));
+    Output out;
+    output_init_memory(&out);
+    emit_latex(&out, ast);
+    output_char(&out, '\0');
+    char *text = strdup(out.data);
+    output_close(&out);
+    arena_free(&arena);
+    return text;
+}
+
+// Each class of token, characters LaTeX treats specially, tabs and a
+// comment over lines, between the preamble and \end{flushleft}
+static void test_known_answers(void)
+{
+    static const struct {
+        const char *source;
+        const char *latex;
+    } cases[] = {
+        {"int f(int x) { return g(x) + 1; } // c\n#define N \"s\\\\\"\n",
+         "\\CKeyword{int}\\ \\CFunction{f}(\\CKeyword{int}\\ x)\\ \\{\\ \\CKeyword{return}\\ \\CFunction{g}(x)\\ +\\ "
+         "\\CNumber{1};\\ \\}\\ \\CComment{//\\ c}\\\\\n"
+         "\\CPreproc{\\#define\\ N\\ \"s\\textbackslash{}\\textbackslash{}\"}\\\\\n"},
+        {"char *s = \"a_b%c$\";\n\tx = y ^ ~z & 31; /* two\n   lines */\n",
+         "\\CKeyword{char}\\ *s\\ =\\ \\CString{\"a\\_b\\%c\\$\"};\\\\\n"
+         "\\mbox{}\\ \\ \\ \\ x\\ =\\ y\\ \\textasciicircum{}\\ \\textasciitilde{}z\\ \\&\\ \\CNumber{31};\\ "
+         "\\CComment{/*\\ two}\\\\\n"
+         "\\mbox{}\\CComment{\\ \\ \\ lines\\ */}\\\\\n"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        char *text = emit_text(cases[i].source);
+        size_t preamble = strlen(PREAMBLE), latex = strlen(cases[i].latex);
+        CHECK(strncmp(text, PREAMBLE, preamble) == 0);
+        if (strncmp(text + preamble, cases[i].latex, latex) != 0 ||
+            strcmp(text + preamble + latex, "\\end{flushleft}\n") != 0)
+        {
+            fprintf(stderr, "case %zu emitted as:\n%s", i, text);
+            CHECK(!"LaTeX as expected");
+        }
+        free(text);
+    }
+}
+
+// Escaping finds the specials with the vectorized scanners; every backend
+// has to find the same ones
+static void test_backends_agree(void)
+{
+    static const char *const backends[] = {"scalar", "sse2", "avx2"};
+    const char *initial = scan_backend();
+    scan_select_backend("scalar");
+    char *expected = emit_text(corpus);
+    for (size_t i = 1; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (scan_select_backend(backends[i]) != 0)
+            continue;
+        char *text = emit_text(corpus);
+        CHECK(strcmp(text, expected) == 0);
+        free(text);
+    }
+    free(expected);
+    scan_select_backend(initial);
+}
+
+// The LaTeX of a file emitted a piece at a time, as watch mode does, is
+// the LaTeX of the whole
+static void test_emit_in_pieces(void)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    Ast *ast = parse_tokens(&arena, lex_buffer(&arena, corpus, strlen(corpus)));
+    Output whole;
+    output_init_memory(&whole);
+    emit_latex(&whole, ast);
+
+    const TokenList *tokens = ast->tokens;
+    uint8_t *functions = (uint8_t *)calloc(tokens->count, 1);
+    mark_function_names(ast, functions);
+    Output pieces;
+    output_init_memory(&pieces);
+    emit_preamble(&pieces);
+    EmitPosition position = EMIT_START;
+    for (uint32_t first = 0; first < tokens->count;)
+    {
+        uint32_t end = first + 1 + random_below(8);
+        if (end > tokens->count)
+            end = tokens->count;
+        // each piece emitted to a buffer of its own, from the position alone
+        Output piece;
+        output_init_memory(&piece);
+        emit_tokens(&piece, tokens, functions, first, end, &position);
+        output_write(&pieces, piece.data, piece.length);
+        output_close(&piece);
+        first = end;
+    }
+    emit_postamble(&pieces, &position);
+    CHECK(pieces.length == whole.length && memcmp(pieces.data, whole.data, whole.length) == 0);
+    free(functions);
+    output_close(&pieces);
+    output_close(&whole);
+    arena_free(&arena);
+}
+
+// --highlight guesses function names from the '(' after them, which for
+// this source is what the parse finds too; everything else is the same
+static void test_highlight_matches_full(void)
+{
+    const char *source = "int sum(int a, int b) { return a + b; }\n"
+                         "/* c */ static void run(void) { int x = sum(1, 2) * 3; printf(\"%d\\n\", x); }\n"
+                         "#define ONE 1\nchar c = 'q'; double d = 1.5e3;\t// tab\n";
+    char *full = emit_text(source);
+    Output highlighted;
+    output_init_memory(&highlighted);
+    lex_highlight(&highlighted, source, strlen(source));
+    output_char(&highlighted, '\0');
+    CHECK(strcmp(highlighted.data, full) == 0);
+    output_close(&highlighted);
+    free(full);
+}
+
+int main(void)
+{
+    test_known_answers();
+    test_backends_agree();
+    test_emit_in_pieces();
+    test_highlight_matches_full();
+    return test_report("emitter");
+}
@@ -0,0 +1,178 @@
+// Tests of include resolution: guards, the header cache and the typedef names found
+#include "arena.h"
+#include "includes.h"
+#include "intern.h"
+#include "lexer.h"
+#include "test.h"
+#include "tokens.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char dir[64];
+    InternTable names;
+    HeaderCache *cache;
+    Arena arena;
+} Run;
+
+static void run_start(Run *run, const char *const *dirs, size_t dir_count)
+{
+    intern_init(&run->names, 1);
+    run->cache = header_cache_open(dirs, dir_count, &run->names);
+    arena_init(&run->arena, 64 * 1024);
+}
+
+static void run_end(Run *run)
+{
+    arena_free(&run->arena);
+    header_cache_close(run->cache);
+    intern_free(&run->names);
+}
+
+static void write_header(const Run *run, const char *name, const char *text)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", run->dir, name);
+    write_file(path, text);
+}
+
+// Resolves the includes of `text`, a file in the run's directory, into *tokens
+static uint64_t resolve(Run *run, const char *text, TokenList **tokens)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/main.c", run->dir);
+    *tokens = lex_buffer(&run->arena, text, strlen(text));
+    return include_resolve(run->cache, path, *tokens);
+}
+
+static int has_type(Run *run, const TokenList *tokens, const char *name)
+{
+    return intern_set_has(tokens->types, intern(&run->names, name, strlen(name)));
+}
+
+// #ifndef/#define/#endif, #if !defined X, #if !defined(X) and #pragma once
+// make a header walked once per file: a second header with the same guard
+// adds nothing, and including a guarded header twice keys the output as
+// including it once. A guard that doesn't enclose the file is none.
+static void test_guards(void)
+{
+    Run run;
+    make_temp_dir(run.dir);
+    run_start(&run, NULL, 0);
+    write_header(&run, "ifndef.h", "// leading comment\n#ifndef ONE_H\n#define ONE_H\ntypedef int A;\n#endif\n");
+    write_header(&run, "ifndef_again.h", "#ifndef ONE_H\n#define ONE_H\ntypedef int B;\n#endif // ONE_H\n");
+    write_header(&run, "defined.h", "#if !defined TWO_H\n#define TWO_H\ntypedef int C;\n#endif\n");
+    write_header(&run, "defined_paren.h", "#if !defined(TWO_H)\n#define TWO_H\ntypedef int D;\n#endif\n");
+    write_header(&run, "once.h", "#pragma once\ntypedef int E;\n");
+    write_header(&run, "plain.h", "typedef int F;\n");
+    write_header(&run, "open.h", "#ifndef THREE_H\n#define THREE_H\n#endif\ntypedef int G;\n");
+    write_header(&run, "open_again.h", "#ifndef THREE_H\n#define THREE_H\ntypedef int H;\n#endif\n");
+    write_header(&run, "else.h", "#ifndef FOUR_H\n#define FOUR_H\ntypedef int I;\n#else\n#endif\n");
+    write_header(&run, "else_again.h", "#ifndef FOUR_H\n#define FOUR_H\ntypedef int J;\n#endif\n");
+
+    TokenList *tokens;
+    resolve(&run,
+            "#include \"ifndef.h\"\n#include \"ifndef_again.h\"\n"
+            "#include \"defined.h\"\n#include \"defined_paren.h\"\n"
+            "#include \"open.h\"\n#include \"open_again.h\"\n"
+            "#include \"else.h\"\n#include \"else_again.h\"\n",
+            &tokens);
+    CHECK(has_type(&run, tokens, "A") && !has_type(&run, tokens, "B"));
+    CHECK(has_type(&run, tokens, "C") && !has_type(&run, tokens, "D"));
+    CHECK(has_type(&run, tokens, "G") && has_type(&run, tokens, "H"));
+    CHECK(has_type(&run, tokens, "I") && has_type(&run, tokens, "J"));
+
+    static const struct {
+        const char *name;
+        int guarded;
+    } cases[] = {{"ifndef.h", 1}, {"defined_paren.h", 1}, {"once.h", 1}, {"plain.h", 0}, {"open.h", 0}};
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        char once[128], twice[320];
+        snprintf(once, sizeof(once), "#include \"%s\"\n", cases[i].name);
+        snprintf(twice, sizeof(twice), "%sint x;\n%s", once, once);
+        uint64_t stamp = resolve(&run, once, &tokens);
+        CHECK(stamp != 0);
+        CHECK((resolve(&run, twice, &tokens) == stamp) == cases[i].guarded);
+    }
+    run_end(&run);
+    remove_tree(run.dir);
+}
+
+// A header is lexed once per run, however many files include it: rewritten
+// behind the cache's back, with its time put back, it still declares what
+// it did. Given a new time, it's read again.
+static void test_headers_lexed_once(void)
+{
+    Run run;
+    make_temp_dir(run.dir);
+    run_start(&run, NULL, 0);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/types.h", run.dir);
+    write_file(path, "typedef int Old;\n");
+    struct timespec times[2] = {{1000000000, 0}, {1000000000, 0}};
+    CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+
+    TokenList *tokens;
+    uint64_t stamp = resolve(&run, "#include \"types.h\"\n", &tokens);
+    CHECK(has_type(&run, tokens, "Old"));
+    write_file(path, "typedef int New;\n");
+    CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+    CHECK(resolve(&run, "#include \"types.h\"\nint y;\n", &tokens) == stamp);
+    CHECK(has_type(&run, tokens, "Old") && !has_type(&run, tokens, "New"));
+
+    times[0].tv_sec = times[1].tv_sec = 1000000060;
+    CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+    CHECK(resolve(&run, "#include \"types.h\"\n", &tokens) != stamp);
+    CHECK(has_type(&run, tokens, "New") && !has_type(&run, tokens, "Old"));
+    run_end(&run);
+    remove_tree(run.dir);
+}
+
+// The names typedefs declare, through nested headers found by quoted and
+// angled includes; not the members, parameters or locals around them
+static void test_typedef_names(void)
+{
+    Run run;
+    make_temp_dir(run.dir);
+    char include_dir[128];
+    snprintf(include_dir, sizeof(include_dir), "%s/include", run.dir);
+    CHECK(mkdir(include_dir, 0700) == 0);
+    const char *dirs[] = {include_dir};
+    run_start(&run, dirs, 1);
+    write_header(&run, "local.h",
+                 "#include <sys.h>\n"
+                 "typedef struct { int x; struct { char *y; } inner; } T, *PT;\n"
+                 "typedef int (*F)(int arg);\n"
+                 "typedef unsigned long Size, Sizes[4];\n"
+                 "static inline int f(int n) { typedef int Local; return n; }\n"
+                 "int not_a_type;\n");
+    write_header(&run, "include/sys.h", "typedef struct Node Node;\ntypedef void (**Handlers)(void);\n");
+    // only looked up next to the including file when quoted
+    write_header(&run, "hidden.h", "typedef int Hidden;\n");
+
+    TokenList *tokens;
+    resolve(&run, "#include \"local.h\"\n#include <hidden.h>\n", &tokens);
+    static const char *const types[] = {"T", "PT", "F", "Size", "Sizes", "Node", "Handlers"};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        CHECK(has_type(&run, tokens, types[i]));
+    static const char *const others[] = {"x", "y", "inner", "arg", "f", "n", "Local", "not_a_type", "Hidden"};
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+        CHECK(!has_type(&run, tokens, others[i]));
+    CHECK(tokens->types->count == sizeof(types) / sizeof(types[0]));
+
+    // a file that includes nothing reaches no headers
+    CHECK(resolve(&run, "int main(void) { return 0; }\n", &tokens) == 0 && tokens->types->count == 0);
+    run_end(&run);
+    remove_tree(run.dir);
+}
+
+int main(void)
+{
+    test_guards();
+    test_headers_lexed_once();
+    test_typedef_names();
+    return test_report("includes");
+}
@@ -0,0 +1,119 @@
+// Tests of identifier interning: IDs are stable, shared tables agree across threads
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "pool.h"
+#include "test.h"
+#include "tokens.h"
+#include <stdio.h>
+#include <string.h>
+
+#define NAMES 2000
+
+typedef struct {
+    InternTable *table;
+    uint32_t ids[4][NAMES];
+} InternJobs;
+
+static void name_of(char *name, size_t size, uint32_t i)
+{
+    snprintf(name, size, "name_%u", i);
+}
+
+// The same text gets the same ID, different text a new one, and the text
+// comes back from the ID; for tables with and without shards
+static void test_ids_are_stable(void)
+{
+    for (int shared = 0; shared <= 1; shared++)
+    {
+        InternTable table;
+        intern_init(&table, shared);
+        uint32_t ids[NAMES];
+        char name[32];
+        for (uint32_t i = 0; i < NAMES; i++)
+        {
+            name_of(name, sizeof(name), i);
+            ids[i] = intern(&table, name, strlen(name));
+            CHECK(ids[i] != INTERN_NONE);
+            for (uint32_t j = i < 3 ? 0 : i - 3; j < i; j++)
+                CHECK(ids[j] != ids[i]);
+        }
+        for (uint32_t i = 0; i < NAMES; i++)
+        {
+            name_of(name, sizeof(name), i);
+            CHECK(intern(&table, name, strlen(name)) == ids[i]);
+            size_t length;
+            CHECK(strcmp(intern_text(&table, ids[i], &length), name) == 0 && length == strlen(name));
+        }
+        // only `length` bytes of the text are the name
+        CHECK(intern(&table, "name_12345", 6) == ids[1]);
+        intern_free(&table);
+    }
+}
+
+// Each job interns every name, starting at a different one
+static void intern_job(void *ctx, size_t job, int worker)
+{
+    (void)worker;
+    InternJobs *jobs = (InternJobs *)ctx;
+    char name[32];
+    for (uint32_t k = 0; k < NAMES; k++)
+    {
+        uint32_t i = (k + (uint32_t)job * NAMES / 4) % NAMES;
+        name_of(name, sizeof(name), i);
+        jobs->ids[job][i] = intern(jobs->table, name, strlen(name));
+    }
+}
+
+// Workers interning into a shared table at once agree on every ID
+static void test_shared_table(void)
+{
+    InternTable table;
+    intern_init(&table, 1);
+    static InternJobs jobs;
+    jobs.table = &table;
+    pool_finish(pool_start(4, 4, NULL, intern_job, &jobs));
+    char name[32];
+    for (uint32_t i = 0; i < NAMES; i++)
+    {
+        uint32_t id = jobs.ids[0][i];
+        CHECK(id != INTERN_NONE && jobs.ids[1][i] == id && jobs.ids[2][i] == id && jobs.ids[3][i] == id);
+        size_t length;
+        name_of(name, sizeof(name), i);
+        CHECK(strcmp(intern_text(&table, id, &length), name) == 0 && length == strlen(name));
+        if (i > 0)
+            CHECK(id != jobs.ids[0][i - 1]);
+    }
+    intern_free(&table);
+}
+
+// The IDs of an interned token list are those of the identifiers' text
+static void test_token_names(void)
+{
+    InternTable table;
+    intern_init(&table, 0);
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *tokens = lex_buffer(&arena, corpus, strlen(corpus));
+    token_list_intern(tokens, &table);
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    while (cursor_next(&cursor, &tok))
+    {
+        if (tok.type == TOKEN_IDENTIFIER)
+            CHECK(tok.name == intern(&table, token_text(tokens, &tok), tok.length));
+        else
+            CHECK(tok.name == INTERN_NONE);
+    }
+    arena_free(&arena);
+    intern_free(&table);
+}
+
+int main(void)
+{
+    test_ids_are_stable();
+    test_shared_table();
+    test_token_names();
+    return test_report("intern");
+}
@@ -0,0 +1,677 @@
+// Tests of the lexer: what it makes of C source, however it is asked to lex it
+#include "arena.h"
+#include "diagnostics.h"
+#include "lexer.h"
+#include "lines.h"
+#include "test.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The tokens cover the source in order, with only whitespace between them,
+// and a LineIndex puts each at the line and column its offset is on
+static void test_token_positions(void)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    size_t length = strlen(corpus);
+    TokenList *tokens = lex_buffer(&arena, corpus, length);
+    CHECK(tokens->count > 0);
+    LineIndex lines;
+    line_index_init(&lines, corpus, length);
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    uint32_t at = 0, line = 1, column = 1;
+    while (cursor_next(&cursor, &tok))
+    {
+        CHECK(tok.offset >= at && tok.offset + tok.length <= length);
+        for (; at < tok.offset; at++)
+        {
+            CHECK(strchr(" \t\n", corpus[at]) != NULL);
+            column = corpus[at] == '\n' ? 1 : column + 1;
+            line += corpus[at] == '\n';
+        }
+        uint32_t found_line, found_column;
+        line_index_position(&lines, tok.offset, &found_line, &found_column);
+        CHECK(found_line == line && found_column == column);
+        for (; at < tok.offset + tok.length; at++)
+        {
+            column = corpus[at] == '\n' ? 1 : column + 1;
+            line += corpus[at] == '\n';
+        }
+        CHECK(token_text(tokens, &tok) == corpus + tok.offset);
+    }
+    line_index_free(&lines);
+    arena_free(&arena);
+}
+
+// Every keyword in TokenType order, C89 then C99 and C11
+static const char *const keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+    "extern", "float", "for", "goto", "if", "int", "long", "register", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+    "inline", "restrict", "_Bool", "_Complex", "_Imaginary", "_Alignas", "_Alignof", "_Atomic", "_Generic",
+    "_Noreturn", "_Static_assert", "_Thread_local",
+};
+
+// Each keyword gets its own type, and a word that only looks like one, one
+// byte longer or shorter or in another case, is an identifier
+static void test_keywords(void)
+{
+    size_t count = sizeof(keywords) / sizeof(keywords[0]);
+    CHECK(count == TOKEN_KW_LAST - TOKEN_KW_FIRST + 1);
+    char source[4096] = "";
+    char words[80];
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t length = strlen(keywords[i]);
+        CHECK(check_keyword(keywords[i], length) == (TokenType)(TOKEN_KW_FIRST + i));
+        snprintf(words, sizeof(words), "%s %s_ %.*s _%s ", keywords[i], keywords[i], (int)length - 1, keywords[i],
+                 keywords[i]);
+        strcat(source, words);
+        for (size_t j = 0; j < length; j++)
+            words[j] = (char)toupper((unsigned char)keywords[i][j]);
+        strcpy(words + length, " ");
+        strcat(source, words);
+    }
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *tokens = lex_buffer(&arena, source, strlen(source));
+    CHECK(tokens->count == count * 5);
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    for (uint32_t i = 0; cursor_next(&cursor, &tok); i++)
+    {
+        if (i % 5 == 0)
+            CHECK(tok.type == (TokenType)(TOKEN_KW_FIRST + i / 5) && token_is_keyword(tok.type));
+        else
+            CHECK(tok.type == TOKEN_IDENTIFIER);
+    }
+    arena_free(&arena);
+}
+
+// The tokens as printList prints them, into `out`
+static void print_tokens(char *out, size_t size, const TokenList *tokens)
+{
+    size_t used = 0;
+    out[0] = '\0';
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    while (cursor_next(&cursor, &tok) && used < size)
+    {
+        size_t length;
+        const char *value = token_value(tokens, &tok, &length);
+        used += (size_t)snprintf(out + used, size - used, "%s : %.*s\n", printEnum(tok.type), (int)length, value);
+    }
+}
+
+// Tokens of small inputs that go through every state of the DFA, as
+// printList prints them. The if-chain lexer the DFA replaced gives the same,
+// but where it lost bytes: the digits before a float's '.', and the text of
+// an unknown character.
+static void test_known_answers(void)
+{
+    static const struct {
+        const char *source;
+        const char *tokens;
+    } cases[] = {
+        {"x=0x1F+1.5e-3-.5;y=10.;z=1e5;w=07;",
+         "TOKEN_IDENTIFIER : x\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_INT_LITERAL : 0\n"
+         "TOKEN_IDENTIFIER : x1F\n"
+         "TOKEN_ASSIGNMENT_OPERATOR : +\n"
+         "TOKEN_FLOAT_LITERAL : 1.5e-3\n"
+         "TOKEN_ASSIGNMENT_OPERATOR : -\n"
+         "TOKEN_FLOAT_LITERAL : .5\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : y\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_FLOAT_LITERAL : 10.\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : z\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_FLOAT_LITERAL : 1e5\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : w\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_INT_LITERAL : 07\n"
+         "TOKEN_SEMICOLON : ;\n"},
+        {"s=\"a\\\"b\\\\\";c='\\n';d='ab';e=\"\";",
+         "TOKEN_IDENTIFIER : s\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_STRING_LITERAL : a\\\"b\\\\\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : c\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_CHAR_LITERAL : \\n\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : d\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_CHAR_LITERAL : ab\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : e\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_STRING_LITERAL : \n"
+         "TOKEN_SEMICOLON : ;\n"},
+        {"// line\n/* block\n * more */ x; /**/ y;\n#include <stdio.h>\n  #define X(a) (a)\n",
+         "TOKEN_COMMENT :  line\n"
+         "TOKEN_COMMENT :  block\n"
+         " * more \n"
+         "TOKEN_IDENTIFIER : x\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_COMMENT : \n"
+         "TOKEN_IDENTIFIER : y\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_PREPROCESSOR : #include <stdio.h>\n"
+         "TOKEN_PREPROCESSOR : #define X(a) (a)\n"},
+        {"a->b.c+=d&&!e|f<<2?g:h;i>>=1;j^=~k;l%=m;n!=o;p<=q>=r==s||t;u++;v--;",
+         "TOKEN_IDENTIFIER : a\n"
+         "TOKEN_ARROW : ->\n"
+         "TOKEN_IDENTIFIER : b\n"
+         "TOKEN_DOT : .\n"
+         "TOKEN_IDENTIFIER : c\n"
+         "TOKEN_ASSIGNMENT_OPERATOR : +=\n"
+         "TOKEN_IDENTIFIER : d\n"
+         "TOKEN_LOGIC_OPERATOR : &&\n"
+         "TOKEN_LOGIC_OPERATOR : !\n"
+         "TOKEN_IDENTIFIER : e\n"
+         "TOKEN_BITWISE_OPERATOR : |\n"
+         "TOKEN_IDENTIFIER : f\n"
+         "TOKEN_BITWISE_OPERATOR : <<\n"
+         "TOKEN_INT_LITERAL : 2\n"
+         "TOKEN_OPERATOR : ?\n"
+         "TOKEN_IDENTIFIER : g\n"
+         "TOKEN_OPERATOR : :\n"
+         "TOKEN_IDENTIFIER : h\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : i\n"
+         "TOKEN_BITWISE_OPERATOR : >>\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_INT_LITERAL : 1\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : j\n"
+         "TOKEN_BITWISE_OPERATOR : ^\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_BITWISE_OPERATOR : ~\n"
+         "TOKEN_IDENTIFIER : k\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : l\n"
+         "TOKEN_OPERATOR : %\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_IDENTIFIER : m\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : n\n"
+         "TOKEN_OPERATOR : !=\n"
+         "TOKEN_IDENTIFIER : o\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : p\n"
+         "TOKEN_OPERATOR : <=\n"
+         "TOKEN_IDENTIFIER : q\n"
+         "TOKEN_OPERATOR : >=\n"
+         "TOKEN_IDENTIFIER : r\n"
+         "TOKEN_OPERATOR : ==\n"
+         "TOKEN_IDENTIFIER : s\n"
+         "TOKEN_LOGIC_OPERATOR : ||\n"
+         "TOKEN_IDENTIFIER : t\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : u\n"
+         "TOKEN_ASSIGNMENT_OPERATOR : ++\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_IDENTIFIER : v\n"
+         "TOKEN_ASSIGNMENT_OPERATOR : --\n"
+         "TOKEN_SEMICOLON : ;\n"},
+        {"a @ b $ c ` d \\ e",
+         "TOKEN_IDENTIFIER : a\n"
+         "TOKEN_UNKNOWN : @\n"
+         "TOKEN_IDENTIFIER : b\n"
+         "TOKEN_UNKNOWN : $\n"
+         "TOKEN_IDENTIFIER : c\n"
+         "TOKEN_BITWISE_OPERATOR : `\n"
+         "TOKEN_IDENTIFIER : d\n"
+         "TOKEN_UNKNOWN : \\\n"
+         "TOKEN_IDENTIFIER : e\n"},
+        {"int main(void){return sizeof(struct s)*2;}\ntypedef unsigned long u;static const volatile int v[3]={1,2,3};",
+         "TOKEN_KW_INT : int\n"
+         "TOKEN_IDENTIFIER : main\n"
+         "TOKEN_PAREN_OPEN : (\n"
+         "TOKEN_KW_VOID : void\n"
+         "TOKEN_PAREN_CLOSE : )\n"
+         "TOKEN_BRACE_OPEN : {\n"
+         "TOKEN_KW_RETURN : return\n"
+         "TOKEN_KW_SIZEOF : sizeof\n"
+         "TOKEN_PAREN_OPEN : (\n"
+         "TOKEN_KW_STRUCT : struct\n"
+         "TOKEN_IDENTIFIER : s\n"
+         "TOKEN_PAREN_CLOSE : )\n"
+         "TOKEN_OPERATOR : *\n"
+         "TOKEN_INT_LITERAL : 2\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_BRACE_CLOSE : }\n"
+         "TOKEN_KW_TYPEDEF : typedef\n"
+         "TOKEN_KW_UNSIGNED : unsigned\n"
+         "TOKEN_KW_LONG : long\n"
+         "TOKEN_IDENTIFIER : u\n"
+         "TOKEN_SEMICOLON : ;\n"
+         "TOKEN_KW_STATIC : static\n"
+         "TOKEN_KW_CONST : const\n"
+         "TOKEN_KW_VOLATILE : volatile\n"
+         "TOKEN_KW_INT : int\n"
+         "TOKEN_IDENTIFIER : v\n"
+         "TOKEN_BRACKET_OPEN : [\n"
+         "TOKEN_INT_LITERAL : 3\n"
+         "TOKEN_BRACKET_CLOSE : ]\n"
+         "TOKEN_OPERATOR : =\n"
+         "TOKEN_BRACE_OPEN : {\n"
+         "TOKEN_INT_LITERAL : 1\n"
+         "TOKEN_COMMA : ,\n"
+         "TOKEN_INT_LITERAL : 2\n"
+         "TOKEN_COMMA : ,\n"
+         "TOKEN_INT_LITERAL : 3\n"
+         "TOKEN_BRACE_CLOSE : }\n"
+         "TOKEN_SEMICOLON : ;\n"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        Arena arena;
+        arena_init(&arena, 64 * 1024);
+        char printed[4096];
+        print_tokens(printed, sizeof(printed), lex_buffer(&arena, cases[i].source, strlen(cases[i].source)));
+        if (strcmp(printed, cases[i].tokens) != 0)
+        {
+            fprintf(stderr, "case %zu lexed as:\n%s", i, printed);
+            CHECK(!"tokens as expected");
+        }
+        arena_free(&arena);
+    }
+}
+
+// The streaming Lexer against lex_buffer, with windows small enough that
+// tokens keep straddling a refill: same tokens, text, positions and errors
+static void test_streaming_lexer(void)
+{
+    char *source = (char *)malloc(strlen(corpus) + 64);
+    strcpy(source, corpus);
+    strcat(source, "x = 1e;\nc = 'ab;\nd = '';\n/* unterminated");
+    size_t length = strlen(source);
+    static const size_t windows[] = {1, 7, 64, 4096};
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    {
+        Arena arena;
+        arena_init(&arena, 64 * 1024);
+        DiagnosticList buffered, streamed;
+        diagnostics_init(&buffered, "buffered");
+        diagnostics_init(&streamed, "streamed");
+        DiagnosticList *previous = diagnostics_capture(&buffered);
+        TokenList *expected = lex_buffer(&arena, source, length);
+        diagnostics_capture(&streamed);
+
+        FILE *file = tmpfile();
+        fwrite(source, 1, length, file);
+        rewind(file);
+        Lexer *lexer = lexer_open_fd(fileno(file), windows[w]);
+        LineIndex lines;
+        line_index_init(&lines, source, length);
+        TokenCursor cursor;
+        cursor_init(&cursor, expected);
+        Token tok, want;
+        uint32_t count = 0;
+        while (lexer_next(lexer, &tok))
+        {
+            count++;
+            if (!cursor_next(&cursor, &want))
+                break;
+            CHECK(tok.type == want.type && tok.offset == want.offset && tok.length == want.length);
+            CHECK(memcmp(lexer_token_text(lexer, &tok), source + tok.offset, tok.length) == 0);
+            uint32_t line, column, want_line, want_column;
+            lexer_position(lexer, tok.offset, &line, &column);
+            line_index_position(&lines, tok.offset, &want_line, &want_column);
+            CHECK(line == want_line && column == want_column);
+        }
+        CHECK(count == expected->count);
+        lexer_close(lexer);
+        line_index_free(&lines);
+        fclose(file);
+        diagnostics_capture(previous);
+
+        CHECK(streamed.count == buffered.count && buffered.count > 0);
+        for (size_t i = 0; i < buffered.count && i < streamed.count; i++)
+            CHECK(streamed.items[i].code == buffered.items[i].code &&
+                  streamed.items[i].offset == buffered.items[i].offset);
+        diagnostics_free(&buffered);
+        diagnostics_free(&streamed);
+        arena_free(&arena);
+    }
+    free(source);
+}
+
+// Tokens far longer than the streaming window, of every kind that is one
+// run of bytes, each come out whole from both lexers
+static void test_long_tokens(void)
+{
+    static const struct {
+        TokenType type;
+        const char *open;
+        char fill;
+        const char *close;
+    } kinds[] = {
+        {TOKEN_IDENTIFIER, "x", 'a', ""},
+        {TOKEN_INT_LITERAL, "1", '0', ""},
+        {TOKEN_COMMENT, "//", ' ', ""},
+        {TOKEN_COMMENT, "/*", '\n', "*/"},
+        {TOKEN_STRING_LITERAL, "\"", 'b', "\""},
+        {TOKEN_PREPROCESSOR, "#define X ", '1', ""},
+    };
+    size_t fill = 100000;
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+    {
+        size_t open = strlen(kinds[k].open), close = strlen(kinds[k].close);
+        size_t length = open + fill + close + strlen("\ny;");
+        char *source = (char *)malloc(length + 1);
+        memcpy(source, kinds[k].open, open);
+        memset(source + open, kinds[k].fill, fill);
+        strcpy(source + open + fill, kinds[k].close);
+        strcat(source, "\ny;");
+        uint32_t line = kinds[k].fill == '\n' ? (uint32_t)fill + 2 : 2, found_line, found_column;
+
+        Arena arena;
+        arena_init(&arena, 64 * 1024);
+        TokenList *tokens = lex_buffer(&arena, source, length);
+        Token tok;
+        CHECK(tokens->count == 3);
+        token_at(tokens, 0, &tok);
+        CHECK(tok.type == kinds[k].type && tok.length == open + fill + close);
+        token_at(tokens, 1, &tok);
+        CHECK(tok.type == TOKEN_IDENTIFIER);
+        LineIndex lines;
+        line_index_init(&lines, source, length);
+        line_index_position(&lines, tok.offset, &found_line, &found_column);
+        CHECK(found_line == line && found_column == 1);
+        line_index_free(&lines);
+        arena_free(&arena);
+
+        FILE *file = tmpfile();
+        fwrite(source, 1, length, file);
+        rewind(file);
+        Lexer *lexer = lexer_open_fd(fileno(file), 64);
+        CHECK(lexer_next(lexer, &tok) && tok.type == kinds[k].type && tok.length == open + fill + close);
+        CHECK(memcmp(lexer_token_text(lexer, &tok), source, tok.length) == 0);
+        CHECK(lexer_next(lexer, &tok) && tok.type == TOKEN_IDENTIFIER);
+        lexer_position(lexer, tok.offset, &found_line, &found_column);
+        CHECK(found_line == line && found_column == 1);
+        lexer_close(lexer);
+        fclose(file);
+        free(source);
+    }
+}
+
+// Same tokens, in the same order and at the same positions
+static int same_tokens(const TokenList *a, const TokenList *b)
+{
+    if (a->count != b->count)
+        return 0;
+    TokenCursor x, y;
+    cursor_init(&x, a);
+    cursor_init(&y, b);
+    Token s, t;
+    while (cursor_next(&x, &s) && cursor_next(&y, &t))
+        if (s.type != t.type || s.offset != t.offset || s.length != t.length)
+            return 0;
+    return 1;
+}
+
+// lex_buffer_parallel against lex_buffer on `source`
+static void check_parallel(const char *source, int threads)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    size_t length = strlen(source);
+    DiagnosticList serial, parallel;
+    diagnostics_init(&serial, "serial");
+    diagnostics_init(&parallel, "parallel");
+    DiagnosticList *previous = diagnostics_capture(&serial);
+    TokenList *expected = lex_buffer(&arena, source, length);
+    diagnostics_capture(&parallel);
+    TokenList *tokens = lex_buffer_parallel(&arena, source, length, threads);
+    diagnostics_capture(previous);
+
+    CHECK(same_tokens(tokens, expected));
+    CHECK(parallel.count == serial.count);
+    for (size_t i = 0; i < serial.count && i < parallel.count; i++)
+        CHECK(parallel.items[i].code == serial.items[i].code && parallel.items[i].offset == serial.items[i].offset);
+    diagnostics_free(&serial);
+    diagnostics_free(&parallel);
+    arena_free(&arena);
+}
+
+// Pieces that start between tokens, whatever the number of them
+static void test_parallel_matches_serial(void)
+{
+    size_t length = strlen(corpus);
+    char *source = (char *)malloc(length * 100 + 1);
+    for (int copy = 0; copy < 100; copy++)
+        memcpy(source + copy * length, corpus, length);
+    source[length * 100] = '\0';
+    for (int threads = 1; threads <= 8; threads++)
+        check_parallel(source, threads);
+    free(source);
+}
+
+// Pieces start after a newline, so an error at the start of every line is
+// one at every split point
+static void test_parallel_errors_at_splits(void)
+{
+    static const char *const errors[] = {"1e;", "'ab", "''", "1e+", "'"};
+    for (size_t e = 0; e < sizeof(errors) / sizeof(errors[0]); e++)
+    {
+        char *source = (char *)malloc(200 * 32);
+        size_t length = 0;
+        for (int line = 0; line < 200; line++)
+            length += (size_t)sprintf(source + length, "%s%s", errors[e],
+                                      line % 3 ? " int x = 1;\n" : " /* c */ f(\"s\");\n");
+        for (int threads = 2; threads <= 7; threads++)
+            check_parallel(source, threads);
+        free(source);
+    }
+}
+
+// Pieces that start inside a comment, string or char literal
+static void test_parallel_open_at_splits(void)
+{
+    const char *lines[] = {"/*\nx = '\n';\n*/ y = 1e5;\n", "s = \"a\\\nb\";\n// c\n"};
+    size_t length = strlen(lines[0]) + strlen(lines[1]);
+    char *source = (char *)malloc(length * 150 + 1);
+    source[0] = '\0';
+    for (int line = 0; line < 300; line++)
+        strcat(source, lines[line % 2]);
+    for (int threads = 2; threads <= 7; threads++)
+        check_parallel(source, threads);
+    free(source);
+}
+
+// Lexes `after` as an edit of `before`, and checks it against a full lex of
+// `after`. Returns 0 if the edited part doesn't lex, which is allowed.
+static int check_edit(const char *before, const char *after)
+{
+    // the full lexes report what the edited one gives up on
+    DiagnosticList diagnostics;
+    diagnostics_init(&diagnostics, "edit");
+    DiagnosticList *previous = diagnostics_capture(&diagnostics);
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    size_t old_length = strlen(before);
+    size_t length = strlen(after);
+    size_t limit = old_length < length ? old_length : length;
+    size_t prefix = 0;
+    while (prefix < limit && before[prefix] == after[prefix])
+        prefix++;
+    size_t suffix = 0;
+    while (suffix < limit - prefix && before[old_length - 1 - suffix] == after[length - 1 - suffix])
+        suffix++;
+
+    TokenList *old = lex_buffer(&arena, before, old_length);
+    TokenEdit edit;
+    TokenList *edited = lex_buffer_edit(&arena, after, length, old, prefix, suffix, &edit);
+    if (edited)
+    {
+        CHECK(same_tokens(edited, lex_buffer(&arena, after, length)));
+        CHECK(edit.first <= edit.new_end && edit.new_end <= edited->count);
+        CHECK(edit.old_end - edit.first + edited->count == old->count + edit.new_end - edit.first);
+    }
+    arena_free(&arena);
+    diagnostics_capture(previous);
+    diagnostics_free(&diagnostics);
+    return edited != NULL;
+}
+
+// A quote is only a char literal when another closes it a few bytes on, so
+// an edit there changes how the quote before it is lexed
+static void test_edit_quote_lookahead(void)
+{
+    CHECK(check_edit("c = 'a b;\nd = 1;\n", "c = 'a b';\nd = 1;\n"));
+    CHECK(check_edit("x = y ' z + w;", "x = y ' z ' w;"));
+    // a stray quote doesn't lex, but the edit isn't wrong about it
+    check_edit("c = 'a b';\nd = 1;\n", "c = 'a b;\nd = 1;\n");
+}
+
+// Bytes inserted and removed at random, quotes, comment marks and
+// malformed floats among them
+static void test_edit_matches_full_lex(void)
+{
+    static const char *const pieces[] = {
+        " ", "\n", "'", "''", "\"", "/*", "*/", "//", "1e", "1.5", "x", "if", "(", ")", "{", "}", ";", "#define X\n",
+        "'a'", "\\", "+=", ".",
+    };
+    const char *seed = "int main(void)\n{\n    char c = 'a'; // one\n    float f = 1.5e3;\n"
+                       "    /* two */ const char *s = \"three\";\n    return c + (int)f;\n}\n";
+    static char text[8192], before[8192];
+    strcpy(text, seed);
+    int lexed = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        strcpy(before, text);
+        size_t length = strlen(text);
+        size_t at = random_below((uint32_t)length + 1);
+        if (random_below(2) == 0)
+        {
+            const char *piece = pieces[random_below(sizeof(pieces) / sizeof(pieces[0]))];
+            memmove(text + at + strlen(piece), text + at, length - at + 1);
+            memcpy(text + at, piece, strlen(piece));
+        }
+        else
+        {
+            size_t count = random_below(6) + 1;
+            if (count > length - at)
+                count = length - at;
+            memmove(text + at, text + at + count, length - at - count + 1);
+        }
+        lexed += check_edit(before, text);
+        // keep it from growing without bound
+        if (strlen(text) > 4096)
+            strcpy(text, seed);
+    }
+    // most edits have to be lexed incrementally for this to test anything
+    CHECK(lexed > 1000);
+}
+
+// A malformed token is reported where it starts, placed by a LineIndex
+// once lexing is done, and lexing carries on after it: a float is kept as it is, a stray or empty quote is unknown
+static void test_errors_recover(void)
+{
+    static const struct {
+        const char *source;
+        const char *tokens;
+        ErrorCode code;
+        uint32_t line;
+        uint32_t column;
+    } cases[] = {
+        {"x = 1e;", "TOKEN_IDENTIFIER : x\nTOKEN_OPERATOR : =\nTOKEN_FLOAT_LITERAL : 1e\nTOKEN_SEMICOLON : ;\n",
+         ERR_MALFORMED_FLOAT, 1, 5},
+        {"int a;\n  x = 1e+ y;", "TOKEN_KW_INT : int\nTOKEN_IDENTIFIER : a\nTOKEN_SEMICOLON : ;\nTOKEN_IDENTIFIER : x\n"
+                                 "TOKEN_OPERATOR : =\nTOKEN_FLOAT_LITERAL : 1e+\nTOKEN_IDENTIFIER : y\nTOKEN_SEMICOLON : ;\n",
+         ERR_MALFORMED_FLOAT, 2, 7},
+        {"c = 'ab;", "TOKEN_IDENTIFIER : c\nTOKEN_OPERATOR : =\nTOKEN_UNKNOWN : '\nTOKEN_IDENTIFIER : ab\nTOKEN_SEMICOLON : ;\n",
+         ERR_MALFORMED_CHAR, 1, 5},
+        {"\n\nc = '';", "TOKEN_IDENTIFIER : c\nTOKEN_OPERATOR : =\nTOKEN_UNKNOWN : ''\nTOKEN_SEMICOLON : ;\n",
+         ERR_MALFORMED_CHAR, 3, 5},
+        // nothing is read past the end of the input
+        {"x = '", "TOKEN_IDENTIFIER : x\nTOKEN_OPERATOR : =\nTOKEN_UNKNOWN : '\n", ERR_MALFORMED_CHAR, 1, 5},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        DiagnosticList diagnostics;
+        diagnostics_init(&diagnostics, "recover");
+        DiagnosticList *previous = diagnostics_capture(&diagnostics);
+        Arena arena;
+        arena_init(&arena, 64 * 1024);
+        char printed[1024];
+        size_t length = strlen(cases[i].source);
+        print_tokens(printed, sizeof(printed), lex_buffer(&arena, cases[i].source, length));
+        diagnostics_capture(previous);
+        LineIndex lines;
+        line_index_init(&lines, cases[i].source, length);
+        diagnostics_resolve(&diagnostics, 0, &lines);
+        line_index_free(&lines);
+        if (strcmp(printed, cases[i].tokens) != 0)
+        {
+            fprintf(stderr, "case %zu lexed as:\n%s", i, printed);
+            CHECK(!"tokens as expected");
+        }
+        CHECK(diagnostics.count == 1);
+        CHECK(diagnostics.count == 0 || (diagnostics.items[0].code == cases[i].code &&
+                                         diagnostics.items[0].line == cases[i].line &&
+                                         diagnostics.items[0].column == cases[i].column));
+        arena_free(&arena);
+        diagnostics_free(&diagnostics);
+    }
+}
+
+// Lengths that 32-bit offsets can't reach are reported once and lexed as
+// empty input, without a byte being read
+static void test_too_long(void)
+{
+    static const char source[] = "int x;";
+    size_t length = SOURCE_MAX_LENGTH + 1;
+    DiagnosticList diagnostics;
+    diagnostics_init(&diagnostics, "big");
+    DiagnosticList *previous = diagnostics_capture(&diagnostics);
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *tokens = lex_buffer(&arena, source, length);
+    CHECK(tokens->count == 0 && diagnostics.count == 1);
+    tokens = lex_buffer_parallel(&arena, source, length, 4);
+    CHECK(tokens->count == 0 && diagnostics.count == 2);
+    Output out;
+    output_init_memory(&out);
+    lex_highlight(&out, source, length);
+    CHECK(diagnostics.count == 3);
+    output_close(&out);
+    TokenEdit edit;
+    TokenList *old = lex_buffer(&arena, source, sizeof(source) - 1);
+    CHECK(lex_buffer_edit(&arena, source, length, old, 3, 3, &edit) == NULL && diagnostics.count == 3);
+    arena_free(&arena);
+    diagnostics_capture(previous);
+    for (size_t i = 0; i < diagnostics.count; i++)
+        CHECK(diagnostics.items[i].code == ERR_MAX_SIZE && diagnostics.items[i].offset == DIAGNOSTIC_NO_OFFSET);
+    diagnostics_free(&diagnostics);
+}
+
+int main(void)
+{
+    test_token_positions();
+    test_keywords();
+    test_known_answers();
+    test_streaming_lexer();
+    test_long_tokens();
+    test_parallel_matches_serial();
+    test_parallel_errors_at_splits();
+    test_parallel_open_at_splits();
+    test_edit_quote_lookahead();
+    test_edit_matches_full_lex();
+    test_errors_recover();
+    test_too_long();
+    return test_report("lexer");
+}
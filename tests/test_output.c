@@ -0,0 +1,91 @@
+// Tests of the output buffer: the same bytes come out whichever way they are flushed
+#include "output.h"
+#include "test.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TOTAL (6 * 1024 * 1024)
+
+// A few MiB in writes of every size the emitter and batch mode make: single
+// characters, strings, reserved runs and blocks bigger than a flush
+static void write_pieces(Output *out, const char *bytes)
+{
+    for (size_t at = 0; at < TOTAL;)
+    {
+        size_t size;
+        switch (random_below(4))
+        {
+        case 0:
+            output_char(out, bytes[at]);
+            size = 1;
+            break;
+        case 1:
+            size = 1 + random_below(100);
+            output_write(out, bytes + at, size < TOTAL - at ? size : TOTAL - at);
+            break;
+        case 2:
+            size = 1 + random_below(5000);
+            size = size < TOTAL - at ? size : TOTAL - at;
+            memcpy(output_reserve(out, size), bytes + at, size);
+            out->length += size;
+            break;
+        default:
+            size = 1 + random_below(3 * 1024 * 1024);
+            output_write(out, bytes + at, size < TOTAL - at ? size : TOTAL - at);
+            break;
+        }
+        at += size;
+    }
+}
+
+static int file_holds(const char *path, const char *bytes)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    char *text = file_text(file);
+    int same = ftell(file) == TOTAL && memcmp(text, bytes, TOTAL) == 0;
+    free(text);
+    fclose(file);
+    return same;
+}
+
+static void test_modes_agree(void)
+{
+    char *bytes = (char *)malloc(TOTAL);
+    for (size_t i = 0; i < TOTAL; i++)
+        bytes[i] = (char)('a' + random_below(26));
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    snprintf(path, sizeof(path), "%s/out", dir);
+
+    Output out;
+    output_init_memory(&out);
+    write_pieces(&out, bytes);
+    CHECK(out.length == TOTAL && memcmp(out.data, bytes, TOTAL) == 0);
+    output_close(&out);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    output_init_fd(&out, fd);
+    write_pieces(&out, bytes);
+    output_close(&out);
+    close(fd);
+    CHECK(file_holds(path, bytes));
+
+    // mapped, grown past its first size and trimmed on close
+    CHECK(output_open_file(&out, path) == 0 && out.is_mapped);
+    write_pieces(&out, bytes);
+    output_close(&out);
+    CHECK(file_holds(path, bytes));
+
+    remove_tree(dir);
+    free(bytes);
+}
+
+int main(void)
+{
+    test_modes_agree();
+    return test_report("output");
+}
@@ -0,0 +1,441 @@
+// Tests of the parser: the trees it builds, and that they don't depend on how the tokens are spaced
+#include "arena.h"
+#include "ast.h"
+#include "emitter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+static Ast *parse_text(Arena *arena, const char *source)
+{
+    return parse_tokens(arena, lex_buffer(arena, source, strlen(source)));
+}
+
+// The node after `id` in the buffer, which is children first
+static NodeId next_node(const Ast *ast, NodeId id)
+{
+    return id + (uint32_t)(sizeof(ASTNode) / sizeof(uint32_t)) + ast_node(ast, id)->count;
+}
+
+// The first node of `type` in buffer order
+static NodeId find_node(const Ast *ast, NodeType type)
+{
+    for (NodeId id = 1; id < ast->used; id = next_node(ast, id))
+        if (ast_node(ast, id)->type == type)
+            return id;
+    return AST_NONE;
+}
+
+// Trees of small inputs as --ast prints them: operator precedence and
+// associativity, every kind of statement, declarators, and an item that
+// doesn't parse between two that do
+static void test_known_trees(void)
+{
+    static const struct {
+        const char *source;
+        const char *tree;
+    } cases[] = {
+        {"int g(void) { x = a + b * c - d / e % f; y = a || b && c | d ^ e & f == g < h << i;\n"
+         "z = c ? a : b, -p->q.r[2](3, 4)++; }\n",
+         "PROGRAM [0-64]\n"
+         "  FUNCTION_DECL [0-64]\n"
+         "    TYPE [0-0]\n"
+         "    DECLARATOR [1-4]\n"
+         "      IDENTIFIER g [1-1]\n"
+         "      -\n"
+         "      PARAM [3-3]\n"
+         "        TYPE [3-3]\n"
+         "        -\n"
+         "    BLOCK [5-64]\n"
+         "      EXPR_STMT [6-19]\n"
+         "        BINARY_OP = [6-18]\n"
+         "          IDENTIFIER x [6-6]\n"
+         "          BINARY_OP - [8-18]\n"
+         "            BINARY_OP + [8-12]\n"
+         "              IDENTIFIER a [8-8]\n"
+         "              BINARY_OP * [10-12]\n"
+         "                IDENTIFIER b [10-10]\n"
+         "                IDENTIFIER c [12-12]\n"
+         "            BINARY_OP % [14-18]\n"
+         "              BINARY_OP / [14-16]\n"
+         "                IDENTIFIER d [14-14]\n"
+         "                IDENTIFIER e [16-16]\n"
+         "              IDENTIFIER f [18-18]\n"
+         "      EXPR_STMT [20-39]\n"
+         "        BINARY_OP = [20-38]\n"
+         "          IDENTIFIER y [20-20]\n"
+         "          BINARY_OP || [22-38]\n"
+         "            IDENTIFIER a [22-22]\n"
+         "            BINARY_OP && [24-38]\n"
+         "              IDENTIFIER b [24-24]\n"
+         "              BINARY_OP | [26-38]\n"
+         "                IDENTIFIER c [26-26]\n"
+         "                BINARY_OP ^ [28-38]\n"
+         "                  IDENTIFIER d [28-28]\n"
+         "                  BINARY_OP & [30-38]\n"
+         "                    IDENTIFIER e [30-30]\n"
+         "                    BINARY_OP == [32-38]\n"
+         "                      IDENTIFIER f [32-32]\n"
+         "                      BINARY_OP < [34-38]\n"
+         "                        IDENTIFIER g [34-34]\n"
+         "                        BINARY_OP << [36-38]\n"
+         "                          IDENTIFIER h [36-36]\n"
+         "                          IDENTIFIER i [38-38]\n"
+         "      EXPR_STMT [40-63]\n"
+         "        BINARY_OP , [40-62]\n"
+         "          BINARY_OP = [40-46]\n"
+         "            IDENTIFIER z [40-40]\n"
+         "            TERNARY [42-46]\n"
+         "              IDENTIFIER c [42-42]\n"
+         "              IDENTIFIER a [44-44]\n"
+         "              IDENTIFIER b [46-46]\n"
+         "          UNARY_OP - [48-62]\n"
+         "            UNARY_OP ++ [49-62]\n"
+         "              CALL [49-61]\n"
+         "                INDEX [49-56]\n"
+         "                  MEMBER . [49-53]\n"
+         "                    MEMBER -> [49-51]\n"
+         "                      IDENTIFIER p [49-49]\n"
+         "                      IDENTIFIER q [51-51]\n"
+         "                    IDENTIFIER r [53-53]\n"
+         "                  INT_LITERAL 2 [55-55]\n"
+         "                INT_LITERAL 3 [58-58]\n"
+         "                INT_LITERAL 4 [60-60]\n"},
+        {"static int *p = &x, a[3] = {1, [2] = 3}, (*fp)(char c);\n"
+         "void h(void) { if (a) b; else while (c) { do d; while (e); } for (i = 0; i < n; i++) ;\n"
+         "switch (k) { case 1: break; default: goto out; } out: return; }\n",
+         "PROGRAM [0-93]\n"
+         "  VAR_DECL [0-31]\n"
+         "    TYPE [0-1]\n"
+         "    DECLARATOR [2-6]\n"
+         "      IDENTIFIER p [3-3]\n"
+         "      UNARY_OP & [5-6]\n"
+         "        IDENTIFIER x [6-6]\n"
+         "    DECLARATOR [8-21]\n"
+         "      IDENTIFIER a [8-8]\n"
+         "      INIT_LIST [13-21]\n"
+         "        INT_LITERAL 1 [14-14]\n"
+         "        BINARY_OP = [16-20]\n"
+         "          DESIGNATOR [16-18]\n"
+         "          INT_LITERAL 3 [20-20]\n"
+         "    DECLARATOR [23-30]\n"
+         "      IDENTIFIER fp [25-25]\n"
+         "      -\n"
+         "      PARAM [28-29]\n"
+         "        TYPE [28-28]\n"
+         "        DECLARATOR [29-29]\n"
+         "          IDENTIFIER c [29-29]\n"
+         "          -\n"
+         "  FUNCTION_DECL [32-93]\n"
+         "    TYPE [32-32]\n"
+         "    DECLARATOR [33-36]\n"
+         "      IDENTIFIER h [33-33]\n"
+         "      -\n"
+         "      PARAM [35-35]\n"
+         "        TYPE [35-35]\n"
+         "        -\n"
+         "    BLOCK [37-93]\n"
+         "      IF [38-58]\n"
+         "        IDENTIFIER a [40-40]\n"
+         "        EXPR_STMT [42-43]\n"
+         "          IDENTIFIER b [42-42]\n"
+         "        WHILE [45-58]\n"
+         "          IDENTIFIER c [47-47]\n"
+         "          BLOCK [49-58]\n"
+         "            DO_WHILE [50-57]\n"
+         "              EXPR_STMT [51-52]\n"
+         "                IDENTIFIER d [51-51]\n"
+         "              IDENTIFIER e [55-55]\n"
+         "      FOR [59-72]\n"
+         "        BINARY_OP = [61-63]\n"
+         "          IDENTIFIER i [61-61]\n"
+         "          INT_LITERAL 0 [63-63]\n"
+         "        BINARY_OP < [65-67]\n"
+         "          IDENTIFIER i [65-65]\n"
+         "          IDENTIFIER n [67-67]\n"
+         "        UNARY_OP ++ [69-70]\n"
+         "          IDENTIFIER i [69-69]\n"
+         "        EMPTY_STMT [72-72]\n"
+         "      SWITCH [73-88]\n"
+         "        IDENTIFIER k [75-75]\n"
+         "        BLOCK [77-88]\n"
+         "          CASE [78-80]\n"
+         "            INT_LITERAL 1 [79-79]\n"
+         "          BREAK [81-82]\n"
+         "          DEFAULT [83-84]\n"
+         "          GOTO [85-87]\n"
+         "            IDENTIFIER out [86-86]\n"
+         "      LABEL [89-90]\n"
+         "        IDENTIFIER out [89-89]\n"
+         "      RETURN [91-92]\n"
+         "        -\n"},
+        {"int f(int a) { return a * 2 + 1; }\nint x = ;\nint y;\n",
+         "PROGRAM [0-21]\n"
+         "  FUNCTION_DECL [0-14]\n"
+         "    TYPE [0-0]\n"
+         "    DECLARATOR [1-5]\n"
+         "      IDENTIFIER f [1-1]\n"
+         "      -\n"
+         "      PARAM [3-4]\n"
+         "        TYPE [3-3]\n"
+         "        DECLARATOR [4-4]\n"
+         "          IDENTIFIER a [4-4]\n"
+         "          -\n"
+         "    BLOCK [6-14]\n"
+         "      RETURN [7-13]\n"
+         "        BINARY_OP + [8-12]\n"
+         "          BINARY_OP * [8-10]\n"
+         "            IDENTIFIER a [8-8]\n"
+         "            INT_LITERAL 2 [10-10]\n"
+         "          INT_LITERAL 1 [12-12]\n"
+         "  UNKNOWN [15-18]\n"
+         "  VAR_DECL [19-21]\n"
+         "    TYPE [19-19]\n"
+         "    DECLARATOR [20-20]\n"
+         "      IDENTIFIER y [20-20]\n"
+         "      -\n"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        Arena arena;
+        arena_init(&arena, 64 * 1024);
+        FILE *out = tmpfile();
+        ast_print(out, parse_text(&arena, cases[i].source));
+        char *printed = file_text(out);
+        if (strcmp(printed, cases[i].tree) != 0)
+        {
+            fprintf(stderr, "case %zu parsed as:\n%s", i, printed);
+            CHECK(!"tree as expected");
+        }
+        free(printed);
+        fclose(out);
+        arena_free(&arena);
+    }
+}
+
+// The tokens again, one space apart, or a newline after a comment or a
+// directive: the same file to the parser, so the same tree
+static void test_round_trip(void)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *tokens = lex_buffer(&arena, corpus, strlen(corpus));
+    size_t length = 0;
+    char *respaced = (char *)malloc(strlen(corpus) * 2 + 1);
+    TokenCursor cursor;
+    cursor_init(&cursor, tokens);
+    Token tok;
+    while (cursor_next(&cursor, &tok))
+    {
+        memcpy(respaced + length, token_text(tokens, &tok), tok.length);
+        length += tok.length;
+        respaced[length++] = tok.type == TOKEN_COMMENT || tok.type == TOKEN_PREPROCESSOR ? '\n' : ' ';
+    }
+    respaced[length] = '\0';
+    Ast *ast = parse_tokens(&arena, tokens);
+    Ast *again = parse_text(&arena, respaced);
+    CHECK(ast->used == again->used);
+    for (NodeId id = 1; id < ast->used && id < again->used; id = next_node(ast, id))
+    {
+        const ASTNode *a = ast_node(ast, id);
+        const ASTNode *b = ast_node(again, id);
+        CHECK(a->type == b->type && a->op == b->op && a->flags == b->flags && a->count == b->count &&
+              a->first_token == b->first_token && a->last_token == b->last_token);
+    }
+    CHECK(find_node(ast, AST_UNKNOWN) == AST_NONE);
+    free(respaced);
+    arena_free(&arena);
+}
+
+static uint32_t count_nodes(const Ast *ast, NodeType type)
+{
+    uint32_t count = 0;
+    for (NodeId id = 1; id < ast->used; id = next_node(ast, id))
+        count += ast_node(ast, id)->type == type;
+    return count;
+}
+
+#define DEPTH 200000
+
+// Expressions nested far deeper than the C stack would allow: groups,
+// calls, subscripts, casts, unary operators, right-associative chains
+static void test_deep_expressions(void)
+{
+    static const struct {
+        const char *open;
+        const char *close;
+        NodeType type;
+        uint32_t count; // of `type` in the whole tree
+    } kinds[] = {
+        {"(", ")", AST_IDENTIFIER, 2},        {"f(", ")", AST_CALL, DEPTH},     {"a[", "]", AST_INDEX, DEPTH},
+        {"(int)", "", AST_CAST, DEPTH},       {"!", "", AST_UNARY_OP, DEPTH},   {"x = ", "", AST_BINARY_OP, DEPTH},
+        {"c ? 1 : ", "", AST_TERNARY, DEPTH},
+    };
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+    {
+        size_t open = strlen(kinds[k].open), close = strlen(kinds[k].close);
+        char *source = (char *)malloc(32 + (open + close) * DEPTH);
+        size_t length = (size_t)sprintf(source, "void g(void) { ");
+        for (uint32_t i = 0; i < DEPTH; i++, length += open)
+            memcpy(source + length, kinds[k].open, open);
+        source[length++] = 'y';
+        for (uint32_t i = 0; i < DEPTH; i++, length += close)
+            memcpy(source + length, kinds[k].close, close);
+        strcpy(source + length, "; }\n");
+
+        Arena arena;
+        arena_init(&arena, 1024 * 1024);
+        Ast *ast = parse_text(&arena, source);
+        CHECK(find_node(ast, AST_UNKNOWN) == AST_NONE);
+        CHECK(count_nodes(ast, kinds[k].type) == kinds[k].count);
+        arena_free(&arena);
+        free(source);
+    }
+}
+
+// Statements nested far deeper than the C stack would allow are parsed,
+// and the file goes through to LaTeX
+static void test_deep_statements(void)
+{
+    static const struct {
+        const char *text;
+        uint32_t times;
+    } pieces[] = {
+        {"void f(void) {\n", 1}, {"{", 50000}, {"}", 50000}, {"\n}\nvoid g(void) {\n", 1}, {"if (x) ", DEPTH},
+        {"y; else z;\n", 1}, {"do while (x) for (;;) ", 20000}, {";", 1}, {" while (x);", 20000}, {"\n}\n", 1},
+    };
+    size_t length = 0;
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++)
+        length += strlen(pieces[i].text) * pieces[i].times;
+    char *source = (char *)malloc(length + 1);
+    length = 0;
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++)
+    {
+        size_t piece = strlen(pieces[i].text);
+        for (uint32_t k = 0; k < pieces[i].times; k++, length += piece)
+            memcpy(source + length, pieces[i].text, piece);
+    }
+    source[length] = '\0';
+
+    Arena arena;
+    arena_init(&arena, 1024 * 1024);
+    Ast *ast = parse_text(&arena, source);
+    CHECK(count_nodes(ast, AST_BLOCK) == 50000 + 2);
+    CHECK(count_nodes(ast, AST_IF) == DEPTH);
+    CHECK(count_nodes(ast, AST_DO_WHILE) == 20000);
+    CHECK(count_nodes(ast, AST_FOR) == 20000);
+    CHECK(find_node(ast, AST_UNKNOWN) == AST_NONE);
+    Output out;
+    output_init_memory(&out);
+    emit_latex(&out, ast);
+    CHECK(out.length > length);
+    output_close(&out);
+    arena_free(&arena);
+    free(source);
+}
+
+// Function pointers whose parameters are function pointers, nested far
+// deeper than the C stack would allow
+static void test_deep_declarators(void)
+{
+    static const char open[] = "(int (*a)";
+    char *source = (char *)malloc(16 + sizeof(open) * DEPTH);
+    size_t length = (size_t)sprintf(source, "int f");
+    for (uint32_t i = 0; i < DEPTH; i++, length += sizeof(open) - 1)
+        memcpy(source + length, open, sizeof(open) - 1);
+    memset(source + length, ')', DEPTH);
+    strcpy(source + length + DEPTH, ";\n");
+
+    Arena arena;
+    arena_init(&arena, 1024 * 1024);
+    Ast *ast = parse_text(&arena, source);
+    CHECK(find_node(ast, AST_UNKNOWN) == AST_NONE);
+    CHECK(count_nodes(ast, AST_PARAM) == DEPTH);
+    CHECK(count_nodes(ast, AST_DECLARATOR) == DEPTH + 1);
+    CHECK(count_nodes(ast, AST_IDENTIFIER) == DEPTH + 1);
+    arena_free(&arena);
+    free(source);
+}
+
+// The initializer of a declarator is kept, however many nodes it takes
+static void test_large_initializer(void)
+{
+    char *source = (char *)malloc(16 * 1024);
+    size_t length = (size_t)sprintf(source, "int a[] = {");
+    for (int i = 0; i < 1000; i++)
+        length += (size_t)sprintf(source + length, "%s%d", i ? ", " : "", i);
+    length += (size_t)sprintf(source + length, "};\nint b = ");
+    for (int i = 0; i < 200; i++)
+        length += (size_t)sprintf(source + length, "x = (int)(c ? d : ");
+    source[length++] = '1';
+    for (int i = 0; i < 200; i++)
+        source[length++] = ')';
+    strcpy(source + length, ";\n");
+
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    Ast *ast = parse_text(&arena, source);
+    int declarators = 0;
+    for (NodeId id = 1; id < ast->used; id = next_node(ast, id))
+    {
+        if (ast_node(ast, id)->type != AST_DECLARATOR)
+            continue;
+        declarators++;
+        NodeId init = ast_child(ast, id, 1);
+        CHECK(init != AST_NONE);
+        if (declarators == 1 && init != AST_NONE)
+            CHECK(ast_node(ast, init)->type == AST_INIT_LIST && ast_node(ast, init)->count == 1000);
+    }
+    CHECK(declarators == 2);
+    CHECK(find_node(ast, AST_UNKNOWN) == AST_NONE);
+    arena_free(&arena);
+    free(source);
+}
+
+// A parser opened on the boundary of a top-level item gives the items a
+// full parse gives from there, as watch mode relies on
+static void test_parse_from_item_boundaries(void)
+{
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *tokens = lex_buffer(&arena, corpus, strlen(corpus));
+    uint32_t boundaries[64];
+    uint32_t ends[64];
+    size_t count = 0;
+    Parser *parser = parser_open(&arena, tokens, 0);
+    NodeId item;
+    uint32_t start = 0;
+    while ((item = parser_next(parser)) != AST_NONE && count < 64)
+    {
+        boundaries[count] = start;
+        start = ends[count++] = ast_node(parser_ast(parser), item)->last_token + 1;
+    }
+    CHECK(count == 7);
+    for (size_t i = 0; i < count; i++)
+    {
+        Parser *from = parser_open(&arena, tokens, boundaries[i]);
+        for (size_t j = i; j < count; j++)
+        {
+            item = parser_next(from);
+            CHECK(item != AST_NONE && ast_node(parser_ast(from), item)->last_token + 1 == ends[j]);
+            if (item == AST_NONE)
+                break;
+        }
+        CHECK(parser_next(from) == AST_NONE);
+    }
+    arena_free(&arena);
+}
+
+int main(void)
+{
+    test_known_trees();
+    test_round_trip();
+    test_deep_expressions();
+    test_deep_statements();
+    test_deep_declarators();
+    test_large_initializer();
+    test_parse_from_item_boundaries();
+    return test_report("parser");
+}
@@ -0,0 +1,69 @@
+// Tests of the work-stealing pool: every job runs once, and waits see it done
+#include "pool.h"
+#include "test.h"
+#include <pthread.h>
+
+#define JOBS 500
+
+typedef struct {
+    pthread_mutex_t lock;
+    int threads;
+    int runs[JOBS];
+    int bad_workers;
+} Jobs;
+
+static void count_job(void *ctx, size_t job, int worker)
+{
+    Jobs *jobs = (Jobs *)ctx;
+    // uneven jobs, so the workers run dry at different times and steal
+    volatile uint32_t spin = 0;
+    for (uint32_t i = 0; i < (job % 7) * 2000; i++)
+        spin += i;
+    pthread_mutex_lock(&jobs->lock);
+    jobs->runs[job]++;
+    jobs->bad_workers += worker < 0 || worker >= jobs->threads;
+    pthread_mutex_unlock(&jobs->lock);
+}
+
+static int runs_of(Jobs *jobs, size_t job)
+{
+    pthread_mutex_lock(&jobs->lock);
+    int runs = jobs->runs[job];
+    pthread_mutex_unlock(&jobs->lock);
+    return runs;
+}
+
+// Each job runs exactly once, on a worker in range, and pool_wait_job
+// returns only once its job is done, with or without weights
+static void test_every_job_once(void)
+{
+    static uint64_t weights[JOBS];
+    for (size_t i = 0; i < JOBS; i++)
+        weights[i] = random_below(1000);
+    for (int threads = 1; threads <= 8; threads++)
+    {
+        static Jobs jobs;
+        pthread_mutex_init(&jobs.lock, NULL);
+        for (size_t i = 0; i < JOBS; i++)
+            jobs.runs[i] = 0;
+        jobs.bad_workers = 0;
+        jobs.threads = threads;
+        ThreadPool *pool = pool_start(threads, JOBS, threads % 2 ? weights : NULL, count_job, &jobs);
+        for (size_t i = 0; i < JOBS; i++)
+        {
+            pool_wait_job(pool, i);
+            CHECK(runs_of(&jobs, i) == 1);
+        }
+        pool_finish(pool);
+        for (size_t i = 0; i < JOBS; i++)
+            CHECK(jobs.runs[i] == 1);
+        CHECK(jobs.bad_workers == 0);
+        pthread_mutex_destroy(&jobs.lock);
+    }
+}
+
+int main(void)
+{
+    test_every_job_once();
+    return test_report("pool");
+}
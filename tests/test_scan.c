@@ -0,0 +1,76 @@
+// Tests of the vectorized scanners, against plain loops over the same bytes
+#include "scan.h"
+#include "test.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The scanners of the selected backend against plain loops, from every
+// start and end in a buffer of the bytes they stop on
+static void test_scanners_match_plain_loops(void)
+{
+    // in runs of one kind, longer than a vector at times
+    static const char *const kinds[] = {" \t\n\r\v\f", "aZ09_", " \t\n\r\v\faZ09_*/\"\\'{}$&#^%~."};
+    char buffer[320];
+    for (size_t i = 0; i < sizeof(buffer);)
+    {
+        const char *kind = kinds[random_below(3)];
+        size_t run = 1 + random_below(40);
+        for (; run > 0 && i < sizeof(buffer); run--)
+            buffer[i++] = kind[random_below((uint32_t)strlen(kind))];
+    }
+    for (const char *p = buffer; p < buffer + 160; p++)
+        for (const char *end = p; end <= buffer + 280; end++)
+        {
+            const char *q;
+            for (q = p; q < end && strchr(" \t\n\v\f\r", *q); q++)
+                ;
+            CHECK(scan_whitespace(p, end) == q);
+            for (q = p; q < end && (isalnum((unsigned char)*q) || *q == '_'); q++)
+                ;
+            CHECK(scan_identifier(p, end) == q);
+            for (q = p; q < end && *q != '\n'; q++)
+                ;
+            CHECK(scan_line_end(p, end) == q);
+            for (q = p; q < end && !(*q == '*' && q + 1 < end && q[1] == '/'); q++)
+                ;
+            CHECK(scan_comment_end(p, end) == q);
+            for (q = p; q < end && *q != '"' && *q != '\\'; q++)
+                ;
+            CHECK(scan_string_special(p, end) == q);
+            uint32_t newlines = 0;
+            const char *last = NULL;
+            for (q = p; q < end; q++)
+                if (*q == '\n')
+                {
+                    newlines++;
+                    last = q;
+                }
+            const char *found = NULL;
+            CHECK(scan_count_newlines(p, end, &found) == newlines && found == last);
+        }
+    for (const char *p = buffer; p + 32 <= buffer + sizeof(buffer); p++)
+    {
+        uint32_t mask = 0;
+        for (int i = 0; i < 32; i++)
+            if (strchr("\\{}$&#^_%~ \t\n\r", p[i]))
+                mask |= 1u << i;
+        CHECK(scan_latex_mask(p) == mask);
+    }
+}
+
+int main(void)
+{
+    // every backend the CPU has, in this one process
+    static const char *const backends[] = {"scalar", "sse2", "avx2"};
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (scan_select_backend(backends[i]) != 0)
+            continue;
+        int failures = test_failures;
+        test_scanners_match_plain_loops();
+        if (test_failures != failures)
+            fprintf(stderr, "with the %s backend\n", backends[i]);
+    }
+    return test_report("scan");
+}
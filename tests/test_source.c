@@ -0,0 +1,123 @@
+// Tests of loading inputs: whole files, mapped or read, and the ones too long to lex
+#include "diagnostics.h"
+#include "source.h"
+#include "test.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A file comes back byte for byte, mapped or read; an empty one as no bytes
+static void test_whole_file(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    snprintf(path, sizeof(path), "%s/a.c", dir);
+    write_file(path, corpus);
+    SourceBuffer source;
+    CHECK(source_open(&source, path) == 0);
+    CHECK(source.is_mapped && source.length == strlen(corpus) && memcmp(source.data, corpus, source.length) == 0);
+    source_close(&source);
+    CHECK(source_read(&source, path) == 0);
+    CHECK(!source.is_mapped && source.length == strlen(corpus) && memcmp(source.data, corpus, source.length) == 0);
+    source_close(&source);
+
+    write_file(path, "");
+    CHECK(source_open(&source, path) == 0 && source.length == 0);
+    source_close(&source);
+    snprintf(path, sizeof(path), "%s/missing.c", dir);
+    CHECK(source_open(&source, path) == -1);
+    remove_tree(dir);
+}
+
+// Token offsets are 32-bit: a file of 4 GiB or more is refused with a
+// diagnostic, before any of it is read. The file is sparse, so it takes
+// no space.
+static void test_too_long(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    snprintf(path, sizeof(path), "%s/big.c", dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd >= 0 && ftruncate(fd, (off_t)SOURCE_MAX_LENGTH + 1) == 0);
+    close(fd);
+
+    DiagnosticList diagnostics;
+    diagnostics_init(&diagnostics, path);
+    DiagnosticList *previous = diagnostics_capture(&diagnostics);
+    SourceBuffer source;
+    CHECK(source_open(&source, path) == -1);
+    Arena arena;
+    arena_init(&arena, 4096);
+    CHECK(source_open_in(&arena, path) == NULL);
+    arena_free(&arena);
+    diagnostics_capture(previous);
+    CHECK(diagnostics.count == 2);
+    for (size_t i = 0; i < diagnostics.count; i++)
+        CHECK(diagnostics.items[i].code == ERR_MAX_SIZE && diagnostics.items[i].offset == DIAGNOSTIC_NO_OFFSET);
+    diagnostics_free(&diagnostics);
+    remove_tree(dir);
+}
+
+static void on_alarm(int signal)
+{
+    (void)signal;
+}
+
+// A read that a signal interrupts is tried again: a FIFO written in two
+// pieces, a while apart, is read whole with SIGALRM arriving every 5 ms
+// and no SA_RESTART
+static void test_interrupted_reads(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    snprintf(path, sizeof(path), "%s/fifo", dir);
+    CHECK(mkfifo(path, 0600) == 0);
+    fflush(NULL);
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        int fd = open(path, O_WRONLY);
+        size_t half = strlen(corpus) / 2;
+        usleep(50 * 1000);
+        int ok = write(fd, corpus, half) == (ssize_t)half;
+        usleep(50 * 1000);
+        ok &= write(fd, corpus + half, strlen(corpus) - half) == (ssize_t)(strlen(corpus) - half);
+        close(fd);
+        _exit(ok ? 0 : 1);
+    }
+
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_alarm;
+    sigaction(SIGALRM, &action, &previous);
+    struct itimerval every = {{0, 5000}, {0, 5000}}, off = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_REAL, &every, NULL);
+    SourceBuffer source;
+    int opened = source_open(&source, path);
+    setitimer(ITIMER_REAL, &off, NULL);
+    sigaction(SIGALRM, &previous, NULL);
+
+    CHECK(opened == 0);
+    if (opened == 0)
+    {
+        CHECK(!source.is_mapped && source.length == strlen(corpus) &&
+              memcmp(source.data, corpus, source.length) == 0);
+        source_close(&source);
+    }
+    int status;
+    CHECK(waitpid(writer, &status, 0) == writer && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    remove_tree(dir);
+}
+
+int main(void)
+{
+    test_whole_file();
+    test_too_long();
+    test_interrupted_reads();
+    return test_report("source");
+}
@@ -0,0 +1,101 @@
+// Tests of --stats: what workers merge into the run totals
+#include "batch.h"
+#include "stats.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The totals' counters as stats_print writes them, from "files" on: the
+// phase timings before them differ from run to run
+static char *counters(void)
+{
+    FILE *out = tmpfile();
+    stats_print(out, 0);
+    char *text = file_text(out);
+    fclose(out);
+    char *from = strstr(text, "\"files\"");
+    memmove(text, from, strlen(from) + 1);
+    return text;
+}
+
+// Three snapshots of the same keys, where every number grew as much from
+// `second` to `third` as from `first` to `second`
+static int same_growth(const char *first, const char *second, const char *third)
+{
+    while (*third)
+    {
+        if (*third >= '0' && *third <= '9')
+        {
+            char *end_first, *end_second, *end_third;
+            unsigned long long a = strtoull(first, &end_first, 10);
+            unsigned long long b = strtoull(second, &end_second, 10);
+            unsigned long long c = strtoull(third, &end_third, 10);
+            if (c - b != b - a)
+                return 0;
+            first = end_first;
+            second = end_second;
+            third = end_third;
+            continue;
+        }
+        if (*first != *third || *second != *third)
+            return 0;
+        first++;
+        second++;
+        third++;
+    }
+    return *first == '\0' && *second == '\0';
+}
+
+// Files compiled by several workers at once add the same counts to the
+// totals as the same files compiled one after another
+static void test_workers_add_up(void)
+{
+    char dir[64], path[128];
+    make_temp_dir(dir);
+    for (int i = 0; i < 12; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%02d.c", dir, i);
+        FILE *file = fopen(path, "w");
+        for (int copy = 0; copy <= i % 4; copy++)
+            fputs(corpus, file);
+        fclose(file);
+    }
+    InputList inputs;
+    input_list_init(&inputs);
+    input_list_add_path(&inputs, dir);
+    stats_enabled = 1;
+    Output out;
+    output_init_memory(&out);
+    // a token type shows up in the totals once it's been counted, so a
+    // first run puts in every one the inputs have
+    BatchOptions options = {1, OUTPUT_TOKENS, NULL, 0, NULL, 0};
+    batch_run(&inputs, &options, &out);
+    char *before = counters();
+    CHECK(strncmp(before, "\"files\": 12,", 12) == 0);
+    static const OutputMode modes[] = {OUTPUT_LATEX, OUTPUT_TOKENS, OUTPUT_AST, OUTPUT_HIGHLIGHT};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        options.mode = modes[m];
+        options.threads = 1;
+        batch_run(&inputs, &options, &out);
+        char *serial = counters();
+        options.threads = 6;
+        batch_run(&inputs, &options, &out);
+        char *parallel = counters();
+        CHECK(same_growth(before, serial, parallel));
+        free(before);
+        free(serial);
+        before = parallel;
+    }
+    free(before);
+    output_close(&out);
+    stats_enabled = 0;
+    input_list_free(&inputs);
+    remove_tree(dir);
+}
+
+int main(void)
+{
+    test_workers_add_up();
+    return test_report("stats");
+}
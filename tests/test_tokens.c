@@ -0,0 +1,168 @@
+// Tests of the chunked token list: storage, random access, cursors and lexeme views
+#include "arena.h"
+#include "test.h"
+#include "tokens.h"
+#include <string.h>
+
+#define TOKENS 1000
+
+// The token a test stores at `i`: every column different from its neighbours
+static void expected_token(uint32_t i, Token *out)
+{
+    out->type = (TokenType)(TOKEN_INT_LITERAL + i % (TOKEN_ARROW - TOKEN_INT_LITERAL + 1));
+    out->offset = i * 2;
+    out->length = i % 7;
+}
+
+static int same_token(const Token *a, const Token *b)
+{
+    return a->type == b->type && a->offset == b->offset && a->length == b->length;
+}
+
+// A list that outgrows its first chunk keeps every token, in order, and
+// reads the same through token_at and a cursor
+static void test_list_across_chunks(void)
+{
+    static char source[TOKENS * 2];
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *list = create_token_list(&arena, source, 0);
+    Token tok, want;
+    for (uint32_t i = 0; i < TOKENS; i++)
+    {
+        expected_token(i, &want);
+        add_token(list, want.type, want.offset, want.length);
+    }
+    CHECK(list->count == TOKENS);
+    CHECK(list->head != list->tail);
+    uint32_t first = 0;
+    for (const TokenChunk *chunk = list->head; chunk; chunk = chunk->next)
+    {
+        CHECK(chunk->first == first && chunk->count <= chunk->capacity);
+        first += chunk->count;
+    }
+    CHECK(first == TOKENS);
+
+    for (uint32_t i = 0; i <= TOKENS; i++)
+    {
+        token_at(list, i, &tok);
+        if (i == TOKENS)
+            CHECK(tok.type == TOKEN_EOF);
+        else
+        {
+            expected_token(i, &want);
+            CHECK(same_token(&tok, &want));
+        }
+    }
+
+    TokenCursor cursor;
+    cursor_init(&cursor, list);
+    for (uint32_t i = 0; i < TOKENS; i++)
+    {
+        CHECK(cursor_position(&cursor) == i);
+        for (uint32_t ahead = 0; ahead < 300; ahead += 37)
+        {
+            token_at(list, i + ahead, &want);
+            CHECK(cursor_peek_ahead(&cursor, ahead) == want.type);
+        }
+        expected_token(i, &want);
+        CHECK(cursor_peek(&cursor) == want.type);
+        CHECK(!cursor_expect(&cursor, TOKEN_EOF, &tok));
+        CHECK(cursor_next(&cursor, &tok) && same_token(&tok, &want));
+    }
+    CHECK(cursor_peek(&cursor) == TOKEN_EOF);
+    CHECK(!cursor_next(&cursor, &tok) && tok.type == TOKEN_EOF);
+    arena_free(&arena);
+}
+
+// What an incremental re-lex is built from: tokens copied over from the old
+// list and moved, the token an edit lands in, and a cursor started anywhere
+static void test_copy_and_seek(void)
+{
+    static char source[TOKENS * 2 + 64];
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *list = create_token_list(&arena, source, 0);
+    Token tok, want;
+    for (uint32_t i = 0; i < TOKENS; i++)
+    {
+        expected_token(i, &want);
+        add_token(list, want.type, want.offset, want.length);
+    }
+    for (uint32_t offset = 0; offset <= TOKENS * 2; offset++)
+        CHECK(token_list_before(list, offset) == (offset + 1) / 2);
+
+    TokenList *copy = create_token_list(&arena, source, 0);
+    token_list_copy(copy, list, 0, 10, 0);
+    token_list_copy(copy, list, 100, TOKENS, 30);
+    CHECK(copy->count == 10 + TOKENS - 100);
+    for (uint32_t i = 0; i < copy->count; i++)
+    {
+        uint32_t from = i < 10 ? i : i + 90;
+        expected_token(from, &want);
+        if (from >= 100)
+            want.offset += 30;
+        token_at(copy, i, &tok);
+        CHECK(same_token(&tok, &want));
+    }
+
+    for (uint32_t i = 0; i <= TOKENS; i += 7)
+    {
+        TokenCursor cursor;
+        cursor_init_at(&cursor, list, i);
+        CHECK(cursor_position(&cursor) == i);
+        token_at(list, i, &want);
+        CHECK(cursor_next(&cursor, &tok) == (i < TOKENS) && tok.type == want.type && tok.offset == want.offset);
+    }
+    arena_free(&arena);
+}
+
+// What token_value leaves of a lexeme once its delimiters are gone
+static void test_token_value(void)
+{
+    static const struct {
+        TokenType type;
+        const char *text;
+        const char *value;
+    } cases[] = {
+        {TOKEN_COMMENT, "// line", " line"},
+        {TOKEN_COMMENT, "/* block */", " block "},
+        {TOKEN_COMMENT, "/* unterminated", " unterminated"},
+        {TOKEN_CHAR_LITERAL, "'a'", "a"},
+        {TOKEN_STRING_LITERAL, "\"s\"", "s"},
+        {TOKEN_STRING_LITERAL, "\"a\\\\\"", "a\\\\"},
+        {TOKEN_STRING_LITERAL, "\"a\\\"", "a\\\""},
+        {TOKEN_IDENTIFIER, "name", "name"},
+    };
+    char source[256] = "";
+    uint32_t offsets[sizeof(cases) / sizeof(cases[0])];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        offsets[i] = (uint32_t)strlen(source);
+        strcat(source, cases[i].text);
+        strcat(source, "\n");
+    }
+    Arena arena;
+    arena_init(&arena, 64 * 1024);
+    TokenList *list = create_token_list(&arena, source, strlen(source));
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        add_token(list, cases[i].type, offsets[i], (uint32_t)strlen(cases[i].text));
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        Token tok;
+        token_at(list, i, &tok);
+        CHECK(strcmp(token_cstr(&arena, list, &tok), cases[i].text) == 0);
+        size_t length;
+        const char *value = token_value(list, &tok, &length);
+        CHECK(length == strlen(cases[i].value) && memcmp(value, cases[i].value, length) == 0);
+    }
+    arena_free(&arena);
+}
+
+int main(void)
+{
+    test_list_across_chunks();
+    test_copy_and_seek();
+    test_token_value();
+    return test_report("tokens");
+}